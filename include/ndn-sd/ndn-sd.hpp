@@ -1,7 +1,11 @@
 #ifndef __ndn_sd_hpp__
 #define __ndn_sd_hpp__
 
+#include <functional>
+#include <map>
+#include <memory>
 #include <string>
+#include <vector>
 #include <ndn-ind/interest.hpp>
 
 namespace ndnsd 
@@ -26,6 +30,23 @@ namespace ndnsd
         }
     }
 
+    // capability flags advertised along with prefixes
+    enum class Capability : uint8_t {
+        // serves its certificate over NDN
+        Certificate = 1,
+        // forwards Interests to its other peers
+        Forwarder = 1 << 1
+    };
+
+    // where services are announced and discovered
+    enum class DiscoveryBackend : uint8_t {
+        // system mDNS daemon
+        DnsSd = 0,
+        // in-process registry shared by all NdnSd instances of the process:
+        // no daemon, no network. for tests and simulations
+        Loopback
+    };
+
     // service browsing/resolving announcements
     enum class Announcement {
         Added,
@@ -43,10 +64,54 @@ namespace ndnsd
         }
     }
 
-    typedef std::function<void(int, Announcement, std::shared_ptr<const NdnSd>, void*)> OnServiceAnnouncement;
+    // single service delta delivered in a batch
+    typedef struct _ServiceAnnouncement {
+        Announcement announcement_;
+        std::shared_ptr<const NdnSd> sd_;
+    } ServiceAnnouncement;
+
+    // immutable copy of a discovered service state, safe to read from any thread
+    typedef struct _ServiceRecord {
+        std::string uuid_;
+        Proto protocol_;
+        uint32_t interfaceIdx_;
+        std::string subtype_;
+        std::string domain_;
+        // fields below are set for resolved services only
+        bool resolved_;
+        uint16_t port_;
+        std::string prefix_;
+        // all prefixes, including prefix_
+        std::vector<std::string> prefixes_;
+        std::map<Proto, uint16_t> ports_;
+        uint8_t capabilities_;
+        std::string certificate_;
+        std::string certificateDigest_;
+        std::string hostname_;
+        std::string fullname_;
+        // numeric addresses of hostname_, IPv4 first
+        std::vector<std::string> addresses_;
+    } ServiceRecord;
+
+    // consistent view of all discovered services of an NdnSd instance.
+    // generation_ increases each time a new snapshot is published
+    typedef struct _ServiceSnapshot {
+        uint64_t generation_ = 0;
+        std::vector<ServiceRecord> services_;
+    } ServiceSnapshot;
+
+    // request handle: slot index and its generation, so that ids of finished
+    // requests are not reused. -1 for requests that failed to start or
+    // completed synchronously
+    typedef int64_t RequestId;
+
+    typedef std::function<void(RequestId, Announcement, std::shared_ptr<const NdnSd>, void*)> OnServiceAnnouncement;
+    // called once DNS-SD reports no more events are immediately pending
+    // (kDNSServiceFlagsMoreComing cleared), with all deltas accumulated so far
+    typedef std::function<void(RequestId, const std::vector<ServiceAnnouncement>&, void*)> OnServiceAnnouncementBatch;
     typedef OnServiceAnnouncement OnResolvedService;
     typedef std::function<void(void*)> OnServiceRegistered;
-    typedef std::function<void(int, int, std::string, bool, void*)> OnError;
+    typedef std::function<void(RequestId, int, std::string, bool, void*)> OnError;
     typedef OnError OnBrowseError;
     typedef OnError OnRegisterError;
 
@@ -68,27 +133,102 @@ namespace ndnsd
         typedef struct _AdvertiseParameters : BrowseConstraints {
             uint16_t port_;
             std::string prefix_;
+            // certificate name. certificate is too large for TXT record and 
+            // shall be fetched over NDN
             std::string cert_;
+            // SHA-256 digest of certificate wire encoding
+            std::string certDigest_;
+            // prefixes served besides prefix_. advertised in the same TXT 
+            // record, so that peers learn all of them from a single resolve.
+            // sort them to make TXT record smaller
+            std::vector<std::string> prefixes_;
+            // ports the instance listens on for other protocols
+            std::map<Proto, uint16_t> ports_;
+            // Capability flags
+            uint8_t capabilities_ = 0;
         } AdvertiseParameters;
 
+        // resolve requests are queued and at most maxInFlight_ of them are
+        // running at a time. a request that times out or fails is retried
+        // with exponential backoff, then reported to the error callback
+        typedef struct _ResolveOptions {
+            // 0 -- unlimited
+            size_t maxInFlight_ = 8;
+            uint32_t timeoutMs_ = 5000;
+            uint32_t maxRetries_ = 2;
+            // delay before the first retry, doubled for every next one
+            uint32_t backoffMs_ = 500;
+        } ResolveOptions;
+
+        typedef struct _ResolveStats {
+            // waiting for a free slot or for a retry
+            size_t queued_ = 0;
+            size_t inFlight_ = 0;
+            uint64_t succeeded_ = 0;
+            uint64_t failed_ = 0;
+            uint64_t timedOut_ = 0;
+            uint64_t retried_ = 0;
+            // time from resolve() call till the service is resolved
+            double avgLatencyMs_ = 0;
+            uint32_t maxLatencyMs_ = 0;
+        } ResolveStats;
+
+        // resolve results cache is shared by all NdnSd instances in a process
+        typedef struct _ResolveCacheStats {
+            uint64_t hits_ = 0;
+            uint64_t misses_ = 0;
+            uint64_t invalidations_ = 0;
+            size_t size_ = 0;
+        } ResolveCacheStats;
+
         NdnSd(std::string uuid);
         ~NdnSd();
 
         int announce(const AdvertiseParameters& parameters,
             OnServiceRegistered onRegisteredCb,
             OnRegisterError onRegisterErrorCb);
-        int browse(BrowseConstraints constraints,
+        // updates TXT record (prefixes, ports of other protocols, capabilities
+        // and certificate) of announced service in place, so that peers don't
+        // see it removed and added again. other parameters can't be changed
+        int update(const AdvertiseParameters& parameters,
+            OnRegisterError onUpdateErrorCb);
+        // Added and Removed are announced as services come and go. Resolved
+        // is announced when TXT record of a service resolved earlier is
+        // updated (see update()), with new prefixes, ports and certificate
+        RequestId browse(BrowseConstraints constraints,
             OnServiceAnnouncement onAnnouncementCb,
             OnBrowseError onBrowseErrorCb);
-        void cancel(int requestId);
+        RequestId browse(BrowseConstraints constraints,
+            OnServiceAnnouncementBatch onAnnouncementBatchCb,
+            OnBrowseError onBrowseErrorCb);
+        // stale ids (of cancelled requests) are ignored
+        void cancel(RequestId requestId);
+        // priority requests are started before all others. if the service
+        // has been resolved recently (by any NdnSd instance, on any interface)
+        // and its records are still valid, completes synchronously from cache
         void resolve(std::shared_ptr<const NdnSd> sd, 
             OnResolvedService onResolvedServiceCb,
             OnError onResolveErrorCb,
-            void *userData = nullptr);
+            void *userData = nullptr,
+            bool priority = false);
+        // moves queued resolve requests of a service ahead of others
+        void prioritizeResolve(std::shared_ptr<const NdnSd> sd);
+        void setResolveOptions(const ResolveOptions& options);
+        ResolveStats getResolveStats() const;
 
-        // TODO: see if this should be static
         // timeout or till the first read
+        // DNS-SD events are processed for all NdnSd instances, same as runAll()
         int run(uint32_t timeoutMs = 0);
+        // process DNS-SD events of all NdnSd instances in a process
+        // with a single wait on all their descriptors
+        static int runAll(uint32_t timeoutMs = 0);
+        // descriptors of other event sources (e.g. NDN forwarder sockets) are
+        // waited on together with DNS-SD ones: onReadable is called from 
+        // run() and runAll() when fd is readable, and must consume what is 
+        // there. watching fd again re-adds it (its number may have been 
+        // reused). returns false if fd is a DNS-SD descriptor
+        static bool watchDescriptor(int fd, std::function<void()> onReadable);
+        static void unwatchDescriptor(int fd);
 
         Proto getProtocol() const;
         std::string getUuid() const;
@@ -101,19 +241,56 @@ namespace ndnsd
         // for registered or discovered instances
         std::string getPrefix() const;
         std::string getCertificate() const;
+        std::string getCertificateDigest() const;
+        // primary prefix followed by the rest
+        std::vector<std::string> getPrefixes() const;
+        // ports for all advertised protocols, including this one
+        std::map<Proto, uint16_t> getPorts() const;
+        uint8_t getCapabilities() const;
 
         // only on resolved instances
         std::string getHostname() const;
         std::string getFullname() const;
+        // numeric IPv4 and IPv6 addresses of the host, IPv4 first. link-local
+        // IPv6 addresses carry interface scope ("fe80::1%2"). empty if DNS-SD
+        // implementation can't look up addresses (avahi compatibility layer)
+        std::vector<std::string> getAddresses() const;
 
         // returns all discovered services
         std::vector<std::shared_ptr<ndnsd::NdnSd>> getDiscoveredServices() const;
+        // iterates over discovered services without copying them
+        void forEachDiscoveredService(
+            std::function<void(const std::shared_ptr<const NdnSd>&)> f) const;
+        // returns latest snapshot of discovered services. unlike methods above,
+        // can be called from any thread. snapshot is rebuilt only when services
+        // are added, removed or resolved
+        std::shared_ptr<const ServiceSnapshot> getSnapshot() const;
+        // generation of the latest snapshot, cheap to poll from any thread
+        uint64_t getSnapshotGeneration() const;
 
         static std::string getVersion();
 
+        // when enabled (default), all DNS-SD requests in a process are multiplexed
+        // over one daemon connection, if daemon supports it. affects requests
+        // made after the call
+        static void setShareConnection(bool enable);
+
+        // backend of all NdnSd instances of the process, DnsSd by default.
+        // can be switched only when no requests are left (all instances are
+        // destroyed), returns false otherwise. drops cached resolve results
+        static bool setBackend(DiscoveryBackend backend);
+
+        // cached resolve results expire after record TTL, but not later than
+        // maxTtlSec (120 by default). 0 disables the cache
+        static void setResolveCacheTtl(uint32_t maxTtlSec);
+        static ResolveCacheStats getResolveCacheStats();
+
     private:
         struct Impl;
         std::shared_ptr<Impl> pimpl_;
+
+        // discovered services: Impl is allocated along with NdnSd
+        NdnSd(std::shared_ptr<Impl> pimpl);
     };
 }
 
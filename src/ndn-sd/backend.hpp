@@ -0,0 +1,67 @@
+#ifndef __backend_hpp__
+#define __backend_hpp__
+
+#include <cstddef>
+#include <stdint.h>
+
+#include "config.hpp"
+#include "dns_sd.h"
+
+namespace ndnsd
+{
+namespace helpers
+{
+    /**
+    * DNS-SD calls that reach out to the daemon, made by NdnSd, RunLoop and
+    * ResolveCache. Mirrors dns_sd.h, so that requests keep their DNSServiceRef
+    * handles, reply callbacks and kDNSServiceFlagsShareConnection semantics
+    * whatever the backend is. TXTRecord* and DNSServiceConstructFullName don't
+    * talk to the daemon and are used directly.
+    * Implementations: getDnsSdBackend() forwards to dns_sd.h,
+    * getLoopbackBackend() is an in-process registry (see loopback-backend.hpp).
+    */
+    class Backend {
+    public:
+        virtual ~Backend() {}
+
+        virtual DNSServiceErrorType createConnection(DNSServiceRef* sdRef) = 0;
+        virtual DNSServiceErrorType registerService(DNSServiceRef* sdRef,
+            DNSServiceFlags flags, uint32_t interfaceIndex, const char* name,
+            const char* regtype, const char* domain, const char* host,
+            uint16_t port, uint16_t txtLen, const void* txtRecord,
+            DNSServiceRegisterReply callBack, void* context) = 0;
+        virtual DNSServiceErrorType updateRecord(DNSServiceRef sdRef,
+            DNSRecordRef recordRef, DNSServiceFlags flags, uint16_t rdlen,
+            const void* rdata, uint32_t ttl) = 0;
+        virtual DNSServiceErrorType browse(DNSServiceRef* sdRef,
+            DNSServiceFlags flags, uint32_t interfaceIndex, const char* regtype,
+            const char* domain, DNSServiceBrowseReply callBack, void* context) = 0;
+        virtual DNSServiceErrorType resolve(DNSServiceRef* sdRef,
+            DNSServiceFlags flags, uint32_t interfaceIndex, const char* name,
+            const char* regtype, const char* domain,
+            DNSServiceResolveReply callBack, void* context) = 0;
+#ifdef HAVE_DNSSERVICEGETADDRINFO
+        virtual DNSServiceErrorType getAddrInfo(DNSServiceRef* sdRef,
+            DNSServiceFlags flags, uint32_t interfaceIndex,
+            DNSServiceProtocol protocol, const char* hostname,
+            DNSServiceGetAddrInfoReply callBack, void* context) = 0;
+#endif
+        virtual DNSServiceErrorType queryRecord(DNSServiceRef* sdRef,
+            DNSServiceFlags flags, uint32_t interfaceIndex, const char* fullname,
+            uint16_t rrtype, uint16_t rrclass, DNSServiceQueryRecordReply callBack,
+            void* context) = 0;
+        virtual void deallocate(DNSServiceRef sdRef) = 0;
+
+        virtual int sockFd(DNSServiceRef sdRef) = 0;
+        virtual DNSServiceErrorType processResult(DNSServiceRef sdRef) = 0;
+
+        // number of refs allocated and not deallocated yet
+        virtual size_t size() const = 0;
+    };
+
+    Backend& getDnsSdBackend();
+    Backend& getLoopbackBackend();
+}
+}
+
+#endif
@@ -0,0 +1,103 @@
+
+#include "backend.hpp"
+
+namespace
+{
+	// system mDNS daemon
+	class DnsSdBackend : public ndnsd::helpers::Backend {
+	public:
+		DNSServiceErrorType createConnection(DNSServiceRef* sdRef) override
+		{
+			return count(DNSServiceCreateConnection(sdRef));
+		}
+
+		DNSServiceErrorType registerService(DNSServiceRef* sdRef,
+			DNSServiceFlags flags, uint32_t interfaceIndex, const char* name,
+			const char* regtype, const char* domain, const char* host,
+			uint16_t port, uint16_t txtLen, const void* txtRecord,
+			DNSServiceRegisterReply callBack, void* context) override
+		{
+			return count(DNSServiceRegister(sdRef, flags, interfaceIndex, name, regtype, 
+				domain, host, port, txtLen, txtRecord, callBack, context));
+		}
+
+		DNSServiceErrorType updateRecord(DNSServiceRef sdRef,
+			DNSRecordRef recordRef, DNSServiceFlags flags, uint16_t rdlen,
+			const void* rdata, uint32_t ttl) override
+		{
+			return DNSServiceUpdateRecord(sdRef, recordRef, flags, rdlen, rdata, ttl);
+		}
+
+		DNSServiceErrorType browse(DNSServiceRef* sdRef,
+			DNSServiceFlags flags, uint32_t interfaceIndex, const char* regtype,
+			const char* domain, DNSServiceBrowseReply callBack, void* context) override
+		{
+			return count(DNSServiceBrowse(sdRef, flags, interfaceIndex, regtype, domain,
+				callBack, context));
+		}
+
+		DNSServiceErrorType resolve(DNSServiceRef* sdRef,
+			DNSServiceFlags flags, uint32_t interfaceIndex, const char* name,
+			const char* regtype, const char* domain,
+			DNSServiceResolveReply callBack, void* context) override
+		{
+			return count(DNSServiceResolve(sdRef, flags, interfaceIndex, name, regtype,
+				domain, callBack, context));
+		}
+
+#ifdef HAVE_DNSSERVICEGETADDRINFO
+		DNSServiceErrorType getAddrInfo(DNSServiceRef* sdRef,
+			DNSServiceFlags flags, uint32_t interfaceIndex,
+			DNSServiceProtocol protocol, const char* hostname,
+			DNSServiceGetAddrInfoReply callBack, void* context) override
+		{
+			return count(DNSServiceGetAddrInfo(sdRef, flags, interfaceIndex, protocol,
+				hostname, callBack, context));
+		}
+#endif
+
+		DNSServiceErrorType queryRecord(DNSServiceRef* sdRef,
+			DNSServiceFlags flags, uint32_t interfaceIndex, const char* fullname,
+			uint16_t rrtype, uint16_t rrclass, DNSServiceQueryRecordReply callBack,
+			void* context) override
+		{
+			return count(DNSServiceQueryRecord(sdRef, flags, interfaceIndex, fullname,
+				rrtype, rrclass, callBack, context));
+		}
+
+		void deallocate(DNSServiceRef sdRef) override
+		{
+			DNSServiceRefDeallocate(sdRef);
+			nRefs_--;
+		}
+
+		int sockFd(DNSServiceRef sdRef) override
+		{
+			return DNSServiceRefSockFD(sdRef);
+		}
+
+		DNSServiceErrorType processResult(DNSServiceRef sdRef) override
+		{
+			return DNSServiceProcessResult(sdRef);
+		}
+
+		size_t size() const override { return nRefs_; }
+
+	private:
+		size_t nRefs_ = 0;
+
+		DNSServiceErrorType count(DNSServiceErrorType err)
+		{
+			if (err == kDNSServiceErr_NoError)
+				nRefs_++;
+			return err;
+		}
+	};
+}
+
+ndnsd::helpers::Backend& ndnsd::helpers::getDnsSdBackend()
+{
+	// never destroyed, same as RunLoop
+	static Backend* backend = new DnsSdBackend();
+	return *backend;
+}
@@ -0,0 +1,112 @@
+
+#include "instance-id.hpp"
+
+#include <cstring>
+#include <functional>
+
+#define UUID_STRING_LENGTH 36
+
+using namespace std;
+using ndnsd::helpers::InstanceId;
+
+namespace
+{
+	const char kHexDigits[] = "0123456789abcdef";
+
+	// group separators of "xxxxxxxx-xxxx-xxxx-xxxx-xxxxxxxxxxxx"
+	bool isDash(size_t pos)
+	{
+		return pos == 8 || pos == 13 || pos == 18 || pos == 23;
+	}
+
+	// lowercase only, so that parsed UUID prints back the same
+	int hexValue(char c)
+	{
+		if (c >= '0' && c <= '9')
+			return c - '0';
+		if (c >= 'a' && c <= 'f')
+			return c - 'a' + 10;
+		return -1;
+	}
+}
+
+InstanceId::InstanceId(const string& name)
+{
+	binary_ = parseUuid(name.c_str(), name.size(), bytes_);
+	if (!binary_)
+		name_ = InternedString(name);
+}
+
+string InstanceId::str() const
+{
+	if (!binary_)
+		return name_.str();
+
+	string s(UUID_STRING_LENGTH, '-');
+	for (size_t pos = 0, i = 0; pos < UUID_STRING_LENGTH; ++pos)
+	{
+		if (isDash(pos))
+			continue;
+
+		s[pos] = kHexDigits[(i % 2 ? bytes_[i / 2] : bytes_[i / 2] >> 4) & 0xf];
+		i++;
+	}
+
+	return s;
+}
+
+bool InstanceId::operator==(const InstanceId& id) const
+{
+	if (binary_ != id.binary_)
+		return false;
+
+	return (binary_ ? memcmp(bytes_, id.bytes_, sizeof(bytes_)) == 0 : name_ == id.name_);
+}
+
+bool InstanceId::operator==(const char* name) const
+{
+	if (!binary_)
+		return name_.str() == name;
+
+	uint8_t bytes[sizeof(bytes_)];
+	return parseUuid(name, strlen(name), bytes) && memcmp(bytes_, bytes, sizeof(bytes_)) == 0;
+}
+
+size_t InstanceId::hash() const
+{
+	if (!binary_)
+		return std::hash<string>()(name_.str());
+
+	// version 4 UUIDs are random: first bytes are hash enough
+	size_t h;
+	memcpy(&h, bytes_, sizeof(h));
+	return h;
+}
+
+bool InstanceId::parseUuid(const char* s, size_t len, uint8_t* bytes)
+{
+	if (len != UUID_STRING_LENGTH)
+		return false;
+
+	for (size_t pos = 0, i = 0; pos < UUID_STRING_LENGTH; ++pos)
+	{
+		if (isDash(pos))
+		{
+			if (s[pos] != '-')
+				return false;
+			continue;
+		}
+
+		int v = hexValue(s[pos]);
+		if (v < 0)
+			return false;
+
+		if (i % 2)
+			bytes[i / 2] |= (uint8_t)v;
+		else
+			bytes[i / 2] = (uint8_t)(v << 4);
+		i++;
+	}
+
+	return true;
+}
@@ -0,0 +1,46 @@
+#ifndef __instance_id_hpp__
+#define __instance_id_hpp__
+
+#include <stdint.h>
+#include <string>
+
+#include "interned-string.hpp"
+
+namespace ndnsd
+{
+namespace helpers
+{
+    /**
+    * Service instance name (NdnSd uuid) in compact form. Canonical UUIDs
+    * (36 characters, lowercase, "8-4-4-4-12" hex groups) are kept as 16
+    * bytes, any other name is interned. str() gives the original name back.
+    */
+    class InstanceId {
+    public:
+        InstanceId() = default;
+        explicit InstanceId(const std::string& name);
+
+        std::string str() const;
+        // true if kept as 16 bytes
+        bool isBinary() const { return binary_; }
+
+        bool operator==(const InstanceId& id) const;
+        bool operator!=(const InstanceId& id) const { return !(*this == id); }
+        // compares to a name without interning it
+        bool operator==(const char* name) const;
+        bool operator!=(const char* name) const { return !(*this == name); }
+
+        size_t hash() const;
+
+        // parses canonical UUID into 16 bytes. returns false for other strings
+        static bool parseUuid(const char* s, size_t len, uint8_t* bytes);
+
+    private:
+        uint8_t bytes_[16] = { 0 };
+        bool binary_ = false;
+        InternedString name_;
+    };
+}
+}
+
+#endif
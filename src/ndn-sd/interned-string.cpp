@@ -0,0 +1,72 @@
+
+#include "interned-string.hpp"
+
+#include <mutex>
+#include <unordered_map>
+
+using namespace std;
+using ndnsd::helpers::InternedString;
+
+namespace
+{
+	typedef unordered_map<string, size_t> Pool;
+
+	// never destroyed, see RunLoop::getSharedInstance(): services may
+	// outlive static destructors
+	Pool& pool()
+	{
+		static Pool* p = new Pool();
+		return *p;
+	}
+
+	mutex& poolMutex()
+	{
+		static mutex* m = new mutex();
+		return *m;
+	}
+}
+
+InternedString::InternedString(const string& s)
+{
+	if (s.empty())
+		return;
+
+	lock_guard<mutex> lock(poolMutex());
+	// map nodes are never moved, entry pointer stays valid till erased
+	auto it = pool().emplace(s, 0).first;
+	it->second++;
+	entry_ = &(*it);
+}
+
+InternedString::InternedString(const InternedString& s)
+	: entry_(s.entry_)
+{
+	if (entry_)
+	{
+		lock_guard<mutex> lock(poolMutex());
+		entry_->second++;
+	}
+}
+
+InternedString::~InternedString()
+{
+	if (entry_)
+	{
+		lock_guard<mutex> lock(poolMutex());
+		// key of the erased node can't be passed to erase() by reference
+		if (--entry_->second == 0)
+			pool().erase(pool().find(entry_->first));
+	}
+}
+
+const string& InternedString::str() const
+{
+	static const string empty;
+	return (entry_ ? entry_->first : empty);
+}
+
+size_t InternedString::getPoolSize()
+{
+	lock_guard<mutex> lock(poolMutex());
+	return pool().size();
+}
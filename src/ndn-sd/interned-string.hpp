@@ -0,0 +1,57 @@
+#ifndef __interned_string_hpp__
+#define __interned_string_hpp__
+
+#include <string>
+#include <utility>
+
+namespace ndnsd
+{
+namespace helpers
+{
+    /**
+    * Reference to a string kept once per process, in a pool shared by all
+    * NdnSd instances. For values most discovered services have in common
+    * (domain, subtype, host of several services): each service holds a
+    * pointer instead of its own copy. Pooled string is freed when its last
+    * reference is gone.
+    * Empty string takes no pool entry. Copies and comparisons are cheap;
+    * interning and releasing lock the pool, so references can be dropped
+    * from any thread.
+    */
+    class InternedString {
+    public:
+        InternedString() = default;
+        InternedString(const std::string& s);
+        InternedString(const InternedString& s);
+        InternedString(InternedString&& s) noexcept
+            : entry_(s.entry_)
+        {
+            s.entry_ = nullptr;
+        }
+        ~InternedString();
+
+        InternedString& operator=(InternedString s) noexcept
+        {
+            std::swap(entry_, s.entry_);
+            return *this;
+        }
+
+        const std::string& str() const;
+        bool empty() const { return entry_ == nullptr; }
+
+        // same strings are the same pool entry
+        bool operator==(const InternedString& s) const { return entry_ == s.entry_; }
+        bool operator!=(const InternedString& s) const { return entry_ != s.entry_; }
+
+        // number of distinct strings in the pool
+        static size_t getPoolSize();
+
+    private:
+        // string and its reference count
+        typedef std::pair<const std::string, size_t> Entry;
+        Entry* entry_ = nullptr;
+    };
+}
+}
+
+#endif
@@ -0,0 +1,608 @@
+
+#include "loopback-backend.hpp"
+
+#include <cerrno>
+#include <cstring>
+#include <iostream>
+
+#ifndef _WIN32
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#endif
+
+// TTL reported to TXT record monitors
+#define LOOPBACK_TXT_TTL 4500
+
+using namespace std;
+using ndnsd::helpers::LoopbackBackend;
+
+namespace
+{
+	const string kDefaultDomain = "local.";
+	const string kDefaultHost = "loopback.local.";
+
+	string normalizeDomain(const char* domain)
+	{
+		string d = (domain ? domain : "");
+		if (d.empty())
+			return kDefaultDomain;
+		if (d.back() != '.')
+			d += '.';
+		return d;
+	}
+
+	// "_ndn._udp,mfd" -> "_ndn._udp." and { "mfd" }
+	string parseRegType(const char* regtype, vector<string>* subtypes)
+	{
+		string r = (regtype ? regtype : "");
+		size_t comma = r.find(',');
+		string type = r.substr(0, comma);
+
+		if (type.size() && type.back() != '.')
+			type += '.';
+
+		while (comma != string::npos && subtypes)
+		{
+			size_t next = r.find(',', comma + 1);
+			string subtype = r.substr(comma + 1, (next == string::npos ? next : next - comma - 1));
+			if (subtype.size())
+				subtypes->push_back(subtype);
+			comma = next;
+		}
+
+		return type;
+	}
+
+	string makeFullName(const string& name, const string& type, const string& domain)
+	{
+		char fullname[kDNSServiceMaxDomainName];
+		if (DNSServiceConstructFullName(fullname, name.c_str(), type.c_str(), domain.c_str()) != 0)
+			return "";
+		return fullname;
+	}
+
+	// services registered on any interface are reported as local: there is
+	// nothing beyond this process
+	uint32_t reportedInterface(uint32_t interfaceIdx)
+	{
+		return (interfaceIdx ? interfaceIdx : kDNSServiceInterfaceIndexLocalOnly);
+	}
+
+	// why makeRef() failed
+	DNSServiceErrorType refError(DNSServiceFlags flags)
+	{
+		return (flags & kDNSServiceFlagsShareConnection ? 
+			kDNSServiceErr_BadReference : kDNSServiceErr_Unsupported);
+	}
+
+	// non-blocking pipe. fails on Windows, where select() takes sockets only
+	bool makePipe(int fds[2])
+	{
+#ifdef _WIN32
+		return false;
+#else
+		if (pipe(fds) < 0)
+		{
+			cerr << "failed to create loopback descriptor: " << errno << " - " << strerror(errno) << endl;
+			return false;
+		}
+
+		for (int i = 0; i < 2; ++i)
+		{
+			fcntl(fds[i], F_SETFL, fcntl(fds[i], F_GETFL) | O_NONBLOCK);
+			fcntl(fds[i], F_SETFD, FD_CLOEXEC);
+		}
+
+		return true;
+#endif
+	}
+
+	void closePipe(int fds[2])
+	{
+#ifndef _WIN32
+		for (int i = 0; i < 2; ++i)
+			if (fds[i] >= 0)
+				close(fds[i]);
+#endif
+	}
+
+	void signalPipe(int fds[2])
+	{
+#ifndef _WIN32
+		char c = 0;
+		if (write(fds[1], &c, 1) < 0 && errno != EAGAIN)
+			cerr << "failed to signal loopback descriptor: " << errno << " - " << strerror(errno) << endl;
+#endif
+	}
+
+	void drainPipe(int fds[2])
+	{
+#ifndef _WIN32
+		char buf[64];
+		while (read(fds[0], buf, sizeof(buf)) > 0);
+#endif
+	}
+}
+
+LoopbackBackend::LoopbackBackend()
+	: lastRefId_(0)
+{
+}
+
+LoopbackBackend::~LoopbackBackend()
+{
+	for (auto& it : refs_)
+		closePipe(it.second->fds_);
+}
+
+LoopbackBackend::Ref* LoopbackBackend::makeRef(DNSServiceRef* sdRef, DNSServiceFlags flags)
+{
+	Ref* connection = nullptr;
+	if (flags & kDNSServiceFlagsShareConnection)
+	{
+		connection = findRef(*sdRef);
+		if (!connection || connection->connection_ || connection->dropped_)
+			return nullptr;
+	}
+
+	unique_ptr<Ref> ref(new Ref());
+	ref->id_ = ++lastRefId_;
+
+	if (connection)
+	{
+		ref->connection_ = connection;
+		connection->subordinates_.insert(ref.get());
+	}
+	else if (!makePipe(ref->fds_))
+		return nullptr;
+
+	Ref* r = ref.get();
+	refs_[r] = move(ref);
+	*sdRef = reinterpret_cast<DNSServiceRef>(r);
+
+	return r;
+}
+
+LoopbackBackend::Ref* LoopbackBackend::findRef(DNSServiceRef sdRef) const
+{
+	auto it = refs_.find(reinterpret_cast<Ref*>(sdRef));
+	return (it != refs_.end() ? it->second.get() : nullptr);
+}
+
+void LoopbackBackend::queue(Ref* ref, function<void(DNSServiceFlags)> deliver)
+{
+	Ref* owner = (ref->connection_ ? ref->connection_ : ref);
+	if (owner->dropped_)
+		return;
+
+	// descriptor stays readable until processResult() takes the queue
+	if (owner->replies_.empty())
+		signalPipe(owner->fds_);
+
+	owner->replies_.push_back({ ref, ref->id_, deliver });
+}
+
+DNSServiceErrorType LoopbackBackend::createConnection(DNSServiceRef* sdRef)
+{
+	return (makeRef(sdRef, 0) ? kDNSServiceErr_NoError : kDNSServiceErr_Unsupported);
+}
+
+DNSServiceErrorType LoopbackBackend::registerService(DNSServiceRef* sdRef,
+	DNSServiceFlags flags, uint32_t interfaceIndex, const char* name,
+	const char* regtype, const char* domain, const char* host,
+	uint16_t port, uint16_t txtLen, const void* txtRecord,
+	DNSServiceRegisterReply callBack, void* context)
+{
+	if (!name || !strlen(name) || !regtype)
+		return kDNSServiceErr_BadParam;
+
+	Service s;
+	s.name_ = name;
+	s.type_ = parseRegType(regtype, &s.subtypes_);
+	s.domain_ = normalizeDomain(domain);
+	s.host_ = (host && strlen(host) ? host : kDefaultHost);
+	s.txt_ = string((const char*)txtRecord, txtLen);
+	s.interfaceIdx_ = reportedInterface(interfaceIndex);
+	s.port_ = port;
+
+	string fullname = makeFullName(s.name_, s.type_, s.domain_);
+	if (fullname.empty())
+		return kDNSServiceErr_BadParam;
+
+	DNSServiceRef r = *sdRef;
+	Ref* ref = makeRef(&r, flags);
+	if (!ref)
+		return refError(flags);
+	*sdRef = r;
+
+	if (services_.count(fullname))
+	{
+		// as if the daemon found a conflict. renaming is not supported
+		queue(ref, [callBack, r, s, context](DNSServiceFlags moreComing)
+		{
+			callBack(r, moreComing, kDNSServiceErr_NameConflict, s.name_.c_str(),
+				s.type_.c_str(), s.domain_.c_str(), context);
+		});
+		return kDNSServiceErr_NoError;
+	}
+
+	s.ref_ = ref;
+	ref->fullname_ = fullname;
+	ref->registered_ = true;
+	services_[fullname] = s;
+
+	queue(ref, [callBack, r, s, context](DNSServiceFlags moreComing)
+	{
+		callBack(r, kDNSServiceFlagsAdd | moreComing, kDNSServiceErr_NoError, s.name_.c_str(),
+			s.type_.c_str(), s.domain_.c_str(), context);
+	});
+	notifyBrowsers(s, true);
+
+	return kDNSServiceErr_NoError;
+}
+
+DNSServiceErrorType LoopbackBackend::updateRecord(DNSServiceRef sdRef,
+	DNSRecordRef recordRef, DNSServiceFlags flags, uint16_t rdlen,
+	const void* rdata, uint32_t ttl)
+{
+	Ref* ref = findRef(sdRef);
+	// only primary TXT record of a registration can be updated
+	if (!ref || !ref->registered_ || recordRef)
+		return kDNSServiceErr_BadReference;
+
+	auto& s = services_[ref->fullname_];
+	s.txt_ = string((const char*)rdata, rdlen);
+	notifyMonitors(ref->fullname_, &s.txt_);
+
+	return kDNSServiceErr_NoError;
+}
+
+DNSServiceErrorType LoopbackBackend::browse(DNSServiceRef* sdRef,
+	DNSServiceFlags flags, uint32_t interfaceIndex, const char* regtype,
+	const char* domain, DNSServiceBrowseReply callBack, void* context)
+{
+	vector<string> subtypes;
+	string type = parseRegType(regtype, &subtypes);
+	if (type.empty())
+		return kDNSServiceErr_BadParam;
+
+	Ref* ref = makeRef(sdRef, flags);
+	if (!ref)
+		return refError(flags);
+
+	ref->type_ = type;
+	ref->subtype_ = (subtypes.size() ? subtypes.front() : "");
+	ref->domain_ = normalizeDomain(domain);
+	browsers_[ref] = { callBack, context };
+
+	// services registered before browse started
+	for (auto& it : services_)
+	{
+		if (!matches(ref, it.second))
+			continue;
+
+		Service s = it.second;
+		DNSServiceRef r = *sdRef;
+		queue(ref, [callBack, r, s, context](DNSServiceFlags moreComing)
+		{
+			callBack(r, kDNSServiceFlagsAdd | moreComing, s.interfaceIdx_, kDNSServiceErr_NoError,
+				s.name_.c_str(), s.type_.c_str(), s.domain_.c_str(), context);
+		});
+	}
+
+	return kDNSServiceErr_NoError;
+}
+
+DNSServiceErrorType LoopbackBackend::resolve(DNSServiceRef* sdRef,
+	DNSServiceFlags flags, uint32_t interfaceIndex, const char* name,
+	const char* regtype, const char* domain,
+	DNSServiceResolveReply callBack, void* context)
+{
+	if (!name || !regtype)
+		return kDNSServiceErr_BadParam;
+
+	string fullname = makeFullName(name, parseRegType(regtype, nullptr), normalizeDomain(domain));
+
+	Ref* ref = makeRef(sdRef, flags);
+	if (!ref)
+		return refError(flags);
+
+	DNSServiceRef r = *sdRef;
+	auto it = services_.find(fullname);
+
+	if (it == services_.end())
+	{
+		// the daemon would keep silent till the request times out
+		queue(ref, [callBack, r, fullname, context](DNSServiceFlags moreComing)
+		{
+			callBack(r, moreComing, 0, kDNSServiceErr_NoSuchName, fullname.c_str(), "", 0, 0,
+				nullptr, context);
+		});
+	}
+	else
+	{
+		Service s = it->second;
+		queue(ref, [callBack, r, s, fullname, context](DNSServiceFlags moreComing)
+		{
+			callBack(r, moreComing, s.interfaceIdx_, kDNSServiceErr_NoError, fullname.c_str(),
+				s.host_.c_str(), s.port_, (uint16_t)s.txt_.size(),
+				(const unsigned char*)s.txt_.data(), context);
+		});
+	}
+
+	return kDNSServiceErr_NoError;
+}
+
+#ifdef HAVE_DNSSERVICEGETADDRINFO
+DNSServiceErrorType LoopbackBackend::getAddrInfo(DNSServiceRef* sdRef,
+	DNSServiceFlags flags, uint32_t interfaceIndex,
+	DNSServiceProtocol protocol, const char* hostname,
+	DNSServiceGetAddrInfoReply callBack, void* context)
+{
+#ifdef _WIN32
+	return kDNSServiceErr_Unsupported;
+#else
+	if (!hostname)
+		return kDNSServiceErr_BadParam;
+
+	Ref* ref = makeRef(sdRef, flags);
+	if (!ref)
+		return refError(flags);
+
+	DNSServiceRef r = *sdRef;
+	string host = hostname;
+	bool v6Only = (protocol == kDNSServiceProtocol_IPv6);
+
+	queue(ref, [callBack, r, host, v6Only, context](DNSServiceFlags moreComing)
+	{
+		if (v6Only)
+		{
+			struct sockaddr_in6 sin6;
+			memset(&sin6, 0, sizeof(sin6));
+			sin6.sin6_family = AF_INET6;
+			sin6.sin6_addr = in6addr_loopback;
+
+			callBack(r, kDNSServiceFlagsAdd | moreComing, kDNSServiceInterfaceIndexLocalOnly,
+				kDNSServiceErr_NoError, host.c_str(), (const struct sockaddr*)&sin6,
+				LOOPBACK_TXT_TTL, context);
+		}
+		else
+		{
+			struct sockaddr_in sin;
+			memset(&sin, 0, sizeof(sin));
+			sin.sin_family = AF_INET;
+			sin.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+			callBack(r, kDNSServiceFlagsAdd | moreComing, kDNSServiceInterfaceIndexLocalOnly,
+				kDNSServiceErr_NoError, host.c_str(), (const struct sockaddr*)&sin,
+				LOOPBACK_TXT_TTL, context);
+		}
+	});
+
+	return kDNSServiceErr_NoError;
+#endif
+}
+#endif
+
+DNSServiceErrorType LoopbackBackend::queryRecord(DNSServiceRef* sdRef,
+	DNSServiceFlags flags, uint32_t interfaceIndex, const char* fullname,
+	uint16_t rrtype, uint16_t rrclass, DNSServiceQueryRecordReply callBack,
+	void* context)
+{
+	// only TXT records of registered services exist here
+	if (!fullname || rrtype != kDNSServiceType_TXT || rrclass != kDNSServiceClass_IN)
+		return kDNSServiceErr_Unsupported;
+
+	Ref* ref = makeRef(sdRef, flags);
+	if (!ref)
+		return refError(flags);
+
+	ref->fullname_ = fullname;
+	monitors_[fullname][ref] = { callBack, context };
+
+	auto it = services_.find(fullname);
+	if (it != services_.end())
+	{
+		DNSServiceRef r = *sdRef;
+		string name = fullname, txt = it->second.txt_;
+		uint32_t interfaceIdx = it->second.interfaceIdx_;
+
+		queue(ref, [callBack, r, name, txt, interfaceIdx, context](DNSServiceFlags moreComing)
+		{
+			callBack(r, kDNSServiceFlagsAdd | moreComing, interfaceIdx, kDNSServiceErr_NoError,
+				name.c_str(), kDNSServiceType_TXT, kDNSServiceClass_IN, (uint16_t)txt.size(),
+				txt.data(), LOOPBACK_TXT_TTL, context);
+		});
+	}
+
+	return kDNSServiceErr_NoError;
+}
+
+void LoopbackBackend::deallocate(DNSServiceRef sdRef)
+{
+	Ref* ref = findRef(sdRef);
+	if (!ref)
+		return;
+
+	// deallocating a connection deallocates its subordinates
+	auto subordinates = ref->subordinates_;
+	for (auto s : subordinates)
+		deallocate(reinterpret_cast<DNSServiceRef>(s));
+
+	if (ref->registered_)
+		removeService(ref);
+	browsers_.erase(ref);
+
+	auto mit = monitors_.find(ref->fullname_);
+	if (mit != monitors_.end())
+	{
+		mit->second.erase(ref);
+		if (mit->second.empty())
+			monitors_.erase(mit);
+	}
+
+	if (ref->connection_)
+	{
+		// replies not delivered yet are dropped, as the daemon would do
+		auto& replies = ref->connection_->replies_;
+		for (auto it = replies.begin(); it != replies.end();)
+			it = (it->ref_ == ref ? replies.erase(it) : next(it));
+		ref->connection_->subordinates_.erase(ref);
+	}
+
+	closePipe(ref->fds_);
+	refs_.erase(ref);
+}
+
+void LoopbackBackend::dropConnection(DNSServiceRef connection)
+{
+	Ref* ref = findRef(connection);
+	if (!ref || ref->connection_ || ref->dropped_)
+		return;
+
+	ref->dropped_ = true;
+	ref->replies_.clear();
+	if (ref->registered_)
+		removeService(ref);
+	for (auto s : ref->subordinates_)
+		if (s->registered_)
+			removeService(s);
+
+	// readable, so that the failure is noticed
+	signalPipe(ref->fds_);
+}
+
+void LoopbackBackend::dropConnections()
+{
+	for (auto& it : refs_)
+		if (!it.first->connection_)
+			dropConnection(reinterpret_cast<DNSServiceRef>(it.first));
+}
+
+int LoopbackBackend::sockFd(DNSServiceRef sdRef)
+{
+	Ref* ref = findRef(sdRef);
+	return (ref && !ref->connection_ ? ref->fds_[0] : -1);
+}
+
+DNSServiceErrorType LoopbackBackend::processResult(DNSServiceRef sdRef)
+{
+	Ref* owner = findRef(sdRef);
+	if (!owner || owner->connection_)
+		return kDNSServiceErr_BadReference;
+
+	drainPipe(owner->fds_);
+	if (owner->dropped_)
+		return kDNSServiceErr_ServiceNotRunning;
+
+	// replies queued by callbacks are delivered on the next call
+	deque<Reply> replies;
+	replies.swap(owner->replies_);
+
+	map<Ref*, size_t> nLeft;
+	for (auto& r : replies)
+		nLeft[r.ref_]++;
+
+	for (auto& r : replies)
+	{
+		size_t left = --nLeft[r.ref_];
+
+		// ref may have been deallocated (or deallocated and its address
+		// reused) by one of the previous callbacks
+		Ref* ref = findRef(reinterpret_cast<DNSServiceRef>(r.ref_));
+		if (!ref || ref->id_ != r.refId_)
+			continue;
+
+		r.deliver_(left ? kDNSServiceFlagsMoreComing : 0);
+
+		// owner itself may be gone now
+		if (!findRef(sdRef))
+			break;
+	}
+
+	return kDNSServiceErr_NoError;
+}
+
+bool LoopbackBackend::matches(const Ref* browser, const Service& s) const
+{
+	if (browser->type_ != s.type_ || browser->domain_ != s.domain_)
+		return false;
+
+	if (browser->subtype_.empty())
+		return true;
+
+	for (auto& st : s.subtypes_)
+		if (st == browser->subtype_)
+			return true;
+
+	return false;
+}
+
+void LoopbackBackend::notifyBrowsers(const Service& s, bool added)
+{
+	for (auto& it : browsers_)
+	{
+		if (!matches(it.first, s))
+			continue;
+
+		auto callBack = it.second.callBack_;
+		auto context = it.second.context_;
+		DNSServiceRef r = reinterpret_cast<DNSServiceRef>(it.first);
+
+		queue(it.first, [callBack, r, s, added, context](DNSServiceFlags moreComing)
+		{
+			callBack(r, (added ? kDNSServiceFlagsAdd : 0) | moreComing, s.interfaceIdx_,
+				kDNSServiceErr_NoError, s.name_.c_str(), s.type_.c_str(), s.domain_.c_str(),
+				context);
+		});
+	}
+}
+
+void LoopbackBackend::notifyMonitors(const string& fullname, const string* txt)
+{
+	auto mit = monitors_.find(fullname);
+	if (mit == monitors_.end())
+		return;
+
+	for (auto& it : mit->second)
+	{
+		auto callBack = it.second.callBack_;
+		auto context = it.second.context_;
+		DNSServiceRef r = reinterpret_cast<DNSServiceRef>(it.first);
+		// null TXT: record is gone
+		string rdata = (txt ? *txt : "");
+		bool added = (txt != nullptr);
+
+		queue(it.first, [callBack, r, fullname, rdata, added, context](DNSServiceFlags moreComing)
+		{
+			callBack(r, (added ? kDNSServiceFlagsAdd : 0) | moreComing,
+				kDNSServiceInterfaceIndexLocalOnly, kDNSServiceErr_NoError, fullname.c_str(),
+				kDNSServiceType_TXT, kDNSServiceClass_IN, (uint16_t)rdata.size(), rdata.data(),
+				(added ? LOOPBACK_TXT_TTL : 0), context);
+		});
+	}
+}
+
+void LoopbackBackend::removeService(Ref* ref)
+{
+	auto it = services_.find(ref->fullname_);
+	if (it == services_.end() || it->second.ref_ != ref)
+		return;
+
+	Service s = it->second;
+	services_.erase(it);
+	ref->registered_ = false;
+
+	notifyBrowsers(s, false);
+	notifyMonitors(ref->fullname_, nullptr);
+}
+
+ndnsd::helpers::Backend& ndnsd::helpers::getLoopbackBackend()
+{
+	// never destroyed, same as RunLoop
+	static Backend* backend = new LoopbackBackend();
+	return *backend;
+}
@@ -0,0 +1,144 @@
+#ifndef __loopback_backend_hpp__
+#define __loopback_backend_hpp__
+
+#include <deque>
+#include <functional>
+#include <map>
+#include <memory>
+#include <set>
+#include <string>
+#include <vector>
+
+#include "backend.hpp"
+
+namespace ndnsd
+{
+namespace helpers
+{
+    /**
+    * In-process DNS-SD registry: services registered through it are
+    * browsed, resolved and monitored by requests of the same process, with
+    * no daemon and no network. Meant for tests and simulations with
+    * thousands of services.
+    * Deterministic: replies are queued in the order requests and records
+    * change and delivered, in that order, by processResult() of the
+    * connection (or standalone ref) they belong to. Each connection has
+    * a pipe that is readable while replies are queued, so RunLoop waits
+    * on it like on a daemon socket. kDNSServiceFlagsMoreComing is set when
+    * more replies to the same ref are queued behind.
+    * Hosts of registered services resolve to 127.0.0.1.
+    * Not available on Windows: requests fail with kDNSServiceErr_Unsupported.
+    * Not thread-safe, same as RunLoop.
+    */
+    class LoopbackBackend : public Backend {
+    public:
+        LoopbackBackend();
+        ~LoopbackBackend();
+
+        DNSServiceErrorType createConnection(DNSServiceRef* sdRef) override;
+        DNSServiceErrorType registerService(DNSServiceRef* sdRef,
+            DNSServiceFlags flags, uint32_t interfaceIndex, const char* name,
+            const char* regtype, const char* domain, const char* host,
+            uint16_t port, uint16_t txtLen, const void* txtRecord,
+            DNSServiceRegisterReply callBack, void* context) override;
+        DNSServiceErrorType updateRecord(DNSServiceRef sdRef,
+            DNSRecordRef recordRef, DNSServiceFlags flags, uint16_t rdlen,
+            const void* rdata, uint32_t ttl) override;
+        DNSServiceErrorType browse(DNSServiceRef* sdRef,
+            DNSServiceFlags flags, uint32_t interfaceIndex, const char* regtype,
+            const char* domain, DNSServiceBrowseReply callBack, void* context) override;
+        DNSServiceErrorType resolve(DNSServiceRef* sdRef,
+            DNSServiceFlags flags, uint32_t interfaceIndex, const char* name,
+            const char* regtype, const char* domain,
+            DNSServiceResolveReply callBack, void* context) override;
+#ifdef HAVE_DNSSERVICEGETADDRINFO
+        DNSServiceErrorType getAddrInfo(DNSServiceRef* sdRef,
+            DNSServiceFlags flags, uint32_t interfaceIndex,
+            DNSServiceProtocol protocol, const char* hostname,
+            DNSServiceGetAddrInfoReply callBack, void* context) override;
+#endif
+        DNSServiceErrorType queryRecord(DNSServiceRef* sdRef,
+            DNSServiceFlags flags, uint32_t interfaceIndex, const char* fullname,
+            uint16_t rrtype, uint16_t rrclass, DNSServiceQueryRecordReply callBack,
+            void* context) override;
+        void deallocate(DNSServiceRef sdRef) override;
+
+        int sockFd(DNSServiceRef sdRef) override;
+        DNSServiceErrorType processResult(DNSServiceRef sdRef) override;
+
+        size_t size() const override { return refs_.size(); }
+        // number of registered services
+        size_t getServiceCount() const { return services_.size(); }
+        // as if the daemon closed the connection (or standalone ref): 
+        // services registered over it are removed, replies are dropped and
+        // processResult() of the connection fails from now on
+        void dropConnection(DNSServiceRef connection);
+        // as if the daemon restarted: every connection is dropped
+        void dropConnections();
+
+    private:
+        struct _Ref;
+        // reply to a ref; argument is kDNSServiceFlagsMoreComing or 0
+        typedef struct _Reply {
+            struct _Ref* ref_;
+            uint64_t refId_;
+            std::function<void(DNSServiceFlags)> deliver_;
+        } Reply;
+
+        typedef struct _Ref {
+            uint64_t id_;
+            // connection this ref is a subordinate of, if any
+            struct _Ref* connection_ = nullptr;
+            std::set<struct _Ref*> subordinates_;
+            // connections and standalone refs only
+            int fds_[2] = { -1, -1 };
+            std::deque<Reply> replies_;
+            // registered or browsed service type ("_ndn._udp.") and subtype.
+            // monitored record name for queries
+            std::string type_, subtype_, domain_, fullname_;
+            bool registered_ = false;
+            // connections and standalone refs only, see dropConnection()
+            bool dropped_ = false;
+        } Ref;
+
+        typedef struct _Service {
+            Ref* ref_;
+            std::string name_, type_, domain_, host_, txt_;
+            std::vector<std::string> subtypes_;
+            uint32_t interfaceIdx_;
+            // network byte order
+            uint16_t port_;
+        } Service;
+
+        typedef struct _Browser {
+            DNSServiceBrowseReply callBack_;
+            void* context_;
+        } Browser;
+
+        typedef struct _Monitor {
+            DNSServiceQueryRecordReply callBack_;
+            void* context_;
+        } Monitor;
+
+        uint64_t lastRefId_;
+        std::map<Ref*, std::unique_ptr<Ref>> refs_;
+        // services by full name
+        std::map<std::string, Service> services_;
+        std::map<Ref*, Browser> browsers_;
+        // TXT queries by record name
+        std::map<std::string, std::map<Ref*, Monitor>> monitors_;
+
+        // creates subordinate of *sdRef if flags ask for it, standalone ref
+        // otherwise. returns nullptr on failure
+        Ref* makeRef(DNSServiceRef* sdRef, DNSServiceFlags flags);
+        Ref* findRef(DNSServiceRef sdRef) const;
+        void queue(Ref* ref, std::function<void(DNSServiceFlags)> deliver);
+        bool matches(const Ref* browser, const Service& s) const;
+        void notifyBrowsers(const Service& s, bool added);
+        void notifyMonitors(const std::string& fullname, const std::string* txt);
+        void removeService(Ref* ref);
+    };
+}
+}
+
+#endif
@@ -2,15 +2,26 @@
 #include "ndn-sd.hpp"
 #include "config.hpp"
 #include "dns_sd.h"
+#include "instance-id.hpp"
+#include "request-slab.hpp"
+#include "resolve-cache.hpp"
+#include "run-loop.hpp"
+#include "service-registry.hpp"
+#include "txt-record.hpp"
 #include <ndn-ind/interest.hpp>
+#include <atomic>
+#include <deque>
 #include <map>
+#include <set>
 #include <time.h>
 #include <cassert>
+#include <algorithm>
 
 #define MAX_TXT_RECORD_SIZE 1000
 
 #ifdef _WIN32
 #include <process.h>
+#include <ws2tcpip.h>
 typedef int pid_t;
 #define getpid _getpid
 #define strcasecmp _stricmp
@@ -19,8 +30,11 @@ typedef int pid_t;
 #include <sys/time.h>
 #include <unistd.h>
 #include <arpa/inet.h>
+#include <netinet/in.h>
+#include <net/if.h>
 #endif
 
+
 using namespace std;
 
 const string ndnsd::kNdnDnsServiceType = "_ndn";
@@ -37,25 +51,52 @@ namespace ndnsd
 		Registered
 	};
 
-	const string kNdnDnsServiceTxtPrefixKey = "p";
-	const string kNdnDnsServiceTxtCertificateKey = "c";
-
 	struct NdnSd::Impl : enable_shared_from_this<NdnSd::Impl> 
 	{
-		typedef struct _ServiceParameters : AdvertiseParameters {
-			string hostname_;
-			string fullname_;
+		// compact state of a service. strings that many discovered services
+		// have in common (subtype, domain, host) are interned, fullname is
+		// made from the rest when asked for
+		typedef struct _ServiceParameters {
+			Proto protocol_ = Proto::UDP;
+			uint8_t capabilities_ = 0;
+			uint16_t port_ = 0;
+			uint32_t interfaceIdx_ = 0;
+			helpers::InternedString subtype_, domain_, hostname_;
+			string prefix_, cert_, certDigest_;
+			vector<string> prefixes_;
+			map<Proto, uint16_t> ports_;
+			vector<string> addresses_;
+			void* userData_ = nullptr;
 
 			struct _ServiceParameters& operator=(const AdvertiseParameters& ap)
 			{
-				*((AdvertiseParameters*)this) = ap;
+				protocol_ = ap.protocol_;
+				port_ = ap.port_;
+				interfaceIdx_ = ap.interfaceIdx_;
+				subtype_ = helpers::InternedString(ap.subtype_);
+				domain_ = helpers::InternedString(ap.domain_);
+				userData_ = ap.userData_;
+				setTxt(ap);
 				return *this;
 			}
+
+			// parameters carried by TXT record
+			void setTxt(AdvertiseParameters ap)
+			{
+				prefix_ = move(ap.prefix_);
+				cert_ = move(ap.cert_);
+				certDigest_ = move(ap.certDigest_);
+				prefixes_ = move(ap.prefixes_);
+				ports_ = move(ap.ports_);
+				capabilities_ = ap.capabilities_;
+			}
 		} ServiceParameters;
 
 		typedef struct _DnsRequest {
-			int id_ = -1;
-			DNSServiceRef serviceRef_;
+			RequestId id_ = -1;
+			DNSServiceRef serviceRef_ = nullptr;
+			// serviceRef_ is a subordinate of the shared daemon connection
+			bool shared_ = false;
 			shared_ptr<Impl> pimpl_;
 			OnBrowseError onError_;
 			OnServiceAnnouncement onAnnouncement_;
@@ -63,15 +104,33 @@ namespace ndnsd
 
 		typedef struct _BrowseRequest : DnsRequest {
 			BrowseConstraints constraints_;
-			vector<shared_ptr<NdnSd>> discovered_;
+			OnServiceAnnouncementBatch onAnnouncementBatch_;
+			// deltas accumulated while kDNSServiceFlagsMoreComing is set
+			vector<ServiceAnnouncement> pending_;
 		} BrowseRequest;
 
 		typedef struct _ResolveRequest : DnsRequest {
 			shared_ptr<NdnSd> sd_;
 			void* userData_;
+			bool priority_ = false;
+			// retries made so far
+			uint32_t attempt_ = 0;
+			// deadline timer while in flight, backoff timer while waiting to retry
+			int timerId_ = 0;
+			helpers::RunLoop::Clock::time_point requestedAt_;
+			// SRV and TXT of resolved service, kept while addresses of the
+			// host are looked up. port in host byte order
+			string fullname_, hostname_, txt_;
+			uint16_t port_ = 0;
+			uint32_t interfaceIdx_ = 0;
+			vector<string> addresses_;
+			// address families reported to have no records
+			int nNoAddress_ = 0;
 		} ResolveRequest;
 
-		Impl(std::string uuid) {
+		struct Discovered;
+
+		Impl(const helpers::InstanceId& uuid) {
 			uuid_ = uuid; 
 			state_ = ServiceState::Created;
 		}
@@ -80,33 +139,118 @@ namespace ndnsd
 		OnResolvedService onResolvedServiceCb_;
 
 		ServiceState state_;
-		string uuid_;
+		helpers::InstanceId uuid_;
 		ServiceParameters parameters_;
-
-		DNSServiceRef advertisedRef_;
+		// set for discovered services only, see self()
+		weak_ptr<void> outer_;
+		// discovered services only: instance that browsed them
+		weak_ptr<Impl> browser_;
+
+		DNSServiceRef advertisedRef_ = nullptr;
+		bool advertisedShared_ = false;
+		// TXT record of advertised service, reused by announce and update.
+		// allocated by the first announce
+		unique_ptr<uint8_t[]> txtBuf_;
+		TXTRecordRef txtRecRef_;
+		// record being made by update, swapped with the one above once 
+		// the daemon accepts it. allocated by the first update
+		unique_ptr<uint8_t[]> nextTxtBuf_;
+		TXTRecordRef nextTxtRecRef_;
 		OnServiceRegistered onRegistered_;
 		OnRegisterError onRegisterError_;
 
-		// all browse requests
-		map<int, shared_ptr<BrowseRequest>> brequests_;
-		// all resolution requests
-		map<int, shared_ptr<ResolveRequest>> rrequests_;
-
-		// store discovered-only services (not resolved yet)
-		//vector<shared_ptr<NdnSd>> discovered_;
-		// store resolved services
-		//vector<shared_ptr<NdnSd>> resolved_;
-		
-
-		// TODO:see if this should be static
-		map<int, DNSServiceRef> fdServiceRefMap_;
+		// requests of all instances live in process-wide slabs, see 
+		// browseRequests() and resolveRequests(). ids of requests of this
+		// instance are kept here, so that they are found without walking
+		// the slabs. resolve requests are indexed by the service resolved
+		set<RequestId> browseIds_;
+		map<const NdnSd*, set<RequestId>> resolveIds_;
+		// number of resolve requests of this instance: queued, in flight
+		// and waiting to retry
+		size_t nResolveRequests_ = 0;
+		// ids of requests waiting for a free slot. may contain ids of 
+		// requests already started or cancelled, these are skipped.
+		// created by the first resolve: empty deques allocate, and 
+		// discovered services don't resolve
+		typedef struct _ResolveQueues {
+			deque<RequestId> normal_, priority_;
+		} ResolveQueues;
+		unique_ptr<ResolveQueues> resolveQueues_;
+		size_t nResolvesInFlight_ = 0;
+		ResolveOptions resolveOptions_;
+		ResolveStats resolveStats_;
+		uint64_t totalResolveLatencyMs_ = 0;
+
+		// discovered services of all browse requests
+		helpers::ServiceRegistry discovered_;
+
+		// copy-on-write view of discovered_ for other threads. built and published
+		// on the event thread, swapped atomically
+		shared_ptr<const ServiceSnapshot> snapshot_ = emptySnapshot();
+		atomic<uint64_t> snapshotGeneration_{ 0 };
+		bool snapshotDirty_ = false;
 
 		// helpers
+		// requests hold their instance with it, so that it stays alive while
+		// their callbacks run
+		shared_ptr<Impl> self()
+		{
+			// Impl of a discovered service is owned by its Discovered
+			auto outer = outer_.lock();
+			return (outer ? shared_ptr<Impl>(outer, this) : shared_from_this());
+		}
+		static shared_ptr<NdnSd> makeDiscovered(const helpers::ServiceRegistry::Key& key,
+			const char* domain, const BrowseConstraints& constraints);
+		static const shared_ptr<const ServiceSnapshot>& emptySnapshot();
+		static helpers::RequestSlab<BrowseRequest>& browseRequests();
+		static helpers::RequestSlab<ResolveRequest>& resolveRequests();
+		// instances with an announced service
+		static set<Impl*>& registrations();
+		// releases slab slot and drops the id from resolveIds_
+		void releaseResolve(RequestId id);
 		void deregister();
-		void addRefToRunLoop(DNSServiceRef ref);
-		void removeRefFromRunloop(DNSServiceRef ref);
+		void addRefToRunLoop(DNSServiceRef ref, bool shared);
+		void removeRefFromRunloop(DNSServiceRef ref, bool shared);
+		static DNSServiceFlags prepareRef(DNSServiceRef& ref);
+		// returns false if parameters don't fit into TXT record
+		bool makeTxtRecord(const AdvertiseParameters& parameters);
+		bool makeTxtRecord(const AdvertiseParameters& parameters,
+			unique_ptr<uint8_t[]>& buf, TXTRecordRef& txtRecRef);
 		vector<shared_ptr<NdnSd>> getDiscoveredServices() const;
 		void removeRequest(shared_ptr<DnsRequest> rr);
+		RequestId browse(const BrowseConstraints& constraints,
+			OnServiceAnnouncement onAnnouncementCb,
+			OnServiceAnnouncementBatch onAnnouncementBatchCb,
+			OnBrowseError onBrowseErrorCb);
+		static void flushAnnouncements(BrowseRequest* br);
+		void enqueueResolve(const shared_ptr<ResolveRequest>& rr);
+		void pumpResolves();
+		bool startResolve(const shared_ptr<ResolveRequest>& rr);
+		// second step of resolve: SRV target to addresses. replaces resolve 
+		// DNSServiceRef, deadline timer keeps running
+		bool startAddrInfo(const shared_ptr<ResolveRequest>& rr);
+		void completeResolve(const shared_ptr<ResolveRequest>& rr);
+		void stopResolve(ResolveRequest* rr);
+		void releaseResolveRef(ResolveRequest* rr);
+		void onResolveFailed(const shared_ptr<ResolveRequest>& rr, 
+			DNSServiceErrorType errorCode);
+		void cancelResolves(const shared_ptr<const NdnSd>& sd);
+		// announces Resolved to browse requests that discovered sd
+		void announceResolved(const shared_ptr<NdnSd>& sd);
+		// TXT record of a cached service has changed: resolved services
+		// are updated and announced again
+		static void onCacheUpdated(const helpers::ResolveCache::Entry& e);
+		// shared daemon connection has failed: requests made over it are 
+		// reported (resolves are retried over a new connection)
+		static void onConnectionLost(DNSServiceRef connection, bool shared);
+		// fills in resolved parameters. returns false if TXT record has no prefix
+		bool applyResolved(const string& hostname, uint16_t port, 
+			uint16_t txtLen, const unsigned char* txtRecord,
+			const vector<string>& addresses);
+		// uuid, if given, is the same as uuid_, already made a string
+		string makeFullname(const string& uuid = "") const;
+		void publishSnapshot();
+		static ServiceRecord makeRecord(const NdnSd& sd);
 
 		// DNS-SD callbacks
 		static void browseReply(
@@ -129,6 +273,15 @@ namespace ndnsd
 			uint16_t                            txtLen,
 			const unsigned char* txtRecord,
 			void* context);
+		static void addrInfoReply(
+			DNSServiceRef                       sdRef,
+			DNSServiceFlags                     flags,
+			uint32_t                            interfaceIndex,
+			DNSServiceErrorType                 errorCode,
+			const char* hostname,
+			const struct sockaddr* address,
+			uint32_t                            ttl,
+			void* context);
 		static void registerReply(
 			DNSServiceRef                       sdRef,
 			DNSServiceFlags                     flags,
@@ -139,17 +292,42 @@ namespace ndnsd
 			void* context);
 	};
 
+	// discovered service: its Impl and NdnSd in a single allocation. NdnSd 
+	// doesn't own Impl here, both are owned by Discovered, and that's what
+	// shared_ptr<NdnSd> of the service keeps alive
+	struct NdnSd::Impl::Discovered {
+		Impl impl_;
+		// destroyed first, as ~NdnSd() uses impl_
+		NdnSd sd_;
+
+		Discovered(const helpers::InstanceId& uuid)
+			: impl_(uuid)
+			, sd_(shared_ptr<Impl>(shared_ptr<Impl>(), &impl_))
+		{}
+	};
+
 	// helpers
 	string makeRegType(Proto p, string subtype = "");
 	Proto parseProtocol(string regtype);
 	string dnsSdErrorMessage(DNSServiceErrorType errorCode);
-	bool isMaxTxtSizeExceeded(size_t sz);
+	// numeric address, with interface scope for link-local IPv6. empty for
+	// other address families
+	string formatAddress(const struct sockaddr* address, uint32_t interfaceIndex);
 }
 
 using ndnsd::NdnSd;
+using ndnsd::helpers::ResolveCache;
+using ndnsd::helpers::RunLoop;
 
 NdnSd::NdnSd(string uuid)
-	: pimpl_(make_shared<NdnSd::Impl>(uuid))
+	: pimpl_(make_shared<NdnSd::Impl>(helpers::InstanceId(uuid)))
+{
+	ResolveCache::getSharedInstance().setOnUpdated(&Impl::onCacheUpdated);
+	RunLoop::getSharedInstance().setOnConnectionLost(&Impl::onConnectionLost);
+}
+
+NdnSd::NdnSd(shared_ptr<Impl> pimpl)
+	: pimpl_(pimpl)
 {
 
 }
@@ -157,14 +335,20 @@ NdnSd::NdnSd(string uuid)
 NdnSd::~NdnSd()
 {
 	// cancel all requests
-	for (auto it = pimpl_->brequests_.cbegin(), nextIt = it;
-		it != pimpl_->brequests_.cend(); it = nextIt)
+	for (auto id : pimpl_->browseIds_)
 	{
-		++nextIt;
-		pimpl_->removeRefFromRunloop(it->second->serviceRef_);
-		DNSServiceRefDeallocate(it->second->serviceRef_);
-		pimpl_->brequests_.erase(it);
+		pimpl_->removeRequest(Impl::browseRequests().get(id));
+		Impl::browseRequests().release(id);
 	}
+	pimpl_->browseIds_.clear();
+	auto resolveIds = move(pimpl_->resolveIds_);
+	for (auto& service : resolveIds)
+		for (auto id : service.second)
+		{
+			pimpl_->stopResolve(Impl::resolveRequests().get(id).get());
+			pimpl_->releaseResolve(id);
+		}
+	pimpl_->discovered_.clear();
 
 	// deregister if registered
 	pimpl_->deregister();
@@ -172,61 +356,22 @@ NdnSd::~NdnSd()
 
 int NdnSd::run(uint32_t timeoutMs)
 {
-	bool run = true;
-
-	while (run)
-	{
-        int maxFd = 0;
-		fd_set readfds;
-		FD_ZERO(&readfds);
-
-		for (auto it : pimpl_->fdServiceRefMap_)
-        {
-            maxFd = max(maxFd, it.first);
-			FD_SET(it.first, &readfds);
-        }
-		struct timeval tv;
-		tv.tv_sec = timeoutMs / 1000;
-		tv.tv_usec = (timeoutMs - (timeoutMs / 1000) * 1000) * 1000;
-
-		int res = select(maxFd+1, &readfds, (fd_set*)nullptr, (fd_set*)nullptr, (timeoutMs ? &tv : 0));
-		if (res > 0)
-		{
-			for (auto it = pimpl_->fdServiceRefMap_.cbegin(), nextIt = it;
-				it != pimpl_->fdServiceRefMap_.cend(); it = nextIt)
-			{
-				// this setup with nextIt is needed because fdServiceRefMap can be 
-				// modified from within this loop (in callbacks invoked by DNSServiceProcessResult)
-				++nextIt; 
-				if (FD_ISSET(it->first, &readfds))
-				{
-					auto err = DNSServiceProcessResult(it->second);
-					if (err)
-					{
-						cerr << "process result error: " << err << endl;
-						run = false;
-						return err;
-					}
-				}
-			}
+	return runAll(timeoutMs);
+}
 
-			// keep running if timeout is not set
-			run = (timeoutMs == 0);
-		}
-		else
-		{
-			if (res < 0)
-			{
-				cerr << "select returned (" << res << ") error: " << errno << " - " << strerror(errno) << endl;
-				return errno;
-			}
+int NdnSd::runAll(uint32_t timeoutMs)
+{
+	return RunLoop::getSharedInstance().run(timeoutMs);
+}
 
-			// timeout reached, stop
-			run = false;
-		}
-	}
+bool NdnSd::watchDescriptor(int fd, function<void()> onReadable)
+{
+	return RunLoop::getSharedInstance().addWatch(fd, onReadable);
+}
 
-	return 0;
+void NdnSd::unwatchDescriptor(int fd)
+{
+	RunLoop::getSharedInstance().removeWatch(fd);
 }
 
 int NdnSd::announce(const AdvertiseParameters& parameters,
@@ -259,7 +404,7 @@ int NdnSd::announce(const AdvertiseParameters& parameters,
 		}
 	}
 
-	if (isMaxTxtSizeExceeded(parameters.prefix_.size() + parameters.cert_.size()))
+	if (!pimpl_->makeTxtRecord(parameters))
 	{
 		try
 		{
@@ -273,30 +418,16 @@ int NdnSd::announce(const AdvertiseParameters& parameters,
 		return -1;
 	}
 
-	// prep TXT record
-	uint16_t txtBufLen = MAX_TXT_RECORD_SIZE;
-	uint8_t* txtBuf = (uint8_t*)malloc(txtBufLen);
-	TXTRecordRef txtRecRef;
-	TXTRecordCreate(&txtRecRef, txtBufLen, txtBuf);
-	TXTRecordSetValue(&txtRecRef, kNdnDnsServiceTxtPrefixKey.c_str(),
-		parameters.prefix_.size(), (void*)parameters.prefix_.data());
-
-	if (parameters.cert_.size())
-	{
-		TXTRecordSetValue(&txtRecRef, kNdnDnsServiceTxtCertificateKey.c_str(), 
-			parameters.cert_.size(), (void*)parameters.cert_.data());
-	}
-
 	DNSServiceRef dnsServiceRef;
-	auto err = DNSServiceRegister(&dnsServiceRef, kDNSServiceFlagsNoAutoRename,
-		parameters.interfaceIdx_, pimpl_->uuid_.c_str(), 
+	DNSServiceFlags shareFlags = Impl::prepareRef(dnsServiceRef);
+	auto err = RunLoop::getSharedInstance().getBackend().registerService(&dnsServiceRef, 
+		kDNSServiceFlagsNoAutoRename | shareFlags, parameters.interfaceIdx_, pimpl_->uuid_.str().c_str(), 
 		makeRegType(parameters.protocol_, parameters.subtype_).c_str(),
 		(parameters.domain_.size() ? parameters.domain_.c_str() : nullptr), 
 		nullptr, 
 		htons(parameters.port_),
-		TXTRecordGetLength(&txtRecRef), TXTRecordGetBytesPtr(&txtRecRef),
+		TXTRecordGetLength(&pimpl_->txtRecRef_), TXTRecordGetBytesPtr(&pimpl_->txtRecRef_),
 		&Impl::registerReply, pimpl_.get());
-	free(txtBuf);
 
 	if (err != kDNSServiceErr_NoError)
 	{
@@ -314,28 +445,96 @@ int NdnSd::announce(const AdvertiseParameters& parameters,
 	{
 		pimpl_->state_ = ServiceState::Registering;
 		pimpl_->advertisedRef_ = dnsServiceRef;
+		pimpl_->advertisedShared_ = (shareFlags != 0);
 		pimpl_->parameters_ = parameters;
 		pimpl_->onRegistered_ = onRegisteredCb;
 		pimpl_->onRegisterError_ = onRegisterErrorCb;
-		pimpl_->addRefToRunLoop(dnsServiceRef);
+		pimpl_->addRefToRunLoop(dnsServiceRef, pimpl_->advertisedShared_);
+		Impl::registrations().insert(pimpl_.get());
 	}
 
 	return 0;
 }
 
-int NdnSd::browse(BrowseConstraints constraints, OnServiceAnnouncement onAnnouncementCb,
+int NdnSd::update(const AdvertiseParameters& parameters, OnRegisterError onUpdateErrorCb)
+{
+	string error;
+	DNSServiceErrorType err = kDNSServiceErr_NoError;
+	const auto& current = pimpl_->parameters_;
+
+	if (pimpl_->state_ < ServiceState::Registering)
+		error = "service is not registered";
+	else if (parameters.protocol_ != current.protocol_ || parameters.port_ != current.port_ ||
+		parameters.interfaceIdx_ != current.interfaceIdx_ || parameters.subtype_ != current.subtype_.str())
+		error = "only TXT record parameters can be updated";
+	else if (!parameters.prefix_.size())
+		error = "prefix is not set";
+	// current record is kept intact, unless the new one is accepted
+	else if (!pimpl_->makeTxtRecord(parameters, pimpl_->nextTxtBuf_, pimpl_->nextTxtRecRef_))
+		error = "maximum TXT record size exceeded";
+	else
+	{
+		// null record ref: primary TXT record of the registration
+		err = RunLoop::getSharedInstance().getBackend().updateRecord(pimpl_->advertisedRef_, nullptr, 0,
+			TXTRecordGetLength(&pimpl_->nextTxtRecRef_), TXTRecordGetBytesPtr(&pimpl_->nextTxtRecRef_), 0);
+
+		if (err == kDNSServiceErr_NoError)
+		{
+			// record refers to its buffer, which is not moved by the swap
+			swap(pimpl_->txtBuf_, pimpl_->nextTxtBuf_);
+			swap(pimpl_->txtRecRef_, pimpl_->nextTxtRecRef_);
+			pimpl_->parameters_.setTxt(parameters);
+			return 0;
+		}
+
+		cerr << "failed to update service record: " << err << endl;
+		error = dnsSdErrorMessage(err);
+	}
+
+	try
+	{
+		onUpdateErrorCb(-1, (err ? err : -1), error, (err != kDNSServiceErr_NoError), parameters.userData_);
+	}
+	catch (std::runtime_error& e)
+	{
+		cerr << "caught exception while calling user callback: " << e.what() << endl;
+	}
+
+	return -1;
+}
+
+ndnsd::RequestId NdnSd::browse(BrowseConstraints constraints, OnServiceAnnouncement onAnnouncementCb,
+	OnError onBrowseErrorCb)
+{
+	return pimpl_->browse(constraints, onAnnouncementCb, nullptr, onBrowseErrorCb);
+}
+
+ndnsd::RequestId NdnSd::browse(BrowseConstraints constraints, OnServiceAnnouncementBatch onAnnouncementBatchCb,
 	OnError onBrowseErrorCb)
+{
+	return pimpl_->browse(constraints, nullptr, onAnnouncementBatchCb, onBrowseErrorCb);
+}
+
+ndnsd::RequestId NdnSd::Impl::browse(const BrowseConstraints& constraints,
+	OnServiceAnnouncement onAnnouncementCb,
+	OnServiceAnnouncementBatch onAnnouncementBatchCb,
+	OnBrowseError onBrowseErrorCb)
 {
 	DNSServiceRef ref;
-	shared_ptr<Impl::BrowseRequest> br = make_shared<Impl::BrowseRequest>();
+	DNSServiceFlags shareFlags = Impl::prepareRef(ref);
+	auto slot = browseRequests().acquire();
+	RequestId brId = slot.first;
+	shared_ptr<Impl::BrowseRequest> br = slot.second;
 	
-	auto res = DNSServiceBrowse(&ref, 0, constraints.interfaceIdx_, 
+	auto res = RunLoop::getSharedInstance().getBackend().browse(&ref, shareFlags, constraints.interfaceIdx_, 
 		makeRegType(constraints.protocol_, constraints.subtype_).c_str(), 
 		(constraints.domain_.size() ? constraints.domain_.c_str() : nullptr),
-		&NdnSd::Impl::browseReply, br.get());
+		&NdnSd::Impl::browseReply, helpers::RequestSlab<BrowseRequest>::toContext(brId));
 
 	if (res != kDNSServiceErr_NoError)
 	{
+		browseRequests().release(brId);
+
 		try
 		{
 			onBrowseErrorCb(-1, res, dnsSdErrorMessage(res), true, constraints.userData_);
@@ -347,18 +546,17 @@ int NdnSd::browse(BrowseConstraints constraints, OnServiceAnnouncement onAnnounc
 	}
 	else
 	{
-		int brId = (pimpl_->brequests_.size() ? pimpl_->brequests_.rbegin()->first + 1 : 1);
-		assert(pimpl_->brequests_.find(brId) == pimpl_->brequests_.end());
-
-		br->pimpl_ = pimpl_;
+		br->pimpl_ = self();
 		br->id_ = brId;
 		br->serviceRef_ = ref;
+		br->shared_ = (shareFlags != 0);
 		br->constraints_ = constraints;
 		br->onAnnouncement_ = onAnnouncementCb;
+		br->onAnnouncementBatch_ = onAnnouncementBatchCb;
 		br->onError_ = onBrowseErrorCb;
 
-		pimpl_->brequests_[brId] = br;
-		pimpl_->addRefToRunLoop(ref);
+		addRefToRunLoop(ref, br->shared_);
+		browseIds_.insert(brId);
 
 		return brId;
 	}
@@ -366,26 +564,36 @@ int NdnSd::browse(BrowseConstraints constraints, OnServiceAnnouncement onAnnounc
 	return -1;
 }
 
-void NdnSd::cancel(int requestId)
+void NdnSd::cancel(RequestId requestId)
 {
-	auto it = pimpl_->brequests_.find(requestId);
+	auto br = Impl::browseRequests().get(requestId);
 
-	if (it != pimpl_->brequests_.end())
+	if (br && br->pimpl_ == pimpl_)
 	{
-		pimpl_->removeRequest(it->second);
-		pimpl_->brequests_.erase(it);
+		pimpl_->removeRequest(br);
+		size_t nDiscovered = pimpl_->discovered_.size();
+		pimpl_->discovered_.removeOwner(requestId);
+		Impl::browseRequests().release(requestId);
+		pimpl_->browseIds_.erase(requestId);
+
+		if (pimpl_->discovered_.size() != nDiscovered)
+		{
+			pimpl_->snapshotDirty_ = true;
+			pimpl_->publishSnapshot();
+		}
 	}
 }
 
 void NdnSd::resolve(shared_ptr<const NdnSd> sd,
 	OnResolvedService onResolvedServiceCb,
 	OnError onResolveErrorCb,
-	void* userData)
+	void* userData,
+	bool priority)
 {
+	shared_ptr<NdnSd> discovered = (sd ? 
+		pimpl_->discovered_.find(helpers::ServiceRegistry::makeKey(*sd)) : nullptr);
 
-	auto allDiscovered = pimpl_->getDiscoveredServices();
-	auto it = find(allDiscovered.begin(), allDiscovered.end(), sd);
-	if (it == allDiscovered.end())
+	if (!discovered || discovered != sd)
 	{
 		try
 		{
@@ -398,50 +606,85 @@ void NdnSd::resolve(shared_ptr<const NdnSd> sd,
 	}
 	else
 	{
-		shared_ptr<Impl::ResolveRequest> rr = make_shared<Impl::ResolveRequest>();
-
-		DNSServiceRef dnsServiceRef;
-		auto res = DNSServiceResolve(&dnsServiceRef, 0, 
-			sd->getInterface(),
-			sd->getUuid().c_str(),
-			makeRegType(sd->getProtocol(), ""/*sd->getSubtype()*/).c_str(),
-			sd->getDomain().c_str(),
-			&Impl::resolveReply, 
-			rr.get());
-
-		if (res == kDNSServiceErr_NoError)
+		string fullname = discovered->pimpl_->makeFullname();
+		auto cached = ResolveCache::getSharedInstance().lookup(fullname, 
+			(uint32_t)discovered->getInterface());
+		if (cached && discovered->pimpl_->applyResolved(cached->hostname_, cached->port_,
+			(uint16_t)cached->txt_.size(), (const unsigned char*)cached->txt_.data(),
+			cached->getAddresses(discovered->getInterface())))
 		{
-			int rrId = (pimpl_->rrequests_.size() ? pimpl_->rrequests_.rbegin()->first + 1 : 1);
-			assert(pimpl_->rrequests_.find(rrId) == pimpl_->rrequests_.end());
-
-			rr->id_ = rrId;
-			rr->pimpl_ = pimpl_;
-			rr->onError_ = onResolveErrorCb;
-			rr->onAnnouncement_ = onResolvedServiceCb;
-			rr->userData_ = userData;
-			rr->sd_ = *it;
-			rr->serviceRef_ = dnsServiceRef;
+			ResolveCache::getSharedInstance().addService(fullname, discovered);
+			pimpl_->snapshotDirty_ = true;
+			pimpl_->publishSnapshot();
 
-			pimpl_->rrequests_[rrId] = rr;
-			pimpl_->addRefToRunLoop(dnsServiceRef);
-		}
-		else
-		{
 			try
 			{
-				onResolveErrorCb(-1, res, dnsSdErrorMessage(res), true, userData);
+				onResolvedServiceCb(-1, Announcement::Resolved, discovered, userData);
 			}
 			catch (runtime_error& e)
 			{
 				cerr << "caught exception while calling user callback: " << e.what() << endl;
 			}
+			return;
+		}
+
+		auto slot = Impl::resolveRequests().acquire();
+		shared_ptr<Impl::ResolveRequest> rr = slot.second;
+
+		rr->id_ = slot.first;
+		rr->pimpl_ = pimpl_->self();
+		rr->onError_ = onResolveErrorCb;
+		rr->onAnnouncement_ = onResolvedServiceCb;
+		rr->userData_ = userData;
+		rr->sd_ = discovered;
+		rr->priority_ = priority;
+		rr->requestedAt_ = RunLoop::Clock::now();
+
+		pimpl_->nResolveRequests_++;
+		pimpl_->resolveIds_[discovered.get()].insert(rr->id_);
+		pimpl_->enqueueResolve(rr);
+		pimpl_->pumpResolves();
+	}
+}
+
+void NdnSd::prioritizeResolve(shared_ptr<const NdnSd> sd)
+{
+	auto it = pimpl_->resolveIds_.find(sd.get());
+	if (it == pimpl_->resolveIds_.end())
+		return;
+
+	for (auto id : it->second)
+	{
+		auto rr = Impl::resolveRequests().get(id);
+		if (rr && !rr->priority_)
+		{
+			rr->priority_ = true;
+			// waiting requests are moved to the priority queue. stale entry in 
+			// the normal queue will be skipped
+			if (!rr->serviceRef_ && !rr->timerId_)
+				pimpl_->resolveQueues_->priority_.push_back(rr->id_);
 		}
 	}
 }
 
+void NdnSd::setResolveOptions(const ResolveOptions& options)
+{
+	pimpl_->resolveOptions_ = options;
+	pimpl_->pumpResolves();
+}
+
+NdnSd::ResolveStats NdnSd::getResolveStats() const
+{
+	ResolveStats stats = pimpl_->resolveStats_;
+	stats.inFlight_ = pimpl_->nResolvesInFlight_;
+	stats.queued_ = pimpl_->nResolveRequests_ - pimpl_->nResolvesInFlight_;
+
+	return stats;
+}
+
 string NdnSd::getUuid() const
 {
-	return pimpl_->uuid_;
+	return pimpl_->uuid_.str();
 }
 
 ndnsd::Proto NdnSd::getProtocol() const
@@ -463,7 +706,7 @@ uint16_t NdnSd::getPort() const
 
 string NdnSd::getSubtype() const 
 {
-	return pimpl_->parameters_.subtype_;
+	return pimpl_->parameters_.subtype_.str();
 }
 
 string NdnSd::getPrefix() const
@@ -480,17 +723,55 @@ string NdnSd::getCertificate() const
 	return "";
 }
 
+string NdnSd::getCertificateDigest() const
+{
+	if (pimpl_->state_ >= ServiceState::Resolved)
+		return pimpl_->parameters_.certDigest_;
+	return "";
+}
+
+vector<string> NdnSd::getPrefixes() const
+{
+	vector<string> prefixes;
+	if (pimpl_->state_ >= ServiceState::Resolved)
+	{
+		prefixes.reserve(pimpl_->parameters_.prefixes_.size() + 1);
+		prefixes.push_back(pimpl_->parameters_.prefix_);
+		prefixes.insert(prefixes.end(), pimpl_->parameters_.prefixes_.begin(),
+			pimpl_->parameters_.prefixes_.end());
+	}
+	return prefixes;
+}
+
+map<ndnsd::Proto, uint16_t> NdnSd::getPorts() const
+{
+	map<Proto, uint16_t> ports;
+	if (pimpl_->state_ >= ServiceState::Resolved)
+	{
+		ports = pimpl_->parameters_.ports_;
+		ports[pimpl_->parameters_.protocol_] = pimpl_->parameters_.port_;
+	}
+	return ports;
+}
+
+uint8_t NdnSd::getCapabilities() const
+{
+	if (pimpl_->state_ >= ServiceState::Resolved)
+		return pimpl_->parameters_.capabilities_;
+	return 0;
+}
+
 string NdnSd::getDomain() const
 {
 	if (pimpl_->state_ > ServiceState::Created)
-		return pimpl_->parameters_.domain_;
+		return pimpl_->parameters_.domain_.str();
 	return "";
 }
 
 string NdnSd::getHostname() const 
 {
 	if (pimpl_->state_ == ServiceState::Resolved)
-		return pimpl_->parameters_.hostname_;
+		return pimpl_->parameters_.hostname_.str();
 
 	return "";
 }
@@ -498,11 +779,50 @@ string NdnSd::getHostname() const
 string NdnSd::getFullname() const 
 {
 	if (pimpl_->state_ == ServiceState::Resolved)
-		return pimpl_->parameters_.fullname_;
+		return pimpl_->makeFullname();
 
 	return "";
 }
 
+vector<string> NdnSd::getAddresses() const
+{
+	if (pimpl_->state_ == ServiceState::Resolved)
+		return pimpl_->parameters_.addresses_;
+
+	return {};
+}
+
+void NdnSd::setShareConnection(bool enable)
+{
+	RunLoop::getSharedInstance().setShareConnection(enable);
+}
+
+bool NdnSd::setBackend(DiscoveryBackend backend)
+{
+	// cache entries keep TXT queries open on the current backend
+	ResolveCache::getSharedInstance().clear();
+
+	return RunLoop::getSharedInstance().setBackend(backend == DiscoveryBackend::Loopback ?
+		helpers::getLoopbackBackend() : helpers::getDnsSdBackend());
+}
+
+void NdnSd::setResolveCacheTtl(uint32_t maxTtlSec)
+{
+	ResolveCache::getSharedInstance().setMaxTtl(maxTtlSec);
+}
+
+NdnSd::ResolveCacheStats NdnSd::getResolveCacheStats()
+{
+	auto s = ResolveCache::getSharedInstance().getStats();
+	ResolveCacheStats stats;
+	stats.hits_ = s.hits_;
+	stats.misses_ = s.misses_;
+	stats.invalidations_ = s.invalidations_;
+	stats.size_ = s.size_;
+
+	return stats;
+}
+
 string NdnSd::getVersion()
 {
 	return NDNSD_VERSION;
@@ -514,6 +834,21 @@ vector<shared_ptr<NdnSd>> NdnSd::getDiscoveredServices() const
 	return pimpl_->getDiscoveredServices();
 }
 
+void NdnSd::forEachDiscoveredService(function<void(const shared_ptr<const NdnSd>&)> f) const
+{
+	pimpl_->discovered_.forEach([&f](const shared_ptr<NdnSd>& sd) { f(sd); });
+}
+
+shared_ptr<const ndnsd::ServiceSnapshot> NdnSd::getSnapshot() const
+{
+	return atomic_load(&pimpl_->snapshot_);
+}
+
+uint64_t NdnSd::getSnapshotGeneration() const
+{
+	return pimpl_->snapshotGeneration_.load(memory_order_acquire);
+}
+
 // Impl helpers
 void NdnSd::Impl::deregister()
 {
@@ -521,45 +856,556 @@ void NdnSd::Impl::deregister()
 	{
 		// TODO: service fd might be under select (in multi-threaded setup). 
 		// need to handle
-		removeRefFromRunloop(advertisedRef_);
-		DNSServiceRefDeallocate(advertisedRef_);
+		removeRefFromRunloop(advertisedRef_, advertisedShared_);
+		RunLoop::getSharedInstance().getBackend().deallocate(advertisedRef_);
+		advertisedRef_ = nullptr;
 		state_ = ServiceState::Created;
+		registrations().erase(this);
 	}
 }
 
-void NdnSd::Impl::addRefToRunLoop(DNSServiceRef ref)
+void NdnSd::Impl::addRefToRunLoop(DNSServiceRef ref, bool shared)
 {
-	// TODO: do mutex access here
-	fdServiceRefMap_[DNSServiceRefSockFD(ref)] = ref;
+	// subordinate refs have no descriptor of their own: their replies are 
+	// dispatched when the shared connection (already in the run loop) is processed
+	if (!shared)
+		RunLoop::getSharedInstance().add(ref);
 }
 
-void NdnSd::Impl::removeRefFromRunloop(DNSServiceRef ref)
+void NdnSd::Impl::removeRefFromRunloop(DNSServiceRef ref, bool shared)
 {
-	auto it = fdServiceRefMap_.find(DNSServiceRefSockFD(ref));
-	if (it != fdServiceRefMap_.end())
+	if (!shared)
+		RunLoop::getSharedInstance().remove(ref);
+}
+
+DNSServiceFlags NdnSd::Impl::prepareRef(DNSServiceRef& ref)
+{
+	DNSServiceRef connection = RunLoop::getSharedInstance().getSharedConnection();
+	if (connection)
 	{
-		// TODO: do mutex access here
-		fdServiceRefMap_.erase(it);
+		ref = connection;
+		return kDNSServiceFlagsShareConnection;
 	}
+
+	return 0;
+}
+
+bool NdnSd::Impl::makeTxtRecord(const AdvertiseParameters& parameters)
+{
+	return makeTxtRecord(parameters, txtBuf_, txtRecRef_);
+}
+
+bool NdnSd::Impl::makeTxtRecord(const AdvertiseParameters& parameters,
+	unique_ptr<uint8_t[]>& buf, TXTRecordRef& txtRecRef)
+{
+	if (!buf)
+		buf.reset(new uint8_t[MAX_TXT_RECORD_SIZE]);
+
+	// TXTRecordCreate with caller-provided buffer does not allocate
+	TXTRecordCreate(&txtRecRef, MAX_TXT_RECORD_SIZE, buf.get());
+	return helpers::encodeTxtRecord(parameters, &txtRecRef);
 }
 
 vector<shared_ptr<NdnSd>> NdnSd::Impl::getDiscoveredServices() const
 {
 	vector<shared_ptr<NdnSd>> all;
-
-	for (auto r : brequests_)
-		all.insert(all.end(),
-			r.second->discovered_.begin(), r.second->discovered_.end());
+	all.reserve(discovered_.size());
+	discovered_.forEach([&all](const shared_ptr<NdnSd>& sd) { all.push_back(sd); });
 
 	return all;
 }
 
+void NdnSd::Impl::publishSnapshot()
+{
+	if (!snapshotDirty_)
+		return;
+
+	auto snapshot = make_shared<ServiceSnapshot>();
+	snapshot->generation_ = snapshotGeneration_.load(memory_order_relaxed) + 1;
+	snapshot->services_.reserve(discovered_.size());
+	discovered_.forEach([&snapshot](const shared_ptr<NdnSd>& sd) {
+		snapshot->services_.push_back(makeRecord(*sd));
+	});
+
+	atomic_store(&snapshot_, shared_ptr<const ServiceSnapshot>(snapshot));
+	snapshotGeneration_.store(snapshot->generation_, memory_order_release);
+	snapshotDirty_ = false;
+}
+
+ndnsd::ServiceRecord NdnSd::Impl::makeRecord(const NdnSd& sd)
+{
+	ServiceRecord r;
+	r.uuid_ = sd.getUuid();
+	r.protocol_ = sd.getProtocol();
+	r.interfaceIdx_ = sd.getInterface();
+	r.subtype_ = sd.getSubtype();
+	r.domain_ = sd.getDomain();
+	r.resolved_ = (sd.pimpl_->state_ == ServiceState::Resolved);
+	r.port_ = sd.getPort();
+	r.prefix_ = sd.getPrefix();
+	r.prefixes_ = sd.getPrefixes();
+	r.ports_ = sd.getPorts();
+	r.capabilities_ = sd.getCapabilities();
+	r.certificate_ = sd.getCertificate();
+	r.certificateDigest_ = sd.getCertificateDigest();
+	r.hostname_ = sd.getHostname();
+	if (r.resolved_)
+		r.fullname_ = sd.pimpl_->makeFullname(r.uuid_);
+	r.addresses_ = sd.getAddresses();
+
+	return r;
+}
+
+void NdnSd::Impl::enqueueResolve(const shared_ptr<ResolveRequest>& rr)
+{
+	if (!resolveQueues_)
+		resolveQueues_.reset(new ResolveQueues());
+
+	if (rr->priority_)
+		resolveQueues_->priority_.push_back(rr->id_);
+	else
+		resolveQueues_->normal_.push_back(rr->id_);
+}
+
+void NdnSd::Impl::pumpResolves()
+{
+	if (!resolveQueues_)
+		return;
+
+	while (resolveOptions_.maxInFlight_ == 0 || 
+		nResolvesInFlight_ < resolveOptions_.maxInFlight_)
+	{
+		deque<RequestId>& q = (resolveQueues_->priority_.size() ? 
+			resolveQueues_->priority_ : resolveQueues_->normal_);
+		if (q.empty())
+			break;
+
+		RequestId rrId = q.front();
+		q.pop_front();
+
+		// keep request alive, as it may be removed from within error callback
+		auto rr = resolveRequests().get(rrId);
+		if (!rr || rr->serviceRef_ || rr->timerId_)
+			continue;
+
+		if (!startResolve(rr))
+			onResolveFailed(rr, kDNSServiceErr_Unknown);
+	}
+}
+
+bool NdnSd::Impl::startResolve(const shared_ptr<ResolveRequest>& rr)
+{
+	// leftovers of a failed attempt
+	rr->addresses_.clear();
+	rr->nNoAddress_ = 0;
+
+	DNSServiceRef dnsServiceRef;
+	DNSServiceFlags shareFlags = prepareRef(dnsServiceRef);
+	auto res = RunLoop::getSharedInstance().getBackend().resolve(&dnsServiceRef, shareFlags, 
+		rr->sd_->getInterface(),
+		rr->sd_->getUuid().c_str(),
+		makeRegType(rr->sd_->getProtocol(), ""/*sd->getSubtype()*/).c_str(),
+		rr->sd_->getDomain().c_str(),
+		&Impl::resolveReply, 
+		helpers::RequestSlab<ResolveRequest>::toContext(rr->id_));
+
+	if (res != kDNSServiceErr_NoError)
+	{
+		cerr << "failed to start resolve of " << rr->sd_->getUuid() << ": " 
+			<< dnsSdErrorMessage(res) << endl;
+		return false;
+	}
+
+	rr->serviceRef_ = dnsServiceRef;
+	rr->shared_ = (shareFlags != 0);
+	addRefToRunLoop(dnsServiceRef, rr->shared_);
+	nResolvesInFlight_++;
+
+	RequestId rrId = rr->id_;
+	rr->timerId_ = RunLoop::getSharedInstance().addTimer(resolveOptions_.timeoutMs_,
+		[rrId]()
+	{
+		auto rr = resolveRequests().get(rrId);
+		if (rr)
+		{
+			auto pimpl = rr->pimpl_;
+			rr->timerId_ = 0;
+			pimpl->resolveStats_.timedOut_++;
+			pimpl->onResolveFailed(rr, kDNSServiceErr_Timeout);
+			pimpl->pumpResolves();
+		}
+	});
+
+	return true;
+}
+
+void NdnSd::Impl::stopResolve(ResolveRequest* rr)
+{
+	if (rr->timerId_)
+	{
+		RunLoop::getSharedInstance().cancelTimer(rr->timerId_);
+		rr->timerId_ = 0;
+	}
+
+	releaseResolveRef(rr);
+}
+
+void NdnSd::Impl::releaseResolveRef(ResolveRequest* rr)
+{
+	if (rr->serviceRef_)
+	{
+		removeRefFromRunloop(rr->serviceRef_, rr->shared_);
+		RunLoop::getSharedInstance().getBackend().deallocate(rr->serviceRef_);
+		rr->serviceRef_ = nullptr;
+		nResolvesInFlight_--;
+	}
+}
+
+bool NdnSd::Impl::startAddrInfo(const shared_ptr<ResolveRequest>& rr)
+{
+#ifdef HAVE_DNSSERVICEGETADDRINFO
+	// host records are not local-only, even if the service is
+	uint32_t interfaceIdx = (rr->interfaceIdx_ == kDNSServiceInterfaceIndexLocalOnly ? 
+		0 : rr->interfaceIdx_);
+
+	DNSServiceRef dnsServiceRef;
+	DNSServiceFlags shareFlags = prepareRef(dnsServiceRef);
+	auto res = RunLoop::getSharedInstance().getBackend().getAddrInfo(&dnsServiceRef, shareFlags, interfaceIdx,
+		kDNSServiceProtocol_IPv4 | kDNSServiceProtocol_IPv6,
+		rr->hostname_.c_str(),
+		&Impl::addrInfoReply,
+		helpers::RequestSlab<ResolveRequest>::toContext(rr->id_));
+
+	if (res != kDNSServiceErr_NoError)
+	{
+		cerr << "failed to look up addresses of " << rr->hostname_ << ": " 
+			<< dnsSdErrorMessage(res) << endl;
+		return false;
+	}
+
+	rr->serviceRef_ = dnsServiceRef;
+	rr->shared_ = (shareFlags != 0);
+	addRefToRunLoop(dnsServiceRef, rr->shared_);
+	nResolvesInFlight_++;
+#else
+	// no address lookup in this DNS-SD implementation, service resolves
+	// with hostname only
+	completeResolve(rr);
+#endif
+
+	return true;
+}
+
+void NdnSd::Impl::completeResolve(const shared_ptr<ResolveRequest>& rr)
+{
+	stable_partition(rr->addresses_.begin(), rr->addresses_.end(), 
+		[](const string& a) { return a.find(':') == string::npos; });
+
+	rr->sd_->pimpl_->parameters_.interfaceIdx_ = rr->interfaceIdx_;
+	rr->sd_->pimpl_->applyResolved(rr->hostname_, rr->port_,
+		(uint16_t)rr->txt_.size(), (const unsigned char*)rr->txt_.data(), rr->addresses_);
+	ResolveCache::getSharedInstance().store(rr->fullname_, rr->interfaceIdx_, 
+		rr->hostname_, rr->port_, rr->txt_, rr->addresses_, rr->sd_);
+
+	uint32_t latencyMs = (uint32_t)chrono::duration_cast<chrono::milliseconds>(
+		RunLoop::Clock::now() - rr->requestedAt_).count();
+	resolveStats_.succeeded_++;
+	resolveStats_.maxLatencyMs_ = max(resolveStats_.maxLatencyMs_, latencyMs);
+	totalResolveLatencyMs_ += latencyMs;
+	resolveStats_.avgLatencyMs_ = (double)totalResolveLatencyMs_ / resolveStats_.succeeded_;
+
+	stopResolve(rr.get());
+	releaseResolve(rr->id_);
+
+	snapshotDirty_ = true;
+	publishSnapshot();
+
+	try
+	{
+		rr->onAnnouncement_(rr->id_, Announcement::Resolved, rr->sd_, rr->userData_);
+	}
+	catch (runtime_error& e)
+	{
+		cerr << "caught exception while calling user callback: " << e.what() << endl;
+	}
+
+	pumpResolves();
+}
+
+void NdnSd::Impl::onResolveFailed(const shared_ptr<ResolveRequest>& rr, 
+	DNSServiceErrorType errorCode)
+{
+	stopResolve(rr.get());
+
+	if (rr->attempt_ < resolveOptions_.maxRetries_)
+	{
+		uint32_t delayMs = resolveOptions_.backoffMs_ * (1u << min(rr->attempt_, 16u));
+		rr->attempt_++;
+		resolveStats_.retried_++;
+
+		RequestId rrId = rr->id_;
+		rr->timerId_ = RunLoop::getSharedInstance().addTimer(delayMs, [rrId]()
+		{
+			auto rr = resolveRequests().get(rrId);
+			if (rr)
+			{
+				auto pimpl = rr->pimpl_;
+				rr->timerId_ = 0;
+				pimpl->enqueueResolve(rr);
+				pimpl->pumpResolves();
+			}
+		});
+	}
+	else
+	{
+		resolveStats_.failed_++;
+		releaseResolve(rr->id_);
+
+		try
+		{
+			rr->onError_(rr->id_, errorCode, dnsSdErrorMessage(errorCode), true, rr->userData_);
+		}
+		catch (runtime_error& e)
+		{
+			cerr << "caught exception while calling user callback: " << e.what() << endl;
+		}
+	}
+}
+
+void NdnSd::Impl::cancelResolves(const shared_ptr<const NdnSd>& sd)
+{
+	auto it = resolveIds_.find(sd.get());
+	if (it == resolveIds_.end())
+		return;
+
+	auto ids = move(it->second);
+	resolveIds_.erase(it);
+	for (auto id : ids)
+	{
+		stopResolve(resolveRequests().get(id).get());
+		releaseResolve(id);
+	}
+}
+
+void NdnSd::Impl::announceResolved(const shared_ptr<NdnSd>& sd)
+{
+	auto key = helpers::ServiceRegistry::makeKey(*sd);
+	if (discovered_.find(key) != sd)
+		return;
+
+	snapshotDirty_ = true;
+	for (auto id : discovered_.getOwners(key))
+	{
+		auto br = browseRequests().get(id);
+		if (br)
+		{
+			br->pending_.push_back({ Announcement::Resolved, sd });
+			flushAnnouncements(br.get());
+		}
+	}
+	publishSnapshot();
+}
+
+void NdnSd::Impl::onCacheUpdated(const helpers::ResolveCache::Entry& e)
+{
+	// callbacks may resolve more services from cache and add them here
+	auto services = e.services_;
+	for (auto& weakSd : services)
+	{
+		auto sd = weakSd.lock();
+		if (!sd || sd->pimpl_->state_ != ServiceState::Resolved)
+			continue;
+
+		// TXT record has changed, addresses it was resolved to stay
+		auto browser = sd->pimpl_->browser_.lock();
+		auto addresses = sd->pimpl_->parameters_.addresses_;
+		if (browser && sd->pimpl_->applyResolved(e.hostname_, e.port_, 
+			(uint16_t)e.txt_.size(), (const unsigned char*)e.txt_.data(), addresses))
+			browser->announceResolved(sd);
+	}
+}
+
+void NdnSd::Impl::onConnectionLost(DNSServiceRef connection, bool shared)
+{
+	const DNSServiceErrorType err = kDNSServiceErr_ServiceNotRunning;
+
+	// subordinates of the shared connection, or the single request that
+	// had a connection of its own
+	auto isLost = [connection, shared](DNSServiceRef ref, bool refShared) {
+		return ref && (shared ? refShared : ref == connection);
+	};
+
+	// TXT monitors are requests as well
+	if (shared)
+		ResolveCache::getSharedInstance().clear();
+	else
+		ResolveCache::getSharedInstance().invalidateMonitor(connection);
+
+	// callbacks below may start requests over a new connection
+	vector<shared_ptr<BrowseRequest>> browses;
+	vector<shared_ptr<ResolveRequest>> resolves;
+	vector<shared_ptr<Impl>> registered;
+	browseRequests().forEach([&](RequestId, const shared_ptr<BrowseRequest>& br) {
+		if (isLost(br->serviceRef_, br->shared_))
+			browses.push_back(br);
+	});
+	resolveRequests().forEach([&](RequestId, const shared_ptr<ResolveRequest>& rr) {
+		if (isLost(rr->serviceRef_, rr->shared_))
+			resolves.push_back(rr);
+	});
+	for (auto impl : registrations())
+		if (isLost(impl->advertisedRef_, impl->advertisedShared_))
+			registered.push_back(impl->self());
+
+	// resolves go first, so that retries are scheduled before users learn
+	// about the failure
+	for (auto& rr : resolves)
+	{
+		if (!rr->serviceRef_)
+			continue;
+
+		auto pimpl = rr->pimpl_;
+		pimpl->onResolveFailed(rr, err);
+		pimpl->pumpResolves();
+	}
+
+	for (auto& br : browses)
+	{
+		// cancelled by a callback meanwhile
+		if (!br->serviceRef_)
+			continue;
+
+		br->pimpl_->removeRequest(br);
+		flushAnnouncements(br.get());
+
+		try
+		{
+			br->onError_(br->id_, err, dnsSdErrorMessage(err), true, br->constraints_.userData_);
+		}
+		catch (std::runtime_error& e)
+		{
+			cerr << "caught exception while calling user callback: " << e.what() << endl;
+		}
+	}
+
+	for (auto& impl : registered)
+	{
+		if (!impl->advertisedRef_)
+			continue;
+
+		// can be announced again
+		impl->deregister();
+
+		try
+		{
+			impl->onRegisterError_(-1, err, dnsSdErrorMessage(err), true, impl->parameters_.userData_);
+		}
+		catch (std::runtime_error& e)
+		{
+			cerr << "caught exception while calling user callback: " << e.what() << endl;
+		}
+	}
+}
+
+void NdnSd::Impl::releaseResolve(RequestId id)
+{
+	auto rr = resolveRequests().get(id);
+	if (!rr)
+		return;
+
+	auto it = resolveIds_.find(rr->sd_.get());
+	if (it != resolveIds_.end())
+	{
+		it->second.erase(id);
+		if (it->second.empty())
+			resolveIds_.erase(it);
+	}
+
+	resolveRequests().release(id);
+	nResolveRequests_--;
+}
+
+shared_ptr<NdnSd> NdnSd::Impl::makeDiscovered(const helpers::ServiceRegistry::Key& key,
+	const char* domain, const BrowseConstraints& constraints)
+{
+	auto d = make_shared<Discovered>(key.uuid_);
+	d->impl_.outer_ = d;
+	d->impl_.state_ = ServiceState::Discovered;
+
+	ServiceParameters& p = d->impl_.parameters_;
+	p.protocol_ = key.protocol_;
+	p.interfaceIdx_ = key.interfaceIdx_;
+	p.domain_ = helpers::InternedString(domain);
+	p.subtype_ = helpers::InternedString(constraints.subtype_);
+	p.userData_ = constraints.userData_;
+
+	return shared_ptr<NdnSd>(d, &d->sd_);
+}
+
+const shared_ptr<const ndnsd::ServiceSnapshot>& NdnSd::Impl::emptySnapshot()
+{
+	// never destroyed, see RunLoop::getSharedInstance()
+	static auto* snapshot = new shared_ptr<const ServiceSnapshot>(make_shared<ServiceSnapshot>());
+	return *snapshot;
+}
+
+set<NdnSd::Impl*>& NdnSd::Impl::registrations()
+{
+	// never destroyed, see RunLoop::getSharedInstance()
+	static auto* registrations = new set<Impl*>();
+	return *registrations;
+}
+
+ndnsd::helpers::RequestSlab<NdnSd::Impl::BrowseRequest>& NdnSd::Impl::browseRequests()
+{
+	// never destroyed, see RunLoop::getSharedInstance()
+	static auto* slab = new helpers::RequestSlab<BrowseRequest>();
+	return *slab;
+}
+
+ndnsd::helpers::RequestSlab<NdnSd::Impl::ResolveRequest>& NdnSd::Impl::resolveRequests()
+{
+	static auto* slab = new helpers::RequestSlab<ResolveRequest>();
+	return *slab;
+}
+
+bool NdnSd::Impl::applyResolved(const string& hostname, uint16_t port, 
+	uint16_t txtLen, const unsigned char* txtRecord,
+	const vector<string>& addresses)
+{
+	AdvertiseParameters txtParameters;
+	if (!helpers::decodeTxtRecord(txtLen, txtRecord, txtParameters))
+		return false;
+
+	state_ = ServiceState::Resolved;
+	parameters_.setTxt(move(txtParameters));
+	parameters_.port_ = port;
+	if (hostname != parameters_.hostname_.str())
+		parameters_.hostname_ = helpers::InternedString(hostname);
+	parameters_.addresses_ = addresses;
+
+	return true;
+}
+
+string NdnSd::Impl::makeFullname(const string& uuid) const
+{
+	// same as fullname reported by resolve, so it needn't be kept
+	char fullname[kDNSServiceMaxDomainName];
+	if (DNSServiceConstructFullName(fullname, (uuid.size() ? uuid : uuid_.str()).c_str(),
+		makeRegType(parameters_.protocol_).c_str(), parameters_.domain_.str().c_str()) != 0)
+		return "";
+
+	return fullname;
+}
+
 void NdnSd::Impl::removeRequest(shared_ptr<DnsRequest> r)
 {
-	if (r)
+	// ref is gone already if its connection has failed
+	if (r && r->serviceRef_)
 	{
-		removeRefFromRunloop(r->serviceRef_);
-		DNSServiceRefDeallocate(r->serviceRef_);
+		removeRefFromRunloop(r->serviceRef_, r->shared_);
+		RunLoop::getSharedInstance().getBackend().deallocate(r->serviceRef_);
+		r->serviceRef_ = nullptr;
 	}
 }
 
@@ -574,7 +1420,10 @@ void NdnSd::Impl::browseReply(
 	const char* replyDomain,
 	void* context)
 {
-	BrowseRequest* br = static_cast<BrowseRequest*>(context);
+	// stale context of a cancelled request is rejected. request is kept
+	// alive, as it may be cancelled from within user callback
+	auto request = browseRequests().get(helpers::RequestSlab<BrowseRequest>::fromContext(context));
+	BrowseRequest* br = request.get();
 
 	if (!br)
 	{
@@ -588,59 +1437,56 @@ void NdnSd::Impl::browseReply(
 		{
 			// TODO: 
 			// 1. check it's not our own
-			// 2. check if more coming and postpone callback
-			// 
 			//cout << "ADD " << serviceName << " " << regtype << endl;
 
 			if (br->pimpl_->uuid_ != serviceName)
 			{
-				// TODO: wrap in a method
-				shared_ptr<NdnSd> sd = make_shared<NdnSd>(serviceName);
-				sd->pimpl_->parameters_.protocol_ = parseProtocol(regtype);
-				sd->pimpl_->parameters_.domain_ = replyDomain;
-				sd->pimpl_->parameters_.interfaceIdx_ = interfaceIndex;
-				sd->pimpl_->parameters_.subtype_ = br->constraints_.subtype_;
-				sd->pimpl_->parameters_.userData_ = br->constraints_.userData_;
-
-				sd->pimpl_->state_ = ServiceState::Discovered;
-				br->discovered_.push_back(sd);
-				try
-				{
-					br->onAnnouncement_(br->id_, Announcement::Added, sd, br->constraints_.userData_);
-				}
-				catch (std::runtime_error& e)
+				helpers::ServiceRegistry::Key key{ helpers::InstanceId(serviceName), 
+					interfaceIndex, parseProtocol(regtype) };
+				shared_ptr<NdnSd> sd = br->pimpl_->discovered_.find(key);
+
+				// service may have been already discovered by another browse request
+				if (!sd)
 				{
-					cerr << "caught exception while calling user callback: " << e.what() << endl;
+					sd = makeDiscovered(key, replyDomain, br->constraints_);
+					sd->pimpl_->browser_ = br->pimpl_;
 				}
+
+				size_t nDiscovered = br->pimpl_->discovered_.size();
+				if (br->pimpl_->discovered_.add(key, sd, br->id_))
+					br->pending_.push_back({ Announcement::Added, sd });
+				if (br->pimpl_->discovered_.size() != nDiscovered)
+					br->pimpl_->snapshotDirty_ = true;
 			}
 		}
 		else
 		{
-			auto it = find_if(br->discovered_.begin(), br->discovered_.end(),
-				[&](auto sd) 
+			helpers::ServiceRegistry::Key key{ helpers::InstanceId(serviceName), 
+				interfaceIndex, parseProtocol(regtype) };
+			
+			size_t nDiscovered = br->pimpl_->discovered_.size();
+			auto sd = br->pimpl_->discovered_.remove(key, br->id_);
+			if (sd)
+				br->pending_.push_back({ Announcement::Removed, sd });
+
+			if (br->pimpl_->discovered_.size() != nDiscovered)
 			{
-				return sd->getUuid() == serviceName;
-			});
+				br->pimpl_->snapshotDirty_ = true;
 
-			if (it != br->discovered_.end())
-			{
-				// TODO: check if it has been resolved and cleanup FD and other structs
-				auto sd = *it;
-				br->discovered_.erase(it);
-
-				try
-				{
-					br->onAnnouncement_(br->id_, Announcement::Removed, sd, br->constraints_.userData_);
-				}
-				catch (std::runtime_error& e)
-				{
-					cerr << "caught exception while calling user callback: " << e.what() << endl;
-				}
+				// service is gone: don't let queued or running resolves of it 
+				// occupy slots
+				br->pimpl_->cancelResolves(sd);
+				br->pimpl_->pumpResolves();
 			}
 		}
+
+		if (!(flags & kDNSServiceFlagsMoreComing))
+			flushAnnouncements(br);
 	}
 	else
 	{
+		flushAnnouncements(br);
+
 		try
 		{
 			br->onError_(br->id_, errorCode, dnsSdErrorMessage(errorCode), true,
@@ -653,6 +1499,44 @@ void NdnSd::Impl::browseReply(
 	}
 }
 
+void NdnSd::Impl::flushAnnouncements(BrowseRequest* br)
+{
+	if (br->pending_.empty())
+		return;
+
+	vector<ServiceAnnouncement> batch;
+	batch.swap(br->pending_);
+
+	// snapshot readers see the batch no later than callbacks do
+	br->pimpl_->publishSnapshot();
+
+	if (br->onAnnouncementBatch_)
+	{
+		try
+		{
+			br->onAnnouncementBatch_(br->id_, batch, br->constraints_.userData_);
+		}
+		catch (std::runtime_error& e)
+		{
+			cerr << "caught exception while calling user callback: " << e.what() << endl;
+		}
+	}
+	else
+	{
+		for (auto& a : batch)
+		{
+			try
+			{
+				br->onAnnouncement_(br->id_, a.announcement_, a.sd_, br->constraints_.userData_);
+			}
+			catch (std::runtime_error& e)
+			{
+				cerr << "caught exception while calling user callback: " << e.what() << endl;
+			}
+		}
+	}
+}
+
 void NdnSd::Impl::resolveReply(
 	DNSServiceRef                       sdRef,
 	DNSServiceFlags                     flags,
@@ -665,7 +1549,10 @@ void NdnSd::Impl::resolveReply(
 	const unsigned char* txtRecord,
 	void* context)
 {
-	ResolveRequest* rr = static_cast<ResolveRequest*>(context);
+	// stale context of a finished or cancelled request is rejected. request
+	// is kept alive, as it is removed before user callbacks are called
+	auto request = resolveRequests().get(helpers::RequestSlab<ResolveRequest>::fromContext(context));
+	ResolveRequest* rr = request.get();
 
 	if (!rr)
 	{
@@ -673,39 +1560,34 @@ void NdnSd::Impl::resolveReply(
 		return;
 	}
 
+	auto pimpl = rr->pimpl_;
+
 	if (errorCode == kDNSServiceErr_NoError)
 	{
-		
-		auto resolvedSdImpl = rr->sd_->pimpl_;
-		resolvedSdImpl->parameters_.interfaceIdx_ = interfaceIndex;
-		resolvedSdImpl->parameters_.port_ = ntohs(port);
-		resolvedSdImpl->parameters_.hostname_ = hosttarget;
-		resolvedSdImpl->parameters_.fullname_ = fullname;
-
-		if (TXTRecordContainsKey(txtLen, txtRecord, kNdnDnsServiceTxtPrefixKey.c_str()))
+		NdnSd::AdvertiseParameters txtParameters;
+		if (helpers::decodeTxtRecord(txtLen, txtRecord, txtParameters))
 		{
-			uint8_t prefixLen = 0;
-			auto prefixData = TXTRecordGetValuePtr(txtLen, txtRecord, kNdnDnsServiceTxtPrefixKey.c_str(),
-				&prefixLen);
-
-			resolvedSdImpl->state_ = ServiceState::Resolved;
-			resolvedSdImpl->parameters_.prefix_ = string((const char*)prefixData, prefixLen);
-
-			if (TXTRecordContainsKey(txtLen, txtRecord, kNdnDnsServiceTxtCertificateKey.c_str()))
+			rr->fullname_ = fullname;
+			rr->hostname_ = hosttarget;
+			rr->port_ = ntohs(port);
+			rr->txt_ = string((const char*)txtRecord, txtLen);
+			rr->interfaceIdx_ = interfaceIndex;
+
+			// service is announced resolved once its host has addresses
+			pimpl->releaseResolveRef(rr);
+			if (!pimpl->startAddrInfo(request))
 			{
-				uint8_t certLen = 0;
-				auto certData = TXTRecordGetValuePtr(txtLen, txtRecord, kNdnDnsServiceTxtCertificateKey.c_str(),
-					&certLen);
-
-				resolvedSdImpl->parameters_.cert_ = string((const char*)certData, certLen);
+				pimpl->onResolveFailed(request, kDNSServiceErr_Unknown);
+				pimpl->pumpResolves();
 			}
-
-			rr->onAnnouncement_(rr->id_, Announcement::Resolved, rr->sd_, rr->userData_);
-			rr->pimpl_->removeRequest(rr->pimpl_->rrequests_[rr->id_]);
-			rr->pimpl_->rrequests_.erase(rr->id_);
 		}
 		else
 		{
+			// retrying won't help: record is malformed, not missing
+			pimpl->stopResolve(rr);
+			pimpl->resolveStats_.failed_++;
+			pimpl->releaseResolve(rr->id_);
+
 			try
 			{
 				rr->onError_(rr->id_, -1, "prefix data was not found in resolved service TXT record",
@@ -715,19 +1597,66 @@ void NdnSd::Impl::resolveReply(
 			{
 				cerr << "caught exception while calling user callback: " << e.what() << endl;
 			}
+
+			pimpl->pumpResolves();
 		}
 
 	}
 	else
 	{
-		try
-		{
-			rr->onError_(rr->id_, errorCode, dnsSdErrorMessage(errorCode), true, rr->userData_);
-		}
-		catch (runtime_error& e)
-		{
-			cerr << "caught exception while calling user callback: " << e.what() << endl;
-		}
+		// retried or reported, depending on attempts left
+		pimpl->onResolveFailed(request, errorCode);
+		pimpl->pumpResolves();
+	}
+}
+
+void NdnSd::Impl::addrInfoReply(
+	DNSServiceRef                       sdRef,
+	DNSServiceFlags                     flags,
+	uint32_t                            interfaceIndex,
+	DNSServiceErrorType                 errorCode,
+	const char* hostname,
+	const struct sockaddr* address,
+	uint32_t                            ttl,
+	void* context)
+{
+	auto request = resolveRequests().get(helpers::RequestSlab<ResolveRequest>::fromContext(context));
+
+	if (!request)
+	{
+		cerr << "DNSServiceRef has no ResolveRequest owner" << endl;
+		return;
+	}
+
+	auto pimpl = request->pimpl_;
+
+	if (errorCode == kDNSServiceErr_NoError)
+	{
+		string a = formatAddress(address, interfaceIndex);
+		if ((flags & kDNSServiceFlagsAdd) && a.size() &&
+			find(request->addresses_.begin(), request->addresses_.end(), a) == request->addresses_.end())
+			request->addresses_.push_back(a);
+	}
+	else if (errorCode == kDNSServiceErr_NoSuchRecord)
+		request->nNoAddress_++;
+	else
+	{
+		pimpl->onResolveFailed(request, errorCode);
+		pimpl->pumpResolves();
+		return;
+	}
+
+	if (flags & kDNSServiceFlagsMoreComing)
+		return;
+
+	// the other address family may come later, but the first batch is 
+	// enough to connect
+	if (request->addresses_.size())
+		pimpl->completeResolve(request);
+	else if (request->nNoAddress_ >= 2)
+	{
+		pimpl->onResolveFailed(request, kDNSServiceErr_NoSuchRecord);
+		pimpl->pumpResolves();
 	}
 }
 
@@ -756,7 +1685,7 @@ void NdnSd::Impl::registerReply(
 		try 
 		{
 			pimpl->state_ = ServiceState::Registered;
-			pimpl->parameters_.domain_ = domain;
+			pimpl->parameters_.domain_ = helpers::InternedString(domain);
 			pimpl->onRegistered_(pimpl->parameters_.userData_);
 		}
 		catch (std::runtime_error& e)
@@ -850,7 +1779,31 @@ string ndnsd::dnsSdErrorMessage(DNSServiceErrorType errorCode)
 	return "unknown error code";
 }
 
-bool ndnsd::isMaxTxtSizeExceeded(size_t sz)
+string ndnsd::formatAddress(const struct sockaddr* address, uint32_t interfaceIndex)
 {
-	return (sz + 4 > MAX_TXT_RECORD_SIZE);
+	char buf[INET6_ADDRSTRLEN] = { 0 };
+
+	if (address->sa_family == AF_INET)
+	{
+		auto sin = (const struct sockaddr_in*)address;
+		if (!inet_ntop(AF_INET, (void*)&sin->sin_addr, buf, sizeof(buf)))
+			return "";
+		return buf;
+	}
+
+	if (address->sa_family == AF_INET6)
+	{
+		auto sin6 = (const struct sockaddr_in6*)address;
+		if (!inet_ntop(AF_INET6, (void*)&sin6->sin6_addr, buf, sizeof(buf)))
+			return "";
+
+		string a = buf;
+		// link-local address is unusable without interface
+		if (IN6_IS_ADDR_LINKLOCAL(&sin6->sin6_addr))
+			a += "%" + to_string(sin6->sin6_scope_id ? sin6->sin6_scope_id : interfaceIndex);
+
+		return a;
+	}
+
+	return "";
 }
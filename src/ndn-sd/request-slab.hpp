@@ -0,0 +1,169 @@
+#ifndef __request_slab_hpp__
+#define __request_slab_hpp__
+
+#include <memory>
+#include <stdint.h>
+#include <utility>
+#include <vector>
+
+#include "ndn-sd.hpp"
+
+namespace ndnsd
+{
+namespace helpers
+{
+    /**
+    * Slots for DNS-SD requests, addressed by generational handles: slot
+    * index in the low 32 bits, slot generation above it. Generation changes
+    * every time a slot is released, so a handle of a finished request (kept
+    * by a timer or passed to DNS-SD as callback context) never resolves to
+    * a request that reused its slot.
+    * Released slots keep their request object, reset, and hand it out again,
+    * unless someone still holds it. Allocation is O(1) and steady request
+    * churn doesn't allocate.
+    * Not thread-safe, same as RunLoop.
+    */
+    template<typename T>
+    class RequestSlab {
+    public:
+        typedef RequestId Handle;
+
+        // returns handle of a free slot and its request, in default state
+        std::pair<Handle, std::shared_ptr<T>> acquire()
+        {
+            uint32_t idx;
+            if (free_.size())
+            {
+                idx = free_.back();
+                free_.pop_back();
+            }
+            else
+            {
+                idx = (uint32_t)slots_.size();
+                slots_.emplace_back();
+            }
+
+            Slot& s = slots_[idx];
+            if (!s.request_)
+                s.request_ = std::make_shared<T>();
+            s.used_ = true;
+            size_++;
+
+            return { makeHandle(idx, s.generation_), s.request_ };
+        }
+
+        // returns nullptr for stale or invalid handles
+        std::shared_ptr<T> get(Handle h) const
+        {
+            const Slot* s = find(h);
+            return (s ? s->request_ : nullptr);
+        }
+
+        // returns false if handle is stale or invalid
+        bool release(Handle h)
+        {
+            Slot* s = const_cast<Slot*>(find(h));
+            if (!s)
+                return false;
+
+            uint32_t idx = index(h);
+            std::shared_ptr<T> request;
+            request.swap(s->request_);
+            s->used_ = false;
+            s->generation_ = nextGeneration(s->generation_);
+            size_--;
+
+            if (request.use_count() == 1)
+            {
+                // released request may hold last references to objects that 
+                // cancel other requests when destroyed, so it is destroyed 
+                // once the slab is consistent again
+                T released = std::move(*request);
+                *request = T();
+                slots_[idx].request_ = request;
+            }
+            free_.push_back(idx);
+
+            return true;
+        }
+
+        // iterates over requests in use
+        template<typename F>
+        void forEach(F&& f) const
+        {
+            for (uint32_t i = 0; i < slots_.size(); ++i)
+                if (slots_[i].used_)
+                    f(makeHandle(i, slots_[i].generation_), slots_[i].request_);
+        }
+
+        size_t size() const { return size_; }
+
+        // DNS-SD callback context. on 32-bit platforms handles are packed
+        // into 20 bits of index and 12 bits of generation
+        static void* toContext(Handle h)
+        {
+            uint64_t v = (uint64_t)h;
+            if (sizeof(uintptr_t) < sizeof(uint64_t))
+                v = (v & kContextIndexMask) | ((v >> 32) << kContextIndexBits);
+
+            return reinterpret_cast<void*>(static_cast<uintptr_t>(v));
+        }
+
+        static Handle fromContext(void* context)
+        {
+            uint64_t v = reinterpret_cast<uintptr_t>(context);
+            if (sizeof(uintptr_t) < sizeof(uint64_t))
+                v = (v & kContextIndexMask) | ((v >> kContextIndexBits) << 32);
+
+            return (Handle)v;
+        }
+
+    private:
+        static const int kContextIndexBits = 20;
+        static const uint64_t kContextIndexMask = (1ull << kContextIndexBits) - 1;
+
+        typedef struct _Slot {
+            // starts from 1, so that valid handles are never 0 or negative
+            uint32_t generation_ = 1;
+            bool used_ = false;
+            std::shared_ptr<T> request_;
+        } Slot;
+
+        std::vector<Slot> slots_;
+        std::vector<uint32_t> free_;
+        size_t size_ = 0;
+
+        static Handle makeHandle(uint32_t idx, uint32_t generation)
+        {
+            return (Handle)(((uint64_t)generation << 32) | idx);
+        }
+
+        static uint32_t index(Handle h) { return (uint32_t)((uint64_t)h & 0xffffffff); }
+
+        static uint32_t nextGeneration(uint32_t generation)
+        {
+            // keeps handles positive and, on 32-bit platforms, fitting into
+            // callback context
+            uint32_t mask = (sizeof(uintptr_t) < sizeof(uint64_t) ?
+                (1u << (32 - kContextIndexBits)) - 1 : 0x7fffffff);
+            uint32_t next = (generation + 1) & mask;
+
+            return (next ? next : 1);
+        }
+
+        const Slot* find(Handle h) const
+        {
+            if (h <= 0 || index(h) >= slots_.size())
+                return nullptr;
+
+            const Slot& s = slots_[index(h)];
+            if (!s.used_ || s.generation_ != (uint32_t)((uint64_t)h >> 32))
+                return nullptr;
+
+            return &s;
+        }
+    };
+}
+}
+
+#endif
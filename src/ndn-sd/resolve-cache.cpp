@@ -0,0 +1,279 @@
+
+#include "resolve-cache.hpp"
+
+#include <algorithm>
+#include <iostream>
+
+// TTL of SRV records: the hostname and port are only as fresh as those
+#define DEFAULT_MAX_TTL_SEC 120
+// expired entries keep their TXT queries running till swept
+#define SWEEP_INTERVAL_MS 10000
+
+using namespace std;
+using ndnsd::helpers::ResolveCache;
+using ndnsd::helpers::RunLoop;
+
+ResolveCache& ResolveCache::getSharedInstance()
+{
+	// never destroyed, see RunLoop::getSharedInstance()
+	static ResolveCache* instance = new ResolveCache();
+	return *instance;
+}
+
+ResolveCache::ResolveCache()
+	: maxTtlSec_(DEFAULT_MAX_TTL_SEC)
+	, sweepTimerId_(0)
+{
+}
+
+vector<string> ResolveCache::Entry::getAddresses(uint32_t interfaceIdx) const
+{
+	auto it = addresses_.find(interfaceIdx);
+	if (it != addresses_.end())
+		return it->second;
+
+	// IPv4 first is kept, as all lists are ordered so
+	vector<string> addresses;
+	for (auto& a : addresses_)
+		for (auto& address : a.second)
+			if (address.find('%') == string::npos &&
+				find(addresses.begin(), addresses.end(), address) == addresses.end())
+				addresses.push_back(address);
+
+	stable_partition(addresses.begin(), addresses.end(),
+		[](const string& address) { return address.find(':') == string::npos; });
+	return addresses;
+}
+
+shared_ptr<const ResolveCache::Entry> ResolveCache::lookup(const string& fullname, 
+	uint32_t interfaceIdx)
+{
+	auto it = entries_.find(fullname);
+	if (it != entries_.end() && it->second->expires_ <= RunLoop::Clock::now())
+	{
+		invalidate(fullname);
+		it = entries_.end();
+	}
+
+	// link-local host is looked up on this interface
+	bool usable = (it != entries_.end() && 
+		(it->second->addresses_.empty() || it->second->getAddresses(interfaceIdx).size()));
+
+	if (!usable)
+	{
+		stats_.misses_++;
+		return nullptr;
+	}
+
+	stats_.hits_++;
+	return it->second;
+}
+
+void ResolveCache::store(const string& fullname, uint32_t interfaceIdx,
+	const string& hostname, uint16_t port, const string& txt,
+	const vector<string>& addresses, const shared_ptr<NdnSd>& sd)
+{
+	if (!maxTtlSec_)
+		return;
+
+	auto& e = entries_[fullname];
+	if (!e)
+	{
+		e = make_shared<Entry>();
+		e->fullname_ = fullname;
+	}
+
+	if (e->hostname_ != hostname)
+		e->addresses_.clear();
+
+	e->hostname_ = hostname;
+	e->port_ = port;
+	e->txt_ = txt;
+	e->addresses_[interfaceIdx] = addresses;
+	// until TXT query reports actual TTL
+	e->expires_ = RunLoop::Clock::now() + chrono::seconds(maxTtlSec_);
+	addService(fullname, sd);
+	scheduleSweep();
+
+	if (!e->monitorRef_)
+	{
+		DNSServiceRef ref = RunLoop::getSharedInstance().getSharedConnection();
+		DNSServiceFlags flags = (ref ? kDNSServiceFlagsShareConnection : 0);
+
+		auto err = RunLoop::getSharedInstance().getBackend().queryRecord(&ref, flags | kDNSServiceFlagsLongLivedQuery,
+			interfaceIdx, fullname.c_str(), kDNSServiceType_TXT, kDNSServiceClass_IN,
+			&ResolveCache::queryRecordReply, e.get());
+
+		if (err == kDNSServiceErr_NoError)
+		{
+			e->monitorRef_ = ref;
+			e->monitorShared_ = (flags != 0);
+			if (!e->monitorShared_)
+				RunLoop::getSharedInstance().add(ref);
+		}
+		else
+		{
+			// can't learn about updates, so don't keep it longer than TTL cap
+			cerr << "failed to monitor TXT record of " << fullname << ": " << err << endl;
+		}
+	}
+}
+
+void ResolveCache::addService(const string& fullname, const shared_ptr<NdnSd>& sd)
+{
+	auto it = entries_.find(fullname);
+	if (it == entries_.end() || !sd)
+		return;
+
+	// services destroyed since are dropped here
+	auto& services = it->second->services_;
+	services.erase(remove_if(services.begin(), services.end(), 
+		[&sd](const weak_ptr<NdnSd>& s) { return s.expired() || s.lock() == sd; }),
+		services.end());
+	services.push_back(sd);
+}
+
+void ResolveCache::invalidate(const string& fullname)
+{
+	auto it = entries_.find(fullname);
+	if (it != entries_.end())
+	{
+		stopMonitor(*it->second);
+		entries_.erase(it);
+		stats_.invalidations_++;
+	}
+}
+
+void ResolveCache::invalidateMonitor(DNSServiceRef monitorRef)
+{
+	for (auto& it : entries_)
+		if (it.second->monitorRef_ == monitorRef)
+		{
+			invalidate(it.first);
+			return;
+		}
+}
+
+void ResolveCache::clear()
+{
+	for (auto& it : entries_)
+		stopMonitor(*it.second);
+	entries_.clear();
+
+	if (sweepTimerId_)
+	{
+		RunLoop::getSharedInstance().cancelTimer(sweepTimerId_);
+		sweepTimerId_ = 0;
+	}
+}
+
+void ResolveCache::setMaxTtl(uint32_t maxTtlSec)
+{
+	maxTtlSec_ = maxTtlSec;
+	if (!maxTtlSec_)
+		clear();
+}
+
+ResolveCache::Stats ResolveCache::getStats() const
+{
+	Stats stats = stats_;
+	stats.size_ = entries_.size();
+
+	return stats;
+}
+
+void ResolveCache::stopMonitor(Entry& e)
+{
+	if (e.monitorRef_)
+	{
+		if (!e.monitorShared_)
+			RunLoop::getSharedInstance().remove(e.monitorRef_);
+		RunLoop::getSharedInstance().getBackend().deallocate(e.monitorRef_);
+		e.monitorRef_ = nullptr;
+	}
+}
+
+void ResolveCache::scheduleSweep()
+{
+	if (sweepTimerId_ || entries_.empty())
+		return;
+
+	sweepTimerId_ = RunLoop::getSharedInstance().addTimer(SWEEP_INTERVAL_MS, []()
+	{
+		ResolveCache& cache = getSharedInstance();
+		cache.sweepTimerId_ = 0;
+		cache.sweep();
+		cache.scheduleSweep();
+	});
+}
+
+void ResolveCache::sweep()
+{
+	auto now = RunLoop::Clock::now();
+	vector<string> expired;
+
+	for (auto& it : entries_)
+		if (it.second->expires_ <= now)
+			expired.push_back(it.first);
+
+	for (auto& fullname : expired)
+		invalidate(fullname);
+}
+
+void ResolveCache::queryRecordReply(
+	DNSServiceRef                       sdRef,
+	DNSServiceFlags                     flags,
+	uint32_t                            interfaceIndex,
+	DNSServiceErrorType                 errorCode,
+	const char* fullname,
+	uint16_t                            rrtype,
+	uint16_t                            rrclass,
+	uint16_t                            rdlen,
+	const void* rdata,
+	uint32_t                            ttl,
+	void* context)
+{
+	Entry* e = static_cast<Entry*>(context);
+	ResolveCache& cache = getSharedInstance();
+
+	if (!e)
+	{
+		cerr << "DNSServiceRef has no resolve cache entry owner" << endl;
+		return;
+	}
+
+	string txt((const char*)rdata, rdlen);
+
+	// when record is updated, the new one is added and the old one is 
+	// flushed after it: removal of a record other than the current one 
+	// is not a removal of the service
+	if (errorCode == kDNSServiceErr_NoError && !(flags & kDNSServiceFlagsAdd) &&
+		txt.size() && txt != e->txt_)
+		return;
+
+	if (errorCode != kDNSServiceErr_NoError || !(flags & kDNSServiceFlagsAdd) || ttl == 0)
+	{
+		// record is gone (or can't be monitored anymore). copy the name, 
+		// entry is destroyed by invalidate
+		string name = e->fullname_;
+		cache.invalidate(name);
+		return;
+	}
+
+	e->expires_ = RunLoop::Clock::now() +
+		chrono::seconds(min(ttl, cache.maxTtlSec_));
+
+	if (txt != e->txt_)
+	{
+		e->txt_ = move(txt);
+
+		// entry stays alive while services are told, even if they
+		// invalidate it
+		auto it = cache.entries_.find(e->fullname_);
+		if (it != cache.entries_.end() && cache.onUpdated_)
+		{
+			shared_ptr<Entry> entry = it->second;
+			cache.onUpdated_(*entry);
+		}
+	}
+}
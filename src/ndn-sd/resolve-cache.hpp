@@ -0,0 +1,124 @@
+#ifndef __resolve_cache_hpp__
+#define __resolve_cache_hpp__
+
+#include <functional>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+#include <stdint.h>
+
+#include "run-loop.hpp"
+
+namespace ndnsd
+{
+    class NdnSd;
+
+namespace helpers
+{
+    /**
+    * Process-wide cache of resolve results, keyed by service fullname.
+    * Lets a service seen on several interfaces, or one that flapped
+    * (Removed, then Added again), be resolved without asking the daemon.
+    * Every entry is monitored with a long-lived TXT record query: record
+    * updates refresh the entry and its TTL and are passed on to services
+    * resolved from it, record removal invalidates it.
+    * Entries also expire after min(TTL, max TTL), even if no update came,
+    * and expired ones are swept from a RunLoop timer. SRV record (host and
+    * port) is not monitored: its changes are seen once the entry expires.
+    * Addresses are kept per interface they were resolved on: link-local
+    * ones are scoped to it.
+    * Not thread-safe, same as RunLoop.
+    */
+    class ResolveCache {
+    public:
+        typedef struct _Entry {
+            std::string hostname_;
+            // host byte order
+            uint16_t port_;
+            std::string txt_;
+            // numeric addresses of hostname_ by interface they were 
+            // resolved on, IPv4 first
+            std::map<uint32_t, std::vector<std::string>> addresses_;
+            RunLoop::Clock::time_point expires_;
+
+            // resolved services (of all NdnSd instances) to be told about
+            // TXT record updates
+            std::vector<std::weak_ptr<NdnSd>> services_;
+
+            // the rest is internal: TXT query keeping entry up to date
+            DNSServiceRef monitorRef_ = nullptr;
+            bool monitorShared_ = false;
+            std::string fullname_;
+
+            // addresses usable on the interface: scoped ones resolved on
+            // another interface are left out
+            std::vector<std::string> getAddresses(uint32_t interfaceIdx) const;
+        } Entry;
+
+        // called when TXT record of an entry changes
+        typedef std::function<void(const Entry&)> OnUpdated;
+
+        typedef struct _Stats {
+            uint64_t hits_ = 0;
+            uint64_t misses_ = 0;
+            uint64_t invalidations_ = 0;
+            size_t size_ = 0;
+        } Stats;
+
+        static ResolveCache& getSharedInstance();
+
+        // returns nullptr if there is no entry, it has expired, or its 
+        // addresses are all scoped to other interfaces
+        std::shared_ptr<const Entry> lookup(const std::string& fullname, uint32_t interfaceIdx);
+        // stores resolve result of service sd and starts monitoring its TXT
+        // record
+        void store(const std::string& fullname, uint32_t interfaceIdx,
+            const std::string& hostname, uint16_t port, const std::string& txt,
+            const std::vector<std::string>& addresses, const std::shared_ptr<NdnSd>& sd);
+        // adds service resolved from a looked up entry
+        void addService(const std::string& fullname, const std::shared_ptr<NdnSd>& sd);
+        void setOnUpdated(OnUpdated onUpdated) { onUpdated_ = onUpdated; }
+        void invalidate(const std::string& fullname);
+        // TXT query of an entry failed on its own connection
+        void invalidateMonitor(DNSServiceRef monitorRef);
+        void clear();
+
+        // 0 disables caching (and drops all entries)
+        void setMaxTtl(uint32_t maxTtlSec);
+        Stats getStats() const;
+
+    private:
+        std::map<std::string, std::shared_ptr<Entry>> entries_;
+        uint32_t maxTtlSec_;
+        Stats stats_;
+        OnUpdated onUpdated_;
+        // 0 if no sweep is scheduled
+        int sweepTimerId_;
+
+        ResolveCache();
+        ResolveCache(const ResolveCache&) = delete;
+        ResolveCache& operator=(const ResolveCache&) = delete;
+
+        void stopMonitor(Entry& e);
+        void scheduleSweep();
+        // invalidates expired entries
+        void sweep();
+
+        static void queryRecordReply(
+            DNSServiceRef                       sdRef,
+            DNSServiceFlags                     flags,
+            uint32_t                            interfaceIndex,
+            DNSServiceErrorType                 errorCode,
+            const char* fullname,
+            uint16_t                            rrtype,
+            uint16_t                            rrclass,
+            uint16_t                            rdlen,
+            const void* rdata,
+            uint32_t                            ttl,
+            void* context);
+    };
+}
+}
+
+#endif
@@ -0,0 +1,466 @@
+
+#include "run-loop.hpp"
+
+#include <cerrno>
+#include <cstring>
+#include <iostream>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+#ifdef _WIN32
+#include <winsock2.h>
+#else
+#include <sys/select.h>
+#include <sys/time.h>
+#include <unistd.h>
+#endif
+
+#ifdef HAVE_SYS_EPOLL_H
+#include <sys/epoll.h>
+#define MAX_EPOLL_EVENTS 64
+#endif
+
+using namespace std;
+using ndnsd::helpers::RunLoop;
+using ndnsd::helpers::Backend;
+using ndnsd::helpers::getDnsSdBackend;
+
+RunLoop& RunLoop::getSharedInstance()
+{
+	// never destroyed: NdnSd instances with static storage duration may
+	// still remove their refs during static destruction
+	static RunLoop* instance = new RunLoop();
+	return *instance;
+}
+
+RunLoop::RunLoop()
+	: epoch_(0)
+	, nDispatched_(0)
+	, lastTimerId_(0)
+	, shareConnection_(true)
+	, sharedConnectionFailed_(false)
+	, sharedConnection_(nullptr)
+	, backend_(&getDnsSdBackend())
+#ifdef HAVE_SYS_EPOLL_H
+	, epollFd_(-1)
+#endif
+{
+}
+
+RunLoop::~RunLoop()
+{
+#ifdef HAVE_SYS_EPOLL_H
+	if (epollFd_ >= 0)
+		close(epollFd_);
+#endif
+}
+
+DNSServiceRef RunLoop::getSharedConnection()
+{
+	if (!shareConnection_ || sharedConnectionFailed_)
+		return nullptr;
+
+	if (!sharedConnection_)
+	{
+		auto err = backend_->createConnection(&sharedConnection_);
+		if (err != kDNSServiceErr_NoError)
+		{
+			cerr << "shared DNS-SD connection is not available (" << err
+				<< "), using connection per request" << endl;
+			sharedConnection_ = nullptr;
+			sharedConnectionFailed_ = true;
+			return nullptr;
+		}
+
+		add(sharedConnection_);
+	}
+
+	return sharedConnection_;
+}
+
+bool RunLoop::setBackend(Backend& backend)
+{
+	if (&backend == backend_)
+		return true;
+
+	if (backend_->size() > (sharedConnection_ ? 1u : 0u))
+		return false;
+
+	if (sharedConnection_)
+	{
+		remove(sharedConnection_);
+		backend_->deallocate(sharedConnection_);
+		sharedConnection_ = nullptr;
+	}
+
+	backend_ = &backend;
+	sharedConnectionFailed_ = false;
+
+	return true;
+}
+
+// milliseconds till t, rounded up
+static uint32_t msUntil(RunLoop::Clock::time_point t)
+{
+	auto now = RunLoop::Clock::now();
+	if (t <= now)
+		return 0;
+
+	return (uint32_t)chrono::ceil<chrono::milliseconds>(t - now).count();
+}
+
+int RunLoop::run(uint32_t timeoutMs)
+{
+	auto deadline = Clock::now() + chrono::milliseconds(timeoutMs);
+	int err = 0;
+
+	do
+	{
+		fireTimers();
+
+		uint32_t waitMs = timeoutMs;
+		if (timeoutMs)
+		{
+			waitMs = msUntil(deadline);
+			if (!waitMs)
+				break;
+		}
+		if (!timers_.empty())
+		{
+			// wake up in time for the next timer
+			uint32_t timerMs = max(msUntil(timers_.begin()->first.first), 1u);
+			waitMs = (waitMs ? min(waitMs, timerMs) : timerMs);
+		}
+
+		uint64_t nDispatched = nDispatched_;
+		err = wait(waitMs);
+
+		if (err || (timeoutMs && nDispatched_ != nDispatched))
+			break;
+	} while (timeoutMs || !timers_.empty() || size());
+
+	fireTimers();
+
+	return err;
+}
+
+int RunLoop::wait(uint32_t timeoutMs)
+{
+#ifdef HAVE_SYS_EPOLL_H
+	return runEpoll(timeoutMs);
+#else
+	return runSelect(timeoutMs);
+#endif
+}
+
+int RunLoop::addTimer(uint32_t delayMs, TimerCallback cb)
+{
+	int id = ++lastTimerId_;
+	auto t = Clock::now() + chrono::milliseconds(delayMs);
+
+	timers_[{ t, id }] = cb;
+	timerDeadlines_[id] = t;
+
+	return id;
+}
+
+void RunLoop::cancelTimer(int timerId)
+{
+	auto it = timerDeadlines_.find(timerId);
+	if (it != timerDeadlines_.end())
+	{
+		timers_.erase({ it->second, timerId });
+		timerDeadlines_.erase(it);
+	}
+}
+
+void RunLoop::fireTimers()
+{
+	auto now = Clock::now();
+	vector<int> due;
+
+	// collect first: callbacks may add or cancel timers
+	for (auto& t : timers_)
+	{
+		if (t.first.first > now)
+			break;
+		due.push_back(t.first.second);
+	}
+
+	for (auto id : due)
+	{
+		auto it = timerDeadlines_.find(id);
+		if (it == timerDeadlines_.end())
+			continue; // cancelled by one of the previous callbacks
+
+		auto tit = timers_.find({ it->second, id });
+		TimerCallback cb = tit->second;
+		timers_.erase(tit);
+		timerDeadlines_.erase(it);
+
+		try
+		{
+			cb();
+		}
+		catch (runtime_error& e)
+		{
+			cerr << "caught exception while calling timer callback: " << e.what() << endl;
+		}
+	}
+}
+
+void RunLoop::add(DNSServiceRef ref)
+{
+	int fd = backend_->sockFd(ref);
+	uint32_t epoch = ++epoch_;
+
+	fdServiceRefMap_[fd] = { ref, epoch };
+	// watched descriptor was closed and its number reused by DNS-SD
+	watches_.erase(fd);
+
+#ifdef HAVE_SYS_EPOLL_H
+	epollAdd(fd, epoch);
+#endif
+}
+
+bool RunLoop::addWatch(int fd, WatchCallback cb)
+{
+	if (fdServiceRefMap_.count(fd))
+		return false;
+
+	uint32_t epoch = ++epoch_;
+	watches_[fd] = { cb, epoch };
+
+#ifdef HAVE_SYS_EPOLL_H
+	epollAdd(fd, epoch);
+#endif
+
+	return true;
+}
+
+void RunLoop::removeWatch(int fd)
+{
+	auto it = watches_.find(fd);
+	if (it != watches_.end())
+	{
+#ifdef HAVE_SYS_EPOLL_H
+		// fails if descriptor is closed already, which removed it from epoll
+		if (epollFd_ >= 0)
+			epoll_ctl(epollFd_, EPOLL_CTL_DEL, fd, nullptr);
+#endif
+		watches_.erase(it);
+	}
+}
+
+#ifdef HAVE_SYS_EPOLL_H
+void RunLoop::epollAdd(int fd, uint32_t epoch)
+{
+	if (epollFd_ < 0)
+		epollFd_ = epoll_create1(EPOLL_CLOEXEC);
+
+	if (epollFd_ < 0)
+	{
+		cerr << "failed to create epoll instance: " << errno << " - " << strerror(errno) << endl;
+		return;
+	}
+
+	struct epoll_event ev;
+	memset(&ev, 0, sizeof(ev));
+	ev.events = EPOLLIN;
+	ev.data.u64 = ((uint64_t)epoch << 32) | (uint32_t)fd;
+
+	if (epoll_ctl(epollFd_, EPOLL_CTL_ADD, fd, &ev) < 0 &&
+		(errno != EEXIST || epoll_ctl(epollFd_, EPOLL_CTL_MOD, fd, &ev) < 0))
+	{
+		cerr << "failed to add descriptor " << fd << " to epoll: " << errno << " - " << strerror(errno) << endl;
+	}
+}
+#endif
+
+void RunLoop::remove(DNSServiceRef ref)
+{
+	auto it = fdServiceRefMap_.find(backend_->sockFd(ref));
+	if (it != fdServiceRefMap_.end() && it->second.ref_ == ref)
+	{
+#ifdef HAVE_SYS_EPOLL_H
+		// must happen before the ref is deallocated and the descriptor is closed
+		if (epollFd_ >= 0)
+			epoll_ctl(epollFd_, EPOLL_CTL_DEL, it->first, nullptr);
+#endif
+		fdServiceRefMap_.erase(it);
+	}
+}
+
+void RunLoop::onProcessResultError(DNSServiceRef ref)
+{
+	remove(ref);
+
+	if (ref == sharedConnection_)
+	{
+		// connection to the daemon is lost; new requests will get a new 
+		// connection. without a callback it's not deallocated, as this would
+		// invalidate subordinate refs still held by their requests
+		sharedConnection_ = nullptr;
+
+		if (onConnectionLost_)
+		{
+			onConnectionLost_(ref, true);
+			backend_->deallocate(ref);
+		}
+	}
+	else if (onConnectionLost_)
+		onConnectionLost_(ref, false);
+}
+
+bool RunLoop::dispatch(int fd, uint32_t epoch, int& lastErr)
+{
+	auto it = fdServiceRefMap_.find(fd);
+	if (it != fdServiceRefMap_.end() && it->second.epoch_ == epoch)
+	{
+		// callbacks may add or remove refs, invalidating it
+		DNSServiceRef ref = it->second.ref_;
+		auto err = backend_->processResult(ref);
+		++nDispatched_;
+		if (err)
+		{
+			// one broken connection should not stall everyone else
+			cerr << "process result error: " << err << endl;
+			onProcessResultError(ref);
+			lastErr = err;
+		}
+		return true;
+	}
+
+	auto wit = watches_.find(fd);
+	if (wit != watches_.end() && wit->second.epoch_ == epoch)
+	{
+		// callback may remove the watch
+		WatchCallback cb = wit->second.cb_;
+		++nDispatched_;
+		try
+		{
+			cb();
+		}
+		catch (runtime_error& e)
+		{
+			cerr << "caught exception while calling watch callback: " << e.what() << endl;
+		}
+		return true;
+	}
+
+	return false;
+}
+
+int RunLoop::runSelect(uint32_t timeoutMs)
+{
+	bool run = true;
+	int lastErr = 0;
+
+	while (run)
+	{
+        int maxFd = 0;
+		fd_set readfds;
+		FD_ZERO(&readfds);
+
+		// descriptors and their epochs: maps can be modified from within 
+		// the dispatch loop (by DNSServiceProcessResult and watch callbacks)
+		vector<pair<int, uint32_t>> fds;
+		for (auto& it : fdServiceRefMap_)
+			fds.push_back({ it.first, it.second.epoch_ });
+		for (auto& it : watches_)
+			fds.push_back({ it.first, it.second.epoch_ });
+
+		for (auto& it : fds)
+        {
+			if (it.first >= FD_SETSIZE)
+			{
+				cerr << "descriptor " << it.first << " exceeds FD_SETSIZE, can't select" << endl;
+				return EINVAL;
+			}
+
+            maxFd = max(maxFd, it.first);
+			FD_SET(it.first, &readfds);
+        }
+		struct timeval tv;
+		tv.tv_sec = timeoutMs / 1000;
+		tv.tv_usec = (timeoutMs - (timeoutMs / 1000) * 1000) * 1000;
+
+		int res = select(maxFd+1, &readfds, (fd_set*)nullptr, (fd_set*)nullptr, (timeoutMs ? &tv : 0));
+		if (res > 0)
+		{
+			for (auto& it : fds)
+				if (FD_ISSET(it.first, &readfds))
+					dispatch(it.first, it.second, lastErr);
+
+			// keep running if timeout is not set, unless timers need attention
+			run = (timeoutMs == 0 && !lastErr && timers_.empty());
+		}
+		else
+		{
+			if (res < 0)
+			{
+				cerr << "select returned (" << res << ") error: " << errno << " - " << strerror(errno) << endl;
+				return errno;
+			}
+
+			// timeout reached, stop
+			run = false;
+		}
+	}
+
+	return lastErr;
+}
+
+#ifdef HAVE_SYS_EPOLL_H
+int RunLoop::runEpoll(uint32_t timeoutMs)
+{
+	if (epollFd_ < 0)
+	{
+		// nothing has been added yet
+		if (timeoutMs)
+			this_thread::sleep_for(chrono::milliseconds(timeoutMs));
+		return 0;
+	}
+
+	bool run = true;
+	int lastErr = 0;
+	struct epoll_event events[MAX_EPOLL_EVENTS];
+
+	while (run)
+	{
+		int res = epoll_wait(epollFd_, events, MAX_EPOLL_EVENTS, (timeoutMs ? (int)timeoutMs : -1));
+		if (res > 0)
+		{
+			for (int i = 0; i < res; ++i)
+			{
+				int fd = (int)(events[i].data.u64 & 0xffffffff);
+				uint32_t epoch = (uint32_t)(events[i].data.u64 >> 32);
+
+				// descriptor may have been removed (or removed and re-added) by 
+				// callbacks invoked earlier in this loop
+				dispatch(fd, epoch, lastErr);
+			}
+
+			// keep running if timeout is not set, unless timers need attention
+			run = (timeoutMs == 0 && !lastErr && timers_.empty());
+		}
+		else
+		{
+			if (res < 0)
+			{
+				if (errno == EINTR)
+					continue;
+
+				cerr << "epoll_wait returned (" << res << ") error: " << errno << " - " << strerror(errno) << endl;
+				return errno;
+			}
+
+			// timeout reached, stop
+			run = false;
+		}
+	}
+
+	return lastErr;
+}
+#endif
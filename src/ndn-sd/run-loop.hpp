@@ -0,0 +1,134 @@
+#ifndef __run_loop_hpp__
+#define __run_loop_hpp__
+
+#include <chrono>
+#include <cstddef>
+#include <functional>
+#include <map>
+#include <stdint.h>
+
+#include "backend.hpp"
+#include "config.hpp"
+#include "dns_sd.h"
+
+namespace ndnsd
+{
+namespace helpers
+{
+    /**
+    * Process-wide reactor for DNS-SD descriptors.
+    * Every NdnSd instance (and every announce, browse and resolve request
+    * it makes) adds its DNSServiceRef here, so that all of them are waited
+    * on at once and only the ready ones are dispatched.
+    * It also owns the daemon connection shared by all requests, when the
+    * daemon supports kDNSServiceFlagsShareConnection.
+    * One-shot timers (used for request deadlines and retries) are fired
+    * from run() as well, and descriptors of other event sources (watches)
+    * can be waited on along with DNS-SD ones.
+    * All DNS-SD calls go through the current Backend, the system daemon by
+    * default.
+    * Not thread-safe: add, remove and run are expected to be called from
+    * the same thread.
+    */
+    class RunLoop {
+    public:
+        typedef std::chrono::steady_clock Clock;
+        typedef std::function<void()> TimerCallback;
+        typedef std::function<void()> WatchCallback;
+        // failed ref is given: the shared connection, deallocated once the
+        // callback returns, or a ref of its own connection, which is left
+        // to its owner
+        typedef std::function<void(DNSServiceRef, bool shared)> ConnectionLostCallback;
+
+        static RunLoop& getSharedInstance();
+
+        void add(DNSServiceRef ref);
+        void remove(DNSServiceRef ref);
+
+        // waits for the timeout or till the first read; runs forever if
+        // timeout is 0. due timers are fired regardless
+        int run(uint32_t timeoutMs = 0);
+
+        // schedules one-shot callback to be fired from run() after delay.
+        // returns timer id
+        int addTimer(uint32_t delayMs, TimerCallback cb);
+        void cancelTimer(int timerId);
+
+        // callback is called from run() when fd is readable and must consume
+        // what is there, or run() keeps waking up. watching fd again re-adds
+        // it (descriptor number may have been reused). returns false if fd
+        // belongs to one of DNS-SD refs
+        bool addWatch(int fd, WatchCallback cb);
+        void removeWatch(int fd);
+
+        size_t size() const { return fdServiceRefMap_.size(); }
+
+        // returns process-wide daemon connection (creating it, if needed) to be 
+        // used with kDNSServiceFlagsShareConnection. returns nullptr if sharing
+        // is disabled or not supported by the daemon (avahi-compat)
+        DNSServiceRef getSharedConnection();
+        void setShareConnection(bool enable) { shareConnection_ = enable; }
+        // called when a connection to the daemon fails and its ref is taken
+        // out of the loop. for the shared one, subordinate refs of it won't
+        // get any more replies, and their owners must deallocate them
+        void setOnConnectionLost(ConnectionLostCallback cb) { onConnectionLost_ = cb; }
+
+        Backend& getBackend() const { return *backend_; }
+        // switches backend if the current one has no refs besides the shared
+        // connection, which is deallocated. returns false otherwise
+        bool setBackend(Backend& backend);
+
+    private:
+        typedef struct _Entry {
+            DNSServiceRef ref_;
+            // incremented every time a descriptor is (re-)added, so that stale
+            // readiness events for a reused descriptor number can be recognized
+            uint32_t epoch_;
+        } Entry;
+
+        typedef struct _Watch {
+            WatchCallback cb_;
+            uint32_t epoch_;
+        } Watch;
+
+        std::map<int, Entry> fdServiceRefMap_;
+        std::map<int, Watch> watches_;
+        uint32_t epoch_;
+        // counts processResult() calls, to tell reads from timeouts
+        uint64_t nDispatched_;
+
+        // timers ordered by deadline; id breaks ties
+        std::map<std::pair<Clock::time_point, int>, TimerCallback> timers_;
+        std::map<int, Clock::time_point> timerDeadlines_;
+        int lastTimerId_;
+        bool shareConnection_, sharedConnectionFailed_;
+        DNSServiceRef sharedConnection_;
+        ConnectionLostCallback onConnectionLost_;
+        Backend* backend_;
+#ifdef HAVE_SYS_EPOLL_H
+        // created lazily, on first add
+        int epollFd_;
+#endif
+
+        RunLoop();
+        ~RunLoop();
+        RunLoop(const RunLoop&) = delete;
+        RunLoop& operator=(const RunLoop&) = delete;
+
+        void onProcessResultError(DNSServiceRef ref);
+        // returns false if fd is neither a DNS-SD nor a watched one (any more)
+        bool dispatch(int fd, uint32_t epoch, int& lastErr);
+#ifdef HAVE_SYS_EPOLL_H
+        void epollAdd(int fd, uint32_t epoch);
+#endif
+        void fireTimers();
+        int wait(uint32_t timeoutMs);
+        int runSelect(uint32_t timeoutMs);
+#ifdef HAVE_SYS_EPOLL_H
+        int runEpoll(uint32_t timeoutMs);
+#endif
+    };
+}
+}
+
+#endif
@@ -0,0 +1,138 @@
+#ifndef __service_registry_hpp__
+#define __service_registry_hpp__
+
+#include <algorithm>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "instance-id.hpp"
+#include "ndn-sd.hpp"
+
+namespace ndnsd
+{
+namespace helpers
+{
+    /**
+    * Hash-indexed registry of discovered services of one NdnSd instance.
+    * Services are keyed by (uuid, interface, protocol) and shared by all
+    * browse requests of the instance: each entry keeps track of the browse
+    * requests (owners) that have seen it and is removed when the last owner
+    * loses it.
+    */
+    class ServiceRegistry {
+    public:
+        typedef struct _Key {
+            InstanceId uuid_;
+            uint32_t interfaceIdx_;
+            Proto protocol_;
+
+            bool operator==(const struct _Key& k) const
+            {
+                return interfaceIdx_ == k.interfaceIdx_ && protocol_ == k.protocol_ &&
+                    uuid_ == k.uuid_;
+            }
+        } Key;
+
+        static Key makeKey(const NdnSd& sd)
+        {
+            return { InstanceId(sd.getUuid()), (uint32_t)sd.getInterface(), sd.getProtocol() };
+        }
+
+        std::shared_ptr<NdnSd> find(const Key& key) const
+        {
+            auto it = entries_.find(key);
+            return (it != entries_.end() ? it->second.sd_ : nullptr);
+        }
+
+        // ids of browse requests that have the service
+        std::vector<RequestId> getOwners(const Key& key) const
+        {
+            auto it = entries_.find(key);
+            return (it != entries_.end() ? it->second.owners_ : std::vector<RequestId>());
+        }
+
+        // adds service (or new owner to an existing service). returns false if
+        // owner already has this service
+        bool add(const Key& key, const std::shared_ptr<NdnSd>& sd, RequestId ownerId)
+        {
+            auto& e = entries_[key];
+            if (!e.sd_)
+                e.sd_ = sd;
+            
+            if (std::find(e.owners_.begin(), e.owners_.end(), ownerId) != e.owners_.end())
+                return false;
+
+            e.owners_.push_back(ownerId);
+            return true;
+        }
+
+        // removes owner of the service. returns service, if owner had it
+        std::shared_ptr<NdnSd> remove(const Key& key, RequestId ownerId)
+        {
+            auto it = entries_.find(key);
+            if (it == entries_.end())
+                return nullptr;
+
+            auto& owners = it->second.owners_;
+            auto ownerIt = std::find(owners.begin(), owners.end(), ownerId);
+            if (ownerIt == owners.end())
+                return nullptr;
+
+            std::shared_ptr<NdnSd> sd = it->second.sd_;
+            owners.erase(ownerIt);
+            if (owners.empty())
+                entries_.erase(it);
+
+            return sd;
+        }
+
+        // removes owner from all services (e.g. when browse request is cancelled)
+        void removeOwner(RequestId ownerId)
+        {
+            for (auto it = entries_.begin(); it != entries_.end();)
+            {
+                auto& owners = it->second.owners_;
+                owners.erase(std::remove(owners.begin(), owners.end(), ownerId), owners.end());
+                
+                if (owners.empty())
+                    it = entries_.erase(it);
+                else
+                    ++it;
+            }
+        }
+
+        template<typename F>
+        void forEach(F&& f) const
+        {
+            for (const auto& it : entries_)
+                f(it.second.sd_);
+        }
+
+        size_t size() const { return entries_.size(); }
+        void clear() { entries_.clear(); }
+
+    private:
+        struct KeyHash {
+            size_t operator()(const Key& k) const
+            {
+                size_t h = k.uuid_.hash();
+                h ^= std::hash<uint32_t>()(k.interfaceIdx_) + 0x9e3779b9 + (h << 6) + (h >> 2);
+                h ^= std::hash<uint8_t>()((uint8_t)k.protocol_) + 0x9e3779b9 + (h << 6) + (h >> 2);
+                return h;
+            }
+        };
+
+        typedef struct _Entry {
+            std::shared_ptr<NdnSd> sd_;
+            // ids of browse requests that discovered this service
+            std::vector<RequestId> owners_;
+        } Entry;
+
+        std::unordered_map<Key, Entry, KeyHash> entries_;
+    };
+}
+}
+
+#endif
@@ -0,0 +1,235 @@
+
+#include "txt-record.hpp"
+
+#include <cstring>
+
+#ifdef _WIN32
+#include <winsock2.h>
+#else
+#include <arpa/inet.h>
+#endif
+
+// key, '=' and value
+#define MAX_TXT_STRING_SIZE 255
+#define MAX_PREFIX_CHUNKS 10
+
+using namespace std;
+
+namespace
+{
+	const string kVersionKey = "v";
+	const string kPrefixKey = "p";
+	const string kPrefixesKey = "n";
+	const string kPortsKey = "m";
+	const string kCapabilitiesKey = "f";
+	const string kCertificateKey = "c";
+	const string kCertificateDigestKey = "d";
+
+	vector<string> splitComponents(const string& prefix)
+	{
+		vector<string> components;
+		size_t pos = 0;
+
+		while (pos < prefix.size())
+		{
+			if (prefix[pos] == '/')
+			{
+				pos++;
+				continue;
+			}
+
+			size_t end = prefix.find('/', pos);
+			if (end == string::npos)
+				end = prefix.size();
+
+			components.push_back(prefix.substr(pos, end - pos));
+			pos = end;
+		}
+
+		return components;
+	}
+
+	string joinComponents(const vector<string>& components, size_t from = 0)
+	{
+		string s;
+		for (size_t i = from; i < components.size(); ++i)
+			s += "/" + components[i];
+		return s;
+	}
+
+	bool setValue(TXTRecordRef* txtRecRef, const string& key, const string& value)
+	{
+		if (key.size() + 1 + value.size() > MAX_TXT_STRING_SIZE)
+			return false;
+
+		return TXTRecordSetValue(txtRecRef, key.c_str(),
+			(uint8_t)value.size(), value.data()) == kDNSServiceErr_NoError;
+	}
+
+	bool getValue(uint16_t txtLen, const unsigned char* txtRecord, const string& key,
+		string& value)
+	{
+		uint8_t len = 0;
+		auto data = TXTRecordGetValuePtr(txtLen, txtRecord, key.c_str(), &len);
+
+		if (!data)
+			return false;
+
+		value = string((const char*)data, len);
+		return true;
+	}
+}
+
+bool ndnsd::helpers::encodeTxtRecord(const NdnSd::AdvertiseParameters& parameters,
+	TXTRecordRef* txtRecRef)
+{
+	string version(1, (char)kTxtRecordVersion);
+	if (!setValue(txtRecRef, kVersionKey, version) ||
+		!setValue(txtRecRef, kPrefixKey, parameters.prefix_))
+		return false;
+
+	if (parameters.prefixes_.size())
+	{
+		string prefixes = encodePrefixes(parameters.prefix_, parameters.prefixes_);
+		// chunk keys are 2 characters long
+		size_t chunkSize = MAX_TXT_STRING_SIZE - 3;
+		size_t nChunks = (prefixes.size() + chunkSize - 1) / chunkSize;
+
+		if (prefixes.empty() || nChunks > MAX_PREFIX_CHUNKS)
+			return false;
+
+		for (size_t i = 0; i < nChunks; ++i)
+			if (!setValue(txtRecRef, kPrefixesKey + to_string(i),
+				prefixes.substr(i * chunkSize, chunkSize)))
+				return false;
+	}
+
+	string ports;
+	for (auto& it : parameters.ports_)
+	{
+		// announced protocol's port comes with SRV record
+		if (it.first == parameters.protocol_)
+			continue;
+
+		uint16_t port = htons(it.second);
+		ports += (char)it.first;
+		ports.append((const char*)&port, sizeof(port));
+	}
+	if (ports.size() && !setValue(txtRecRef, kPortsKey, ports))
+		return false;
+
+	if (parameters.capabilities_ &&
+		!setValue(txtRecRef, kCapabilitiesKey, string(1, (char)parameters.capabilities_)))
+		return false;
+
+	for (auto kv : { make_pair(&kCertificateKey, &parameters.cert_),
+		make_pair(&kCertificateDigestKey, &parameters.certDigest_) })
+	{
+		if (kv.second->size() && !setValue(txtRecRef, *kv.first, *kv.second))
+			return false;
+	}
+
+	return true;
+}
+
+bool ndnsd::helpers::decodeTxtRecord(uint16_t txtLen, const unsigned char* txtRecord,
+	NdnSd::AdvertiseParameters& parameters)
+{
+	if (!getValue(txtLen, txtRecord, kPrefixKey, parameters.prefix_))
+		return false;
+
+	parameters.cert_.clear();
+	parameters.certDigest_.clear();
+	parameters.prefixes_.clear();
+	parameters.ports_.clear();
+	parameters.capabilities_ = 0;
+
+	// version 0 record. newer versions are expected to keep version 1 keys.
+	// its "c" is the certificate itself, not a name: it is ignored, and the
+	// instance is treated as one advertising no certificate
+	string version;
+	if (!getValue(txtLen, txtRecord, kVersionKey, version) || version.empty())
+		return true;
+
+	getValue(txtLen, txtRecord, kCertificateKey, parameters.cert_);
+	getValue(txtLen, txtRecord, kCertificateDigestKey, parameters.certDigest_);
+
+	string prefixes, chunk;
+	for (int i = 0; i < MAX_PREFIX_CHUNKS &&
+		getValue(txtLen, txtRecord, kPrefixesKey + to_string(i), chunk); ++i)
+		prefixes += chunk;
+	if (prefixes.size())
+		parameters.prefixes_ = decodePrefixes(parameters.prefix_, prefixes);
+
+	string ports;
+	getValue(txtLen, txtRecord, kPortsKey, ports);
+	for (size_t i = 0; i + 3 <= ports.size(); i += 3)
+	{
+		uint8_t protocol = (uint8_t)ports[i];
+		if (protocol != (uint8_t)Proto::UDP && protocol != (uint8_t)Proto::TCP)
+			continue;
+
+		uint16_t port;
+		memcpy(&port, ports.data() + i + 1, sizeof(port));
+		parameters.ports_[(Proto)protocol] = ntohs(port);
+	}
+
+	string capabilities;
+	if (getValue(txtLen, txtRecord, kCapabilitiesKey, capabilities) && capabilities.size())
+		parameters.capabilities_ = (uint8_t)capabilities[0];
+
+	return true;
+}
+
+string ndnsd::helpers::encodePrefixes(const string& root, const vector<string>& prefixes)
+{
+	string encoded;
+	vector<string> previous = splitComponents(root);
+
+	for (auto& p : prefixes)
+	{
+		vector<string> components = splitComponents(p);
+		size_t shared = 0;
+		while (shared < components.size() && shared < previous.size() &&
+			components[shared] == previous[shared] && shared < UINT8_MAX)
+			shared++;
+
+		string remainder = joinComponents(components, shared);
+		if (remainder.size() > UINT8_MAX)
+			return "";
+
+		encoded += (char)shared;
+		encoded += (char)remainder.size();
+		encoded += remainder;
+		previous.swap(components);
+	}
+
+	return encoded;
+}
+
+vector<string> ndnsd::helpers::decodePrefixes(const string& root, const string& encoded)
+{
+	vector<string> prefixes;
+	vector<string> previous = splitComponents(root);
+	size_t pos = 0;
+
+	while (pos + 2 <= encoded.size())
+	{
+		size_t shared = (uint8_t)encoded[pos];
+		size_t len = (uint8_t)encoded[pos + 1];
+		pos += 2;
+
+		if (shared > previous.size() || pos + len > encoded.size())
+			break;
+
+		vector<string> components(previous.begin(), previous.begin() + shared);
+		for (auto& c : splitComponents(encoded.substr(pos, len)))
+			components.push_back(c);
+		pos += len;
+
+		prefixes.push_back(components.size() ? joinComponents(components) : "/");
+		previous.swap(components);
+	}
+
+	return prefixes;
+}
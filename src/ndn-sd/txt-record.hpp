@@ -0,0 +1,54 @@
+#ifndef __txt_record_hpp__
+#define __txt_record_hpp__
+
+#include <string>
+#include <vector>
+
+#include "dns_sd.h"
+#include "ndn-sd.hpp"
+
+namespace ndnsd
+{
+namespace helpers
+{
+    /**
+    * NDN-SD TXT record schema.
+    * Version 1 keys:
+    *   v      -- schema version, one byte
+    *   p      -- primary prefix, as URI. the only prefix version 0 peers see
+    *   n0..n9 -- more prefixes, front-coded (see encodePrefixes()) and split
+    *             into chunks that fit TXT record strings
+    *   m      -- ports for other protocols: (protocol, port) pairs, 3 bytes
+    *             each, port in network byte order. pairs of protocols this
+    *             version does not know are skipped
+    *   f      -- capability flags, one byte
+    *   c, d   -- certificate name and SHA-256 digest
+    * Records without "v" are version 0: "p" and "c" only, "c" being the
+    * base64 certificate itself. It is not decoded: version 0 instances are
+    * seen as advertising no certificate.
+    * Absent keys have default values, so an instance with a single prefix
+    * and no certificate costs the same as in version 0 plus 4 bytes.
+    */
+    const uint8_t kTxtRecordVersion = 1;
+
+    // fills in TXT record. returns false if some key/value string exceeds
+    // 255 bytes or the record does not fit into its buffer
+    bool encodeTxtRecord(const NdnSd::AdvertiseParameters& parameters,
+        TXTRecordRef* txtRecRef);
+    // reads prefixes, ports, capabilities and certificate from TXT record.
+    // returns false if there is no primary prefix
+    bool decodeTxtRecord(uint16_t txtLen, const unsigned char* txtRecord,
+        NdnSd::AdvertiseParameters& parameters);
+
+    // each prefix is written as number of leading components shared with
+    // the previous one (the first one is compared to root), length of the
+    // remainder and the remainder itself. prefixes are expected to be
+    // sorted, so that neighbours share most components
+    std::string encodePrefixes(const std::string& root,
+        const std::vector<std::string>& prefixes);
+    std::vector<std::string> decodePrefixes(const std::string& root,
+        const std::string& encoded);
+}
+}
+
+#endif
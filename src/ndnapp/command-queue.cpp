@@ -0,0 +1,192 @@
+
+#include "command-queue.hpp"
+
+#include <cerrno>
+#include <cstring>
+#include <iostream>
+
+#ifdef __linux__
+#include <sys/eventfd.h>
+#endif
+#ifndef _WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+using namespace std;
+using namespace ndnapp::helpers;
+
+CommandQueue::CommandQueue()
+    : head_(&stub_)
+    , tail_(&stub_)
+    , rung_(false)
+    , readFd_(-1)
+    , writeFd_(-1)
+{
+    stub_.next_.store(nullptr);
+
+#if defined(__linux__)
+    readFd_ = writeFd_ = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+#elif !defined(_WIN32)
+    int fds[2];
+    if (pipe(fds) == 0)
+    {
+        for (int fd : fds)
+        {
+            fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+            fcntl(fd, F_SETFD, FD_CLOEXEC);
+        }
+        readFd_ = fds[0];
+        writeFd_ = fds[1];
+    }
+#endif
+
+#ifndef _WIN32
+    if (readFd_ < 0)
+        cerr << "failed to create command queue doorbell: " << errno << " - "
+            << strerror(errno) << endl;
+#endif
+}
+
+CommandQueue::~CommandQueue()
+{
+    // commands left are dropped
+    bool blocked;
+    while (Node* node = pop(blocked))
+        delete node;
+
+#ifndef _WIN32
+    if (readFd_ >= 0)
+        close(readFd_);
+    if (writeFd_ >= 0 && writeFd_ != readFd_)
+        close(writeFd_);
+#endif
+}
+
+void CommandQueue::post(Command command)
+{
+    Node* node = new Node();
+    node->command_ = move(command);
+
+    push(node);
+    ring();
+}
+
+size_t CommandQueue::drain(size_t maxCommands)
+{
+    // doorbell is cleared first: commands posted from now on ring it again
+    clearDoorbell();
+    rung_.exchange(false);
+
+    size_t n = 0;
+    bool blocked = false;
+
+    while (n < maxCommands)
+    {
+        Node* node = pop(blocked);
+        if (!node)
+            break;
+
+        Command command = move(node->command_);
+        delete node;
+        n++;
+
+        try
+        {
+            command();
+        }
+        catch (...)
+        {
+            // the rest are run on the next drain()
+            ring();
+            throw;
+        }
+    }
+
+    // batch is over or a producer hides the rest: come back for them
+    if (blocked || n == maxCommands)
+        ring();
+
+    return n;
+}
+
+void CommandQueue::push(Node* node)
+{
+    // stub is pushed again and again
+    node->next_.store(nullptr, memory_order_relaxed);
+    Node* prev = head_.exchange(node, memory_order_acq_rel);
+    // till this store, nodes after prev are not reachable from tail
+    prev->next_.store(node, memory_order_release);
+}
+
+CommandQueue::Node* CommandQueue::pop(bool& blocked)
+{
+    blocked = false;
+
+    Node* tail = tail_;
+    Node* next = tail->next_.load(memory_order_acquire);
+
+    if (tail == &stub_)
+    {
+        if (!next)
+            return nullptr;
+
+        tail_ = next;
+        tail = next;
+        next = next->next_.load(memory_order_acquire);
+    }
+
+    if (next)
+    {
+        tail_ = next;
+        return tail;
+    }
+
+    if (tail != head_.load(memory_order_acquire))
+    {
+        blocked = true;
+        return nullptr;
+    }
+
+    // tail is the last node: stub goes after it, so that it can be popped
+    push(&stub_);
+
+    next = tail->next_.load(memory_order_acquire);
+    if (next)
+    {
+        tail_ = next;
+        return tail;
+    }
+
+    blocked = true;
+    return nullptr;
+}
+
+void CommandQueue::ring()
+{
+    if (writeFd_ < 0 || rung_.exchange(true))
+        return;
+
+#ifndef _WIN32
+    uint64_t one = 1;
+    // eventfd takes 8 bytes, pipe is fine with the first one. full pipe is
+    // rung already
+    if (write(writeFd_, &one, (writeFd_ == readFd_ ? sizeof(one) : 1)) < 0 && errno != EAGAIN)
+        cerr << "failed to ring command queue doorbell: " << errno << " - "
+            << strerror(errno) << endl;
+#endif
+}
+
+void CommandQueue::clearDoorbell()
+{
+#ifndef _WIN32
+    if (readFd_ < 0)
+        return;
+
+    uint8_t buf[64];
+    // eventfd is cleared by one read, pipe is read till empty
+    while (read(readFd_, buf, (writeFd_ == readFd_ ? sizeof(uint64_t) : sizeof(buf))) > 0 &&
+        writeFd_ != readFd_)
+        ;
+#endif
+}
@@ -0,0 +1,69 @@
+#ifndef __command_queue_hpp__
+#define __command_queue_hpp__
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+
+namespace ndnapp
+{
+namespace helpers
+{
+    /**
+    * Commands posted from other threads (CLI, control plane) to the event
+    * loop. Multi-producer single-consumer: post() is lock-free and can be
+    * called from any thread, drain() runs commands on the consumer thread
+    * in order of posting.
+    * The queue has a doorbell descriptor (eventfd, or a pipe where there
+    * is none) for the event loop to wait on. It is rung only when the
+    * queue was drained, so a burst of posts costs one wakeup.
+    * Nodes are linked by producers after they are published: a producer
+    * preempted in between hides the nodes behind its own, drain() stops
+    * there and rings the doorbell to come back for them.
+    */
+    class CommandQueue {
+    public:
+        typedef std::function<void()> Command;
+
+        CommandQueue();
+        ~CommandQueue();
+        CommandQueue(const CommandQueue&) = delete;
+        CommandQueue& operator=(const CommandQueue&) = delete;
+
+        void post(Command command);
+        // runs up to maxCommands commands, rings the doorbell if some are
+        // left. must be called from one (consumer) thread. returns number
+        // of commands run
+        size_t drain(size_t maxCommands = SIZE_MAX);
+
+        // readable while there are commands to drain. -1 where there are
+        // no descriptors (Windows): drain() is to be polled
+        int getFd() const { return readFd_; }
+
+    private:
+        typedef struct _Node {
+            std::atomic<struct _Node*> next_;
+            Command command_;
+        } Node;
+
+        // producers push at head, consumer pops at tail. stub keeps the
+        // list non-empty, so that push and pop never touch the same node
+        std::atomic<Node*> head_;
+        Node* tail_;
+        Node stub_;
+
+        std::atomic<bool> rung_;
+        int readFd_, writeFd_;
+
+        void push(Node* node);
+        // nullptr if queue is empty, or if blocked by a producer in the
+        // middle of push()
+        Node* pop(bool& blocked);
+        void ring();
+        void clearDoorbell();
+    };
+}
+}
+
+#endif
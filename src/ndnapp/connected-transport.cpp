@@ -0,0 +1,147 @@
+#include "connected-transport.hpp"
+
+#include <ndn-ind/encoding/element-listener.hpp>
+
+#include <stdexcept>
+#include <string.h>
+
+#ifndef _WIN32
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#endif
+
+using namespace std;
+using namespace ndn;
+using namespace ndnapp::helpers;
+
+// as ndn-ind Face::getMaxNdnPacketSize()
+static const size_t kMaxPacketSize = 8800;
+
+// TLV type or length at data. 0 if it is not complete yet
+static size_t readVarNumber(const uint8_t* data, size_t size, uint64_t& value)
+{
+    if (!size)
+        return 0;
+
+    size_t length = data[0] < 253 ? 1 : (data[0] == 253 ? 3 : (data[0] == 254 ? 5 : 9));
+    if (size < length)
+        return 0;
+
+    value = length == 1 ? data[0] : 0;
+    for (size_t i = 1; i < length; ++i)
+        value = (value << 8) | data[i];
+
+    return length;
+}
+
+ConnectedTransport::ConnectedTransport(int fd)
+    : fd_(fd)
+    , elementListener_(nullptr)
+{
+#ifndef _WIN32
+    // sends block, as those of ndn-ind transports do. receives don't
+    fcntl(fd_, F_SETFL, fcntl(fd_, F_GETFL) & ~O_NONBLOCK);
+#endif
+}
+
+ConnectedTransport::~ConnectedTransport()
+{
+    close();
+}
+
+void ConnectedTransport::connect(const ConnectionInfo& connectionInfo,
+    ElementListener& elementListener, const OnConnected& onConnected)
+{
+    elementListener_ = &elementListener;
+    if (onConnected)
+        onConnected();
+}
+
+void ConnectedTransport::send(const uint8_t* data, size_t dataLength)
+{
+#ifndef _WIN32
+    if (fd_ < 0)
+        throw runtime_error("ConnectedTransport: socket is closed");
+
+    while (dataLength)
+    {
+        ssize_t sent = ::send(fd_, data, dataLength, MSG_NOSIGNAL);
+        if (sent < 0)
+        {
+            if (errno == EINTR)
+                continue;
+
+            string error = strerror(errno);
+            close();
+            throw runtime_error("ConnectedTransport: send failed: " + error);
+        }
+
+        data += sent;
+        dataLength -= (size_t)sent;
+    }
+#endif
+}
+
+void ConnectedTransport::processEvents()
+{
+#ifndef _WIN32
+    uint8_t chunk[kMaxPacketSize];
+
+    while (fd_ >= 0)
+    {
+        ssize_t received = recv(fd_, chunk, sizeof(chunk), MSG_DONTWAIT);
+        if (received < 0 && errno == EINTR)
+            continue;
+        if (received < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+            break;
+        // peer has closed the connection: forwarder sees it as not connected
+        if (received <= 0)
+        {
+            close();
+            break;
+        }
+
+        buffer_.insert(buffer_.end(), chunk, chunk + received);
+
+        // packets are passed as soon as they are complete
+        size_t offset = 0;
+        while (offset < buffer_.size())
+        {
+            uint64_t type, length;
+            size_t typeSize = readVarNumber(buffer_.data() + offset, buffer_.size() - offset, type);
+            size_t lengthSize = typeSize ? readVarNumber(buffer_.data() + offset + typeSize,
+                buffer_.size() - offset - typeSize, length) : 0;
+            if (!lengthSize)
+                break;
+
+            size_t packetSize = typeSize + lengthSize + length;
+            if (length > kMaxPacketSize || packetSize > kMaxPacketSize)
+            {
+                // stream can't be resynchronized
+                close();
+                throw runtime_error("ConnectedTransport: packet exceeds the maximum size");
+            }
+            if (buffer_.size() - offset < packetSize)
+                break;
+
+            if (elementListener_)
+                elementListener_->onReceivedElement(buffer_.data() + offset, packetSize);
+            offset += packetSize;
+        }
+
+        buffer_.erase(buffer_.begin(), buffer_.begin() + offset);
+    }
+#endif
+}
+
+void ConnectedTransport::close()
+{
+#ifndef _WIN32
+    if (fd_ >= 0)
+        ::close(fd_);
+#endif
+    fd_ = -1;
+    buffer_.clear();
+}
@@ -0,0 +1,43 @@
+#ifndef __connected_transport_hpp__
+#define __connected_transport_hpp__
+
+#include <vector>
+
+#include <ndn-ind/transport/transport.hpp>
+
+namespace ndnapp
+{
+namespace helpers
+{
+    /**
+    * Transport over a stream socket that is connected already (e.g. by a
+    * non-blocking connect App has waited for), so that the forwarder does
+    * not connect again. connect() takes over the socket whatever the
+    * connection info is; the transport closes it. Packets are read as they
+    * come, without blocking.
+    */
+    class ConnectedTransport : public ndn::Transport {
+    public:
+        ConnectedTransport(int fd);
+        ~ConnectedTransport();
+
+        bool isLocal(const ConnectionInfo& connectionInfo) override { return false; }
+        bool isAsync() override { return false; }
+        void connect(const ConnectionInfo& connectionInfo, ndn::ElementListener& elementListener,
+            const OnConnected& onConnected) override;
+        using ndn::Transport::send;
+        void send(const uint8_t* data, size_t dataLength) override;
+        void processEvents() override;
+        bool getIsConnected() override { return fd_ >= 0; }
+        void close() override;
+
+    private:
+        int fd_;
+        ndn::ElementListener* elementListener_;
+        // received bytes of a packet not complete yet
+        std::vector<uint8_t> buffer_;
+    };
+}
+}
+
+#endif
@@ -82,6 +82,12 @@ const Name& IdentityManager::getInstanceIdentity() const
 	return (instanceIdentity_ ? instanceIdentity_->getName() : Name());
 }
 
+shared_ptr<CertificateV2> IdentityManager::getSigningCertificate() const
+{
+	return (signingIdentity_ ? signingIdentity_->getDefaultKey()->getDefaultCertificate() :
+		shared_ptr<CertificateV2>());
+}
+
 shared_ptr<CertificateV2> IdentityManager::getAppCertificate() const
 {
 	return (appIdentity_ ? appIdentity_->getDefaultKey()->getDefaultCertificate() :
@@ -77,6 +77,8 @@ namespace helpers
         const ndn::Name& getSigningIdentity() const;
         const ndn::Name& getAppIdentity() const;
         const ndn::Name& getInstanceIdentity() const;
+        // issuer of app certificate
+        std::shared_ptr<ndn::CertificateV2> getSigningCertificate() const;
         std::shared_ptr<ndn::CertificateV2> getAppCertificate() const;
         std::shared_ptr<ndn::CertificateV2> getInstanceCertificate() const;
 
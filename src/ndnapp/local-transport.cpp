@@ -0,0 +1,29 @@
+#include "local-transport.hpp"
+
+#include <iostream>
+
+using namespace std;
+using namespace ndn;
+using namespace ndnapp::helpers;
+
+// TLV type of Interest packet
+#define INTEREST_TLV_TYPE 0x05
+
+void LocalTransport::send(const uint8_t* data, size_t dataLength)
+{
+    if (onInterest_ && dataLength && data[0] == INTEREST_TLV_TYPE)
+    {
+        try
+        {
+            Interest interest;
+            interest.wireDecode(data, dataLength);
+            onInterest_(interest);
+        }
+        catch (exception& e)
+        {
+            cerr << "caught exception while passing local Interest: " << e.what() << endl;
+        }
+    }
+
+    MicroForwarderTransport::send(data, dataLength);
+}
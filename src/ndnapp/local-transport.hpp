@@ -0,0 +1,34 @@
+#ifndef __local_transport_hpp__
+#define __local_transport_hpp__
+
+#include <functional>
+
+#include <ndn-ind/interest.hpp>
+#include <ndn-ind-tools/micro-forwarder/micro-forwarder-transport.hpp>
+
+namespace ndnapp
+{
+namespace helpers
+{
+    /**
+    * Transport of a local application face. Interests the application
+    * sends are passed to onInterest before the forwarder gets them: the
+    * forwarder does not tell which face an Interest came from, so this is
+    * how App tells Interests of local applications from those of peers.
+    * Packets are only decoded while onInterest is set.
+    */
+    class LocalTransport : public ndntools::MicroForwarderTransport {
+    public:
+        typedef std::function<void(const ndn::Interest&)> OnInterest;
+
+        void setOnInterest(OnInterest onInterest) { onInterest_ = onInterest; }
+
+        void send(const uint8_t* data, size_t dataLength) override;
+
+    private:
+        OnInterest onInterest_;
+    };
+}
+}
+
+#endif
@@ -1,17 +1,44 @@
 // TODO: add copyright
 
 #include "ndnapp.hpp"
+#include "connected-transport.hpp"
 
+#include <algorithm>
+#include <cctype>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
 #include <filesystem>
 #include <fstream>
 #include <iostream>
 
+#ifdef __linux__
+#include <dirent.h>
+#endif
+#ifdef __APPLE__
+#include <libproc.h>
+#endif
+#ifndef _WIN32
+#include <fcntl.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
 #include <ndn-ind/transport/udp-transport.hpp>
 #include <ndn-ind/transport/tcp-transport.hpp>
 #include <ndn-ind/face.hpp>
 #include <ndn-ind/security/key-chain.hpp>
 #include <ndn-ind/util/memory-content-cache.hpp>
 #include <ndn-ind/security/certificate/certificate.hpp>
+#include <ndn-ind/security/verification-helpers.hpp>
+#include <ndn-ind/encoding/base64.hpp>
+#include <ndn-ind/key-locator.hpp>
+#include <ndn-ind/lite/util/crypto-lite.hpp>
+#include <ndn-ind-tools/micro-forwarder/micro-forwarder-transport.hpp>
 
 #include <fmt/core.h>
 #include <fmt/format.h>
@@ -25,6 +52,224 @@ using namespace ndnsd;
 using namespace ndnapp;
 
 static chrono::seconds kCertRenewWindow = chrono::minutes(15);
+static chrono::milliseconds kCertFetchTimeout = chrono::seconds(2);
+// issuers fetched from a peer before its certificate chain must reach the
+// trust anchor
+static int kMaxCertificateChain = 4;
+// lazy mode: instances resolved on a miss that has no better candidates
+static size_t kLazyFallbackBatch = 8;
+// ...at most once per name in this interval, while consumer retransmits it
+static chrono::milliseconds kLazyFallbackInterval = chrono::seconds(2);
+// Interest without lifetime times out after it
+static chrono::milliseconds kDefaultInterestLifetime = chrono::seconds(4);
+// catches forwarder sockets closed by the forwarder (e.g. peer has 
+// disconnected)
+static chrono::milliseconds kSocketScanInterval = chrono::seconds(1);
+// catches forwarder changes App did not make (prefix registrations, 
+// incoming connections)
+static chrono::milliseconds kForwarderSnapshotInterval = chrono::seconds(1);
+// posted commands run at once; more are left for the next wakeup, so that
+// a burst doesn't hold up forwarding
+static size_t kCommandBatch = 256;
+// TCP peer that doesn't accept connection within it (host name lookup 
+// included) gets no face
+static chrono::milliseconds kConnectTimeout = chrono::seconds(3);
+// connect completes when socket is writable, and run() waits for readable
+// ones: connects in progress are polled
+static chrono::milliseconds kConnectPollInterval = chrono::milliseconds(10);
+
+static string certificateDigest(const CertificateV2& cert)
+{
+    auto wire = cert.wireEncode();
+    string digest(32, 0);
+    CryptoLite::digestSha256(wire.buf(), wire.size(), (uint8_t*)&digest[0]);
+
+    return digest;
+}
+
+// faces connect to numeric addresses, so that opening one never waits for
+// host name lookup. DNS-SD implementations without address lookup leave
+// hostname only
+static string peerAddress(const shared_ptr<const NdnSd>& sd)
+{
+    auto addresses = sd->getAddresses();
+    return addresses.size() ? addresses.front() : sd->getHostname();
+}
+
+// as kept in peer table: zeros if instance advertises no digest
+static array<uint8_t, 32> peerCertificateDigest(const shared_ptr<const NdnSd>& sd)
+{
+    array<uint8_t, 32> digest;
+    digest.fill(0);
+    if (sd->getCertificateDigest().size() == digest.size())
+        memcpy(digest.data(), sd->getCertificateDigest().data(), digest.size());
+
+    return digest;
+}
+
+// 0 if fd is not a socket
+static uint64_t socketInode(int fd)
+{
+#ifndef _WIN32
+    struct stat st;
+    if (fd > STDERR_FILENO && fstat(fd, &st) == 0 && S_ISSOCK(st.st_mode))
+        return (uint64_t)st.st_ino;
+#endif
+    return 0;
+}
+
+// all sockets of the process, searched when forwarder sockets can't be 
+// found otherwise. returns descriptors and their inodes; empty where they 
+// can't be listed
+static map<int, uint64_t> listSockets()
+{
+    map<int, uint64_t> sockets;
+#if defined(__linux__) || defined(__APPLE__)
+    vector<int> fds;
+#ifdef __linux__
+    if (DIR* dir = opendir("/proc/self/fd"))
+    {
+        while (struct dirent* e = readdir(dir))
+            if (isdigit(e->d_name[0]))
+                fds.push_back(atoi(e->d_name));
+        closedir(dir);
+    }
+#else
+    int size = proc_pidinfo(getpid(), PROC_PIDLISTFDS, 0, nullptr, 0);
+    if (size > 0)
+    {
+        vector<proc_fdinfo> info(size / sizeof(proc_fdinfo));
+        size = proc_pidinfo(getpid(), PROC_PIDLISTFDS, 0, info.data(), 
+            (int)(info.size() * sizeof(proc_fdinfo)));
+        for (int i = 0; i < size / (int)sizeof(proc_fdinfo); ++i)
+            if (info[i].proc_fdtype == PROX_FDTYPE_SOCKET)
+                fds.push_back(info[i].proc_fd);
+    }
+#endif
+    // directory descriptor is among fds, but it is closed and not a socket.
+    // standard streams may be sockets (under a supervisor), but are not read
+    for (int fd : fds)
+        if (uint64_t inode = socketInode(fd))
+            sockets[fd] = inode;
+#endif
+    return sockets;
+}
+
+// ndn-ind transports don't expose their sockets. descriptors are allocated
+// lowest first, so the socket a forwarder call creates is looked for at 
+// the lowest descriptor that was free before the call
+static int lowestFreeDescriptor()
+{
+#ifndef _WIN32
+    int fd = fcntl(STDERR_FILENO, F_DUPFD_CLOEXEC, 0);
+    if (fd >= 0)
+        close(fd);
+    return fd;
+#else
+    return -1;
+#endif
+}
+
+// local or peer's port of a socket, 0 if there is none
+static uint16_t socketPort(int fd, bool peer)
+{
+#ifndef _WIN32
+    struct sockaddr_storage addr;
+    socklen_t len = sizeof(addr);
+    if ((peer ? getpeername(fd, (struct sockaddr*)&addr, &len) : 
+            getsockname(fd, (struct sockaddr*)&addr, &len)) != 0)
+        return 0;
+
+    if (addr.ss_family == AF_INET)
+        return ntohs(((struct sockaddr_in*)&addr)->sin_port);
+    if (addr.ss_family == AF_INET6)
+        return ntohs(((struct sockaddr_in6*)&addr)->sin6_port);
+#endif
+    return 0;
+}
+
+// numeric address of a host, empty if it is not found. getaddrinfo()
+// blocks for host names: they are looked up off the event loop
+static string lookupHost(const string& hostname, bool numericOnly)
+{
+    string address;
+#ifndef _WIN32
+    struct addrinfo hints, *ai = nullptr;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_flags = numericOnly ? AI_NUMERICHOST : 0;
+    hints.ai_socktype = SOCK_STREAM;
+    if (getaddrinfo(hostname.c_str(), nullptr, &hints, &ai) != 0)
+        return address;
+
+    char host[NI_MAXHOST];
+    if (getnameinfo(ai->ai_addr, ai->ai_addrlen, host, sizeof(host), nullptr, 0, NI_NUMERICHOST) == 0)
+        address = host;
+    freeaddrinfo(ai);
+#endif
+    return address;
+}
+
+// ndn-ind-tools releases differ in whether MicroForwarder removes a single
+// route. where it doesn't, route stays till its face is removed
+template<typename Forwarder>
+static auto removeForwarderRoute(Forwarder& mfd, const Name& name, int faceId, int)
+    -> decltype(mfd.removeRoute(name, faceId), bool())
+{
+    mfd.removeRoute(name, faceId);
+    return true;
+}
+
+template<typename Forwarder>
+static bool removeForwarderRoute(Forwarder&, const Name&, int, long)
+{
+    return false;
+}
+
+// non-blocking connect to a numeric address. returns -1 if address is not
+// numeric (lookup would block) or platform has no non-blocking connect,
+// sets error if connect has failed right away
+static int startConnect(const string& hostname, uint16_t port, string& error)
+{
+#ifndef _WIN32
+    struct addrinfo hints, *ai = nullptr;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_flags = AI_NUMERICHOST | AI_NUMERICSERV;
+    hints.ai_socktype = SOCK_STREAM;
+    if (getaddrinfo(hostname.c_str(), to_string(port).c_str(), &hints, &ai) != 0)
+        return -1;
+
+    int fd = socket(ai->ai_family, SOCK_STREAM, 0);
+    if (fd < 0)
+        error = strerror(errno);
+    else
+    {
+        fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+        fcntl(fd, F_SETFD, FD_CLOEXEC);
+        if (connect(fd, ai->ai_addr, ai->ai_addrlen) < 0 && errno != EINPROGRESS)
+        {
+            error = strerror(errno);
+            close(fd);
+            fd = -1;
+        }
+    }
+
+    freeaddrinfo(ai);
+    return fd;
+#else
+    return -1;
+#endif
+}
+
+static bool isListening(int fd)
+{
+#ifndef _WIN32
+    int listening = 0;
+    socklen_t len = sizeof(listening);
+    return getsockopt(fd, SOL_SOCKET, SO_ACCEPTCONN, &listening, &len) == 0 && listening;
+#else
+    return false;
+#endif
+}
 
 App::App(string appName, string id, const shared_ptr<spdlog::logger>& logger,
     Face* face, KeyChain* keyChain, bool filterInterface)
@@ -35,9 +280,49 @@ App::App(string appName, string id, const shared_ptr<spdlog::logger>& logger,
     , face_(face)
     , keyChain_(keyChain)
     , filterInterface_(filterInterface)
+    , warmStartGrace_(0)
+    , timeToFirstRoute_(0)
+    , timeToFirstConfirmedRoute_(0)
+    , lazy_(false)
+    , idleTimeout_(0)
+    , skipValidation_(false)
+    , allowUnverified_(false)
+    , flapHoldTime_(0)
+    , stopped_(false)
+    , socketsReady_(false)
+    , socketsChanged_(false)
+    , forwarderSnapshot_(make_shared<ForwarderSnapshot>())
+    , forwarderChanged_(true)
+    , faceSetups_(0)
     , identityManager_(this, logger_, keyChain)
     , memCache_(make_shared<MemoryContentCache>(face_))
+    , snapshot_(make_shared<ServiceSnapshot>())
 {
+    // doorbell wakes run() up, drained by processEvents() as well
+    if (commands_.getFd() >= 0)
+        NdnSd::watchDescriptor(commands_.getFd(), [this]() { commands_.drain(kCommandBatch); });
+}
+
+App::~App()
+{
+    for (auto& t : localTransports_)
+        if (auto transport = t.lock())
+            transport->setOnInterest(nullptr);
+    if (commands_.getFd() >= 0)
+        NdnSd::unwatchDescriptor(commands_.getFd());
+    for (auto& it : watchedSockets_)
+        NdnSd::unwatchDescriptor(it.first);
+    for (auto fd : appDescriptors_)
+        NdnSd::unwatchDescriptor(fd);
+#ifndef _WIN32
+    for (auto& it : connects_)
+        if (it.second.fd_ >= 0)
+            close(it.second.fd_);
+    for (auto& it : connected_)
+        if (it.second.first >= 0)
+            close(it.second.first);
+#endif
+    // host name lookups in progress are waited for
 }
 
 void App::configure(const vector<Proto>& protocols, const NdnSd::AdvertiseParameters& params,
@@ -45,31 +330,91 @@ void App::configure(const vector<Proto>& protocols, const NdnSd::AdvertiseParame
 {
     protocols_ = protocols;
     params_ = params;
+    startTime_ = chrono::steady_clock::now();
 
     setupMicroforwarder();
+    // every registration carries ports of all protocols
+    for (auto& it : protocolPort_)
+        params_.ports_[it.first] = it.second;
+    params_.capabilities_ |= (uint8_t)Capability::Forwarder;
     printAppInfo();
+    addProvisionalRoutes();
 
     setupNdnSd();
 
     identityManager_.setup(signingIdentityOrPath, password);
     
-    memCache_->registerPrefix(identityManager_.getAppIdentity(), [this](const auto& prefix)
-    {
-        logger_->error("Failed to register prefix for app identity: {}", prefix);
-    });
-    memCache_->add(*identityManager_.getAppCertificate());
-    memCache_->add(*identityManager_.getInstanceCertificate());
+    registerAppIdentity();
+    updateAdvertisedCertificate();
+    if (lazy_)
+        logger_->info("lazy resolve: peers are resolved on demand, reaped after {}ms idle", 
+            idleTimeout_.count());
 
     // setup cert auto-renew
+    // new certificate is republished in place: peers keep their routes
     setupCertificateAutoRenew(identityManager_.getAppCertificate(), [this]() 
     {
         identityManager_.createNewAppIdentity();
         identityManager_.createNewInstanceIdentity();
+        registerAppIdentity();
+        updateAdvertisedCertificate();
     });
     setupCertificateAutoRenew(identityManager_.getInstanceCertificate(), [this]() 
     {
         identityManager_.createNewInstanceIdentity();
+        updateAdvertisedCertificate();
+    });
+}
+
+void App::registerAppIdentity()
+{
+    memCache_->registerPrefix(identityManager_.getAppIdentity(), [this](const auto& prefix)
+    {
+        logger_->error("Failed to register prefix for app identity: {}", prefix);
     });
+    memCache_->add(*identityManager_.getAppCertificate());
+
+    // issuer of app certificate, so that peers can validate the chain up 
+    // to their trust anchor
+    auto signingCert = identityManager_.getSigningCertificate();
+    if (signingCert)
+    {
+        memCache_->registerPrefix(signingCert->getKeyName(), [this](const auto& prefix)
+        {
+            logger_->error("Failed to register prefix for signing certificate: {}", prefix);
+        });
+        memCache_->add(*signingCert);
+    }
+}
+
+void App::updateAdvertisedCertificate()
+{
+    // only name and digest are advertised, peers fetch certificate itself
+    // from memory cache
+    auto cert = identityManager_.getInstanceCertificate();
+    memCache_->add(*cert);
+
+    params_.cert_ = cert->getName().toUri();
+    params_.certDigest_ = certificateDigest(*cert);
+    params_.capabilities_ |= (uint8_t)Capability::Certificate;
+
+    for (auto& s : advertised_)
+    {
+        NdnSd::AdvertiseParameters prm = params_;
+        prm.protocol_ = s->getProtocol();
+        prm.port_ = s->getPort();
+        prm.interfaceIdx_ = s->getInterface();
+        prm.subtype_ = s->getSubtype();
+
+        if (s->update(prm, 
+            [s, this](int, int errCode, std::string msg, bool, void*)
+            {
+                logger_->error("update error {}/{}: {} - {}", s->getUuid(), s->getProtocol(), errCode, msg);
+            }) == 0)
+        {
+            logger_->info("advertise certificate {} for {}/{}", params_.cert_, s->getUuid(), s->getProtocol());
+        }
+    }
 }
 
 void App::setupCertificateAutoRenew(const shared_ptr<const CertificateV2>& cert, function<void()> renewRoutine)
@@ -78,6 +423,7 @@ void App::setupCertificateAutoRenew(const shared_ptr<const CertificateV2>& cert,
     auto now = chrono::system_clock::now();
 
     // capture "this" -- ndnapp assumed to be a singleton and live through the application lifecycle
+    addFaceDeadline(chrono::duration_cast<chrono::milliseconds>(now - renewT));
     face_->callLater(now - renewT, [this, cert, renewRoutine]() {
         logger_->info("Certificate {} expires in {} seconds. Triggered renew...", 
             cert->getName().toUri(),
@@ -94,6 +440,7 @@ void App::setupMicroforwarder()
         try
         {
             ptr_lib::shared_ptr<const Transport> t;
+            int hint = lowestFreeDescriptor();
 
             if (p == Proto::UDP)
                 t = mfd_->addChannel(
@@ -107,6 +454,13 @@ void App::setupMicroforwarder()
             else
             {
                 protocolPort_[p] = t->getBoundPort();
+
+                int fd = findForwarderSocket(hint, protocolPort_[p], false);
+                if (fd >= 0)
+                    watchForwarderSocket(fd, isListening(fd));
+                else
+                    logger_->warn("socket of {} channel is not found, run() won't wake up for it",
+                        p == Proto::TCP ? "TCP" : "UDP");
             }
         }
         catch (exception& e)
@@ -125,86 +479,38 @@ void App::setupNdnSd()
         NdnSd::AdvertiseParameters prm = params_;
         prm.protocol_ = p;
         shared_ptr<NdnSd> s = make_shared<NdnSd>(instanceId_);
+        // callbacks are kept by requests of s: they must not keep s alive,
+        // or it would never be destroyed (and its requests cancelled)
+        weak_ptr<NdnSd> ws = s;
 
         if (find(protocols_.begin(), protocols_.end(), p) != protocols_.end())
         {
             prm.port_ = protocolPort_[p];
+            advertised_.push_back(s);
 
             s->announce(prm,
-                [s, this](void*)
+                [ws, this](void*)
             {
+                auto s = ws.lock();
+                if (!s)
+                    return;
+
                 logger_->info("announce {}/{} iface {} {}:{} -- {}", s->getUuid(), s->getProtocol(),
                     s->getInterface(), s->getDomain(), s->getPort(), s->getPrefix());
             },
-                [s, this](int reqId, int errCode, std::string msg, bool, void*)
+                [p, this](int reqId, int errCode, std::string msg, bool, void*)
             {
-                logger_->error("announce error {}/{}: {} - {}", s->getUuid(), s->getProtocol(), errCode, msg);
+                logger_->error("announce error {}/{}: {} - {}", instanceId_, p, errCode, msg);
             });
         }
 
         // TODO: browse constraints -- shall browse with empty subtype or our subtype?
         NdnSd::BrowseConstraints cnstr = static_cast<NdnSd::BrowseConstraints>(prm);
         s->browse(cnstr,
-            [s, this](int, Announcement a, shared_ptr<const NdnSd> sd, void*)
+            [ws, this](int, const vector<ServiceAnnouncement>& announcements, void*)
         {
-            if (a == Announcement::Added)
-            {
-                if (filterInterface_ && discoveredInstances_.count(sd->getUuid()))
-                    logger_->warn("iface filtering: skip duplicate {} on iface {}", sd->getUuid(), sd->getInterface());
-                else
-                {
-                    logger_->info("add {}/{} iface {}", sd->getUuid(), sd->getProtocol(), sd->getInterface());
-
-                    discoveredInstances_.insert(sd->getUuid());
-
-                    s->resolve(sd,
-                        [this](int, Announcement a, shared_ptr<const NdnSd> sd, void*)
-                    {
-                        if (a == Announcement::Resolved)
-                        {
-                            logger_->info("resolve {} iface {} {}://{}:{} -- {}", sd->getUuid(), sd->getInterface(),
-                                sd->getProtocol(), sd->getHostname(), sd->getPort(), sd->getPrefix());
-
-                            addRoute(sd);
-
-                            try {
-
-                                if (onInstanceAdd_)
-                                    onInstanceAdd_(sd);
-                            }
-                            catch (exception& e)
-                            {
-                                logger_->error("caught exception while calling user callback: {}", e.what());
-                            }
-                        }
-                    },
-                        [this, sd](int reqId, int errCode, std::string msg, bool ismDns, void*)
-                    {
-                        logger_->error("resolve error {} (is mDNS {}): {} - {}", sd->getUuid(),
-                            ismDns, errCode, msg);
-                    });
-                }
-            }
-
-            if (a == Announcement::Removed)
-            {
-                if (discoveredInstances_.count(sd->getUuid()))
-                {
-                    logger_->info("remove {0}/{1}", sd->getUuid(), sd->getProtocol());
-
-                    removeRoute(sd);
-                    discoveredInstances_.erase(sd->getUuid());
-
-                    try {
-                        if (onInstanceRemove_)
-                            onInstanceRemove_(sd);
-                    }
-                    catch (exception& e)
-                    {
-                        logger_->error("caught exception while calling user callback: {}", e.what());
-                    }
-                }
-            }
+            if (auto s = ws.lock())
+                onServiceAnnouncements(s, announcements);
         },
             [this](int reqId, int errCode, std::string msg, bool ismDns, void*)
         {
@@ -215,98 +521,1611 @@ void App::setupNdnSd()
     }
 }
 
-void App::processEvents()
+void App::onServiceAnnouncements(const shared_ptr<NdnSd>& s,
+    const vector<ServiceAnnouncement>& announcements)
 {
-    mfd_->processEvents();
+    if (announcements.size() > 1)
+        logger_->debug("processing batch of {} announcements", announcements.size());
 
-    for (auto s : ndnsds_)
-        s->run(1);
+    // deltas are handled in order: an instance may appear and disappear 
+    // within the same batch
+    for (auto& a : announcements)
+    {
+        if (a.announcement_ == Announcement::Added)
+            onServiceAdded(s, a.sd_);
+        if (a.announcement_ == Announcement::Removed)
+            onServiceRemoved(a.sd_);
+        if (a.announcement_ == Announcement::Resolved)
+            onServiceUpdated(a.sd_);
+    }
 }
 
-vector<shared_ptr<const ndnsd::NdnSd>>
-App::getDiscoveredNodes() const
+void App::onServiceAdded(const shared_ptr<NdnSd>& s, const shared_ptr<const NdnSd>& sd)
 {
-    vector<shared_ptr<const ndnsd::NdnSd>> nodes;
+    if (filterInterface_ && discoveredInstances_.count(sd->getUuid()))
+    {
+        logger_->warn("iface filtering: skip duplicate {} on iface {}", sd->getUuid(), sd->getInterface());
+        return;
+    }
 
-    for (auto& sd : ndnsds_)
+    logger_->info("add {}/{} iface {}", sd->getUuid(), sd->getProtocol(), sd->getInterface());
+
+    discoveredInstances_.insert(sd->getUuid());
+
+    // flapped peer is resolved ahead, its held face waits for it
+    bool priority = cancelHeldRemoval(sd) || isPriorityInstance(sd->getUuid());
+    if (lazy_)
     {
-        auto discovered = sd->getDiscoveredServices();
-        nodes.insert(nodes.end(), discovered.begin(), discovered.end());
+        lazyInstances_[sd] = { s, false, chrono::steady_clock::now() };
+        lazyUuids_.insert({ sd->getUuid(), sd });
+        auto it = knownPrefixes_.find(sd->getUuid());
+        if (it != knownPrefixes_.end())
+            hintIndex_.insert(sd, it->second);
+
+        // priority instances are wanted anyway
+        if (priority)
+            activateInstance(sd, true);
+        return;
     }
 
-    return nodes;
+    resolveInstance(s, sd, priority);
 }
 
-void App::printAppInfo()
+void App::resolveInstance(const shared_ptr<NdnSd>& s, const shared_ptr<const NdnSd>& sd, 
+    bool priority)
 {
-    fmt::print(R"(
-{}
-    instance id {}
-    announce NDN service: {}, subtype {}
-    prefix {}
-    listen ports {}
+    s->resolve(sd,
+        [this](int, Announcement a, shared_ptr<const NdnSd> sd, void*)
+    {
+        if (a == Announcement::Resolved)
+            onServiceResolved(sd);
+    },
+        [this, sd](int reqId, int errCode, std::string msg, bool ismDns, void*)
+    {
+        logger_->error("resolve error {} (is mDNS {}): {} - {}", sd->getUuid(),
+            ismDns, errCode, msg);
+    }, nullptr, priority);
+}
 
-)",
-appName_,
-fmt::format(fmt::emphasis::bold, "{}", instanceId_),
-fmt::format(fmt::emphasis::bold, "{}", protocols_), params_.subtype_,
-fmt::format(fmt::emphasis::bold, "{}", params_.prefix_),
-fmt::format(fmt::emphasis::bold, "{}", protocolPort_)
-);
+void App::prioritizePrefix(const Name& prefix)
+{
+    priorityPrefixes_.push_back(prefix);
+
+    // move already queued resolves ahead
+    for (auto& s : ndnsds_)
+        s->forEachDiscoveredService([&](const shared_ptr<const NdnSd>& sd)
+        {
+            if (isPriorityInstance(sd->getUuid()))
+                s->prioritizeResolve(sd);
+        });
+
+    vector<shared_ptr<const NdnSd>> inactive;
+    for (auto& it : lazyInstances_)
+        if (!it.second.active_ && isPriorityInstance(it.first->getUuid()))
+            inactive.push_back(it.first);
+    for (auto& sd : inactive)
+        activateInstance(sd, true);
+}
+
+bool App::isPriorityInstance(const string& instanceId) const
+{
+    for (auto& p : priorityPrefixes_)
+        for (int i = 0; i < (int)p.size(); ++i)
+            if (p.get(i).toEscapedString() == instanceId)
+                return true;
+
+    return false;
+}
+
+void App::onServiceResolved(const shared_ptr<const NdnSd>& sd)
+{
+    logger_->info("resolve {} iface {} {}://{}:{} ({}) -- {}", sd->getUuid(), sd->getInterface(),
+        sd->getProtocol(), sd->getHostname(), sd->getPort(), 
+        fmt::join(sd->getAddresses(), ", "), sd->getPrefix());
+
+    if (!confirmProvisionalRoute(sd) && !confirmHeldRoute(sd))
+        addRoute(sd);
+
+    // re-resolved instance may advertise other prefixes now
+    vector<Name> prefixes;
+    for (auto& p : sd->getPrefixes())
+        prefixes.push_back(Name(p));
+    prefixIndex_.insert(sd, prefixes);
+
+    if (lazy_)
+    {
+        knownPrefixes_[sd->getUuid()] = prefixes;
+        auto it = lazyInstances_.find(sd);
+        if (it != lazyInstances_.end())
+            it->second.lastUsed_ = chrono::steady_clock::now();
     }
 
-void App::addRoute(const shared_ptr<const NdnSd>& sd)
+    if (peerTable_.isOpen() && 
+        !peerTable_.update({ sd->getUuid(), sd->getProtocol(), peerAddress(sd), sd->getPort(),
+            sd->getPrefixes(), peerCertificateDigest(sd), chrono::system_clock::now() }))
+        logger_->warn("failed to persist peer {}", sd->getUuid());
+
+    for (size_t i = 0; i < ndnsds_.size(); ++i)
+    {
+        auto stats = ndnsds_[i]->getResolveStats();
+        logger_->debug("resolver {}: queued {} in flight {} latency avg {:.1f}ms max {}ms "
+            "(timed out {} retried {} failed {})", i, stats.queued_, stats.inFlight_, 
+            stats.avgLatencyMs_, stats.maxLatencyMs_, stats.timedOut_, stats.retried_, stats.failed_);
+    }
+
+    try {
+
+        if (onInstanceAdd_)
+            onInstanceAdd_(sd);
+    }
+    catch (exception& e)
+    {
+        logger_->error("caught exception while calling user callback: {}", e.what());
+    }
+}
+
+void App::onServiceUpdated(const shared_ptr<const NdnSd>& sd)
+{
+    if (!discoveredInstances_.count(sd->getUuid()))
+        return;
+
+    // inactive lazy instance picks up new prefixes once it is resolved
+    auto it = lazyInstances_.find(sd);
+    if (it != lazyInstances_.end() && !it->second.active_)
+        return;
+
+    // prefixes or certificate may have changed: route is added (and 
+    // certificate verified) again
+    logger_->info("update {}/{} iface {}", sd->getUuid(), sd->getProtocol(), sd->getInterface());
+    onServiceResolved(sd);
+}
+
+void App::onServiceRemoved(const shared_ptr<const NdnSd>& sd)
 {
-    if (sd->getPrefix().size())
+    if (discoveredInstances_.count(sd->getUuid()))
     {
-        // TODO: verify instance here
-        //if (verifyInstance(sd->getCertificate()))
+        logger_->info("remove {0}/{1}", sd->getUuid(), sd->getProtocol());
+        flapStats_[{ sd->getUuid(), sd->getProtocol() }].removals_++;
+
+        // inactive lazy instance has no route
+        auto it = lazyInstances_.find(sd);
+        bool routed = (it == lazyInstances_.end() || it->second.active_);
+        if (it != lazyInstances_.end())
         {
-            string hostname(sd->getHostname());
-            string uri = sd->getProtocol() == Proto::TCP ? "tcp://" : "udp://";
-            uri += hostname + ":" + to_string(sd->getPort());
+            lazyInstances_.erase(it);
+            auto range = lazyUuids_.equal_range(sd->getUuid());
+            for (auto u = range.first; u != range.second; ++u)
+                if (u->second == sd)
+                {
+                    lazyUuids_.erase(u);
+                    break;
+                }
+        }
+        hintIndex_.remove(sd);
+        discoveredInstances_.erase(sd->getUuid());
 
-            ptr_lib::shared_ptr<Transport> t;
-            if (sd->getProtocol() == Proto::TCP)
-                t = ptr_lib::make_shared<TcpTransport>();
-            else
-                t = ptr_lib::make_shared<UdpTransport>();
+        if (routed && holdRemoval(sd))
+            return;
 
-            ptr_lib::shared_ptr<Transport::ConnectionInfo> ci;
-            if (sd->getProtocol() == Proto::TCP)
-                ci = ndn::ptr_lib::make_shared<TcpTransport::ConnectionInfo>(hostname.c_str(), sd->getPort());
-            else
-                ci = ndn::ptr_lib::make_shared<UdpTransport::ConnectionInfo>(hostname.c_str(), sd->getPort());
+        if (routed)
+            removeRoute(sd);
+        completeRemoval(sd);
+    }
+}
 
-            int faceId = mfd_->addFace(uri, t, ci);
-            faces_[sd] = faceId;
+void App::completeRemoval(const shared_ptr<const NdnSd>& sd)
+{
+    prefixIndex_.remove(sd);
+    // peer has left (or flapped): it has to be re-discovered on next start
+    peerTable_.remove(sd->getUuid(), sd->getProtocol());
 
-            if (mfd_->addRoute(Name(sd->getPrefix()), faceId))
-            {
-                logger_->info("add route {} face {} id {} ", sd->getPrefix(), uri, sd->getUuid());
-            }
-            else
-            {
-                logger_->error("failed to add route {} face {} instance {}", sd->getPrefix(), uri, sd->getUuid());
-            }
-        }
+    try {
+        if (onInstanceRemove_)
+            onInstanceRemove_(sd);
     }
-    else
+    catch (exception& e)
     {
-        logger_->warn("instance {} has empty prefix. no route created", sd->getUuid());
+        logger_->error("caught exception while calling user callback: {}", e.what());
     }
 }
 
-void App::removeRoute(const shared_ptr<const NdnSd>& sd)
+void App::processEvents()
 {
-    auto it = faces_.find(sd);
-    
-    if (it != faces_.end())
+    mfd_->processEvents();
+
+    // single wait on descriptors of all NdnSd instances
+    NdnSd::runAll(1);
+
+    processHousekeeping();
+}
+
+void App::run(chrono::milliseconds timeout)
+{
+    auto deadline = chrono::steady_clock::now() + timeout;
+    auto process = [this]() {
+        mfd_->processEvents();
+        if (face_)
+            face_->processEvents();
+        processHousekeeping();
+    };
+
+    stopped_ = false;
+    while (!stopped_)
+    {
+        process();
+        watchSockets();
+
+        auto wait = getNextWait();
+        if (timeout.count())
+        {
+            auto left = chrono::ceil<chrono::milliseconds>(deadline - chrono::steady_clock::now());
+            if (left.count() <= 0)
+                break;
+            wait = min(wait, left);
+        }
+
+        // forwarder sockets are watched along with DNS-SD descriptors
+        socketsReady_ = false;
+        NdnSd::runAll((uint32_t)max(wait.count(), (chrono::milliseconds::rep)1));
+
+        // timeouts of Interests local applications sent are theirs to 
+        // process as well
+        bool timersDue = (faceDeadlines_.size() && 
+            faceDeadlines_.top() <= chrono::steady_clock::now());
+        if ((socketsReady_ || timersDue) && timeout.count())
+        {
+            process();
+            break;
+        }
+    }
+}
+
+void App::processHousekeeping()
+{
+    commands_.drain(kCommandBatch);
+    processConnects();
+
+    auto now = chrono::steady_clock::now();
+    while (faceDeadlines_.size() && faceDeadlines_.top() <= now)
+        faceDeadlines_.pop();
+
+    expireProvisionalRoutes();
+    expireHeldRemovals();
+    reapIdleInstances();
+    publishSnapshot();
+    publishForwarderSnapshot();
+}
+
+void App::post(function<void()> command)
+{
+    commands_.post(command);
+}
+
+void App::watchDescriptor(int fd, function<void()> onReadable)
+{
+    // socket scan may have watched it already
+    watchedSockets_.erase(fd);
+    listeningSockets_.erase(fd);
+    appDescriptors_.insert(fd);
+
+    if (!onReadable)
+        NdnSd::unwatchDescriptor(fd);
+    else if (!NdnSd::watchDescriptor(fd, onReadable))
+        logger_->warn("descriptor {} can't be watched", fd);
+}
+
+void App::unwatchDescriptor(int fd)
+{
+    if (!appDescriptors_.erase(fd))
+        return;
+
+    NdnSd::unwatchDescriptor(fd);
+}
+
+void App::watchSockets()
+{
+    // incoming connection: forwarder has accepted it as a socket that
+    // shares local port of the channel
+    auto tcp = protocolPort_.find(Proto::TCP);
+    if (socketsChanged_ && tcp != protocolPort_.end())
     {
-        mfd_->removeFace(it->second);
+        for (auto& s : listSockets())
+        {
+            auto it = watchedSockets_.find(s.first);
+            if ((it == watchedSockets_.end() || it->second != s.second) && 
+                !appDescriptors_.count(s.first) && socketPort(s.first, true) &&
+                socketPort(s.first, false) == tcp->second)
+                watchForwarderSocket(s.first, false);
+        }
+    }
+    socketsChanged_ = false;
+
+    auto now = chrono::steady_clock::now();
+    if (now < nextSocketScan_)
+        return;
+    nextSocketScan_ = now + kSocketScanInterval;
+
+    // sockets forwarder has closed, e.g. of peers that disconnected
+    vector<int> closed;
+    for (auto& it : watchedSockets_)
+        if (socketInode(it.first) != it.second)
+            closed.push_back(it.first);
+    for (int fd : closed)
+        unwatchForwarderSocket(fd);
+}
 
-        logger_->info("face {} removed for service {}", it->second, it->first->getUuid());
+int App::findForwarderSocket(int hint, uint16_t port, bool peer) const
+{
+    auto isNew = [this](int fd, uint64_t inode) {
+        auto it = watchedSockets_.find(fd);
+        return inode && (it == watchedSockets_.end() || it->second != inode) && 
+            !appDescriptors_.count(fd);
+    };
+
+    // unconnected UDP socket has no peer to compare
+    if (hint >= 0 && isNew(hint, socketInode(hint)))
+    {
+        uint16_t p = socketPort(hint, peer);
+        if (p == port || (peer && p == 0))
+            return hint;
     }
+
+    // e.g. another thread has taken the descriptor meanwhile
+    for (auto& s : listSockets())
+        if (isNew(s.first, s.second) && socketPort(s.first, peer) == port)
+            return s.first;
+
+    return -1;
+}
+
+void App::watchForwarderSocket(int fd, bool listening)
+{
+    watchedSockets_[fd] = socketInode(fd);
+    if (listening)
+        listeningSockets_.insert(fd);
     else
-        logger_->warn("remove face error: no face found for discovered service {}", sd->getUuid());
-}
\ No newline at end of file
+        listeningSockets_.erase(fd);
+
+    NdnSd::watchDescriptor(fd, [this, fd]()
+    {
+        socketsReady_ = true;
+        // incoming connection: forwarder accepts it as a new socket
+        if (listeningSockets_.count(fd))
+            socketsChanged_ = true;
+    });
+}
+
+void App::unwatchForwarderSocket(int fd)
+{
+    NdnSd::unwatchDescriptor(fd);
+    watchedSockets_.erase(fd);
+    listeningSockets_.erase(fd);
+}
+
+void App::addFaceDeadline(chrono::milliseconds delay)
+{
+    faceDeadlines_.push(chrono::steady_clock::now() + max(delay, chrono::milliseconds(0)));
+}
+
+chrono::milliseconds App::getNextWait() const
+{
+    // forwarder sockets are not known: it is polled, as processEvents() does
+    if (watchedSockets_.empty())
+        return chrono::milliseconds(1);
+
+    auto now = chrono::steady_clock::now();
+    auto next = min(nextSocketScan_, nextForwarderSnapshot_);
+
+    if (faceDeadlines_.size())
+        next = min(next, faceDeadlines_.top());
+    if (provisionalRoutes_.size())
+        next = min(next, warmStartDeadline_);
+    for (auto& it : heldRemovals_)
+        next = min(next, it.second.deadline_);
+    if (lazy_)
+        next = min(next, nextReap_);
+    if (connects_.size())
+        next = min(next, now + kConnectPollInterval);
+
+    return chrono::ceil<chrono::milliseconds>(max(next - now, chrono::steady_clock::duration(0)));
+}
+
+uint16_t App::getListenPort(Proto protocol) const
+{
+    auto it = protocolPort_.find(protocol);
+    return (it != protocolPort_.end() ? (uint16_t)it->second : 0);
+}
+
+void App::setLazyResolve(bool enable, chrono::milliseconds idleTimeout)
+{
+    lazy_ = enable;
+    idleTimeout_ = idleTimeout;
+}
+
+void App::addLocalTransport(const shared_ptr<helpers::LocalTransport>& transport)
+{
+    localTransports_.push_back(transport);
+    // run() returns for timeouts of these Interests, lazy mode resolves 
+    // peers for them
+    transport->setOnInterest([this](const Interest& interest)
+    {
+        auto lifetime = chrono::duration_cast<chrono::milliseconds>(interest.getInterestLifetime());
+        addFaceDeadline(lifetime.count() >= 0 ? lifetime : kDefaultInterestLifetime);
+
+        if (lazy_)
+            onLocalInterest(interest);
+    });
+}
+
+void App::onLocalInterest(const Interest& interest)
+{
+    auto& name = interest.getName();
+    auto now = chrono::steady_clock::now();
+    for (auto& sd : prefixIndex_.longestPrefixMatch(name))
+    {
+        auto it = lazyInstances_.find(sd);
+        if (it != lazyInstances_.end())
+            it->second.lastUsed_ = now;
+    }
+
+    // own and control (localhost, localhop) Interests never need a peer
+    if (isRouted(name) || Name(params_.prefix_).match(name) || 
+        identityManager_.getAppIdentity().match(name) ||
+        (name.size() && (name.get(0).toEscapedString() == "localhost" ||
+            name.get(0).toEscapedString() == "localhop")))
+        return;
+
+    // peers named in the Interest, then peers that served it before
+    vector<shared_ptr<const NdnSd>> candidates;
+    for (size_t i = 0; i < name.size() && lazyUuids_.size(); ++i)
+    {
+        auto range = lazyUuids_.equal_range(name.get(i).toEscapedString());
+        for (auto it = range.first; it != range.second; ++it)
+        {
+            auto lazy = lazyInstances_.find(it->second);
+            if (lazy != lazyInstances_.end() && !lazy->second.active_)
+                candidates.push_back(it->second);
+        }
+    }
+
+    for (auto& sd : hintIndex_.longestPrefixMatch(name))
+        candidates.push_back(sd);
+
+    if (candidates.size())
+    {
+        logger_->debug("no route for {}, resolving {} peer(s)", name.toUri(), candidates.size());
+        for (auto& sd : candidates)
+            activateInstance(sd, true);
+        return;
+    }
+
+    // no hints: try a few peers, those of our subtype first. retransmissions
+    // of the same Interest don't start another batch. these are guesses, so 
+    // resolves other peers need are not held up by them
+    auto last = lastFallback_.find(name);
+    if (last != lastFallback_.end() && now - last->second < kLazyFallbackInterval)
+        return;
+
+    for (int sameSubtype = 1; sameSubtype >= 0; --sameSubtype)
+        for (auto& it : lazyInstances_)
+            if (!it.second.active_ && candidates.size() < kLazyFallbackBatch &&
+                (it.first->getSubtype() == params_.subtype_) == (bool)sameSubtype)
+                candidates.push_back(it.first);
+
+    if (candidates.empty())
+        return;
+
+    lastFallback_[name] = now;
+    logger_->debug("no route for {}, resolving {} peer(s) of {}", name.toUri(), 
+        candidates.size(), lazyInstances_.size());
+
+    for (auto& sd : candidates)
+        activateInstance(sd, false);
+}
+
+bool App::isRouted(const Name& name) const
+{
+    // routes forwarder has: instances that are still resolving or fetching
+    // certificate are known in prefixIndex_, but have none yet
+    return !routeIndex_.longestPrefixMatch(name).empty();
+}
+
+void App::indexRoutes(int faceId)
+{
+    if (!lazy_)
+        return;
+
+    vector<Name> prefixes;
+    auto key = pooledFaces_.find(faceId);
+    if (key != pooledFaces_.end())
+        for (auto& it : facePool_[key->second].prefixRefs_)
+            prefixes.push_back(Name(it.first));
+
+    routeIndex_.insert(faceId, prefixes);
+}
+
+void App::activateInstance(const shared_ptr<const NdnSd>& sd, bool priority)
+{
+    auto it = lazyInstances_.find(sd);
+    if (it == lazyInstances_.end() || it->second.active_)
+        return;
+
+    it->second.active_ = true;
+    it->second.lastUsed_ = chrono::steady_clock::now();
+    hintIndex_.remove(sd);
+
+    resolveInstance(it->second.browser_, sd, priority);
+}
+
+void App::reapIdleInstances()
+{
+    auto now = chrono::steady_clock::now();
+    if (!lazy_ || now < nextReap_)
+        return;
+
+    nextReap_ = now + max(idleTimeout_ / 4, chrono::milliseconds(100));
+
+    for (auto it = lastFallback_.begin(); it != lastFallback_.end();)
+        if (now - it->second >= kLazyFallbackInterval)
+            it = lastFallback_.erase(it);
+        else
+            ++it;
+
+    for (auto& it : lazyInstances_)
+    {
+        auto& sd = it.first;
+        auto& instance = it.second;
+
+        // instance that is still resolving or fetching certificate has no
+        // face yet, and isn't idle. priority instances are kept
+        if (!instance.active_ || now - instance.lastUsed_ < idleTimeout_ ||
+            !faces_.count(sd) || isPriorityInstance(sd->getUuid()))
+            continue;
+
+        logger_->info("reap idle {}/{}", sd->getUuid(), sd->getProtocol());
+        removeRoute(sd);
+        prefixIndex_.remove(sd);
+        instance.active_ = false;
+
+        auto known = knownPrefixes_.find(sd->getUuid());
+        if (known != knownPrefixes_.end())
+            hintIndex_.insert(sd, known->second);
+    }
+}
+
+bool App::setPeerTable(const string& path, chrono::milliseconds gracePeriod)
+{
+    warmStartGrace_ = gracePeriod;
+
+    if (!peerTable_.open(path))
+    {
+        logger_->error("failed to open peer table {}, warm start is disabled", path);
+        return false;
+    }
+
+    logger_->info("peer table {}: {} peers", path, peerTable_.size());
+    return true;
+}
+
+void App::addProvisionalRoutes()
+{
+    warmStartDeadline_ = chrono::steady_clock::now() + warmStartGrace_;
+
+    for (auto& p : peerTable_.load())
+    {
+        if (p.uuid_ == instanceId_)
+            continue;
+        // all-zero digest: peer advertised no certificate
+        if (!allowUnverified_ && 
+            all_of(p.certDigest_.begin(), p.certDigest_.end(), [](uint8_t b) { return b == 0; }))
+            continue;
+
+        logger_->info("provisional route for {}/{} (last seen {}s ago)", p.uuid_, p.protocol_,
+            chrono::duration_cast<chrono::seconds>(chrono::system_clock::now() - p.lastSeen_).count());
+
+        if (lazy_)
+        {
+            vector<Name> prefixes;
+            for (auto& prefix : p.prefixes_)
+                prefixes.push_back(Name(prefix));
+            knownPrefixes_[p.uuid_] = prefixes;
+        }
+
+        connectFace(p.protocol_, p.hostname_, p.port_, [this, p](bool connected)
+        {
+            if (!connected)
+            {
+                logger_->info("peer {}/{} is not reachable, no provisional route", 
+                    p.uuid_, p.protocol_);
+                peerTable_.remove(p.uuid_, p.protocol_);
+                return;
+            }
+            // discovered meanwhile, its route is added once it resolves
+            if (discoveredInstances_.count(p.uuid_) || 
+                chrono::steady_clock::now() >= warmStartDeadline_)
+                return;
+
+            FaceUse face;
+            if (addFace(p.protocol_, p.hostname_, p.port_, p.prefixes_, p.uuid_, face))
+            {
+                provisionalRoutes_[{ p.uuid_, p.protocol_ }] = { p, face };
+                onFirstRoute(false);
+            }
+        });
+    }
+}
+
+void App::expireProvisionalRoutes()
+{
+    if (provisionalRoutes_.empty() || chrono::steady_clock::now() < warmStartDeadline_)
+        return;
+
+    for (auto& it : provisionalRoutes_)
+    {
+        logger_->info("provisional route for {}/{} was not confirmed, removing",
+            it.first.first, it.first.second);
+
+        removeFace(it.second.face_);
+        peerTable_.remove(it.first.first, it.first.second);
+    }
+    provisionalRoutes_.clear();
+}
+
+bool App::confirmProvisionalRoute(const shared_ptr<const NdnSd>& sd)
+{
+    auto it = provisionalRoutes_.find({ sd->getUuid(), sd->getProtocol() });
+    if (it == provisionalRoutes_.end())
+        return false;
+
+    auto& p = it->second.peer_;
+    FaceUse face = it->second.face_;
+    // peer table keeps the address route was created with, and digest of
+    // the certificate peer advertised then
+    bool same = (p.hostname_ == peerAddress(sd) && p.port_ == sd->getPort() && 
+        p.prefixes_ == sd->getPrefixes() && p.certDigest_ == peerCertificateDigest(sd));
+    // certificate of the previous run is not trusted
+    bool confirmed = (same && isCertificateVerified(sd));
+    provisionalRoutes_.erase(it);
+    
+    if (confirmed)
+    {
+        logger_->info("provisional route for {}/{} confirmed", sd->getUuid(), sd->getProtocol());
+        faces_[sd] = face;
+        onFirstRoute(true);
+    }
+    else if (same)
+    {
+        // face is kept while certificate is fetched, and replaced by the 
+        // one addRoute() sets up
+        logger_->info("provisional route for {}/{} waits for certificate {}", sd->getUuid(), 
+            sd->getProtocol(), sd->getCertificate());
+        faces_[sd] = face;
+    }
+    else
+    {
+        logger_->info("peer {}/{} has changed, replacing provisional route", 
+            sd->getUuid(), sd->getProtocol());
+        removeFace(face);
+    }
+
+    return confirmed;
+}
+
+void App::setFlapDamping(chrono::milliseconds holdTime)
+{
+    flapHoldTime_ = holdTime;
+}
+
+bool App::setTrustAnchor(const string& path)
+{
+    try
+    {
+        ifstream file(path, ios::binary);
+        if (!file)
+            throw runtime_error(strerror(errno));
+
+        string contents((istreambuf_iterator<char>(file)), istreambuf_iterator<char>());
+        vector<uint8_t> wire;
+        // binary certificate starts with Data TLV type
+        if (contents.size() && (uint8_t)contents[0] == 0x06)
+            wire.assign(contents.begin(), contents.end());
+        else
+            fromBase64(contents, wire);
+
+        auto anchor = make_shared<CertificateV2>();
+        anchor->wireDecode(Blob(wire));
+        trustAnchor_ = anchor;
+    }
+    catch (exception& e)
+    {
+        logger_->error("failed to load trust anchor {}: {}", path, e.what());
+        return false;
+    }
+
+    logger_->info("trust anchor {}", trustAnchor_->getName());
+    return true;
+}
+
+void App::setSkipValidation(bool skip)
+{
+    skipValidation_ = skip;
+}
+
+void App::setAllowUnverified(bool allow)
+{
+    allowUnverified_ = allow;
+}
+
+bool App::holdRemoval(const shared_ptr<const NdnSd>& sd)
+{
+    if (flapHoldTime_.count() == 0)
+        return false;
+
+    auto deadline = chrono::steady_clock::now() + flapHoldTime_;
+    auto held = heldRemovals_.find({ sd->getUuid(), sd->getProtocol() });
+    if (held != heldRemovals_.end())
+    {
+        // removed again before it resolved: face is still the one of the
+        // first removal
+        held->second.readded_ = false;
+        held->second.deadline_ = deadline;
+        logger_->info("hold face {} of {}/{} for {}ms", held->second.face_.faceId_, 
+            sd->getUuid(), sd->getProtocol(), flapHoldTime_.count());
+        return true;
+    }
+
+    // face that waits for certificate is routed for certificate name only
+    auto it = faces_.find(sd);
+    if (it == faces_.end() || !isCertificateVerified(sd))
+        return false;
+
+    heldRemovals_[{ sd->getUuid(), sd->getProtocol() }] = { sd, it->second, peerAddress(sd), 
+        sd->getPort(), sd->getPrefixes(), sd->getCertificateDigest(), false, deadline };
+    logger_->info("hold face {} of {}/{} for {}ms", it->second.faceId_, sd->getUuid(), 
+        sd->getProtocol(), flapHoldTime_.count());
+    faces_.erase(it);
+
+    return true;
+}
+
+bool App::cancelHeldRemoval(const shared_ptr<const NdnSd>& sd)
+{
+    auto it = heldRemovals_.find({ sd->getUuid(), sd->getProtocol() });
+    if (it == heldRemovals_.end() || it->second.readded_)
+        return false;
+
+    // face is kept till resolve confirms it, and for no longer than hold 
+    // time again
+    it->second.readded_ = true;
+    it->second.deadline_ = chrono::steady_clock::now() + flapHoldTime_;
+
+    auto& stats = flapStats_[it->first];
+    stats.flaps_++;
+    stats.lastFlap_ = chrono::system_clock::now();
+    logger_->info("{}/{} flapped ({} of {} removals), face {} kept", sd->getUuid(), 
+        sd->getProtocol(), stats.flaps_, stats.removals_, it->second.face_.faceId_);
+
+    return true;
+}
+
+bool App::confirmHeldRoute(const shared_ptr<const NdnSd>& sd)
+{
+    auto it = heldRemovals_.find({ sd->getUuid(), sd->getProtocol() });
+    if (it == heldRemovals_.end() || !it->second.readded_)
+        return false;
+
+    auto& h = it->second;
+    // face of a peer that advertises another certificate now is not reused,
+    // the new one is fetched and verified first
+    bool same = (h.hostname_ == peerAddress(sd) && h.port_ == sd->getPort() && 
+        h.prefixes_ == sd->getPrefixes() && h.certDigest_ == sd->getCertificateDigest() &&
+        isCertificateVerified(sd));
+
+    if (same)
+    {
+        logger_->info("reuse face {} for re-added {}/{}", h.face_.faceId_, sd->getUuid(), 
+            sd->getProtocol());
+        faces_[sd] = h.face_;
+        flapStats_[it->first].facesReused_++;
+    }
+    else
+    {
+        logger_->info("peer {}/{} has changed, replacing held face {}", 
+            sd->getUuid(), sd->getProtocol(), h.face_.faceId_);
+        removeFace(h.face_);
+    }
+
+    prefixIndex_.remove(h.sd_);
+    heldRemovals_.erase(it);
+    return same;
+}
+
+void App::expireHeldRemovals()
+{
+    if (heldRemovals_.empty())
+        return;
+
+    auto now = chrono::steady_clock::now();
+    for (auto it = heldRemovals_.begin(); it != heldRemovals_.end(); )
+    {
+        if (now < it->second.deadline_)
+        {
+            ++it;
+            continue;
+        }
+
+        HeldRemoval h = it->second;
+        it = heldRemovals_.erase(it);
+
+        removeFace(h.face_);
+        logger_->info("face {} removed for service {} after hold", h.face_.faceId_, h.sd_->getUuid());
+
+        // re-added instance that did not resolve in time gets a face of its
+        // own once it does
+        if (h.readded_)
+            prefixIndex_.remove(h.sd_);
+        else
+            completeRemoval(h.sd_);
+    }
+}
+
+void App::onFirstRoute(bool confirmed)
+{
+    auto t = chrono::duration_cast<chrono::milliseconds>(chrono::steady_clock::now() - startTime_);
+
+    if (timeToFirstRoute_.count() == 0)
+    {
+        timeToFirstRoute_ = max(t, chrono::milliseconds(1));
+        logger_->info("time to first route: {}ms ({} start)", timeToFirstRoute_.count(),
+            (confirmed ? "cold" : "warm"));
+    }
+    if (confirmed && timeToFirstConfirmedRoute_.count() == 0)
+    {
+        timeToFirstConfirmedRoute_ = max(t, chrono::milliseconds(1));
+        logger_->info("time to first confirmed route: {}ms", timeToFirstConfirmedRoute_.count());
+    }
+}
+
+shared_ptr<const ServiceSnapshot> App::getSnapshot() const
+{
+    return atomic_load(&snapshot_);
+}
+
+shared_ptr<const ForwarderSnapshot> App::getForwarderSnapshot() const
+{
+    return atomic_load(&forwarderSnapshot_);
+}
+
+void App::publishForwarderSnapshot()
+{
+    auto now = chrono::steady_clock::now();
+    if (!forwarderChanged_ && now < nextForwarderSnapshot_)
+        return;
+
+    forwarderChanged_ = false;
+    nextForwarderSnapshot_ = now + kForwarderSnapshotInterval;
+
+    auto snapshot = make_shared<ForwarderSnapshot>();
+    snapshot->generation_ = forwarderSnapshot_->generation_ + 1;
+    for (auto& [faceId, faceUri] : mfd_->getFaces())
+        snapshot->faces_[faceId] = faceUri;
+    for (auto& [route, faces] : mfd_->getRoutes())
+    {
+        auto& faceIds = snapshot->routes_[fmt::format("{}", route)];
+        for (auto faceId : faces)
+            faceIds.push_back(faceId);
+    }
+
+    // readers keep the previous one till they are done with it
+    if (snapshot->faces_ != forwarderSnapshot_->faces_ || 
+        snapshot->routes_ != forwarderSnapshot_->routes_)
+        atomic_store(&forwarderSnapshot_, shared_ptr<const ForwarderSnapshot>(snapshot));
+}
+
+void App::publishSnapshot()
+{
+    // rebuild only if any of NdnSd instances published new snapshot
+    vector<uint64_t> generations;
+    generations.reserve(ndnsds_.size());
+    for (auto& sd : ndnsds_)
+        generations.push_back(sd->getSnapshotGeneration());
+
+    if (generations == snapshotGenerations_)
+        return;
+
+    auto snapshot = make_shared<ServiceSnapshot>();
+    snapshot->generation_ = snapshot_->generation_ + 1;
+    for (auto& sd : ndnsds_)
+    {
+        auto s = sd->getSnapshot();
+        snapshot->services_.insert(snapshot->services_.end(), 
+            s->services_.begin(), s->services_.end());
+    }
+
+    atomic_store(&snapshot_, shared_ptr<const ServiceSnapshot>(snapshot));
+    snapshotGenerations_.swap(generations);
+}
+
+vector<shared_ptr<const ndnsd::NdnSd>>
+App::getDiscoveredNodes() const
+{
+    vector<shared_ptr<const ndnsd::NdnSd>> nodes;
+
+    for (auto& sd : ndnsds_)
+        sd->forEachDiscoveredService([&nodes](const shared_ptr<const NdnSd>& s) 
+        {
+            nodes.push_back(s);
+        });
+
+    return nodes;
+}
+
+vector<shared_ptr<const NdnSd>> App::findNodesServing(const Name& name) const
+{
+    return prefixIndex_.longestPrefixMatch(name);
+}
+
+vector<shared_ptr<const NdnSd>> App::findNodesUnder(const Name& prefix) const
+{
+    return prefixIndex_.findUnder(prefix);
+}
+
+void App::printAppInfo()
+{
+    fmt::print(R"(
+{}
+    instance id {}
+    announce NDN service: {}, subtype {}
+    prefix {}
+    listen ports {}
+
+)",
+appName_,
+fmt::format(fmt::emphasis::bold, "{}", instanceId_),
+fmt::format(fmt::emphasis::bold, "{}", protocols_), params_.subtype_,
+fmt::format(fmt::emphasis::bold, "{}", params_.prefix_),
+fmt::format(fmt::emphasis::bold, "{}", protocolPort_)
+);
+    }
+
+void App::addRoute(const shared_ptr<const NdnSd>& sd)
+{
+    if (!sd->getPrefix().size())
+    {
+        logger_->warn("instance {} has empty prefix. no route created", sd->getUuid());
+        return;
+    }
+
+    if (!sd->getCertificate().size() || !sd->getCertificateDigest().size())
+    {
+        if (!allowUnverified_)
+        {
+            logger_->warn("instance {} advertises no certificate. no route created", sd->getUuid());
+            // e.g. provisional face kept till discovery
+            if (faces_.count(sd) || pendingFaces_.count(sd))
+                removeRoute(sd);
+            return;
+        }
+        logger_->warn("instance {} advertises no certificate. route is not verified", sd->getUuid());
+    }
+    else
+    {
+        auto it = certificates_.find(sd->getCertificateDigest());
+        if (it == certificates_.end())
+        {
+            // route is added once certificate is fetched and verified
+            fetchCertificate(sd);
+            return;
+        }
+        if (!verifyInstance(sd, *it->second))
+            return;
+    }
+
+    addInstanceFace(sd, sd->getPrefixes(), [this](int) { onFirstRoute(true); });
+}
+
+void App::fetchCertificate(const shared_ptr<const NdnSd>& sd)
+{
+    // face is routed only for certificate name until certificate is verified
+    addInstanceFace(sd, { sd->getCertificate() }, [this, sd](int faceId) {
+        requestCertificate(sd, faceId);
+    });
+}
+
+void App::requestCertificate(const shared_ptr<const NdnSd>& sd, int faceId)
+{
+    logger_->info("fetch certificate {} of {}", sd->getCertificate(), sd->getUuid());
+
+    Interest interest(sd->getCertificate());
+    interest.setMustBeFresh(false);
+    interest.setInterestLifetime(kCertFetchTimeout);
+    addFaceDeadline(kCertFetchTimeout);
+
+    // service may be removed, re-resolved or updated while certificate is 
+    // being fetched. pooled face keeps its id, so certificate is compared too
+    auto isPending = [this, sd, faceId, certName = sd->getCertificate()]() {
+        auto it = faces_.find(sd);
+        return it != faces_.end() && it->second.faceId_ == faceId && sd->getCertificate() == certName;
+    };
+
+    face_->expressInterest(interest,
+        [this, sd, isPending](const ptr_lib::shared_ptr<const Interest>&, 
+            const ptr_lib::shared_ptr<Data>& data)
+    {
+        if (!isPending())
+            return;
+
+        shared_ptr<CertificateV2> cert;
+        try
+        {
+            cert = make_shared<CertificateV2>(*data);
+        }
+        catch (exception& e)
+        {
+            logger_->error("failed to decode certificate of {}: {}", sd->getUuid(), e.what());
+        }
+
+        if (!cert || !verifyInstance(sd, *cert))
+        {
+            removeRoute(sd);
+            return;
+        }
+
+        validateCertificate(sd, cert, 0, isPending, [this, sd, cert](bool valid)
+        {
+            if (!valid)
+            {
+                removeRoute(sd);
+                return;
+            }
+
+            certificates_[sd->getCertificateDigest()] = cert;
+
+            if (addRoutes(faces_[sd], sd->getPrefixes(), sd->getUuid()))
+                onFirstRoute(true);
+        });
+    },
+        [this, sd, isPending](const ptr_lib::shared_ptr<const Interest>& interest)
+    {
+        if (!isPending())
+            return;
+
+        logger_->error("timeout fetching certificate {} of {}", interest->getName(), sd->getUuid());
+        removeRoute(sd);
+    });
+}
+
+bool App::isCertificateVerified(const shared_ptr<const NdnSd>& sd) const
+{
+    // routes of such instances are not verified, see addRoute()
+    if (!sd->getCertificate().size() || !sd->getCertificateDigest().size())
+        return allowUnverified_;
+
+    auto it = certificates_.find(sd->getCertificateDigest());
+    return it != certificates_.end() && verifyInstance(sd, *it->second);
+}
+
+bool App::verifyInstance(const shared_ptr<const NdnSd>& sd, const CertificateV2& cert) const
+{
+    if (cert.getName() != Name(sd->getCertificate()) || 
+        certificateDigest(cert) != sd->getCertificateDigest())
+    {
+        logger_->error("certificate {} does not match one advertised by {}", 
+            cert.getName(), sd->getUuid());
+        return false;
+    }
+    if (!cert.isValid())
+    {
+        logger_->error("certificate {} of {} is not valid", cert.getName(), sd->getUuid());
+        return false;
+    }
+
+    return true;
+}
+
+void App::validateCertificate(const shared_ptr<const NdnSd>& sd, const shared_ptr<CertificateV2>& cert,
+    int depth, function<bool()> isPending, function<void(bool)> onValidated)
+{
+    if (skipValidation_)
+    {
+        onValidated(true);
+        return;
+    }
+    if (!trustAnchor_)
+    {
+        logger_->error("no trust anchor to validate certificate {} of {} with", cert->getName(), 
+            sd->getUuid());
+        onValidated(false);
+        return;
+    }
+    if (!cert->isValid() || !KeyLocator::canGetFromSignature(cert->getSignature()))
+    {
+        logger_->error("certificate {} of {} is not valid", cert->getName(), sd->getUuid());
+        onValidated(false);
+        return;
+    }
+
+    Name issuerKey = KeyLocator::getFromSignature(cert->getSignature()).getKeyName();
+    if (CertificateV2::isValidName(issuerKey))
+        issuerKey = CertificateV2::extractKeyNameFromCertName(issuerKey);
+
+    // the anchor itself, or an issuer validated for another peer
+    shared_ptr<CertificateV2> issuer;
+    if (issuerKey == trustAnchor_->getKeyName())
+        issuer = trustAnchor_;
+    else
+    {
+        auto it = issuers_.find(issuerKey);
+        if (it != issuers_.end() && it->second->isValid())
+            issuer = it->second;
+    }
+
+    if (issuer)
+    {
+        bool valid = VerificationHelpers::verifyDataSignature(*cert, *issuer);
+        if (!valid)
+            logger_->error("certificate {} of {} is not signed by {}", cert->getName(), 
+                sd->getUuid(), issuer->getName());
+        onValidated(valid);
+        return;
+    }
+
+    // self-signed certificate other than the anchor ends the chain too
+    auto face = faces_.find(sd);
+    if (depth >= kMaxCertificateChain || issuerKey == cert->getKeyName() ||
+        face == faces_.end() || !addRoutes(face->second, { issuerKey.toUri() }, sd->getUuid()))
+    {
+        logger_->error("certificate {} of {} does not chain to trust anchor {}", cert->getName(), 
+            sd->getUuid(), trustAnchor_->getName());
+        onValidated(false);
+        return;
+    }
+
+    // issuer certificate is fetched from the instance, over the face its 
+    // certificate came from
+    logger_->info("fetch issuer certificate {} of {}", issuerKey, sd->getUuid());
+
+    Interest interest(issuerKey);
+    interest.setCanBePrefix(true);
+    interest.setMustBeFresh(false);
+    interest.setInterestLifetime(kCertFetchTimeout);
+    addFaceDeadline(kCertFetchTimeout);
+
+    face_->expressInterest(interest,
+        [this, sd, cert, depth, issuerKey, isPending, onValidated](const ptr_lib::shared_ptr<const Interest>&, 
+            const ptr_lib::shared_ptr<Data>& data)
+    {
+        if (!isPending())
+            return;
+
+        shared_ptr<CertificateV2> issuer;
+        try
+        {
+            issuer = make_shared<CertificateV2>(*data);
+        }
+        catch (exception& e)
+        {
+            logger_->error("failed to decode issuer certificate of {}: {}", sd->getUuid(), e.what());
+        }
+
+        if (!issuer || issuer->getKeyName() != issuerKey ||
+            !VerificationHelpers::verifyDataSignature(*cert, *issuer))
+        {
+            logger_->error("certificate {} of {} is not signed by {}", cert->getName(), 
+                sd->getUuid(), issuerKey);
+            onValidated(false);
+            return;
+        }
+
+        validateCertificate(sd, issuer, depth + 1, isPending, [this, issuer, onValidated](bool valid)
+        {
+            if (valid)
+                issuers_[issuer->getKeyName()] = issuer;
+            onValidated(valid);
+        });
+    },
+        [this, sd, isPending, onValidated](const ptr_lib::shared_ptr<const Interest>& interest)
+    {
+        if (!isPending())
+            return;
+
+        logger_->error("timeout fetching issuer certificate {} of {}", interest->getName(), 
+            sd->getUuid());
+        onValidated(false);
+    });
+}
+
+void App::addInstanceFace(const shared_ptr<const NdnSd>& sd, const vector<string>& prefixes,
+    function<void(int)> onFace)
+{
+    uint64_t setup = ++faceSetups_;
+    pendingFaces_[sd] = setup;
+
+    connectFace(sd->getProtocol(), peerAddress(sd), sd->getPort(), 
+        [this, sd, prefixes, onFace, setup](bool connected)
+    {
+        auto it = pendingFaces_.find(sd);
+        if (it == pendingFaces_.end() || it->second != setup)
+            return;
+        pendingFaces_.erase(it);
+
+        if (!connected)
+        {
+            logger_->error("instance {} is not reachable at {}:{}, no face added", 
+                sd->getUuid(), peerAddress(sd), sd->getPort());
+
+            // face it had (e.g. a provisional one waiting for certificate) 
+            // is not confirmed either
+            auto old = faces_.find(sd);
+            if (old != faces_.end())
+            {
+                removeFace(old->second);
+                faces_.erase(old);
+            }
+            return;
+        }
+
+        FaceUse face;
+        if (!addFace(sd->getProtocol(), peerAddress(sd), sd->getPort(), prefixes, 
+            sd->getUuid(), face))
+            return;
+
+        // re-resolved instance: face it had is released after the new one is
+        // taken, so that a face they share stays, and only the routes it no
+        // longer has are removed
+        auto old = faces_.find(sd);
+        if (old != faces_.end())
+            removeFace(old->second);
+        faces_[sd] = face;
+
+        onFace(face.faceId_);
+    });
+}
+
+void App::connectFace(Proto protocol, const string& hostname, uint16_t port,
+    function<void(bool)> onConnect)
+{
+    FaceKey key{ protocol, hostname, port };
+    bool numeric = lookupHost(hostname, true).size();
+    if (facePool_.count(key) || (protocol != Proto::TCP && numeric))
+    {
+        onConnect(true);
+        return;
+    }
+
+    // instances at the same address wait for one connect
+    auto it = connects_.find(key);
+    if (it == connects_.end())
+    {
+        PendingConnect connect;
+        connect.fd_ = -1;
+        connect.deadline_ = chrono::steady_clock::now() + kConnectTimeout;
+
+        if (numeric)
+        {
+            string error;
+            connect.fd_ = startConnect(hostname, port, error);
+            if (connect.fd_ < 0)
+            {
+                if (error.size())
+                    logger_->warn("failed to connect to {}:{}: {}", hostname, port, error);
+                // platform has no non-blocking connect: forwarder connects
+                onConnect(error.empty());
+                return;
+            }
+
+            // socket scan leaves it alone
+            watchDescriptor(connect.fd_, nullptr);
+            logger_->debug("connecting to {}:{}", hostname, port);
+        }
+        else
+        {
+#ifndef _WIN32
+            connect.lookup_ = async(launch::async, lookupHost, hostname, false);
+            logger_->debug("looking up {}", hostname);
+#else
+            onConnect(true);
+            return;
+#endif
+        }
+
+        it = connects_.insert({ key, move(connect) }).first;
+    }
+
+    it->second.waiters_.push_back(onConnect);
+}
+
+void App::processConnects()
+{
+#ifndef _WIN32
+    for (auto it = abandonedLookups_.begin(); it != abandonedLookups_.end(); )
+        if (it->wait_for(chrono::seconds(0)) == future_status::ready)
+            it = abandonedLookups_.erase(it);
+        else
+            ++it;
+
+    // waiters are called once connects_ is updated: they may start connects
+    vector<tuple<FaceKey, bool, vector<function<void(bool)>>>> completed;
+    auto now = chrono::steady_clock::now();
+
+    for (auto it = connects_.begin(); it != connects_.end(); )
+    {
+        auto& key = it->first;
+        auto& connect = it->second;
+        string address, error;
+        bool connected = false;
+
+        if (connect.lookup_.valid() && 
+            connect.lookup_.wait_for(chrono::seconds(0)) == future_status::ready)
+        {
+            address = connect.lookup_.get();
+            if (address.empty())
+                error = "host is not found";
+            // UDP face only needs the address
+            else if (get<0>(key) != Proto::TCP)
+                connected = true;
+            else if ((connect.fd_ = startConnect(address, get<2>(key), error)) >= 0)
+            {
+                watchDescriptor(connect.fd_, nullptr);
+                logger_->debug("connecting to {} at {}:{}", get<1>(key), address, get<2>(key));
+            }
+            else if (error.empty())
+                error = "address is not supported";
+        }
+
+        if (!connected && error.empty() && connect.fd_ >= 0)
+        {
+            struct pollfd fd = { connect.fd_, POLLOUT, 0 };
+            if (poll(&fd, 1, 0) > 0)
+            {
+                int err = 0;
+                socklen_t len = sizeof(err);
+                if (getsockopt(connect.fd_, SOL_SOCKET, SO_ERROR, &err, &len) < 0)
+                    err = errno;
+
+                if (err)
+                    error = strerror(err);
+                else
+                    connected = true;
+            }
+        }
+
+        if (!connected && error.empty())
+        {
+            if (now < connect.deadline_)
+            {
+                ++it;
+                continue;
+            }
+
+            error = strerror(ETIMEDOUT);
+            // lookup can't be cancelled: it is let finish
+            if (connect.lookup_.valid())
+                abandonedLookups_.push_back(move(connect.lookup_));
+        }
+
+        if (connect.fd_ >= 0)
+            unwatchDescriptor(connect.fd_);
+
+        if (connected)
+        {
+            logger_->debug("connected to {}:{}", get<1>(key), get<2>(key));
+            // forwarder's transport takes the socket over, it doesn't connect
+            // again. the first waiter that adds the face takes it
+            connected_[key] = { connect.fd_, address };
+        }
+        else
+        {
+            logger_->warn("failed to connect to {}:{}: {}", get<1>(key), get<2>(key), error);
+            if (connect.fd_ >= 0)
+                close(connect.fd_);
+        }
+
+        completed.push_back({ key, connected, move(connect.waiters_) });
+        it = connects_.erase(it);
+    }
+
+    for (auto& c : completed)
+    {
+        for (auto& onConnect : get<2>(c))
+            onConnect(get<1>(c));
+
+        // no waiter has added the face, e.g. instance was removed meanwhile
+        auto left = connected_.find(get<0>(c));
+        if (left != connected_.end())
+        {
+            if (left->second.first >= 0)
+                close(left->second.first);
+            connected_.erase(left);
+        }
+    }
+#endif
+}
+
+bool App::addFace(Proto protocol, const string& hostname, uint16_t port,
+    const vector<string>& prefixes, const string& uuid, FaceUse& face)
+{
+    face = FaceUse();
+
+    FaceKey key{ protocol, hostname, port };
+    auto pooled = facePool_.find(key);
+    if (pooled != facePool_.end())
+    {
+        face.faceId_ = pooled->second.faceId_;
+        pooled->second.refs_++;
+        logger_->info("share face {} with instance {} ({} users)", face.faceId_, uuid, 
+            pooled->second.refs_);
+
+        if (addRoutes(face, prefixes, uuid))
+            return true;
+
+        removeFace(face);
+        return false;
+    }
+
+    string uri = protocol == Proto::TCP ? "tcp://" : "udp://";
+    if (hostname.find(':') != string::npos)
+        uri += "[" + hostname + "]:" + to_string(port);
+    else
+        uri += hostname + ":" + to_string(port);
+
+    // socket connected by connectFace() or address it has looked up
+    int connectedFd = -1;
+    string address = hostname;
+    auto connected = connected_.find(key);
+    if (connected != connected_.end())
+    {
+        connectedFd = connected->second.first;
+        if (connected->second.second.size())
+            address = connected->second.second;
+        connected_.erase(connected);
+    }
+
+    ptr_lib::shared_ptr<Transport> t;
+    if (connectedFd >= 0)
+        t = ptr_lib::make_shared<helpers::ConnectedTransport>(connectedFd);
+    else if (protocol == Proto::TCP)
+        t = ptr_lib::make_shared<TcpTransport>();
+    else
+        t = ptr_lib::make_shared<UdpTransport>();
+
+    ptr_lib::shared_ptr<Transport::ConnectionInfo> ci;
+    if (protocol == Proto::TCP)
+        ci = ndn::ptr_lib::make_shared<TcpTransport::ConnectionInfo>(address.c_str(), port);
+    else
+        ci = ndn::ptr_lib::make_shared<UdpTransport::ConnectionInfo>(address.c_str(), port);
+
+    int hint = lowestFreeDescriptor();
+    int faceId = mfd_->addFace(uri, t, ci);
+    forwarderChanged_ = true;
+
+    int fd = connectedFd >= 0 ? connectedFd : findForwarderSocket(hint, port, true);
+    if (fd >= 0)
+    {
+        watchForwarderSocket(fd, false);
+        faceSockets_[faceId] = { fd, watchedSockets_[fd] };
+    }
+    else
+        logger_->warn("socket of face {} is not found, run() won't wake up for it", uri);
+    logger_->info("add face {} id {} instance {}", uri, faceId, uuid);
+
+    facePool_[key] = { faceId, 1, {} };
+    pooledFaces_[faceId] = key;
+    face.faceId_ = faceId;
+
+    if (addRoutes(face, prefixes, uuid))
+        return true;
+
+    removeFace(face);
+    return false;
+}
+
+bool App::addRoutes(FaceUse& face, const vector<string>& prefixes, const string& uuid)
+{
+    bool added = false;
+    forwarderChanged_ = true;
+
+    auto key = pooledFaces_.find(face.faceId_);
+    auto pooled = (key != pooledFaces_.end() ? &facePool_[key->second] : nullptr);
+
+    for (auto& prefix : prefixes)
+    {
+        if (find(face.prefixes_.begin(), face.prefixes_.end(), prefix) != face.prefixes_.end())
+        {
+            added = true;
+            continue;
+        }
+
+        // shared face is routed for it by another user
+        if (pooled && pooled->prefixRefs_.count(prefix))
+        {
+            pooled->prefixRefs_[prefix]++;
+            face.prefixes_.push_back(prefix);
+            added = true;
+            continue;
+        }
+
+        if (mfd_->addRoute(Name(prefix), face.faceId_))
+        {
+            logger_->info("add route {} face {} instance {}", prefix, face.faceId_, uuid);
+            added = true;
+            face.prefixes_.push_back(prefix);
+            if (pooled)
+                pooled->prefixRefs_[prefix] = 1;
+        }
+        else
+            logger_->error("failed to add route {} face {} instance {}", prefix, face.faceId_, uuid);
+    }
+
+    indexRoutes(face.faceId_);
+    return added;
+}
+
+void App::removeRoute(const shared_ptr<const NdnSd>& sd)
+{
+    // face that is still connecting is not added
+    bool pending = pendingFaces_.erase(sd);
+    auto it = faces_.find(sd);
+    
+    if (it != faces_.end())
+    {
+        removeFace(it->second);
+
+        logger_->info("face {} removed for service {}", it->second.faceId_, it->first->getUuid());
+        faces_.erase(it);
+    }
+    else if (pending)
+        logger_->info("face setup cancelled for service {}", sd->getUuid());
+    else
+        logger_->warn("remove face error: no face found for discovered service {}", sd->getUuid());
+}
+
+void App::removeFace(const FaceUse& face)
+{
+    forwarderChanged_ = true;
+
+    auto key = pooledFaces_.find(face.faceId_);
+    if (key != pooledFaces_.end())
+    {
+        auto pooled = facePool_.find(key->second);
+        if (--pooled->second.refs_ > 0)
+        {
+            // routes no other user has are removed: the peer may not serve
+            // them anymore
+            auto& prefixRefs = pooled->second.prefixRefs_;
+            for (auto& prefix : face.prefixes_)
+            {
+                auto it = prefixRefs.find(prefix);
+                if (it == prefixRefs.end() || --it->second > 0)
+                    continue;
+
+                prefixRefs.erase(it);
+                if (removeForwarderRoute(*mfd_, Name(prefix), face.faceId_, 0))
+                    logger_->info("remove route {} face {}", prefix, face.faceId_);
+                else
+                    logger_->info("route {} face {} stays till the face is removed", prefix, 
+                        face.faceId_);
+            }
+
+            indexRoutes(face.faceId_);
+            logger_->debug("face {} is still used ({} users)", face.faceId_, pooled->second.refs_);
+            return;
+        }
+
+        facePool_.erase(pooled);
+        pooledFaces_.erase(key);
+    }
+
+    // descriptor number may have been reused by another forwarder socket
+    auto socket = faceSockets_.find(face.faceId_);
+    if (socket != faceSockets_.end())
+    {
+        auto watched = watchedSockets_.find(socket->second.first);
+        if (watched != watchedSockets_.end() && watched->second == socket->second.second)
+            unwatchForwarderSocket(socket->second.first);
+        faceSockets_.erase(socket);
+    }
+
+    indexRoutes(face.faceId_);
+    mfd_->removeFace(face.faceId_);
+}
@@ -1,27 +1,54 @@
 #ifndef __ndnapp_hpp__
 #define __ndnapp_hpp__
 
+#include <chrono>
 #include <functional>
+#include <future>
+#include <map>
+#include <queue>
 #include <set>
 #include <string>
+#include <tuple>
+#include <vector>
 
 #include <spdlog/spdlog.h>
 #include <ndn-sd/ndn-sd.hpp>
 #include <ndn-ind-tools/micro-forwarder/micro-forwarder.hpp>
 
+#include "command-queue.hpp"
 #include "identity-manager.hpp"
+#include "local-transport.hpp"
+#include "peer-table.hpp"
+#include "prefix-index.hpp"
 
 namespace ndnapp
 {
+    // faces and routes of the forwarder, as published for other threads
+    typedef struct _ForwarderSnapshot {
+        uint64_t generation_;
+        std::map<int, std::string> faces_;
+        std::map<std::string, std::vector<int>> routes_;
+    } ForwarderSnapshot;
+
     class App {
     public:
         typedef std::function<void(const std::shared_ptr<const ndnsd::NdnSd>&)> OnInstanceAnnouncement;
         typedef OnInstanceAnnouncement OnInstanceAdd;
         typedef OnInstanceAnnouncement OnInstanceRemove;
 
+        typedef struct _FlapStats {
+            // Removed announcements of the peer
+            uint32_t removals_;
+            // removals cancelled by Added within hold time
+            uint32_t flaps_;
+            // re-added peers which face was reused as is
+            uint32_t facesReused_;
+            std::chrono::system_clock::time_point lastFlap_;
+        } FlapStats;
+
         App(std::string appName, std::string id, const std::shared_ptr<spdlog::logger>& logger,
             ndn::Face* face, ndn::KeyChain* keyChain, bool filterInterface = true);
-        ~App() {}
+        ~App();
 
         void setAddInstanceCallback(OnInstanceAdd onInstanceAdd) {
             onInstanceAdd_ = onInstanceAdd;
@@ -34,10 +61,102 @@ namespace ndnapp
             const ndnsd::NdnSd::AdvertiseParameters& params, const std::string& signingIdentity = "",
             const std::string& password = "");
 
+        // resolved peers are persisted in a file and, on the next start, routes
+        // to them are added right away as provisional. provisional routes not
+        // confirmed by discovery within grace period are removed.
+        // must be called before configure()
+        bool setPeerTable(const std::string& path,
+            std::chrono::milliseconds gracePeriod = std::chrono::seconds(10));
+
+        // lazy mode: discovered peers are only recorded. a peer is resolved,
+        // and its face and routes are added, when a local application sends 
+        // an Interest that no route matches and the peer is a candidate for
+        // it: its id is a component of the name or its last known prefix 
+        // covers the name (a few peers of our subtype otherwise, at most once
+        // per name every couple of seconds). Interest itself is not 
+        // forwarded, consumer's retransmission will be. peers whose routes 
+        // see no local Interests for idleTimeout are reaped. local 
+        // applications are those sending over transports given to
+        // addLocalTransport(). must be called before configure()
+        void setLazyResolve(bool enable, 
+            std::chrono::milliseconds idleTimeout = std::chrono::seconds(60));
+        // Interests sent over transport are taken as those of a local 
+        // application (see setLazyResolve()); run() returns when they time
+        // out. App keeps a weak reference
+        void addLocalTransport(const std::shared_ptr<helpers::LocalTransport>& transport);
+
+        // flap damping: face and routes of a removed peer are kept for 
+        // holdTime. if the peer is added back meanwhile and resolves to the 
+        // same address and prefixes, the face is reused, so Interests in 
+        // flight over it are not lost. otherwise peer is removed (and remove
+        // callback is called) once holdTime has passed. zero disables
+        void setFlapDamping(std::chrono::milliseconds holdTime);
+        // certificate chain a peer advertises is validated up to the trust 
+        // anchor, issuer certificates are fetched from the peer. file holds
+        // anchor certificate, base64 (as ndnsec dumps it) or binary. returns
+        // false if it can't be loaded. must be called before configure()
+        bool setTrustAnchor(const std::string& path);
+        // explicit opt-out of chain validation: peer certificate is only 
+        // checked against name and digest the peer advertises. peers 
+        // advertising a certificate get no routes without either of them
+        void setSkipValidation(bool skip);
+        // peers advertising no certificate (e.g. version 0 ones) get routes
+        // that are not verified if allowed; they are ignored otherwise 
+        // (default)
+        void setAllowUnverified(bool allow);
+        // per peer, keyed by (uuid, protocol). must be called on the thread 
+        // that runs processEvents()
+        const std::map<std::pair<std::string, ndnsd::Proto>, FlapStats>& 
+        getFlapStats() const { return flapStats_; }
+
         void processEvents();
+        // event-driven alternative to calling processEvents() in a loop: 
+        // waits on forwarder sockets, DNS-SD descriptors and App deadlines
+        // at once, and processes events of the face App was given too. 
+        // returns after timeout or once socket events or timeouts of 
+        // Interests sent over the forwarder were processed, whichever comes
+        // first; runs till stop() if timeout is zero. sockets of other 
+        // Faces are not waited on, nor callLater() of the application: 
+        // pass them to watchDescriptor() or use a timeout
+        void run(std::chrono::milliseconds timeout = std::chrono::milliseconds(0));
+        // makes run() return. must be called on its thread (e.g. from a callback)
+        void stop() { stopped_ = true; }
+        // runs command on the thread that runs processEvents() or run(), in
+        // order of posting. can be called from any thread, does not block
+        void post(std::function<void()> command);
+        // descriptors the application serves itself (e.g. a control socket)
+        // are waited on by run() as well; onReadable is called on its 
+        // thread and must consume what is there. the socket scan leaves 
+        // them to the application; empty onReadable keeps fd so, without 
+        // waiting on it (e.g. while the application takes no input)
+        void watchDescriptor(int fd, std::function<void()> onReadable);
+        void unwatchDescriptor(int fd);
+
+        // time from configure() till the first route (provisional or confirmed
+        // by discovery) was added. zero if there is none yet
+        std::chrono::milliseconds getTimeToFirstRoute() const { return timeToFirstRoute_; }
+        std::chrono::milliseconds getTimeToFirstConfirmedRoute() const { return timeToFirstConfirmedRoute_; }
+
+        // discovered instances which ids are components of this prefix are 
+        // resolved ahead of others
+        void prioritizePrefix(const ndn::Name& prefix);
 
         ndntools::MicroForwarder* getMfd() const { return mfd_; }
+        // port of forwarder's listen channel, 0 if there is none
+        uint16_t getListenPort(ndnsd::Proto protocol) const;
+        // must be called on the thread that runs processEvents()
         std::vector<std::shared_ptr<const ndnsd::NdnSd>> getDiscoveredNodes() const;
+        // resolved nodes advertising the longest prefix of name, cost depends
+        // on name length only. must be called on the thread that runs 
+        // processEvents()
+        std::vector<std::shared_ptr<const ndnsd::NdnSd>> findNodesServing(const ndn::Name& name) const;
+        // resolved nodes advertising prefix or prefixes under it
+        std::vector<std::shared_ptr<const ndnsd::NdnSd>> findNodesUnder(const ndn::Name& prefix) const;
+        // discovered nodes of all protocols; can be called from any thread
+        std::shared_ptr<const ndnsd::ServiceSnapshot> getSnapshot() const;
+        // forwarder faces and routes; can be called from any thread. changes
+        // App makes are published right away, others within a second
+        std::shared_ptr<const ForwarderSnapshot> getForwarderSnapshot() const;
         std::string getAppName() const { return appName_; }
         std::string getInstanceId() const { return instanceId_; }
 
@@ -47,12 +166,146 @@ namespace ndnapp
         std::shared_ptr<spdlog::logger> logger_;
         bool filterInterface_;
         std::set<std::string> discoveredInstances_;
+        std::vector<ndn::Name> priorityPrefixes_;
         ndntools::MicroForwarder* mfd_;
         std::vector<ndnsd::Proto> protocols_;
         std::map<ndnsd::Proto, int> protocolPort_;
         ndnsd::NdnSd::AdvertiseParameters params_;
         std::vector<std::shared_ptr<ndnsd::NdnSd> > ndnsds_;
-        std::map<std::shared_ptr<const ndnsd::NdnSd>, int> faces_;
+        // instances that announce our service
+        std::vector<std::shared_ptr<ndnsd::NdnSd> > advertised_;
+        // face taken (see addFace()) by an instance, a provisional or a held
+        // route, and the routes it added
+        typedef struct _FaceUse {
+            int faceId_ = -1;
+            std::vector<std::string> prefixes_;
+        } FaceUse;
+
+        std::map<std::shared_ptr<const ndnsd::NdnSd>, FaceUse> faces_;
+        // advertised prefixes of resolved instances
+        helpers::PrefixIndex<std::shared_ptr<const ndnsd::NdnSd>> prefixIndex_;
+
+        typedef struct _LazyInstance {
+            // NdnSd instance that discovered it
+            std::shared_ptr<ndnsd::NdnSd> browser_;
+            // resolve started, face and routes are (or will be) added
+            bool active_;
+            // last Interest routed to it
+            std::chrono::steady_clock::time_point lastUsed_;
+        } LazyInstance;
+
+        bool lazy_;
+        std::chrono::milliseconds idleTimeout_;
+        std::chrono::steady_clock::time_point nextReap_;
+        std::map<std::shared_ptr<const ndnsd::NdnSd>, LazyInstance> lazyInstances_;
+        // lazy instances by uuid, for finding those named in an Interest
+        std::multimap<std::string, std::shared_ptr<const ndnsd::NdnSd>> lazyUuids_;
+        // prefixes instances advertised when they were resolved last time, 
+        // keyed by uuid. hints for choosing whom to resolve on a miss
+        std::map<std::string, std::vector<ndn::Name>> knownPrefixes_;
+        // known prefixes of inactive instances
+        helpers::PrefixIndex<std::shared_ptr<const ndnsd::NdnSd>> hintIndex_;
+        std::vector<std::weak_ptr<helpers::LocalTransport>> localTransports_;
+        // routes App added, by face id: tells whether a name is routed
+        helpers::PrefixIndex<int> routeIndex_;
+        // names a fallback batch of peers was resolved for last time
+        std::map<ndn::Name, std::chrono::steady_clock::time_point> lastFallback_;
+        // peer certificates fetched over NDN and validated, keyed by digest
+        std::map<std::string, std::shared_ptr<ndn::CertificateV2>> certificates_;
+        std::shared_ptr<ndn::CertificateV2> trustAnchor_;
+        // issuer certificates of peers validated up to the anchor, keyed by
+        // key name
+        std::map<ndn::Name, std::shared_ptr<ndn::CertificateV2>> issuers_;
+        bool skipValidation_, allowUnverified_;
+
+        typedef struct _ProvisionalRoute {
+            helpers::PeerTable::Peer peer_;
+            FaceUse face_;
+        } ProvisionalRoute;
+
+        helpers::PeerTable peerTable_;
+        std::chrono::milliseconds warmStartGrace_;
+        std::chrono::steady_clock::time_point startTime_, warmStartDeadline_;
+        std::chrono::milliseconds timeToFirstRoute_, timeToFirstConfirmedRoute_;
+        // routes loaded from peer table, keyed by (uuid, protocol)
+        std::map<std::pair<std::string, ndnsd::Proto>, ProvisionalRoute> provisionalRoutes_;
+
+        typedef struct _HeldRemoval {
+            // removed instance, its prefixes stay in prefixIndex_ while held
+            std::shared_ptr<const ndnsd::NdnSd> sd_;
+            FaceUse face_;
+            // address and prefixes the face was created with
+            std::string hostname_;
+            uint16_t port_;
+            std::vector<std::string> prefixes_;
+            // digest of the certificate the face was verified with
+            std::string certDigest_;
+            // added back, waiting for resolve to confirm the face
+            bool readded_;
+            std::chrono::steady_clock::time_point deadline_;
+        } HeldRemoval;
+
+        std::chrono::milliseconds flapHoldTime_;
+        // faces of removed peers, keyed by (uuid, protocol)
+        std::map<std::pair<std::string, ndnsd::Proto>, HeldRemoval> heldRemovals_;
+        std::map<std::pair<std::string, ndnsd::Proto>, FlapStats> flapStats_;
+
+        // faces are shared by instances, provisional and held routes at the 
+        // same address, and removed with the last of them
+        typedef std::tuple<ndnsd::Proto, std::string, uint16_t> FaceKey;
+        typedef struct _PooledFace {
+            int faceId_;
+            int refs_;
+            // routes of the face and number of users that added each of 
+            // them: route is removed with the last one
+            std::map<std::string, int> prefixRefs_;
+        } PooledFace;
+
+        std::map<FaceKey, PooledFace> facePool_;
+        std::map<int, FaceKey> pooledFaces_;
+
+        typedef struct _PendingConnect {
+            int fd_;
+            std::chrono::steady_clock::time_point deadline_;
+            std::vector<std::function<void(bool)>> waiters_;
+            // numeric address of a host name, looked up off the event loop
+            std::future<std::string> lookup_;
+        } PendingConnect;
+
+        // TCP connects and host name lookups in progress
+        std::map<FaceKey, PendingConnect> connects_;
+        // sockets connected and addresses looked up, till addFace() takes them
+        std::map<FaceKey, std::pair<int, std::string>> connected_;
+        // lookups that have timed out: getaddrinfo() can't be cancelled
+        std::vector<std::future<std::string>> abandonedLookups_;
+        // instances waiting for their face, and the setup they wait for: 
+        // instance may be removed or re-resolved meanwhile
+        std::map<std::shared_ptr<const ndnsd::NdnSd>, uint64_t> pendingFaces_;
+        uint64_t faceSetups_;
+
+        bool stopped_;
+        // set by watched socket callbacks
+        bool socketsReady_, socketsChanged_;
+        // watched sockets and their inodes, to tell reused descriptor numbers
+        std::map<int, uint64_t> watchedSockets_;
+        std::set<int> listeningSockets_;
+        // watched for the application
+        std::set<int> appDescriptors_;
+        // sockets of faces and their inodes
+        std::map<int, std::pair<int, uint64_t>> faceSockets_;
+        std::chrono::steady_clock::time_point nextSocketScan_;
+        // Interest timeouts and callLater() of the faces, earliest first
+        std::priority_queue<std::chrono::steady_clock::time_point,
+            std::vector<std::chrono::steady_clock::time_point>,
+            std::greater<std::chrono::steady_clock::time_point>> faceDeadlines_;
+        // commands posted from other threads
+        helpers::CommandQueue commands_;
+        std::shared_ptr<const ForwarderSnapshot> forwarderSnapshot_;
+        bool forwarderChanged_;
+        std::chrono::steady_clock::time_point nextForwarderSnapshot_;
+        // merged snapshots of ndnsds_ and their generations it was built from
+        std::shared_ptr<const ndnsd::ServiceSnapshot> snapshot_;
+        std::vector<uint64_t> snapshotGenerations_;
 
         ndn::Face* face_;
         ndn::KeyChain* keyChain_;
@@ -67,10 +320,89 @@ namespace ndnapp
         void setupKeyChain() {}
         void setupCertificateAutoRenew(const std::shared_ptr<const ndn::CertificateV2>& cert,
             std::function<void()> renewRoutine);
+        void registerAppIdentity();
+        // republishes instance certificate name and digest in advertised TXT 
+        // records
+        void updateAdvertisedCertificate();
 
+        void onServiceAnnouncements(const std::shared_ptr<ndnsd::NdnSd>& s,
+            const std::vector<ndnsd::ServiceAnnouncement>& announcements);
+        void onServiceAdded(const std::shared_ptr<ndnsd::NdnSd>& s,
+            const std::shared_ptr<const ndnsd::NdnSd>& sd);
+        void onServiceResolved(const std::shared_ptr<const ndnsd::NdnSd>& sd);
+        // TXT record of a resolved instance was updated
+        void onServiceUpdated(const std::shared_ptr<const ndnsd::NdnSd>& sd);
+        void onServiceRemoved(const std::shared_ptr<const ndnsd::NdnSd>& sd);
+
+        void resolveInstance(const std::shared_ptr<ndnsd::NdnSd>& s,
+            const std::shared_ptr<const ndnsd::NdnSd>& sd, bool priority);
+        bool isPriorityInstance(const std::string& instanceId) const;
+        void onLocalInterest(const ndn::Interest& interest);
+        bool isRouted(const ndn::Name& name) const;
+        // updates routeIndex_ with routes of pooled face
+        void indexRoutes(int faceId);
+        void activateInstance(const std::shared_ptr<const ndnsd::NdnSd>& sd, bool priority);
+        void reapIdleInstances();
         void addRoute(const std::shared_ptr<const ndnsd::NdnSd>& sd);
+        void fetchCertificate(const std::shared_ptr<const ndnsd::NdnSd>& sd);
+        void requestCertificate(const std::shared_ptr<const ndnsd::NdnSd>& sd, int faceId);
+        bool verifyInstance(const std::shared_ptr<const ndnsd::NdnSd>& sd, 
+            const ndn::CertificateV2& cert) const;
+        // validates certificate chain up to trust anchor, fetching issuer 
+        // certificates from the instance. onValidated is not called once 
+        // isPending returns false (instance removed or re-resolved)
+        void validateCertificate(const std::shared_ptr<const ndnsd::NdnSd>& sd,
+            const std::shared_ptr<ndn::CertificateV2>& cert, int depth,
+            std::function<bool()> isPending, std::function<void(bool valid)> onValidated);
+        // certificate instance advertises has been fetched and validated (or
+        // it advertises none and that is allowed), so that its routes can be
+        // added right away
+        bool isCertificateVerified(const std::shared_ptr<const ndnsd::NdnSd>& sd) const;
+        // face is set in faces_ and onFace is called once peer is connected
+        // to; not if it can't be, or instance was removed or re-resolved 
+        // meanwhile
+        void addInstanceFace(const std::shared_ptr<const ndnsd::NdnSd>& sd,
+            const std::vector<std::string>& prefixes, std::function<void(int faceId)> onFace);
+        // TCP transport connects in MicroForwarder::addFace(), blocking the 
+        // event loop: peer is connected to without blocking first, and 
+        // onConnect is called once that completes, fails or times out. 
+        // called right away when there is nothing to wait for (UDP, pooled 
+        // face, host name)
+        void connectFace(ndnsd::Proto protocol, const std::string& hostname, uint16_t port,
+            std::function<void(bool connected)> onConnect);
+        void processConnects();
+        // face to the same address is shared: each call takes a reference
+        // to it and to the routes, removeFace() releases them. returns false
+        // if none of the routes could be added
+        bool addFace(ndnsd::Proto protocol, const std::string& hostname, uint16_t port,
+            const std::vector<std::string>& prefixes, const std::string& uuid, FaceUse& face);
+        bool addRoutes(FaceUse& face, const std::vector<std::string>& prefixes, 
+            const std::string& uuid);
+        void removeFace(const FaceUse& face);
+        void addProvisionalRoutes();
+        void expireProvisionalRoutes();
+        bool confirmProvisionalRoute(const std::shared_ptr<const ndnsd::NdnSd>& sd);
+        void onFirstRoute(bool confirmed);
+        bool holdRemoval(const std::shared_ptr<const ndnsd::NdnSd>& sd);
+        bool cancelHeldRemoval(const std::shared_ptr<const ndnsd::NdnSd>& sd);
+        bool confirmHeldRoute(const std::shared_ptr<const ndnsd::NdnSd>& sd);
+        void expireHeldRemovals();
+        void completeRemoval(const std::shared_ptr<const ndnsd::NdnSd>& sd);
         void removeRoute(const std::shared_ptr<const ndnsd::NdnSd>& sd);
 
+        void processHousekeeping();
+        void watchSockets();
+        // socket a forwarder call has created: hint is the descriptor that
+        // was lowest free before it. -1 if it's not found
+        int findForwarderSocket(int hint, uint16_t port, bool peer) const;
+        void watchForwarderSocket(int fd, bool listening);
+        void unwatchForwarderSocket(int fd);
+        void addFaceDeadline(std::chrono::milliseconds delay);
+        // till the earliest of App deadlines
+        std::chrono::milliseconds getNextWait() const;
+
+        void publishSnapshot();
+        void publishForwarderSnapshot();
         void printAppInfo();
     };
 }
@@ -0,0 +1,337 @@
+
+#include "peer-table.hpp"
+
+#include <cerrno>
+#include <cstring>
+#include <iostream>
+
+#include <ndn-ind/lite/util/crypto-lite.hpp>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#define PEER_TABLE_MAGIC 0x5450444e // "NDPT"
+#define PEER_TABLE_VERSION 2
+#define PEER_TABLE_INITIAL_CAPACITY 64
+
+using namespace std;
+using namespace ndnapp::helpers;
+
+struct PeerTable::Header {
+    uint32_t magic_;
+    uint32_t version_;
+    uint32_t capacity_;
+    uint32_t recordSize_;
+};
+
+struct PeerTable::Record {
+    char uuid_[48];
+    char hostname_[128];
+    // NUL-terminated prefixes one after another, empty one ends the list
+    char prefixes_[456];
+    uint8_t certDigest_[32];
+    // milliseconds since epoch, 0 marks free record
+    uint64_t lastSeen_;
+    uint16_t port_;
+    uint8_t protocol_;
+    uint8_t reserved_[5];
+};
+
+static_assert(sizeof(PeerTable::Peer::certDigest_) == 32, "unexpected digest size");
+
+static void copyField(char* dst, size_t dstSize, const string& src)
+{
+    memset(dst, 0, dstSize);
+    memcpy(dst, src.data(), src.size());
+}
+
+static string readField(const char* src, size_t srcSize)
+{
+    return string(src, strnlen(src, srcSize));
+}
+
+static bool isKnownProtocol(uint8_t protocol)
+{
+    return (protocol == (uint8_t)ndnsd::Proto::UDP || protocol == (uint8_t)ndnsd::Proto::TCP);
+}
+
+static size_t listSize(const vector<string>& list)
+{
+    size_t size = 0;
+    for (auto& s : list)
+        size += s.size() + 1;
+
+    return size;
+}
+
+static void copyList(char* dst, size_t dstSize, const vector<string>& src)
+{
+    memset(dst, 0, dstSize);
+    for (auto& s : src)
+    {
+        memcpy(dst, s.data(), s.size());
+        dst += s.size() + 1;
+    }
+}
+
+static vector<string> readList(const char* src, size_t srcSize)
+{
+    vector<string> list;
+    for (size_t pos = 0; pos < srcSize; )
+    {
+        string s = readField(src + pos, srcSize - pos);
+        if (s.empty())
+            break;
+
+        pos += s.size() + 1;
+        list.push_back(s);
+    }
+
+    return list;
+}
+
+PeerTable::PeerTable()
+    : fd_(-1)
+    , map_(nullptr)
+    , mapSize_(0)
+{
+}
+
+PeerTable::~PeerTable()
+{
+    close();
+}
+
+bool PeerTable::open(const string& path)
+{
+#ifdef _WIN32
+    cerr << "peer table is not supported on this platform" << endl;
+    return false;
+#else
+    close();
+
+    fd_ = ::open(path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (fd_ < 0)
+    {
+        cerr << "failed to open peer table " << path << ": " << strerror(errno) << endl;
+        return false;
+    }
+
+    // records are updated in place, a second writer would mix them up
+    if (flock(fd_, LOCK_EX | LOCK_NB) < 0)
+    {
+        cerr << "peer table " << path << " is in use: " << strerror(errno) << endl;
+        close();
+        return false;
+    }
+
+    struct stat st;
+    if (fstat(fd_, &st) < 0)
+    {
+        close();
+        return false;
+    }
+
+    Header h;
+    bool valid = ((size_t)st.st_size >= sizeof(Header) &&
+        pread(fd_, &h, sizeof(h), 0) == sizeof(h) &&
+        h.magic_ == PEER_TABLE_MAGIC && h.version_ == PEER_TABLE_VERSION &&
+        h.recordSize_ == sizeof(Record) &&
+        (size_t)st.st_size >= sizeof(Header) + (size_t)h.capacity_ * sizeof(Record));
+
+    if (!valid && ftruncate(fd_, 0) < 0)
+    {
+        close();
+        return false;
+    }
+
+    if (!remap(valid ? h.capacity_ : PEER_TABLE_INITIAL_CAPACITY))
+    {
+        close();
+        return false;
+    }
+
+    return true;
+#endif
+}
+
+void PeerTable::close()
+{
+#ifndef _WIN32
+    if (map_)
+        munmap(map_, mapSize_);
+    if (fd_ >= 0)
+        ::close(fd_);
+#endif
+
+    map_ = nullptr;
+    mapSize_ = 0;
+    fd_ = -1;
+}
+
+vector<PeerTable::Peer> PeerTable::load() const
+{
+    vector<Peer> peers;
+    if (!map_)
+        return peers;
+
+    for (uint32_t i = 0; i < header()->capacity_; ++i)
+    {
+        const Record& r = records()[i];
+        // damaged record
+        if (!r.lastSeen_ || !isKnownProtocol(r.protocol_))
+            continue;
+
+        Peer p;
+        p.uuid_ = readField(r.uuid_, sizeof(r.uuid_));
+        p.protocol_ = (ndnsd::Proto)r.protocol_;
+        p.hostname_ = readField(r.hostname_, sizeof(r.hostname_));
+        p.port_ = r.port_;
+        p.prefixes_ = readList(r.prefixes_, sizeof(r.prefixes_));
+        memcpy(p.certDigest_.data(), r.certDigest_, sizeof(r.certDigest_));
+        p.lastSeen_ = chrono::system_clock::time_point(chrono::milliseconds(r.lastSeen_));
+
+        peers.push_back(p);
+    }
+
+    return peers;
+}
+
+bool PeerTable::update(const Peer& peer)
+{
+    if (!map_)
+        return false;
+
+    if (!isKnownProtocol((uint8_t)peer.protocol_) ||
+        peer.uuid_.size() >= sizeof(Record::uuid_) ||
+        peer.hostname_.size() >= sizeof(Record::hostname_) ||
+        listSize(peer.prefixes_) > sizeof(Record::prefixes_))
+        return false;
+
+    for (auto& prefix : peer.prefixes_)
+        if (prefix.empty())
+            return false;
+
+    Record* r = find(peer.uuid_, peer.protocol_);
+    if (!r)
+    {
+        // take first free record, grow if there is none
+        for (uint32_t i = 0; i < header()->capacity_ && !r; ++i)
+            if (!records()[i].lastSeen_)
+                r = &records()[i];
+
+        if (!r)
+        {
+            uint32_t capacity = header()->capacity_;
+            if (!remap(capacity * 2))
+                return false;
+            r = &records()[capacity];
+        }
+    }
+
+    copyField(r->uuid_, sizeof(r->uuid_), peer.uuid_);
+    copyField(r->hostname_, sizeof(r->hostname_), peer.hostname_);
+    copyList(r->prefixes_, sizeof(r->prefixes_), peer.prefixes_);
+    memcpy(r->certDigest_, peer.certDigest_.data(), sizeof(r->certDigest_));
+    r->port_ = peer.port_;
+    r->protocol_ = (uint8_t)peer.protocol_;
+    r->lastSeen_ = max<uint64_t>(1, chrono::duration_cast<chrono::milliseconds>(
+        peer.lastSeen_.time_since_epoch()).count());
+
+    return true;
+}
+
+void PeerTable::remove(const string& uuid, ndnsd::Proto protocol)
+{
+    if (Record* r = find(uuid, protocol))
+        memset(r, 0, sizeof(Record));
+}
+
+size_t PeerTable::size() const
+{
+    size_t n = 0;
+    if (map_)
+        for (uint32_t i = 0; i < header()->capacity_; ++i)
+            if (records()[i].lastSeen_)
+                n++;
+
+    return n;
+}
+
+array<uint8_t, 32> PeerTable::digest(const string& certificate)
+{
+    array<uint8_t, 32> d;
+    d.fill(0);
+
+    if (certificate.size())
+        ndn::CryptoLite::digestSha256((const uint8_t*)certificate.data(), certificate.size(), d.data());
+
+    return d;
+}
+
+PeerTable::Header* PeerTable::header() const
+{
+    return static_cast<Header*>(map_);
+}
+
+PeerTable::Record* PeerTable::records() const
+{
+    return reinterpret_cast<Record*>(static_cast<uint8_t*>(map_) + sizeof(Header));
+}
+
+PeerTable::Record* PeerTable::find(const string& uuid, ndnsd::Proto protocol) const
+{
+    if (!map_)
+        return nullptr;
+
+    for (uint32_t i = 0; i < header()->capacity_; ++i)
+    {
+        Record& r = records()[i];
+        if (r.lastSeen_ && r.protocol_ == (uint8_t)protocol &&
+            readField(r.uuid_, sizeof(r.uuid_)) == uuid)
+            return &r;
+    }
+
+    return nullptr;
+}
+
+bool PeerTable::remap(uint32_t capacity)
+{
+#ifdef _WIN32
+    return false;
+#else
+    size_t size = sizeof(Header) + (size_t)capacity * sizeof(Record);
+
+    // new space reads as zeros, i.e. free records
+    if (ftruncate(fd_, size) < 0)
+    {
+        cerr << "failed to resize peer table: " << strerror(errno) << endl;
+        return false;
+    }
+
+    if (map_)
+        munmap(map_, mapSize_);
+
+    map_ = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd_, 0);
+    if (map_ == MAP_FAILED)
+    {
+        cerr << "failed to map peer table: " << strerror(errno) << endl;
+        map_ = nullptr;
+        mapSize_ = 0;
+        return false;
+    }
+
+    mapSize_ = size;
+    header()->magic_ = PEER_TABLE_MAGIC;
+    header()->version_ = PEER_TABLE_VERSION;
+    header()->capacity_ = capacity;
+    header()->recordSize_ = sizeof(Record);
+
+    return true;
+#endif
+}
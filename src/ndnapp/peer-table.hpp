@@ -0,0 +1,74 @@
+#ifndef __peer_table_hpp__
+#define __peer_table_hpp__
+
+#include <array>
+#include <chrono>
+#include <string>
+#include <vector>
+
+#include <ndn-sd/ndn-sd.hpp>
+
+namespace ndnapp
+{
+namespace helpers
+{
+    /**
+    * Resolved peers persisted in a memory-mapped file of fixed-size records,
+    * so that routes to them can be set up right after a restart, before
+    * discovery goes round again.
+    * Records are updated in place; the file grows (doubling capacity) when
+    * full. The file is locked while open, so it is not shared by two
+    * running instances. Not available on Windows: open() fails there.
+    */
+    class PeerTable {
+    public:
+        typedef struct _Peer {
+            std::string uuid_;
+            ndnsd::Proto protocol_;
+            // address the face was created with, host name if there was none
+            std::string hostname_;
+            uint16_t port_;
+            // all advertised prefixes, primary one first
+            std::vector<std::string> prefixes_;
+            // SHA-256 of the advertised certificate, zeros if none
+            std::array<uint8_t, 32> certDigest_;
+            std::chrono::system_clock::time_point lastSeen_;
+        } Peer;
+
+        PeerTable();
+        ~PeerTable();
+        PeerTable(const PeerTable&) = delete;
+        PeerTable& operator=(const PeerTable&) = delete;
+
+        // maps the file, creating it if needed. file with unexpected format
+        // is reset. fails if another process has the file open
+        bool open(const std::string& path);
+        void close();
+        bool isOpen() const { return map_ != nullptr; }
+
+        std::vector<Peer> load() const;
+        // inserts or updates peer record, keyed by (uuid, protocol). returns
+        // false if peer does not fit into the record or its protocol is unknown
+        bool update(const Peer& peer);
+        void remove(const std::string& uuid, ndnsd::Proto protocol);
+        size_t size() const;
+
+        static std::array<uint8_t, 32> digest(const std::string& certificate);
+
+    private:
+        struct Header;
+        struct Record;
+
+        int fd_;
+        void* map_;
+        size_t mapSize_;
+
+        Header* header() const;
+        Record* records() const;
+        Record* find(const std::string& uuid, ndnsd::Proto protocol) const;
+        bool remap(uint32_t capacity);
+    };
+}
+}
+
+#endif
@@ -0,0 +1,156 @@
+#ifndef __prefix_index_hpp__
+#define __prefix_index_hpp__
+
+#include <algorithm>
+#include <map>
+#include <memory>
+#include <vector>
+
+#include <ndn-ind/name.hpp>
+
+namespace ndnapp
+{
+namespace helpers
+{
+    /**
+    * Name-component trie over advertised prefixes, answering "who serves
+    * this name" without scanning all values: lookups walk one node per name
+    * component. Each value (discovered service) is stored under all of its
+    * prefixes; insert() replaces prefixes of a value, so the index is kept
+    * up to date on every resolve and remove.
+    * Not thread-safe.
+    */
+    template<typename T>
+    class PrefixIndex {
+    public:
+        // replaces prefixes of value. value with no prefixes is removed
+        void insert(const T& value, const std::vector<ndn::Name>& prefixes)
+        {
+            remove(value);
+            if (prefixes.empty())
+                return;
+
+            for (auto& p : prefixes)
+            {
+                Node* n = &root_;
+                for (size_t i = 0; i < p.size(); ++i)
+                {
+                    auto& child = n->children_[p.get(i)];
+                    if (!child)
+                        child = std::make_unique<Node>();
+                    n = child.get();
+                }
+                n->values_.push_back(value);
+            }
+            prefixes_[value] = prefixes;
+        }
+
+        // returns false if value is not indexed
+        bool remove(const T& value)
+        {
+            auto it = prefixes_.find(value);
+            if (it == prefixes_.end())
+                return false;
+
+            for (auto& p : it->second)
+                erase(root_, p, 0, value);
+            prefixes_.erase(it);
+
+            return true;
+        }
+
+        // values advertising the longest of prefixes that name starts with
+        std::vector<T> longestPrefixMatch(const ndn::Name& name) const
+        {
+            const Node* n = &root_;
+            const Node* match = (n->values_.size() ? n : nullptr);
+
+            for (size_t i = 0; i < name.size(); ++i)
+            {
+                auto it = n->children_.find(name.get(i));
+                if (it == n->children_.end())
+                    break;
+
+                n = it->second.get();
+                if (n->values_.size())
+                    match = n;
+            }
+
+            return (match ? unique(match->values_) : std::vector<T>());
+        }
+
+        // values advertising prefix itself or any prefix under it
+        std::vector<T> findUnder(const ndn::Name& prefix) const
+        {
+            const Node* n = &root_;
+            for (size_t i = 0; i < prefix.size() && n; ++i)
+            {
+                auto it = n->children_.find(prefix.get(i));
+                n = (it != n->children_.end() ? it->second.get() : nullptr);
+            }
+
+            std::vector<T> values;
+            if (n)
+                collect(*n, values);
+
+            return unique(values);
+        }
+
+        // number of indexed values
+        size_t size() const { return prefixes_.size(); }
+        void clear()
+        {
+            root_.children_.clear();
+            root_.values_.clear();
+            prefixes_.clear();
+        }
+
+    private:
+        typedef struct _Node {
+            std::map<ndn::Name::Component, std::unique_ptr<struct _Node>> children_;
+            std::vector<T> values_;
+        } Node;
+
+        Node root_;
+        // prefixes of each value, to remove it from all of its nodes
+        std::map<T, std::vector<ndn::Name>> prefixes_;
+
+        // removes value from node of prefix and prunes nodes left empty.
+        // returns true if n is empty
+        static bool erase(Node& n, const ndn::Name& prefix, size_t depth, const T& value)
+        {
+            if (depth == prefix.size())
+            {
+                auto it = std::find(n.values_.begin(), n.values_.end(), value);
+                if (it != n.values_.end())
+                    n.values_.erase(it);
+            }
+            else
+            {
+                auto it = n.children_.find(prefix.get(depth));
+                if (it != n.children_.end() && erase(*it->second, prefix, depth + 1, value))
+                    n.children_.erase(it);
+            }
+
+            return n.values_.empty() && n.children_.empty();
+        }
+
+        static void collect(const Node& n, std::vector<T>& values)
+        {
+            values.insert(values.end(), n.values_.begin(), n.values_.end());
+            for (auto& c : n.children_)
+                collect(*c.second, values);
+        }
+
+        // value advertising several prefixes under the same node is listed once
+        static std::vector<T> unique(std::vector<T> values)
+        {
+            std::sort(values.begin(), values.end());
+            values.erase(std::unique(values.begin(), values.end()), values.end());
+            return values;
+        }
+    };
+}
+}
+
+#endif
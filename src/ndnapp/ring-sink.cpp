@@ -0,0 +1,217 @@
+
+#include "ring-sink.hpp"
+
+#include <cstdio>
+
+#include <spdlog/pattern_formatter.h>
+
+using namespace std;
+using namespace ndnapp::helpers;
+
+// wakeups are not missed, this is a safety net only
+static chrono::milliseconds kIdleWait = chrono::seconds(1);
+
+RingSink::RingSink(Writer writer, size_t capacity, Overflow overflow)
+    : mask_(0)
+    , overflow_(overflow)
+    , writer_(writer)
+    , enqueuePos_(0)
+    , dequeuePos_(0)
+    , written_(0)
+    , dropped_(0)
+    , blocked_(0)
+    , batches_(0)
+    , formatter_(make_unique<spdlog::pattern_formatter>())
+    , sleeping_(false)
+    , stop_(false)
+    , flushing_(0)
+{
+    size_t size = 2;
+    while (size < capacity)
+        size <<= 1;
+
+    cells_ = make_unique<Cell[]>(size);
+    mask_ = size - 1;
+    for (size_t i = 0; i < size; ++i)
+        cells_[i].seq_.store(i, memory_order_relaxed);
+
+    thread_ = thread(&RingSink::run, this);
+}
+
+RingSink::~RingSink()
+{
+    {
+        lock_guard<mutex> lock(mutex_);
+        stop_ = true;
+    }
+    wakeup_.notify_one();
+    thread_.join();
+}
+
+void RingSink::log(const spdlog::details::log_msg& msg)
+{
+    if (!push(msg))
+    {
+        if (overflow_ == Overflow::Drop)
+        {
+            dropped_++;
+            return;
+        }
+
+        blocked_++;
+        do
+        {
+            wake();
+            this_thread::yield();
+        } while (!push(msg));
+    }
+
+    wake();
+}
+
+void RingSink::flush()
+{
+    size_t pos = enqueuePos_.load();
+
+    flushing_++;
+    {
+        unique_lock<mutex> lock(mutex_);
+        wakeup_.notify_one();
+        flushed_.wait(lock, [this, pos]() {
+            return written_.load() >= pos || stop_;
+        });
+    }
+    flushing_--;
+}
+
+void RingSink::set_pattern(const string& pattern)
+{
+    set_formatter(make_unique<spdlog::pattern_formatter>(pattern));
+}
+
+void RingSink::set_formatter(unique_ptr<spdlog::formatter> formatter)
+{
+    lock_guard<mutex> lock(formatterMutex_);
+    formatter_ = move(formatter);
+}
+
+RingSink::Stats RingSink::getStats() const
+{
+    return { written_.load(), dropped_.load(), blocked_.load(), batches_.load() };
+}
+
+bool RingSink::push(const spdlog::details::log_msg& msg)
+{
+    size_t pos = enqueuePos_.load(memory_order_relaxed);
+
+    while (true)
+    {
+        Cell& cell = cells_[pos & mask_];
+        size_t seq = cell.seq_.load(memory_order_acquire);
+        intptr_t diff = (intptr_t)seq - (intptr_t)pos;
+
+        if (diff == 0)
+        {
+            if (enqueuePos_.compare_exchange_weak(pos, pos + 1, memory_order_relaxed))
+            {
+                cell.msg_ = spdlog::details::log_msg_buffer(msg);
+                cell.seq_.store(pos + 1, memory_order_release);
+                return true;
+            }
+        }
+        // writer hasn't taken the record a lap ago yet
+        else if (diff < 0)
+            return false;
+        else
+            pos = enqueuePos_.load(memory_order_relaxed);
+    }
+}
+
+bool RingSink::isReadable() const
+{
+    size_t pos = dequeuePos_.load(memory_order_relaxed);
+    return cells_[pos & mask_].seq_.load(memory_order_acquire) == pos + 1;
+}
+
+void RingSink::wake()
+{
+    // pairs with the fence in run(): either the writer sees the record, or
+    // this sees it asleep
+    atomic_thread_fence(memory_order_seq_cst);
+    if (sleeping_.load(memory_order_relaxed))
+    {
+        lock_guard<mutex> lock(mutex_);
+        wakeup_.notify_one();
+    }
+}
+
+void RingSink::run()
+{
+    spdlog::memory_buf_t batch;
+    uint64_t reportedDrops = 0;
+
+    while (true)
+    {
+        size_t n = 0;
+        {
+            lock_guard<mutex> lock(formatterMutex_);
+            while (isReadable())
+            {
+                size_t pos = dequeuePos_.load(memory_order_relaxed);
+                Cell& cell = cells_[pos & mask_];
+
+                formatter_->format(cell.msg_, batch);
+                // cell is free for the next lap
+                cell.seq_.store(pos + mask_ + 1, memory_order_release);
+                dequeuePos_.store(pos + 1, memory_order_release);
+                n++;
+            }
+        }
+
+        uint64_t dropped = dropped_.load();
+        if (dropped != reportedDrops)
+        {
+            string notice = "*** " + to_string(dropped - reportedDrops) + " log records dropped\n";
+            batch.append(notice.data(), notice.data() + notice.size());
+            reportedDrops = dropped;
+        }
+
+        if (batch.size())
+        {
+            try
+            {
+                writer_(batch.data(), batch.size());
+            }
+            catch (exception& e)
+            {
+                fprintf(stderr, "caught exception while writing log: %s\n", e.what());
+            }
+
+            batch.clear();
+            written_ += n;
+            batches_++;
+        }
+
+        if (flushing_.load())
+        {
+            lock_guard<mutex> lock(mutex_);
+            flushed_.notify_all();
+        }
+
+        if (n)
+            continue;
+
+        unique_lock<mutex> lock(mutex_);
+        if (stop_)
+            break;
+
+        sleeping_.store(true, memory_order_relaxed);
+        atomic_thread_fence(memory_order_seq_cst);
+        if (!isReadable())
+            wakeup_.wait_for(lock, kIdleWait);
+        sleeping_.store(false, memory_order_relaxed);
+    }
+
+    lock_guard<mutex> lock(mutex_);
+    flushed_.notify_all();
+}
@@ -0,0 +1,100 @@
+#ifndef __ring_sink_hpp__
+#define __ring_sink_hpp__
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+#include <spdlog/details/log_msg_buffer.h>
+#include <spdlog/formatter.h>
+#include <spdlog/sinks/sink.h>
+
+namespace ndnapp
+{
+namespace helpers
+{
+    /**
+    * Asynchronous spdlog sink, so that a slow terminal or disk doesn't hold
+    * up the thread that logs. Records are copied into a bounded lock-free
+    * ring (any number of logging threads); a writer thread formats them and
+    * hands them to writer function in batches, so that per-write work,
+    * like redrawing CLI prompt, is done once per batch.
+    * When the ring is full, a record is dropped or the logging thread waits
+    * for the writer, depending on overflow policy. Both are counted; drops
+    * are reported in the output as well.
+    */
+    class RingSink : public spdlog::sinks::sink {
+    public:
+        enum class Overflow { Drop, Block };
+
+        typedef struct _Stats {
+            uint64_t written_;
+            uint64_t dropped_;
+            // records which waited for space in the ring
+            uint64_t blocked_;
+            uint64_t batches_;
+        } Stats;
+
+        // formatted records of a batch, one after another. called on the
+        // writer thread
+        typedef std::function<void(const char* data, size_t size)> Writer;
+
+        // capacity is rounded up to a power of two
+        RingSink(Writer writer, size_t capacity = 8192, Overflow overflow = Overflow::Drop);
+        // records left in the ring are written
+        ~RingSink();
+        RingSink(const RingSink&) = delete;
+        RingSink& operator=(const RingSink&) = delete;
+
+        void log(const spdlog::details::log_msg& msg) override;
+        // returns once records logged before are written. must not be
+        // called from the writer function
+        void flush() override;
+        void set_pattern(const std::string& pattern) override;
+        void set_formatter(std::unique_ptr<spdlog::formatter> formatter) override;
+
+        Stats getStats() const;
+
+    private:
+        // cell is free for a producer at position pos when seq_ is pos,
+        // holds a record for the writer when seq_ is pos + 1
+        typedef struct _Cell {
+            std::atomic<size_t> seq_;
+            spdlog::details::log_msg_buffer msg_;
+        } Cell;
+
+        std::unique_ptr<Cell[]> cells_;
+        size_t mask_;
+        Overflow overflow_;
+        Writer writer_;
+
+        alignas(64) std::atomic<size_t> enqueuePos_;
+        // written by the writer thread only
+        alignas(64) std::atomic<size_t> dequeuePos_;
+        // every record pushed is written, so flush() waits for written_ to
+        // reach enqueuePos_
+        std::atomic<uint64_t> written_, dropped_, blocked_, batches_;
+
+        std::mutex formatterMutex_;
+        std::unique_ptr<spdlog::formatter> formatter_;
+
+        // writer sleeps while the ring is empty
+        std::mutex mutex_;
+        std::condition_variable wakeup_, flushed_;
+        std::atomic<bool> sleeping_, stop_;
+        std::atomic<int> flushing_;
+        std::thread thread_;
+
+        bool push(const spdlog::details::log_msg& msg);
+        bool isReadable() const;
+        void wake();
+        void run();
+    };
+}
+}
+
+#endif
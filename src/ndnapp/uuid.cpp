@@ -16,34 +16,30 @@ namespace uuid
     }
 
     static std::mt19937                    gen(randomlySeededMersenneTwister());
-    static std::uniform_int_distribution<> dis(0, 15);
-    static std::uniform_int_distribution<> dis2(8, 11);
 
     std::string generate_uuid_v4() {
-        std::stringstream ss;
-        int i;
-        ss << std::hex;
-        for (i = 0; i < 8; i++) {
-            ss << dis(gen);
-        }
-        ss << "-";
-        for (i = 0; i < 4; i++) {
-            ss << dis(gen);
-        }
-        ss << "-4";
-        for (i = 0; i < 3; i++) {
-            ss << dis(gen);
-        }
-        ss << "-";
-        ss << dis2(gen);
-        for (i = 0; i < 3; i++) {
-            ss << dis(gen);
+        static const char hex[] = "0123456789abcdef";
+        // "xxxxxxxx-xxxx-4xxx-yxxx-xxxxxxxxxxxx", y is one of 8, 9, a, b.
+        // each random word gives 8 digits
+        std::string uuid(36, '-');
+        uint32_t bits = 0;
+        int n = 0;
+        for (int pos = 0; pos < 36; ++pos) {
+            if (pos == 8 || pos == 13 || pos == 18 || pos == 23)
+                continue;
+
+            if (n++ % 8 == 0)
+                bits = gen();
+            int v = bits & 0xf;
+            bits >>= 4;
+
+            if (pos == 14)
+                v = 4;
+            else if (pos == 19)
+                v = 8 | (v & 3);
+            uuid[pos] = hex[v];
         }
-        ss << "-";
-        for (i = 0; i < 12; i++) {
-            ss << dis(gen);
-        };
-        return ss.str();
+        return uuid;
     }
 
 }
\ No newline at end of file
@@ -0,0 +1,305 @@
+// TODO: add copyright
+
+#include "control-server.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <sstream>
+#include <stdexcept>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+
+#include <spdlog/spdlog.h>
+
+#include "ndnapp.hpp"
+
+using namespace std;
+
+// read from a client at once; the rest is read on the next wakeup, so that
+// one client doesn't hold up others
+static size_t kReadBudget = 256 * 1024;
+static size_t kMaxRequestLength = 4096;
+// responses a client doesn't take: its requests are not read meanwhile
+static size_t kMaxPendingOutput = 1024 * 1024;
+
+#ifdef MSG_NOSIGNAL
+static int kSendFlags = MSG_NOSIGNAL;
+#else
+static int kSendFlags = 0;
+#endif
+
+#ifndef _WIN32
+static void setNonBlocking(int fd)
+{
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+    fcntl(fd, F_SETFD, FD_CLOEXEC);
+#ifdef SO_NOSIGPIPE
+    int on = 1;
+    setsockopt(fd, SOL_SOCKET, SO_NOSIGPIPE, &on, sizeof(on));
+#endif
+}
+#endif
+
+ControlServer::ControlServer(const string& path, ndnapp::App& app,
+    shared_ptr<spdlog::logger> logger)
+    : path_(path)
+    , app_(app)
+    , logger_(logger)
+    , fd_(-1)
+{
+#ifdef _WIN32
+    throw runtime_error("control socket is not supported on this platform");
+#else
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (path_.size() >= sizeof(addr.sun_path))
+        throw runtime_error("control socket path is too long: " + path_);
+    strncpy(addr.sun_path, path_.c_str(), sizeof(addr.sun_path) - 1);
+
+    // socket of a previous run, nothing else is replaced
+    struct stat st;
+    if (lstat(path_.c_str(), &st) == 0)
+    {
+        if (!S_ISSOCK(st.st_mode))
+            throw runtime_error("control socket path exists and is not a socket: " + path_);
+        unlink(path_.c_str());
+    }
+
+    fd_ = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd_ < 0)
+        throw runtime_error("failed to create control socket: " + string(strerror(errno)));
+
+    setNonBlocking(fd_);
+    if (::bind(fd_, (struct sockaddr*)&addr, sizeof(addr)) < 0 ||
+        // commands are not authenticated: owner only
+        chmod(path_.c_str(), S_IRUSR | S_IWUSR) < 0 ||
+        listen(fd_, SOMAXCONN) < 0)
+    {
+        string error = strerror(errno);
+        ::close(fd_);
+        throw runtime_error("failed to listen on control socket " + path_ + ": " + error);
+    }
+
+    app_.watchDescriptor(fd_, [this]() { onAccept(); });
+    logger_->info("control socket listening at {}", path_);
+#endif
+}
+
+ControlServer::~ControlServer()
+{
+#ifndef _WIN32
+    while (clients_.size())
+        close(clients_.begin()->first);
+
+    if (fd_ >= 0)
+    {
+        app_.unwatchDescriptor(fd_);
+        ::close(fd_);
+        unlink(path_.c_str());
+    }
+#endif
+}
+
+void ControlServer::addCommand(const string& name, Handler handler)
+{
+    commands_[name] = handler;
+}
+
+void ControlServer::processEvents()
+{
+    for (auto it = clients_.begin(); it != clients_.end(); )
+    {
+        int fd = it->first;
+        Client& client = (it++)->second;
+
+        if (client.out_.empty())
+            continue;
+        if (!flush(fd, client))
+            continue;
+
+        // client took its responses: read what it sent meanwhile
+        if (client.paused_ && !client.eof_ && client.out_.empty())
+        {
+            client.paused_ = false;
+            app_.watchDescriptor(fd, [this, fd]() { onReadable(fd); });
+        }
+    }
+}
+
+void ControlServer::onAccept()
+{
+#ifndef _WIN32
+    while (true)
+    {
+        int fd = accept(fd_, nullptr, nullptr);
+        if (fd < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            if (errno != EAGAIN && errno != EWOULDBLOCK)
+                logger_->warn("failed to accept control connection: {}", strerror(errno));
+            break;
+        }
+
+        setNonBlocking(fd);
+        clients_[fd] = { "", "", false, false };
+        app_.watchDescriptor(fd, [this, fd]() { onReadable(fd); });
+
+        logger_->debug("control client connected ({} total)", clients_.size());
+    }
+#endif
+}
+
+void ControlServer::onReadable(int fd)
+{
+#ifndef _WIN32
+    auto it = clients_.find(fd);
+    if (it == clients_.end())
+        return;
+
+    Client& client = it->second;
+    bool eof = false;
+    size_t nRead = 0;
+    char buf[16 * 1024];
+
+    while (nRead < kReadBudget)
+    {
+        ssize_t n = ::read(fd, buf, sizeof(buf));
+        if (n > 0)
+        {
+            client.in_.append(buf, n);
+            nRead += n;
+            continue;
+        }
+        if (n < 0 && errno == EINTR)
+            continue;
+
+        eof = (n == 0 || (errno != EAGAIN && errno != EWOULDBLOCK));
+        break;
+    }
+
+    // all requests read are answered with one write
+    size_t start = 0;
+    for (size_t end; (end = client.in_.find('\n', start)) != string::npos; start = end + 1)
+        serve(client.in_.substr(start, end - start), client.out_);
+    client.in_.erase(0, start);
+
+    if (client.in_.size() > kMaxRequestLength)
+    {
+        client.out_ += "ERR request is too long\n";
+        client.in_.clear();
+        eof = true;
+    }
+    // the last request may have no newline
+    else if (eof && client.in_.size())
+    {
+        serve(client.in_, client.out_);
+        client.in_.clear();
+    }
+
+    client.eof_ = eof;
+    if (!flush(fd, client))
+        return;
+
+    // the rest of responses is flushed by processEvents()
+    if (client.eof_ || client.out_.size() >= kMaxPendingOutput)
+    {
+        client.paused_ = true;
+        app_.watchDescriptor(fd, nullptr);
+    }
+#endif
+}
+
+void ControlServer::serve(const string& request, string& out)
+{
+    istringstream ss(request);
+    string command;
+    vector<string> args;
+
+    ss >> command;
+    for (string arg; ss >> arg; )
+        args.push_back(arg);
+
+    // empty line gets empty response, so that clients can sync on it
+    if (command.empty())
+    {
+        out += "OK 0\n";
+        return;
+    }
+
+    auto it = commands_.find(command);
+    if (it == commands_.end())
+    {
+        out += "ERR unknown command " + command + "\n";
+        return;
+    }
+
+    ostringstream os;
+    try
+    {
+        it->second(args, os);
+    }
+    catch (exception& e)
+    {
+        string error = e.what();
+        replace(error.begin(), error.end(), '\n', ' ');
+        out += "ERR " + error + "\n";
+        return;
+    }
+
+    string output = os.str();
+    if (output.size() && output.back() != '\n')
+        output += '\n';
+
+    out += "OK " + to_string(count(output.begin(), output.end(), '\n')) + "\n";
+    out += output;
+}
+
+bool ControlServer::flush(int fd, Client& client)
+{
+#ifndef _WIN32
+    size_t sent = 0;
+    while (sent < client.out_.size())
+    {
+        ssize_t n = send(fd, client.out_.data() + sent, client.out_.size() - sent, kSendFlags);
+        if (n > 0)
+        {
+            sent += n;
+            continue;
+        }
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+            break;
+
+        logger_->debug("control client disconnected");
+        close(fd);
+        return false;
+    }
+    client.out_.erase(0, sent);
+
+    if (client.eof_ && client.out_.empty())
+    {
+        close(fd);
+        return false;
+    }
+#endif
+    return true;
+}
+
+void ControlServer::close(int fd)
+{
+#ifndef _WIN32
+    app_.unwatchDescriptor(fd);
+    ::close(fd);
+    clients_.erase(fd);
+#endif
+}
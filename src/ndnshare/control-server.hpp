@@ -0,0 +1,77 @@
+// TODO: add copyright
+
+#ifndef __control_server_hpp__
+#define __control_server_hpp__
+
+#include <functional>
+#include <map>
+#include <memory>
+#include <ostream>
+#include <string>
+#include <vector>
+
+namespace spdlog {
+    class logger;
+}
+
+namespace ndnapp {
+    class App;
+}
+
+/**
+ * Local control plane of a headless ndnshare: commands are served over a
+ * Unix-domain socket, on the thread that runs App (its descriptors are
+ * waited on by App::run()).
+ * Protocol is line-based, so that clients can pipeline requests:
+ *   request:   <command> [<arg> ...]\n
+ *   response:  OK <n>\n followed by n lines of output, or
+ *              ERR <message>\n
+ * Responses come in order of requests. All requests read at once are
+ * answered with one write.
+ */
+class ControlServer {
+public:
+    // writes output lines to os; throws to answer ERR
+    typedef std::function<void(const std::vector<std::string>& args, std::ostream& os)> Handler;
+
+    // socket file left by a previous run is replaced
+    ControlServer(const std::string& path, ndnapp::App& app,
+        std::shared_ptr<spdlog::logger> logger);
+    ~ControlServer();
+    ControlServer(const ControlServer&) = delete;
+    ControlServer& operator=(const ControlServer&) = delete;
+
+    void addCommand(const std::string& name, Handler handler);
+
+    // flushes responses clients were not ready to take. must be called
+    // on the thread that runs App
+    void processEvents();
+
+    std::string getPath() const { return path_; }
+    size_t getClientsNumber() const { return clients_.size(); }
+
+private:
+    typedef struct _Client {
+        std::string in_, out_;
+        // not read from till out_ is flushed
+        bool paused_;
+        // closed once out_ is flushed
+        bool eof_;
+    } Client;
+
+    std::string path_;
+    ndnapp::App& app_;
+    std::shared_ptr<spdlog::logger> logger_;
+    int fd_;
+    std::map<int, Client> clients_;
+    std::map<std::string, Handler> commands_;
+
+    void onAccept();
+    void onReadable(int fd);
+    void serve(const std::string& request, std::string& out);
+    // false if client is gone
+    bool flush(int fd, Client& client);
+    void close(int fd);
+};
+
+#endif
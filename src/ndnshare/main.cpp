@@ -1,13 +1,17 @@
 // TODO: add copyright
 
 #include <csignal>
+#include <cstdio>
 #include <filesystem>
 #include <fstream>
 #include <iostream>
 #include <map>
+#include <sstream>
 #include <thread>
 
 #include <docopt.h>
+#include <fmt/ostream.h>
+#include <fmt/ranges.h>
 #include <ndn-ind/face.hpp>
 #include <ndn-ind-tools/micro-forwarder/micro-forwarder-transport.hpp>
 #include <cnl-cpp/namespace.hpp>
@@ -15,13 +19,16 @@
 #include <cli/cli.h>
 #include <cli/loopscheduler.h>
 #include <cli/clilocalsession.h>
+#include <spdlog/sinks/stdout_color_sinks.h>
 
 #include <ndn-sd/ndn-sd.hpp>
 
 #include "config.hpp"
+#include "control-server.hpp"
 #include "fileshare.hpp"
 #include "logging.hpp"
 #include "ndnapp.hpp"
+#include "ring-sink.hpp"
 #include "uuid.hpp"
 
 using namespace std;
@@ -51,7 +58,7 @@ static const char USAGE[] =
 R"(ndnshare.
 
     Usage:
-      ndnshare <path> <prefix> --cert=<certificate> [--id=<node_id>] [--anchor=<trust_anchor>] [--logfile=<log_file>] [--tcp | --udp]
+      ndnshare <path> <prefix> --cert=<certificate> (--anchor=<trust_anchor> | --no-validation) [--allow-unverified] [--id=<node_id>] [--logfile=<log_file>] [--peers=<peer_table>] [--lazy] [--flap-hold=<ms>] [--tcp | --udp] [--daemon [--control=<socket_path>]]
       ndnshare (-h | --help)
       ndnshare --version
 
@@ -61,9 +68,16 @@ R"(ndnshare.
       --cert=<certificate>      Certificate used to sign data.
       --id=<node_id>            Custom node ID (generated, if not provided).
       --anchor=<tust_anchor>    Trust anchor (certificate) used to verify connections and incoming data.
+      --no-validation           Do not validate peer certificate chains, only match them to what peers advertise.
+      --allow-unverified        Add routes to peers that advertise no certificate.
       --logfile=<log_file>      Log file(defaults to stdout if not provided).
+      --peers=<peer_table>      File to keep discovered peers in, for faster restart.
+      --lazy                    Resolve discovered peers only when their prefixes are requested.
+      --flap-hold=<ms>          Keep face of a removed peer this long, in case it comes back [default: 5000].
       -t, --tcp                 Advertise over Bonjour as TCP-only service.
       -u, --udp                 Advertise over Bonjour as UDP-only service.
+      --daemon                  Run headless: no terminal, commands are taken over control socket.
+      --control=<socket_path>   Control socket of daemon mode [default: ndnshare.sock].
 )";
 
 vector<Proto> loadProtocols(const map<string, docopt::value>& args);
@@ -173,58 +187,21 @@ static uint8_t DEFAULT_RSA_PRIVATE_KEY_DER[] = {
 };
 
 
-//******************************************************************************
-// callback sink implementation
-// @see https://github.com/gabime/spdlog/wiki/4.-Sinks#implementing-your-own-sink
-
-#include "spdlog/sinks/base_sink.h"
-namespace spdlog
-{
-    namespace ext
-    {
-        typedef std::function<void(const std::string&)> SinkHook;
-
-        template<typename Mutex>
-        class CliFriendlySink : public spdlog::sinks::base_sink <Mutex>
-        {
-        public:
-            CliFriendlySink(cli::CliSession* cli) : cli_(cli) {}
-
-        protected:
-            void sink_it_(const spdlog::details::log_msg& msg) override
-            {
-                printf("\r");
-
-                spdlog::memory_buf_t formatted;
-                spdlog::sinks::base_sink<Mutex>::formatter_->format(msg, formatted);
-                std::cout << fmt::to_string(formatted);
-
-                cli_->Prompt();
-            }
-
-            void flush_() override
-            {
-                std::cout << std::flush;
-            }
-        private:
-            cli::CliSession* cli_;
-        };
-
-        using CliFriendlySinkMt = CliFriendlySink<std::mutex>;
-        using CliFriendlySinkSt = CliFriendlySink<spdlog::details::null_mutex>;
-    }
-}
-
 atomic_bool run = true;
 void signal_handler(int signal)
 {
-    run = !(signal == SIGINT);
+    run = !(signal == SIGINT || signal == SIGTERM);
     NLOG_DEBUG("signal caught");
 }
 
+// log records queued for the writer thread. more are dropped: event loop
+// never waits on the terminal
+static size_t kLogRingSize = 8192;
+
 int main(int argc, char** argv)
 {
     signal(SIGINT, signal_handler);
+    signal(SIGTERM, signal_handler);
     auto mainLogger = spdlog::default_logger();
     mainLogger->set_level(spdlog::level::trace);
 
@@ -245,11 +222,48 @@ int main(int argc, char** argv)
     }
 #endif
 
+    // no terminal to share in daemon mode: records are written to log file
+    // or stdout by the sink's thread, so that the event loop doesn't wait
+    // on console or disk
+    bool daemon = args["--daemon"].asBool();
+    if (daemon)
+    {
+        shared_ptr<FILE> logFile(stdout, [](FILE*) {});
+        if (args["--logfile"])
+        {
+            logFile.reset(fopen(args["--logfile"].asString().c_str(), "a"), [](FILE* f) { if (f) fclose(f); });
+            if (!logFile)
+            {
+                NLOG_ERROR("failed to open log file {}", args["--logfile"].asString());
+                return -1;
+            }
+        }
+
+        auto sink = make_shared<ndnapp::helpers::RingSink>([logFile](const char* data, size_t size)
+        {
+            fwrite(data, 1, size, logFile.get());
+            fflush(logFile.get());
+        }, kLogRingSize);
+
+        mainLogger = make_shared<spdlog::logger>("ndnshare", sink);
+        mainLogger->set_level(spdlog::level::trace);
+        spdlog::set_default_logger(mainLogger);
+    }
+
     string instanceId = (args["--id"] ? args["--id"].asString() : uuid::generate_uuid_v4());
     vector<Proto> protocols = loadProtocols(args);
     NdnSd::AdvertiseParameters params = loadParameters(instanceId, args);
 
     ndnapp::App app("ndnshare", instanceId, mainLogger);
+    if (args["--anchor"] && !app.setTrustAnchor(args["--anchor"].asString()))
+        return -1;
+    app.setSkipValidation(args["--no-validation"].asBool());
+    app.setAllowUnverified(args["--allow-unverified"].asBool());
+    if (args["--peers"])
+        app.setPeerTable(args["--peers"].asString());
+    if (args["--lazy"].asBool())
+        app.setLazyResolve(true);
+    app.setFlapDamping(chrono::milliseconds(args["--flap-hold"].asLong()));
     app.configure(protocols, params);
 
     try
@@ -264,111 +278,216 @@ int main(int argc, char** argv)
         //    Blob(DEFAULT_RSA_PRIVATE_KEY_DER, sizeof(DEFAULT_RSA_PRIVATE_KEY_DER)),
         //    Blob(DEFAULT_RSA_PUBLIC_KEY_DER, sizeof(DEFAULT_RSA_PUBLIC_KEY_DER))));
 
-        Face face(ptr_lib::make_shared<ndntools::MicroForwarderTransport>(),
+        // Interests of the file sharing client are what lazy mode resolves for
+        auto transport = ptr_lib::make_shared<ndnapp::helpers::LocalTransport>();
+        app.addLocalTransport(transport);
+        Face face(transport,
             ptr_lib::make_shared<ndntools::MicroForwarderTransport::ConnectionInfo>(app.getMfd()));
         face.setCommandSigningInfo(keyChain, keyChain.getDefaultCertificateName());
 
         FileshareClient peer(args["<path>"].asString(), params.prefix_, &face, &keyChain, mainLogger);
 
-        // setup cli
-        cli::LoopScheduler sessionLoop;
-
-        auto rootMenu = make_unique<cli::Menu>("_");
-        rootMenu->Insert("fetch", { "ndn_name" },
-            [&](ostream& os, string name)
+        // commands of CLI and control socket. they run on the main thread
+        // and write output lines to os
+        map<string, ControlServer::Handler> commands;
+        commands["fetch"] = [&](const vector<string>& args, ostream& os)
         {
-            sessionLoop.Post(std::bind(&FileshareClient::fetch, &peer, name));
-        },
-            "Fetch NDN generalized object and save as file");
-        rootMenu->Insert("faces",
-            [&](ostream& os)
+            if (args.size() != 1)
+                throw runtime_error("usage: fetch <ndn_name>");
+            if (app.findNodesServing(Name(args[0])).empty())
+                os << "no discovered node serves " << args[0] << endl;
+            peer.fetch(args[0]);
+        };
+        commands["serving"] = [&](const vector<string>& args, ostream& os)
         {
-            for (auto& [faceId, faceUri] : app.getMfd()->getFaces())
-            {
-                os << "\t" << faceId << " " << faceUri << endl;
-            }
-        });
-        rootMenu->Insert("routes",
-            [&](ostream& os) 
+            if (args.size() != 1)
+                throw runtime_error("usage: serving <ndn_name>");
+            for (auto& sd : app.findNodesServing(Name(args[0])))
+                os << fmt::format("{} is served by {} ({}) -- {}", args[0], sd->getUuid(),
+                    sd->getProtocol(), fmt::join(sd->getPrefixes(), " ")) << endl;
+        };
+        commands["flaps"] = [&](const vector<string>&, ostream& os)
+        {
+            for (auto& [peer, stats] : app.getFlapStats())
+                os << fmt::format("{}/{} removed {} flapped {} face reused {}", peer.first, peer.second,
+                    stats.removals_, stats.flaps_, stats.facesReused_) << endl;
+        };
+        commands["faces"] = [&](const vector<string>&, ostream& os)
         {
-            for (auto& [route, faces] : app.getMfd()->getRoutes())
+            for (auto& [faceId, faceUri] : app.getForwarderSnapshot()->faces_)
+                os << faceId << " " << faceUri << endl;
+        };
+        commands["routes"] = [&](const vector<string>&, ostream& os)
+        {
+            for (auto& [route, faces] : app.getForwarderSnapshot()->routes_)
             {
-                os << "\t" << route;
+                os << route;
                 for (auto fId : faces) os << " " << fId;
                 os << endl;
             }
-        });
-        rootMenu->Insert("files",
-            [&](ostream& os)
+        };
+        commands["files"] = [&](const vector<string>&, ostream& os)
         {
-            os << "\t" << peer.getRootPath() << ":" << endl;
+            os << peer.getRootPath() << ":" << endl;
             for (auto& f : peer.getFilesList())
-                os << "\t\t" << f << endl;
-        });
-        rootMenu->Insert("log", { "level" },
-            [&](ostream& os, string llevel) 
+                os << "\t" << f << endl;
+        };
+        commands["log"] = [&](const vector<string>& args, ostream& os)
+        {
+            if (args.size() != 1)
+                throw runtime_error("usage: log <level>");
+
+            auto level = spdlog::level::from_str(args[0]);
+            if (level == spdlog::level::off && args[0] != "off")
+                throw runtime_error("unknown log level " + args[0]);
+
+            mainLogger->set_level(level);
+            os << "set log level " << args[0] << endl;
+        };
+        commands["nodes"] = [&](const vector<string>&, ostream& os)
+        {
+            for (auto& r : app.getSnapshot()->services_)
+                os << r.fullname_ << " (" << r.subtype_ << ") " << r.prefix_ << endl;
+        };
+
+        unique_ptr<ControlServer> control;
+        unique_ptr<cli::LoopScheduler> runLoop;
+        unique_ptr<cli::Cli> cli;
+        unique_ptr<cli::CliLocalTerminalSession> session;
+        thread cliThread;
+
+        if (daemon)
         {
-            mainLogger->set_level(spdlog::level::from_str(llevel));
-            os << "set log level " << llevel << endl;
-        },
-            "Set log level: trace debug info warn error off"
-            );
-        rootMenu->Insert("nodes",
-            [&](ostream& os)
+            control = make_unique<ControlServer>(args["--control"].asString(), app, mainLogger);
+            for (auto& [name, handler] : commands)
+                control->addCommand(name, handler);
+        }
+        else
         {
-            for (auto& sd : app.getDiscoveredNodes())
-                os << "\t" << sd->getFullname() << " ("
-                    << sd->getSubtype() << ") " << sd->getPrefix() << endl;
-        },
-            "Print all discovered nodes");
-
-        cli::Cli cli(move(rootMenu));
-        cli.ExitAction([&](auto& out) { run = false; });
-        
-        cli::LoopScheduler runLoop;
-        cli::CliLocalTerminalSession session(cli, runLoop, cout);
-        
-        mainLogger->sinks().clear();
-        mainLogger->sinks().push_back(make_shared<spdlog::ext::CliFriendlySinkMt>(&session));
-
-        thread cliThread([&]() {
-            while (run)
+            // CLI runs on its own thread. commands that touch App state are
+            // posted to the main thread and print to the log, readers of 
+            // snapshots print right away
+            auto postCommand = [&](const string& command, vector<string> args)
+            {
+                app.post([&commands, command, args]()
+                {
+                    ostringstream os;
+                    try
+                    {
+                        commands.at(command)(args, os);
+                    }
+                    catch (exception& e)
+                    {
+                        NLOG_ERROR("{}: {}", command, e.what());
+                    }
+
+                    istringstream lines(os.str());
+                    for (string line; getline(lines, line); )
+                        NLOG_INFO("{}", line);
+                });
+            };
+            auto runCommand = [&](ostream& out, const string& command, vector<string> args)
             {
-                try 
+                ostringstream os;
+                try
                 {
-                    runLoop.Run();
+                    commands.at(command)(args, os);
                 }
                 catch (exception& e)
                 {
-                    NLOG_ERROR("caught exception in terminal session thread: {}", e.what());
+                    out << e.what() << endl;
                 }
-            }
-        });
 
-        // main runloop
-        auto processEvents = [&]() {
+                istringstream lines(os.str());
+                for (string line; getline(lines, line); )
+                    out << "\t" << line << endl;
+            };
+
+            auto rootMenu = make_unique<cli::Menu>("_");
+            rootMenu->Insert("fetch", { "ndn_name" },
+                [=](ostream& os, string name) { postCommand("fetch", { name }); },
+                "Fetch NDN generalized object and save as file");
+            rootMenu->Insert("serving", { "ndn_name" },
+                [=](ostream& os, string name) { postCommand("serving", { name }); },
+                "Print discovered nodes serving NDN name (longest prefix match)");
+            rootMenu->Insert("flaps",
+                [=](ostream& os) { postCommand("flaps", {}); },
+                "Print Removed/Added flap counters of discovered peers");
+            rootMenu->Insert("faces",
+                [=](ostream& os) { runCommand(os, "faces", {}); });
+            rootMenu->Insert("routes",
+                [=](ostream& os) { runCommand(os, "routes", {}); });
+            rootMenu->Insert("files",
+                [=](ostream& os) { runCommand(os, "files", {}); });
+            rootMenu->Insert("log", { "level" },
+                [=](ostream& os, string llevel) { runCommand(os, "log", { llevel }); },
+                "Set log level: trace debug info warn error off");
+            rootMenu->Insert("nodes",
+                [=](ostream& os) { runCommand(os, "nodes", {}); },
+                "Print all discovered nodes");
+
+            cli = make_unique<cli::Cli>(move(rootMenu));
+            cli->ExitAction([&](auto& out) { run = false; });
+
+            runLoop = make_unique<cli::LoopScheduler>();
+            session = make_unique<cli::CliLocalTerminalSession>(*cli, *runLoop, cout);
+
+            // prompt is redrawn once per batch of records, not per record
+            auto terminal = session.get();
+            mainLogger->sinks().clear();
+            mainLogger->sinks().push_back(make_shared<ndnapp::helpers::RingSink>(
+                [terminal](const char* data, size_t size)
+            {
+                cout << "\r";
+                cout.write(data, size) << flush;
+                terminal->Prompt();
+            }, kLogRingSize));
+
+            cliThread = thread([&]() {
+                while (run)
+                {
+                    try 
+                    {
+                        runLoop->Run();
+                    }
+                    catch (exception& e)
+                    {
+                        NLOG_ERROR("caught exception in terminal session thread: {}", e.what());
+                    }
+                }
+            });
+        }
+
+        // main runloop. App waits for forwarder and DNS-SD events, for 
+        // posted CLI commands and for control socket requests; returns at 
+        // least this often to stop on exit
+        auto runTimeout = chrono::milliseconds(100);
+        while (run)
+        {
             try
             {
-                app.processEvents();
+                app.run(runTimeout);
                 peer.processEvents();
+                if (control)
+                    control->processEvents();
             }
             catch (exception& e)
             {
                 NLOG_ERROR("caught exception while processing events: {}", e.what());
             }
-        };
+        }
 
-        while (run)
+        if (runLoop)
         {
-            sessionLoop.Post(processEvents);
-            sessionLoop.ExecOne();
+            runLoop->Stop();
+            cliThread.join();
 
-            this_thread::sleep_for(chrono::milliseconds(5));
+            // terminal session goes away before App, which may log yet
+            mainLogger->flush();
+            mainLogger->sinks().clear();
+            mainLogger->sinks().push_back(make_shared<spdlog::sinks::stdout_color_sink_mt>());
         }
 
-        runLoop.Stop();
-        cliThread.join();
-
         NLOG_INFO("shutting down.");
     }
     catch (exception& e)
@@ -0,0 +1,567 @@
+#include <catch2/catch_test_macros.hpp>
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstring>
+#include <filesystem>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <spdlog/sinks/null_sink.h>
+#include <ndn-ind/face.hpp>
+#include <ndn-ind/security/key-chain.hpp>
+#include <ndn-ind/transport/udp-transport.hpp>
+#include <ndn-ind-tools/micro-forwarder/micro-forwarder.hpp>
+#include <ndn-ind-tools/micro-forwarder/micro-forwarder-transport.hpp>
+
+#include "ndnapp.hpp"
+#include "peer-table.hpp"
+
+#ifndef _WIN32
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#endif
+
+using namespace std;
+using namespace ndn;
+using namespace ndnsd;
+
+// NOTE: peers are announced over the in-process loopback backend and resolve
+// to 127.0.0.1. forwarder is shared by all Apps of the process and keeps
+// faces of destroyed ones, so every peer gets a port of its own and faces
+// are looked up by it
+
+typedef chrono::steady_clock Clock;
+
+static uint16_t nextPortHelper()
+{
+    static uint16_t port = 46000;
+    return port++;
+}
+
+static shared_ptr<NdnSd> announcePeerHelper(string uuid, uint16_t port, string prefix,
+    vector<string> prefixes = {}, Proto protocol = Proto::UDP)
+{
+    auto sd = make_shared<NdnSd>(uuid);
+    NdnSd::AdvertiseParameters params;
+    params.protocol_ = protocol;
+    params.port_ = port;
+    params.prefix_ = prefix;
+    params.prefixes_ = prefixes;
+    params.subtype_ = kNdnDnsServiceSubtypeMFD;
+
+    REQUIRE(sd->announce(params, [](void*) {},
+        [](int, int, string msg, bool, void*) { FAIL(msg); }) == 0);
+
+    return sd;
+}
+
+// App with a local application face, both over the process-wide forwarder
+class AppHelper {
+public:
+    AppHelper(string id)
+        : keyChain_("pib-memory:", "tpm-memory:")
+        , transport_(ptr_lib::make_shared<ndnapp::helpers::LocalTransport>())
+        , face_(transport_,
+            ptr_lib::make_shared<ndntools::MicroForwarderTransport::ConnectionInfo>(
+                ndntools::MicroForwarder::get()))
+        , app_("test", id, make_shared<spdlog::logger>(id, make_shared<spdlog::sinks::null_sink_mt>()),
+            &face_, &keyChain_)
+    {
+        keyChain_.createIdentityV2(Name("/test/signer"));
+        // simulated peers advertise no certificate
+        app_.setAllowUnverified(true);
+        app_.addLocalTransport(transport_);
+        app_.setAddInstanceCallback([this](const shared_ptr<const NdnSd>&) { nAdded_++; });
+        app_.setRemoveInstanceCallback([this](const shared_ptr<const NdnSd>&) { nRemoved_++; });
+    }
+
+    void configure(const vector<Proto>& protocols = { Proto::UDP })
+    {
+        NdnSd::AdvertiseParameters params;
+        params.prefix_ = "/test/app/" + app_.getInstanceId();
+        params.subtype_ = kNdnDnsServiceSubtypeMFD;
+        app_.configure(protocols, params, "/test/signer");
+    }
+
+    bool runUntil(function<bool()> done, chrono::milliseconds timeout = chrono::seconds(2))
+    {
+        auto deadline = Clock::now() + timeout;
+        while (!done() && Clock::now() < deadline)
+        {
+            face_.processEvents();
+            app_.processEvents();
+        }
+        return done();
+    }
+
+    void runFor(chrono::milliseconds timeout)
+    {
+        runUntil([]() { return false; }, timeout);
+    }
+
+    // forwarder faces to a peer
+    vector<int> getPeerFaces(uint16_t port, Proto protocol = Proto::UDP) const
+    {
+        vector<int> faceIds;
+        string uri = (protocol == Proto::TCP ? "tcp://" : "udp://") + string("127.0.0.1:") + 
+            to_string(port);
+        for (auto& [faceId, faceUri] : app_.getForwarderSnapshot()->faces_)
+            if (faceUri == uri)
+                faceIds.push_back(faceId);
+        return faceIds;
+    }
+
+    bool isRouted(const string& prefix, int faceId) const
+    {
+        auto& routes = app_.getForwarderSnapshot()->routes_;
+        auto it = routes.find(prefix);
+        return it != routes.end() &&
+            find(it->second.begin(), it->second.end(), faceId) != it->second.end();
+    }
+
+    KeyChain keyChain_;
+    // Interests of face_ are those of a local application
+    shared_ptr<ndnapp::helpers::LocalTransport> transport_;
+    Face face_;
+    ndnapp::App app_;
+    int nAdded_ = 0;
+    int nRemoved_ = 0;
+};
+
+#ifndef _WIN32
+// TCP peer that accepts connections, but never reads
+class ListenerHelper {
+public:
+    ListenerHelper(uint16_t port)
+    {
+        fd_ = socket(AF_INET, SOCK_STREAM, 0);
+        REQUIRE(fd_ >= 0);
+        int on = 1;
+        setsockopt(fd_, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+
+        struct sockaddr_in addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sin_family = AF_INET;
+        addr.sin_port = htons(port);
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        REQUIRE(::bind(fd_, (struct sockaddr*)&addr, sizeof(addr)) == 0);
+        REQUIRE(listen(fd_, 8) == 0);
+        fcntl(fd_, F_SETFL, fcntl(fd_, F_GETFL) | O_NONBLOCK);
+    }
+
+    ~ListenerHelper()
+    {
+        for (int fd : accepted_)
+            close(fd);
+        close(fd_);
+    }
+
+    // connections made so far
+    size_t accept()
+    {
+        int fd;
+        while ((fd = ::accept(fd_, nullptr, nullptr)) >= 0)
+            accepted_.push_back(fd);
+        return accepted_.size();
+    }
+
+private:
+    int fd_;
+    vector<int> accepted_;
+};
+#endif
+
+TEST_CASE("App trust policy", "[app][trust]") {
+    REQUIRE(NdnSd::setBackend(DiscoveryBackend::Loopback));
+    {
+        GIVEN("App that does not allow unverified peers") {
+            AppHelper h("trust-app");
+            h.app_.setAllowUnverified(false);
+
+            THEN("trust anchor that can't be read is refused") {
+                REQUIRE_FALSE(h.app_.setTrustAnchor("/nonexistent/anchor.cert"));
+            }
+
+            WHEN("a peer without certificate is discovered") {
+                h.configure();
+                uint16_t port = nextPortHelper();
+                auto peer = announcePeerHelper("trust-peer", port, "/test/trust");
+                REQUIRE(h.runUntil([&]() { return h.nAdded_ == 1; }));
+                h.runFor(chrono::milliseconds(200));
+
+                THEN("it gets no face") {
+                    REQUIRE(h.getPeerFaces(port).empty());
+                }
+            }
+        }
+    }
+    REQUIRE(NdnSd::setBackend(DiscoveryBackend::DnsSd));
+}
+
+TEST_CASE("App face pooling", "[app][pooling]") {
+    REQUIRE(NdnSd::setBackend(DiscoveryBackend::Loopback));
+    {
+        GIVEN("two peers behind the same address") {
+            AppHelper h("pooling-app");
+            h.configure();
+
+            uint16_t port = nextPortHelper();
+            auto peerA = announcePeerHelper("pooling-peer-a", port, "/test/pooling/a",
+                { "/test/pooling/shared" });
+            auto peerB = announcePeerHelper("pooling-peer-b", port, "/test/pooling/b",
+                { "/test/pooling/shared" });
+
+            REQUIRE(h.runUntil([&]() {
+                auto faces = h.getPeerFaces(port);
+                return faces.size() == 1 && h.isRouted("/test/pooling/a", faces[0]) &&
+                    h.isRouted("/test/pooling/b", faces[0]);
+            }));
+            int faceId = h.getPeerFaces(port)[0];
+
+            THEN("they share a face routed for prefixes of both") {
+                REQUIRE(h.nAdded_ == 2);
+                REQUIRE(h.isRouted("/test/pooling/shared", faceId));
+            }
+
+            WHEN("one of them is gone") {
+                peerA.reset();
+                REQUIRE(h.runUntil([&]() { return !h.isRouted("/test/pooling/a", faceId); }));
+
+                THEN("face stays with routes the other one still needs") {
+                    REQUIRE(h.nRemoved_ == 1);
+                    REQUIRE(h.getPeerFaces(port) == vector<int>({ faceId }));
+                    REQUIRE(h.isRouted("/test/pooling/b", faceId));
+                    REQUIRE(h.isRouted("/test/pooling/shared", faceId));
+                }
+            }
+
+            WHEN("one of them stops advertising a prefix") {
+                NdnSd::AdvertiseParameters params;
+                params.protocol_ = Proto::UDP;
+                params.port_ = port;
+                params.prefix_ = "/test/pooling/a";
+                params.subtype_ = kNdnDnsServiceSubtypeMFD;
+                REQUIRE(peerA->update(params, [](int, int, string msg, bool, void*) { FAIL(msg); }) == 0);
+                // updated instance is announced added again, its new face 
+                // use follows once the face is connected
+                REQUIRE(h.runUntil([&]() { return h.nAdded_ == 3; }));
+                h.runFor(chrono::milliseconds(200));
+
+                THEN("route is kept while the other one advertises it") {
+                    REQUIRE(h.isRouted("/test/pooling/shared", faceId));
+                    REQUIRE(h.isRouted("/test/pooling/a", faceId));
+                }
+
+                AND_WHEN("the other one stops advertising it too") {
+                    params.port_ = port;
+                    params.prefix_ = "/test/pooling/b";
+                    REQUIRE(peerB->update(params, [](int, int, string msg, bool, void*) { FAIL(msg); }) == 0);
+
+                    THEN("route is removed from the face") {
+                        REQUIRE(h.runUntil([&]() { return !h.isRouted("/test/pooling/shared", faceId); }));
+                        REQUIRE(h.isRouted("/test/pooling/a", faceId));
+                        REQUIRE(h.isRouted("/test/pooling/b", faceId));
+                    }
+                }
+            }
+
+            WHEN("both of them are gone") {
+                peerA.reset();
+                peerB.reset();
+
+                THEN("face is removed") {
+                    REQUIRE(h.runUntil([&]() { return h.getPeerFaces(port).empty(); }));
+                    REQUIRE(h.nRemoved_ == 2);
+                    REQUIRE_FALSE(h.isRouted("/test/pooling/shared", faceId));
+                }
+            }
+        }
+    }
+    REQUIRE(NdnSd::setBackend(DiscoveryBackend::DnsSd));
+}
+
+TEST_CASE("App flap damping", "[app][flap]") {
+    REQUIRE(NdnSd::setBackend(DiscoveryBackend::Loopback));
+    {
+        GIVEN("a routed peer and hold time") {
+            auto holdTime = chrono::milliseconds(500);
+            AppHelper h("flap-app");
+            h.app_.setFlapDamping(holdTime);
+            h.configure();
+
+            uint16_t port = nextPortHelper();
+            auto peer = announcePeerHelper("flap-peer", port, "/test/flap");
+            REQUIRE(h.runUntil([&]() {
+                auto faces = h.getPeerFaces(port);
+                return faces.size() == 1 && h.isRouted("/test/flap", faces[0]);
+            }));
+            int faceId = h.getPeerFaces(port)[0];
+
+            auto stats = [&]() {
+                auto it = h.app_.getFlapStats().find({ "flap-peer", Proto::UDP });
+                return it != h.app_.getFlapStats().end() ? it->second : ndnapp::App::FlapStats{};
+            };
+
+            auto removed = Clock::now();
+            peer.reset();
+            REQUIRE(h.runUntil([&]() { return stats().removals_ == 1; }));
+
+            THEN("its face is held") {
+                REQUIRE(h.nRemoved_ == 0);
+                REQUIRE(h.isRouted("/test/flap", faceId));
+            }
+
+            WHEN("it is added back within hold time") {
+                peer = announcePeerHelper("flap-peer", port, "/test/flap");
+                REQUIRE(h.runUntil([&]() { return stats().facesReused_ == 1; }));
+
+                THEN("face is reused") {
+                    REQUIRE(stats().flaps_ == 1);
+                    REQUIRE(h.nRemoved_ == 0);
+                    REQUIRE(h.getPeerFaces(port) == vector<int>({ faceId }));
+                    REQUIRE(h.isRouted("/test/flap", faceId));
+                }
+
+                AND_WHEN("hold time has passed") {
+                    h.runFor(holdTime * 2);
+
+                    THEN("face stays") {
+                        REQUIRE(h.nRemoved_ == 0);
+                        REQUIRE(h.isRouted("/test/flap", faceId));
+                    }
+                }
+            }
+
+            WHEN("it is added back with another prefix") {
+                peer = announcePeerHelper("flap-peer", port, "/test/flap/other");
+                REQUIRE(h.runUntil([&]() {
+                    auto faces = h.getPeerFaces(port);
+                    return faces.size() == 1 && h.isRouted("/test/flap/other", faces[0]);
+                }));
+
+                THEN("held face is replaced") {
+                    REQUIRE(stats().flaps_ == 1);
+                    REQUIRE(stats().facesReused_ == 0);
+                    REQUIRE(h.getPeerFaces(port) != vector<int>({ faceId }));
+                    REQUIRE_FALSE(h.isRouted("/test/flap", h.getPeerFaces(port)[0]));
+                }
+            }
+
+            WHEN("it doesn't come back") {
+                REQUIRE(h.runUntil([&]() { return h.nRemoved_ == 1; }));
+
+                THEN("it is removed once hold time has passed") {
+                    REQUIRE(Clock::now() - removed >= holdTime);
+                    REQUIRE(h.runUntil([&]() { return h.getPeerFaces(port).empty(); }));
+                    REQUIRE(stats().flaps_ == 0);
+                }
+            }
+        }
+    }
+    REQUIRE(NdnSd::setBackend(DiscoveryBackend::DnsSd));
+}
+
+TEST_CASE("App lazy resolve", "[app][lazy]") {
+    REQUIRE(NdnSd::setBackend(DiscoveryBackend::Loopback));
+    {
+        GIVEN("a lazy App and a discovered peer") {
+            auto idleTimeout = chrono::milliseconds(500);
+            AppHelper h("lazy-app");
+            h.app_.setLazyResolve(true, idleTimeout);
+            h.configure();
+
+            uint16_t port = nextPortHelper();
+            string uuid = "lazy-peer-" + to_string(port);
+            string prefix = "/test/lazy/" + uuid;
+            auto peer = announcePeerHelper(uuid, port, prefix);
+
+            REQUIRE(h.runUntil([&]() {
+                for (auto& sd : h.app_.getDiscoveredNodes())
+                    if (sd->getUuid() == uuid)
+                        return true;
+                return false;
+            }));
+            h.runFor(chrono::milliseconds(200));
+
+            auto isRouted = [&]() {
+                auto faces = h.getPeerFaces(port);
+                return faces.size() == 1 && h.isRouted(prefix, faces[0]);
+            };
+            auto expressInterest = [](Face& face, const Name& name) {
+                face.expressInterest(name, 
+                    [](const ptr_lib::shared_ptr<const Interest>&, const ptr_lib::shared_ptr<Data>&) {},
+                    [](const ptr_lib::shared_ptr<const Interest>&) {});
+            };
+
+            THEN("it is not resolved") {
+                REQUIRE(h.nAdded_ == 0);
+                REQUIRE(h.getPeerFaces(port).empty());
+            }
+
+            WHEN("a local application asks for data named after it") {
+                expressInterest(h.face_, Name("/test/data").append(uuid));
+                REQUIRE(h.runUntil(isRouted));
+
+                THEN("it is resolved and routed") {
+                    REQUIRE(h.nAdded_ == 1);
+                    REQUIRE(h.app_.findNodesServing(Name(prefix)).size() == 1);
+                }
+
+                AND_WHEN("its route sees no Interests for idle timeout") {
+                    REQUIRE(h.runUntil([&]() { return h.getPeerFaces(port).empty(); }, idleTimeout * 4));
+
+                    THEN("it is reaped, and activated again for its last known prefix") {
+                        REQUIRE(h.nRemoved_ == 0);
+                        REQUIRE(h.app_.findNodesServing(Name(prefix)).empty());
+
+                        expressInterest(h.face_, Name(prefix).append("data"));
+                        REQUIRE(h.runUntil(isRouted));
+                    }
+                }
+            }
+
+            WHEN("a local application asks for data no peer is known for") {
+                expressInterest(h.face_, Name("/test/unknown").append(to_string(port)));
+
+                THEN("a few peers are tried") {
+                    REQUIRE(h.runUntil(isRouted));
+                }
+            }
+
+            WHEN("a peer forwards an Interest for data named after it") {
+                Face remote(ptr_lib::make_shared<UdpTransport>(),
+                    ptr_lib::make_shared<UdpTransport::ConnectionInfo>("127.0.0.1", 
+                        h.app_.getListenPort(Proto::UDP)));
+                expressInterest(remote, Name("/test/data").append(uuid));
+                h.runUntil([&]() { remote.processEvents(); return false; }, chrono::milliseconds(500));
+
+                THEN("it is not resolved") {
+                    REQUIRE(h.nAdded_ == 0);
+                    REQUIRE(h.getPeerFaces(port).empty());
+                }
+            }
+        }
+    }
+    REQUIRE(NdnSd::setBackend(DiscoveryBackend::DnsSd));
+}
+
+TEST_CASE("App warm start", "[app][warm-start]") {
+    REQUIRE(NdnSd::setBackend(DiscoveryBackend::Loopback));
+    {
+        GIVEN("a peer persisted by the previous run") {
+            auto grace = chrono::milliseconds(500);
+            string path = (filesystem::temp_directory_path() / "ndnapp-app-test-peers").string();
+            filesystem::remove(path);
+
+            uint16_t port = nextPortHelper();
+            string uuid = "warm-peer-" + to_string(port);
+            {
+                ndnapp::helpers::PeerTable pt;
+                REQUIRE(pt.open(path));
+                array<uint8_t, 32> noDigest;
+                noDigest.fill(0);
+                REQUIRE(pt.update({ uuid, Proto::UDP, "127.0.0.1", port, { "/test/warm" }, noDigest,
+                    chrono::system_clock::now() }));
+            }
+
+            // App keeps peer table locked until it is gone
+            auto app = make_unique<AppHelper>("warm-app");
+            AppHelper& h = *app;
+            REQUIRE(h.app_.setPeerTable(path, grace));
+            h.configure();
+
+            REQUIRE(h.runUntil([&]() {
+                auto faces = h.getPeerFaces(port);
+                return faces.size() == 1 && h.isRouted("/test/warm", faces[0]);
+            }));
+            int faceId = h.getPeerFaces(port)[0];
+
+            THEN("its route is added before it is discovered") {
+                REQUIRE(h.nAdded_ == 0);
+                REQUIRE(h.app_.getTimeToFirstConfirmedRoute().count() == 0);
+            }
+
+            WHEN("it is discovered unchanged") {
+                auto peer = announcePeerHelper(uuid, port, "/test/warm");
+                REQUIRE(h.runUntil([&]() { return h.nAdded_ == 1; }));
+                h.runFor(grace * 2);
+
+                THEN("provisional route is confirmed and kept") {
+                    REQUIRE(h.getPeerFaces(port) == vector<int>({ faceId }));
+                    REQUIRE(h.isRouted("/test/warm", faceId));
+                }
+            }
+
+            WHEN("it is discovered with another prefix") {
+                auto peer = announcePeerHelper(uuid, port, "/test/warm/other");
+                REQUIRE(h.runUntil([&]() {
+                    auto faces = h.getPeerFaces(port);
+                    return faces.size() == 1 && h.isRouted("/test/warm/other", faces[0]);
+                }));
+
+                THEN("provisional route is replaced") {
+                    REQUIRE_FALSE(h.isRouted("/test/warm", h.getPeerFaces(port)[0]));
+                }
+            }
+
+            WHEN("it is not discovered within grace period") {
+                REQUIRE(h.runUntil([&]() { return h.getPeerFaces(port).empty(); }, grace * 4));
+
+                THEN("provisional route is removed along with the peer") {
+                    REQUIRE_FALSE(h.isRouted("/test/warm", faceId));
+
+                    ndnapp::helpers::PeerTable pt;
+                    REQUIRE_FALSE(pt.open(path));
+                    app.reset();
+                    REQUIRE(pt.open(path));
+                    for (auto& p : pt.load())
+                        REQUIRE(p.uuid_ != uuid);
+                }
+            }
+        }
+    }
+    REQUIRE(NdnSd::setBackend(DiscoveryBackend::DnsSd));
+}
+
+#ifndef _WIN32
+TEST_CASE("App TCP connect", "[app][connect]") {
+    REQUIRE(NdnSd::setBackend(DiscoveryBackend::Loopback));
+    {
+        GIVEN("App that discovers TCP peers") {
+            AppHelper h("connect-app");
+            h.configure({ Proto::UDP, Proto::TCP });
+            uint16_t port = nextPortHelper();
+
+            WHEN("a peer accepts connections") {
+                ListenerHelper listener(port);
+                auto peer = announcePeerHelper("connect-peer", port, "/test/connect", {}, Proto::TCP);
+
+                THEN("its face is added over the connection App has made") {
+                    REQUIRE(h.runUntil([&]() {
+                        auto faces = h.getPeerFaces(port, Proto::TCP);
+                        return faces.size() == 1 && h.isRouted("/test/connect", faces[0]);
+                    }));
+                    REQUIRE(listener.accept() == 1);
+                }
+            }
+
+            WHEN("a peer refuses connections") {
+                auto peer = announcePeerHelper("refusing-peer", port, "/test/refusing", {}, Proto::TCP);
+                REQUIRE(h.runUntil([&]() { return h.nAdded_ == 1; }));
+                h.runFor(chrono::milliseconds(200));
+
+                THEN("it gets no face") {
+                    REQUIRE(h.getPeerFaces(port, Proto::TCP).empty());
+                }
+            }
+        }
+    }
+    REQUIRE(NdnSd::setBackend(DiscoveryBackend::DnsSd));
+}
+#endif
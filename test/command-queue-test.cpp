@@ -0,0 +1,102 @@
+
+#include <catch2/catch_test_macros.hpp>
+
+#include <thread>
+#include <vector>
+
+#ifndef _WIN32
+#include <poll.h>
+#endif
+
+#include "command-queue.hpp"
+
+using namespace std;
+using namespace ndnapp::helpers;
+
+#ifndef _WIN32
+static bool isReadableHelper(int fd, int timeoutMs = 0)
+{
+    struct pollfd pfd = { fd, POLLIN, 0 };
+    return poll(&pfd, 1, timeoutMs) == 1;
+}
+#endif
+
+TEST_CASE("CommandQueue batches", "[command-queue]")
+{
+    CommandQueue queue;
+    vector<int> ran;
+
+    GIVEN("posted commands")
+    {
+        for (int i = 0; i < 10; ++i)
+            queue.post([&ran, i]() { ran.push_back(i); });
+
+        THEN("they are run in order, in batches")
+        {
+            REQUIRE(queue.drain(4) == 4);
+            REQUIRE(queue.drain() == 6);
+            REQUIRE(ran == vector<int>{ 0, 1, 2, 3, 4, 5, 6, 7, 8, 9 });
+            REQUIRE(queue.drain() == 0);
+        }
+#ifndef _WIN32
+        THEN("doorbell rings till all of them are run")
+        {
+            REQUIRE(queue.getFd() >= 0);
+            REQUIRE(isReadableHelper(queue.getFd()));
+
+            queue.drain(4);
+            REQUIRE(isReadableHelper(queue.getFd()));
+
+            queue.drain();
+            REQUIRE_FALSE(isReadableHelper(queue.getFd()));
+        }
+#endif
+    }
+
+    WHEN("command throws")
+    {
+        queue.post([]() { throw runtime_error("command failed"); });
+        queue.post([&ran]() { ran.push_back(1); });
+
+        THEN("the rest are run by the next drain")
+        {
+            REQUIRE_THROWS(queue.drain());
+            REQUIRE(queue.drain() == 1);
+            REQUIRE(ran == vector<int>{ 1 });
+        }
+    }
+}
+
+#ifndef _WIN32
+TEST_CASE("CommandQueue producers", "[command-queue]")
+{
+    CommandQueue queue;
+    const int nProducers = 4, nCommands = 10000;
+    vector<int> last(nProducers, -1);
+    int nRan = 0;
+    bool ordered = true;
+
+    vector<thread> producers;
+    for (int p = 0; p < nProducers; ++p)
+        producers.emplace_back([&, p]()
+        {
+            for (int i = 0; i < nCommands; ++i)
+                queue.post([&, p, i]()
+                {
+                    ordered = ordered && (last[p] == i - 1);
+                    last[p] = i;
+                    nRan++;
+                });
+        });
+
+    // doorbell never goes quiet while commands are queued
+    while (nRan < nProducers * nCommands && isReadableHelper(queue.getFd(), 1000))
+        queue.drain(256);
+
+    for (auto& t : producers)
+        t.join();
+
+    REQUIRE(nRan == nProducers * nCommands);
+    REQUIRE(ordered);
+}
+#endif
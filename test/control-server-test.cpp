@@ -0,0 +1,222 @@
+#include <catch2/catch_test_macros.hpp>
+#include <chrono>
+#include <cstring>
+#include <functional>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <spdlog/sinks/null_sink.h>
+#include <ndn-ind/face.hpp>
+#include <ndn-ind/security/key-chain.hpp>
+#include <ndn-ind-tools/micro-forwarder/micro-forwarder.hpp>
+#include <ndn-ind-tools/micro-forwarder/micro-forwarder-transport.hpp>
+
+#include "control-server.hpp"
+#include "ndnapp.hpp"
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+
+using namespace std;
+using namespace ndn;
+
+#ifndef _WIN32
+
+typedef chrono::steady_clock Clock;
+
+// App is not configured: its run() serves the control socket alone
+class ControlServerHelper {
+public:
+    ControlServerHelper()
+        : keyChain_("pib-memory:", "tpm-memory:")
+        , face_(ptr_lib::make_shared<ndntools::MicroForwarderTransport>(),
+            ptr_lib::make_shared<ndntools::MicroForwarderTransport::ConnectionInfo>(
+                ndntools::MicroForwarder::get()))
+        , logger_(make_shared<spdlog::logger>("control-test", make_shared<spdlog::sinks::null_sink_mt>()))
+        , app_("test", "control-app", logger_, &face_, &keyChain_)
+        , server_("/tmp/ndnshare-control-test-" + to_string(getpid()) + ".sock", app_, logger_)
+    {
+        server_.addCommand("echo", [](const vector<string>& args, ostream& os)
+        {
+            for (auto& arg : args)
+                os << arg << endl;
+        });
+        server_.addCommand("fail", [](const vector<string>&, ostream&)
+        {
+            throw runtime_error("failed\non purpose");
+        });
+        server_.addCommand("blob", [](const vector<string>& args, ostream& os)
+        {
+            os << string(stoul(args.at(0)), 'x') << endl;
+        });
+    }
+
+    bool runUntil(function<bool()> done, chrono::milliseconds timeout = chrono::seconds(2))
+    {
+        auto deadline = Clock::now() + timeout;
+        while (!done() && Clock::now() < deadline)
+        {
+            app_.run(chrono::milliseconds(5));
+            server_.processEvents();
+        }
+        return done();
+    }
+
+    void runFor(chrono::milliseconds timeout)
+    {
+        runUntil([]() { return false; }, timeout);
+    }
+
+    KeyChain keyChain_;
+    Face face_;
+    shared_ptr<spdlog::logger> logger_;
+    ndnapp::App app_;
+    ControlServer server_;
+};
+
+class ControlClientHelper {
+public:
+    ControlClientHelper(const string& path)
+    {
+        fd_ = socket(AF_UNIX, SOCK_STREAM, 0);
+        REQUIRE(fd_ >= 0);
+
+        struct sockaddr_un addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sun_family = AF_UNIX;
+        strncpy(addr.sun_path, path.c_str(), sizeof(addr.sun_path) - 1);
+        REQUIRE(connect(fd_, (struct sockaddr*)&addr, sizeof(addr)) == 0);
+        fcntl(fd_, F_SETFL, fcntl(fd_, F_GETFL) | O_NONBLOCK);
+    }
+
+    ~ControlClientHelper()
+    {
+        close(fd_);
+    }
+
+    // requests are small enough for the socket buffer
+    void send(const string& data)
+    {
+        REQUIRE(write(fd_, data.data(), data.size()) == (ssize_t)data.size());
+    }
+
+    void shutdownWrite()
+    {
+        shutdown(fd_, SHUT_WR);
+    }
+
+    // reads what has arrived. false once server has closed the connection
+    bool receive()
+    {
+        char buf[64 * 1024];
+        ssize_t n;
+        while ((n = read(fd_, buf, sizeof(buf))) > 0)
+            in_.append(buf, n);
+        if (n == 0)
+            closed_ = true;
+        return !closed_;
+    }
+
+    string in_;
+    bool closed_ = false;
+
+private:
+    int fd_;
+};
+
+TEST_CASE("ControlServer", "[control]") {
+    GIVEN("control server with a client") {
+        ControlServerHelper h;
+        ControlClientHelper c(h.server_.getPath());
+        REQUIRE(h.runUntil([&]() { return h.server_.getClientsNumber() == 1; }));
+
+        auto receive = [&](size_t size) {
+            return h.runUntil([&]() { c.receive(); return c.in_.size() >= size || c.closed_; });
+        };
+
+        WHEN("requests are pipelined") {
+            c.send("echo a\necho b c\n\nnope\nfail\necho d\n");
+            string expected = "OK 1\na\nOK 2\nb\nc\nOK 0\nERR unknown command nope\n"
+                "ERR failed on purpose\nOK 1\nd\n";
+
+            THEN("they are answered in order, errors included") {
+                REQUIRE(receive(expected.size()));
+                REQUIRE(c.in_ == expected);
+                REQUIRE_FALSE(c.closed_);
+            }
+        }
+
+        WHEN("a request is split across writes") {
+            c.send("ec");
+            h.runFor(chrono::milliseconds(20));
+            c.send("ho split\n");
+
+            THEN("it is answered once complete") {
+                REQUIRE(receive(string("OK 1\nsplit\n").size()));
+                REQUIRE(c.in_ == "OK 1\nsplit\n");
+            }
+        }
+
+        WHEN("the last request has no newline") {
+            c.send("echo a\necho last");
+            c.shutdownWrite();
+
+            THEN("it is answered before the connection is closed") {
+                REQUIRE(h.runUntil([&]() { return !c.receive(); }));
+                REQUIRE(c.in_ == "OK 1\na\nOK 1\nlast\n");
+                REQUIRE(h.runUntil([&]() { return h.server_.getClientsNumber() == 0; }));
+            }
+        }
+
+        WHEN("a request is too long") {
+            c.send("echo " + string(8 * 1024, 'x'));
+
+            THEN("client gets an error and is disconnected") {
+                REQUIRE(h.runUntil([&]() { return !c.receive(); }));
+                REQUIRE(c.in_ == "ERR request is too long\n");
+                REQUIRE(h.runUntil([&]() { return h.server_.getClientsNumber() == 0; }));
+            }
+        }
+
+        WHEN("client does not take its responses") {
+            // a few MB of output, more than server keeps pending
+            const int nRequests = 48;
+            const size_t blobSize = 64 * 1024;
+            string requests;
+            for (int i = 0; i < nRequests; ++i)
+                requests += "blob " + to_string(blobSize) + "\n";
+            c.send(requests);
+            h.runFor(chrono::milliseconds(200));
+            c.send("echo after\n");
+            h.runFor(chrono::milliseconds(50));
+
+            THEN("all of them come in order once it does") {
+                string blobResponse = "OK 1\n" + string(blobSize, 'x') + "\n";
+                size_t size = nRequests * blobResponse.size() + string("OK 1\nafter\n").size();
+
+                REQUIRE(receive(size));
+                REQUIRE(c.in_.size() == size);
+                for (int i = 0; i < nRequests; ++i)
+                    REQUIRE(c.in_.compare(i * blobResponse.size(), blobResponse.size(), blobResponse) == 0);
+                REQUIRE(c.in_.substr(nRequests * blobResponse.size()) == "OK 1\nafter\n");
+                REQUIRE_FALSE(c.closed_);
+            }
+        }
+
+        WHEN("client disconnects") {
+            c.shutdownWrite();
+
+            THEN("it is forgotten") {
+                REQUIRE(h.runUntil([&]() { return h.server_.getClientsNumber() == 0; }));
+            }
+        }
+    }
+}
+
+#endif
@@ -0,0 +1,752 @@
+#include <catch2/catch_test_macros.hpp>
+#include <catch2/generators/catch_generators.hpp>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <spdlog/sinks/base_sink.h>
+#include <spdlog/sinks/null_sink.h>
+#include <ndn-ind/face.hpp>
+#include <ndn-ind/security/key-chain.hpp>
+#include <ndn-ind/transport/udp-transport.hpp>
+#include <ndn-ind-tools/micro-forwarder/micro-forwarder.hpp>
+#include <ndn-ind-tools/micro-forwarder/micro-forwarder-transport.hpp>
+
+#include "control-server.hpp"
+#include "ndnapp.hpp"
+#include "ring-sink.hpp"
+
+#ifndef _WIN32
+#include <arpa/inet.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+
+using namespace std;
+using namespace ndn;
+using namespace ndnsd;
+
+// NOTE: simulated peers are announced over the in-process loopback backend,
+// no mDNS daemon is needed. every peer gets a UDP face, so open file limit
+// is raised to fit 10k of them.
+// Run with: bench-ndnapp "[!benchmark]"
+
+typedef chrono::steady_clock Clock;
+
+void raiseFdLimitHelper(size_t n)
+{
+#ifndef _WIN32
+    struct rlimit rl;
+    if (getrlimit(RLIMIT_NOFILE, &rl) == 0 && rl.rlim_cur < n)
+    {
+        rl.rlim_cur = min((rlim_t)n, rl.rlim_max);
+        setrlimit(RLIMIT_NOFILE, &rl);
+    }
+#endif
+}
+
+// socket of this process connected to the port on 127.0.0.1, -1 if none
+int connectedSocketHelper(uint16_t port)
+{
+#ifdef __linux__
+    int found = -1;
+    if (DIR* dir = opendir("/proc/self/fd"))
+    {
+        while (struct dirent* entry = readdir(dir))
+        {
+            int fd = atoi(entry->d_name);
+            struct sockaddr_in addr;
+            socklen_t len = sizeof(addr);
+            if (fd > STDERR_FILENO && getpeername(fd, (struct sockaddr*)&addr, &len) == 0 &&
+                addr.sin_family == AF_INET && ntohs(addr.sin_port) == port &&
+                addr.sin_addr.s_addr == htonl(INADDR_LOOPBACK))
+                found = fd;
+        }
+        closedir(dir);
+    }
+    return found;
+#else
+    return -1;
+#endif
+}
+
+// resident set size, KB. peak RSS where current one is not available
+size_t rssKbHelper()
+{
+#ifdef __linux__
+    size_t pages = 0, resident = 0;
+    ifstream statm("/proc/self/statm");
+    statm >> pages >> resident;
+    return resident * (size_t)sysconf(_SC_PAGESIZE) / 1024;
+#elif !defined(_WIN32)
+    struct rusage ru;
+    getrusage(RUSAGE_SELF, &ru);
+#ifdef __APPLE__
+    return (size_t)ru.ru_maxrss / 1024;
+#else
+    return (size_t)ru.ru_maxrss;
+#endif
+#else
+    return 0;
+#endif
+}
+
+// user and system CPU time of the process
+chrono::microseconds cpuTimeHelper()
+{
+#ifndef _WIN32
+    struct rusage ru;
+    getrusage(RUSAGE_SELF, &ru);
+    return chrono::seconds(ru.ru_utime.tv_sec + ru.ru_stime.tv_sec) +
+        chrono::microseconds(ru.ru_utime.tv_usec + ru.ru_stime.tv_usec);
+#else
+    return chrono::microseconds(0);
+#endif
+}
+
+double percentileHelper(vector<double> v, double p)
+{
+    if (v.empty())
+        return 0;
+
+    sort(v.begin(), v.end());
+    return v[min(v.size() - 1, (size_t)(p * (v.size() - 1) + 0.5))];
+}
+
+shared_ptr<NdnSd> announcePeerHelper(int i, int& nRegistered)
+{
+    auto sd = make_shared<NdnSd>("bench-peer-" + to_string(i));
+    NdnSd::AdvertiseParameters params;
+    params.protocol_ = Proto::UDP;
+    params.port_ = 20000 + i;
+    params.prefix_ = "/bench/peer/" + to_string(i);
+    params.subtype_ = kNdnDnsServiceSubtypeMFD;
+
+    sd->announce(params, [&nRegistered](void*) { nRegistered++; },
+        [](int, int errCode, string msg, bool, void*) {
+            FAIL("failed to announce peer: " << errCode << " " << msg);
+        });
+
+    return sd;
+}
+
+// announce/route timestamps of one phase
+typedef struct _Phase {
+    string name_;
+    map<string, Clock::time_point> started_;
+    vector<double> latenciesMs_;
+    chrono::microseconds cpu_;
+
+    void done(const string& uuid)
+    {
+        auto it = started_.find(uuid);
+        if (it != started_.end())
+        {
+            latenciesMs_.push_back(chrono::duration<double, milli>(Clock::now() - it->second).count());
+            started_.erase(it);
+        }
+    }
+
+    void report(size_t nPeers) const
+    {
+        size_t n = latenciesMs_.size();
+        cout << setw(6) << nPeers << " peers, " << setw(8) << name_ << ": " << setw(6) << n
+            << " events, p50 " << fixed << setprecision(2) << percentileHelper(latenciesMs_, 0.5)
+            << "ms, p99 " << percentileHelper(latenciesMs_, 0.99) << "ms, CPU "
+            << (n ? (double)cpu_.count() / n : 0) << "us/event" << endl;
+    }
+} Phase;
+
+TEST_CASE("discovery pipeline: announce to route installed", "[!benchmark][discovery]") {
+    raiseFdLimitHelper(32768);
+    REQUIRE(NdnSd::setBackend(DiscoveryBackend::Loopback));
+
+    auto nPeers = GENERATE(100, 1000, 10000);
+    // peers re-announced right after they are gone
+    int nFlaps = nPeers / 10;
+
+    {
+        auto logger = spdlog::null_logger_mt("bench-" + to_string(nPeers));
+        KeyChain keyChain("pib-memory:", "tpm-memory:");
+        keyChain.createIdentityV2(Name("/bench/signer"));
+        Face face(ptr_lib::make_shared<ndntools::MicroForwarderTransport>(),
+            ptr_lib::make_shared<ndntools::MicroForwarderTransport::ConnectionInfo>(
+                ndntools::MicroForwarder::get()));
+
+        Phase add{ "add" }, flap{ "flap" }, remove{ "remove" };
+        Phase* current = &add;
+
+        ndnapp::App app("bench", "bench-app", logger, &face, &keyChain);
+        // simulated peers advertise no certificate
+        app.setAllowUnverified(true);
+        app.setAddInstanceCallback([&](const shared_ptr<const NdnSd>& sd) { current->done(sd->getUuid()); });
+        app.setRemoveInstanceCallback([&](const shared_ptr<const NdnSd>& sd) {
+            if (current == &remove)
+                remove.done(sd->getUuid());
+        });
+
+        NdnSd::AdvertiseParameters params;
+        params.prefix_ = "/bench/app";
+        params.subtype_ = kNdnDnsServiceSubtypeMFD;
+        app.configure({ Proto::UDP }, params, "/bench/signer");
+
+        auto runUntil = [&](function<bool()> done, chrono::milliseconds timeout) {
+            auto deadline = Clock::now() + timeout;
+            while (!done() && Clock::now() < deadline)
+            {
+                face.processEvents();
+                app.processEvents();
+            }
+        };
+
+        // App's own registrations settle before peers show up
+        runUntil([]() { return false; }, chrono::milliseconds(200));
+        size_t rssBefore = rssKbHelper();
+
+        // all peers appear at once, as on a busy LAN
+        int nRegistered = 0;
+        vector<shared_ptr<NdnSd>> peers;
+        auto cpuStart = cpuTimeHelper();
+        for (int i = 0; i < nPeers; ++i)
+        {
+            add.started_["bench-peer-" + to_string(i)] = Clock::now();
+            peers.push_back(announcePeerHelper(i, nRegistered));
+        }
+        runUntil([&]() { return add.started_.empty(); }, chrono::seconds(60));
+        add.cpu_ = cpuTimeHelper() - cpuStart;
+        REQUIRE(add.latenciesMs_.size() == (size_t)nPeers);
+
+        // simulated peers and their loopback records are counted too
+        size_t rssAfter = rssKbHelper();
+
+        // peers leave and come back right away
+        current = &flap;
+        cpuStart = cpuTimeHelper();
+        for (int i = 0; i < nFlaps; ++i)
+        {
+            peers[i].reset();
+            flap.started_["bench-peer-" + to_string(i)] = Clock::now();
+            peers[i] = announcePeerHelper(i, nRegistered);
+        }
+        runUntil([&]() { return flap.started_.empty(); }, chrono::seconds(60));
+        flap.cpu_ = cpuTimeHelper() - cpuStart;
+        REQUIRE(flap.latenciesMs_.size() == (size_t)nFlaps);
+
+        // everyone leaves: routes and faces are removed
+        current = &remove;
+        cpuStart = cpuTimeHelper();
+        for (int i = 0; i < nPeers; ++i)
+        {
+            remove.started_["bench-peer-" + to_string(i)] = Clock::now();
+            peers[i].reset();
+        }
+        runUntil([&]() { return remove.started_.empty(); }, chrono::seconds(60));
+        remove.cpu_ = cpuTimeHelper() - cpuStart;
+        REQUIRE(remove.latenciesMs_.size() == (size_t)nPeers);
+
+        for (auto p : { &add, &flap, &remove })
+            p->report(nPeers);
+        cout << setw(6) << nPeers << " peers, memory " << fixed << setprecision(2)
+            << (double)(rssAfter - min(rssAfter, rssBefore)) / nPeers << "KB/peer" << endl;
+
+        spdlog::drop(logger->name());
+    }
+
+    REQUIRE(NdnSd::setBackend(DiscoveryBackend::DnsSd));
+}
+
+// NOTE: loopback discovery answers right away, while mDNS takes from tens
+// of milliseconds to seconds on a real LAN. cold start figures are a lower
+// bound then, warm start ones do not depend on discovery.
+TEST_CASE("warm start: time to first route", "[!benchmark][warm-start]") {
+    raiseFdLimitHelper(4096);
+    REQUIRE(NdnSd::setBackend(DiscoveryBackend::Loopback));
+
+    auto nPeers = GENERATE(1, 100, 1000);
+    string path = (filesystem::temp_directory_path() / "ndnapp-bench-peers").string();
+    filesystem::remove(path);
+
+    {
+        int nRegistered = 0;
+        vector<shared_ptr<NdnSd>> peers;
+        for (int i = 0; i < nPeers; ++i)
+            peers.push_back(announcePeerHelper(i, nRegistered));
+
+        KeyChain keyChain("pib-memory:", "tpm-memory:");
+        keyChain.createIdentityV2(Name("/bench/signer"));
+
+        // first run finds peer table empty, second one starts from the 
+        // peers first run has persisted
+        for (auto start : { "cold", "warm" })
+        {
+            auto logger = spdlog::null_logger_mt("bench-" + string(start) + "-" + to_string(nPeers));
+            Face face(ptr_lib::make_shared<ndntools::MicroForwarderTransport>(),
+                ptr_lib::make_shared<ndntools::MicroForwarderTransport::ConnectionInfo>(
+                    ndntools::MicroForwarder::get()));
+
+            size_t nAdded = 0;
+            ndnapp::App app("bench", "bench-" + string(start) + "-app", logger, &face, &keyChain);
+            // simulated peers advertise no certificate
+            app.setAllowUnverified(true);
+            app.setAddInstanceCallback([&](const shared_ptr<const NdnSd>&) { nAdded++; });
+            REQUIRE(app.setPeerTable(path, chrono::seconds(10)));
+
+            NdnSd::AdvertiseParameters params;
+            params.prefix_ = "/bench/warm/app";
+            params.subtype_ = kNdnDnsServiceSubtypeMFD;
+            auto started = Clock::now();
+            app.configure({ Proto::UDP }, params, "/bench/signer");
+
+            auto deadline = started + chrono::seconds(60);
+            while (nAdded < (size_t)nPeers && Clock::now() < deadline)
+            {
+                face.processEvents();
+                app.processEvents();
+            }
+            double allConfirmedMs = chrono::duration<double, milli>(Clock::now() - started).count();
+            REQUIRE(nAdded == (size_t)nPeers);
+
+            cout << setw(6) << nPeers << " peers, " << start << " start: first route " 
+                << app.getTimeToFirstRoute().count() << "ms, first confirmed route "
+                << app.getTimeToFirstConfirmedRoute().count() << "ms, all confirmed " << fixed 
+                << setprecision(2) << allConfirmedMs << "ms" << endl;
+
+            spdlog::drop(logger->name());
+        }
+    }
+
+    filesystem::remove(path);
+    REQUIRE(NdnSd::setBackend(DiscoveryBackend::DnsSd));
+}
+
+TEST_CASE("event loop: Interest/Data RTT and idle CPU", "[!benchmark][loop]") {
+    REQUIRE(NdnSd::setBackend(DiscoveryBackend::Loopback));
+
+    const int nInterests = 500;
+    const auto idleTime = chrono::seconds(3);
+
+    {
+        auto logger = spdlog::null_logger_mt("bench-loop");
+        KeyChain keyChain("pib-memory:", "tpm-memory:");
+        keyChain.createIdentityV2(Name("/bench/signer"));
+        auto transport = make_shared<ndnapp::helpers::LocalTransport>();
+        Face face(transport,
+            ptr_lib::make_shared<ndntools::MicroForwarderTransport::ConnectionInfo>(
+                ndntools::MicroForwarder::get()));
+
+        ndnapp::App app("bench", "bench-loop-app", logger, &face, &keyChain);
+        // Interest timeouts wake run() up
+        app.addLocalTransport(transport);
+        NdnSd::AdvertiseParameters params;
+        params.prefix_ = "/bench/loop/app";
+        params.subtype_ = kNdnDnsServiceSubtypeMFD;
+        app.configure({ Proto::UDP }, params, "/bench/signer");
+        REQUIRE(app.getListenPort(Proto::UDP));
+
+        // producer is one socket hop away, as a peer on the LAN would be
+        Face producer(ptr_lib::make_shared<UdpTransport>(),
+            ptr_lib::make_shared<UdpTransport::ConnectionInfo>("127.0.0.1", app.getListenPort(Proto::UDP)));
+        producer.setCommandSigningInfo(keyChain, keyChain.getDefaultCertificateName());
+
+        bool registered = false;
+        producer.registerPrefix(Name("/bench/loop/producer"),
+            [&](const ptr_lib::shared_ptr<const Name>&, const ptr_lib::shared_ptr<const Interest>& interest,
+                Face& f, uint64_t, const ptr_lib::shared_ptr<const InterestFilter>&)
+        {
+            Data data(interest->getName());
+            data.setContent(Blob((const uint8_t*)"data", 4));
+            // RSA signing would take most of RTT
+            keyChain.signWithSha256(data);
+            f.putData(data);
+        },
+            [](const ptr_lib::shared_ptr<const Name>& prefix) {
+                FAIL("failed to register " << prefix->toUri());
+            },
+            [&](const ptr_lib::shared_ptr<const Name>&, uint64_t) { registered = true; });
+
+        // ndnshare's loop before App::run()
+        auto pollStep = [&]() {
+            face.processEvents();
+            app.processEvents();
+            producer.processEvents();
+            this_thread::sleep_for(chrono::milliseconds(5));
+        };
+        // App::run() returns once forwarder or producer socket is readable.
+        // producer's socket is not the forwarder's: it's ours to pass
+        auto runStep = [&]() {
+            app.run(chrono::milliseconds(500));
+            producer.processEvents();
+        };
+
+        auto deadline = Clock::now() + chrono::seconds(5);
+        while (!registered && Clock::now() < deadline)
+            pollStep();
+        REQUIRE(registered);
+
+        int producerFd = connectedSocketHelper(app.getListenPort(Proto::UDP));
+        REQUIRE(producerFd >= 0);
+        app.watchDescriptor(producerFd, [&]() { producer.processEvents(); });
+
+        auto measure = [&](const string& name, function<void()> step) {
+            vector<double> rttsMs;
+            int nTimeouts = 0;
+
+            for (int i = 0; i < nInterests; ++i)
+            {
+                Interest interest(Name("/bench/loop/producer").append(name).appendSequenceNumber(i));
+                interest.setInterestLifetime(chrono::seconds(1));
+
+                bool done = false;
+                auto started = Clock::now();
+                face.expressInterest(interest,
+                    [&](const ptr_lib::shared_ptr<const Interest>&, const ptr_lib::shared_ptr<Data>&)
+                {
+                    rttsMs.push_back(chrono::duration<double, milli>(Clock::now() - started).count());
+                    done = true;
+                },
+                    [&](const ptr_lib::shared_ptr<const Interest>&)
+                {
+                    nTimeouts++;
+                    done = true;
+                });
+
+                while (!done)
+                    step();
+            }
+
+            // nothing to do: CPU spent on waiting alone
+            auto cpuStart = cpuTimeHelper();
+            auto idleStart = Clock::now();
+            while (Clock::now() - idleStart < idleTime)
+                step();
+            double idleCpu = (double)(cpuTimeHelper() - cpuStart).count() /
+                chrono::duration_cast<chrono::microseconds>(Clock::now() - idleStart).count();
+
+            cout << setw(14) << name << ": " << rttsMs.size() << " Interests, RTT p50 " << fixed
+                << setprecision(2) << percentileHelper(rttsMs, 0.5) << "ms, p99 "
+                << percentileHelper(rttsMs, 0.99) << "ms, idle CPU " << idleCpu * 100 << "%" << endl;
+
+            REQUIRE(nTimeouts == 0);
+        };
+
+        measure("processEvents", pollStep);
+        measure("run", runStep);
+
+        app.unwatchDescriptor(producerFd);
+        spdlog::drop(logger->name());
+    }
+
+    REQUIRE(NdnSd::setBackend(DiscoveryBackend::DnsSd));
+}
+
+TEST_CASE("command queue: burst posted from another thread", "[!benchmark][commands]") {
+    REQUIRE(NdnSd::setBackend(DiscoveryBackend::Loopback));
+
+    auto nCommands = GENERATE(1000, 100000);
+
+    {
+        auto logger = spdlog::null_logger_mt("bench-commands-" + to_string(nCommands));
+        KeyChain keyChain("pib-memory:", "tpm-memory:");
+        keyChain.createIdentityV2(Name("/bench/signer"));
+        Face face(ptr_lib::make_shared<ndntools::MicroForwarderTransport>(),
+            ptr_lib::make_shared<ndntools::MicroForwarderTransport::ConnectionInfo>(
+                ndntools::MicroForwarder::get()));
+
+        ndnapp::App app("bench", "bench-commands-app", logger, &face, &keyChain);
+        NdnSd::AdvertiseParameters params;
+        params.prefix_ = "/bench/commands/app";
+        params.subtype_ = kNdnDnsServiceSubtypeMFD;
+        app.configure({ Proto::UDP }, params, "/bench/signer");
+
+        // as scripted CLI would post them
+        int nRan = 0;
+        vector<double> latenciesMs;
+        auto started = Clock::now();
+        thread producer([&]() {
+            for (int i = 0; i < nCommands; ++i)
+            {
+                auto posted = Clock::now();
+                app.post([&, posted]() {
+                    latenciesMs.push_back(chrono::duration<double, milli>(Clock::now() - posted).count());
+                    nRan++;
+                });
+            }
+        });
+
+        auto deadline = Clock::now() + chrono::seconds(60);
+        while (nRan < nCommands && Clock::now() < deadline)
+            app.run(chrono::milliseconds(100));
+        auto elapsed = chrono::duration<double, milli>(Clock::now() - started).count();
+        producer.join();
+
+        REQUIRE(nRan == nCommands);
+        cout << setw(6) << nCommands << " commands: all run in " << fixed << setprecision(2)
+            << elapsed << "ms, post to run p50 " << percentileHelper(latenciesMs, 0.5) << "ms, p99 "
+            << percentileHelper(latenciesMs, 0.99) << "ms" << endl;
+
+        spdlog::drop(logger->name());
+    }
+
+    REQUIRE(NdnSd::setBackend(DiscoveryBackend::DnsSd));
+}
+
+#ifndef _WIN32
+TEST_CASE("control socket: pipelined commands", "[!benchmark][control]") {
+    REQUIRE(NdnSd::setBackend(DiscoveryBackend::Loopback));
+
+    // requests a client sends before it reads responses
+    auto depth = GENERATE(1, 100);
+    const int nCommands = 100000;
+
+    {
+        auto logger = spdlog::null_logger_mt("bench-control-" + to_string(depth));
+        KeyChain keyChain("pib-memory:", "tpm-memory:");
+        Face face(ptr_lib::make_shared<ndntools::MicroForwarderTransport>(),
+            ptr_lib::make_shared<ndntools::MicroForwarderTransport::ConnectionInfo>(
+                ndntools::MicroForwarder::get()));
+        ndnapp::App app("bench", "bench-control-app", logger, &face, &keyChain);
+
+        ControlServer control("/tmp/bench-ndnapp-" + to_string(getpid()) + ".sock", app, logger);
+        control.addCommand("echo", [](const vector<string>& args, ostream& os)
+        {
+            for (auto& arg : args)
+                os << arg << endl;
+        });
+
+        int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        struct sockaddr_un addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sun_family = AF_UNIX;
+        strncpy(addr.sun_path, control.getPath().c_str(), sizeof(addr.sun_path) - 1);
+        REQUIRE(connect(fd, (struct sockaddr*)&addr, sizeof(addr)) == 0);
+
+        // as a script driving the daemon would
+        atomic<bool> done(false);
+        int nAnswered = 0;
+        vector<double> latenciesMs;
+        auto started = Clock::now();
+        thread client([&]() {
+            string batch, response = "OK 1\nx\n";
+            for (int i = 0; i < depth; ++i)
+                batch += "echo x\n";
+
+            char buf[64 * 1024];
+            while (nAnswered < nCommands)
+            {
+                auto sent = Clock::now();
+                if (write(fd, batch.data(), batch.size()) != (ssize_t)batch.size())
+                    break;
+
+                size_t expected = response.size() * depth, received = 0;
+                ssize_t n = 0;
+                while (received < expected && (n = read(fd, buf, sizeof(buf))) > 0)
+                    received += n;
+                if (received < expected)
+                    break;
+
+                latenciesMs.push_back(chrono::duration<double, milli>(Clock::now() - sent).count());
+                nAnswered += depth;
+            }
+            done = true;
+        });
+
+        auto deadline = Clock::now() + chrono::seconds(60);
+        while (!done && Clock::now() < deadline)
+        {
+            app.run(chrono::milliseconds(100));
+            control.processEvents();
+        }
+        auto elapsed = chrono::duration<double>(Clock::now() - started).count();
+        shutdown(fd, SHUT_RDWR);
+        client.join();
+        close(fd);
+
+        REQUIRE(nAnswered >= nCommands);
+        double rate = nAnswered / elapsed;
+        cout << setw(3) << depth << " in flight: " << nAnswered << " commands at " << fixed
+            << setprecision(0) << rate << "/s, round trip p50 " << setprecision(3)
+            << percentileHelper(latenciesMs, 0.5) << "ms, p99 " << percentileHelper(latenciesMs, 0.99)
+            << "ms" << endl;
+        // thousands of commands per second, even one at a time
+        REQUIRE(rate > 1000);
+
+        spdlog::drop(logger->name());
+    }
+
+    REQUIRE(NdnSd::setBackend(DiscoveryBackend::DnsSd));
+}
+
+#ifndef _WIN32
+// terminal: a pipe drained by a thread that takes a while to draw each chunk
+typedef struct _SlowTerminal {
+    int fds_[2];
+    atomic<bool> stop_;
+    thread reader_;
+
+    _SlowTerminal(chrono::microseconds perChunk) : stop_(false)
+    {
+        REQUIRE(pipe(fds_) == 0);
+        fcntl(fds_[0], F_SETFL, fcntl(fds_[0], F_GETFL) | O_NONBLOCK);
+        reader_ = thread([this, perChunk]() {
+            char buf[4096];
+            while (!stop_)
+                if (read(fds_[0], buf, sizeof(buf)) > 0)
+                    this_thread::sleep_for(perChunk);
+                else
+                    this_thread::sleep_for(chrono::microseconds(100));
+        });
+    }
+    ~_SlowTerminal()
+    {
+        stop_ = true;
+        reader_.join();
+        close(fds_[0]);
+        close(fds_[1]);
+    }
+
+    void write(const char* data, size_t size)
+    {
+        while (size)
+        {
+            ssize_t n = ::write(fds_[1], data, size);
+            if (n <= 0)
+                break;
+            data += n;
+            size -= (size_t)n;
+        }
+    }
+} SlowTerminal;
+
+// ndnshare's sink before RingSink: every record is written and followed by
+// prompt redraw on the logging thread
+class SyncTerminalSinkHelper : public spdlog::sinks::base_sink<mutex> {
+public:
+    SyncTerminalSinkHelper(SlowTerminal& terminal) : terminal_(terminal) {}
+
+protected:
+    void sink_it_(const spdlog::details::log_msg& msg) override
+    {
+        terminal_.write("\r", 1);
+        spdlog::memory_buf_t formatted;
+        formatter_->format(msg, formatted);
+        terminal_.write(formatted.data(), formatted.size());
+        terminal_.write("_ > ", 4);
+    }
+    void flush_() override {}
+
+private:
+    SlowTerminal& terminal_;
+};
+
+TEST_CASE("logging: info records on the event loop", "[!benchmark][logging]") {
+    REQUIRE(NdnSd::setBackend(DiscoveryBackend::Loopback));
+
+    const int nRecords = 100000, nEvents = 10000;
+    auto sinkType = GENERATE(as<string>(), "sync", "ring/drop", "ring/block");
+
+    {
+        SlowTerminal terminal(chrono::microseconds(50));
+        shared_ptr<ndnapp::helpers::RingSink> ringSink;
+        spdlog::sink_ptr sink;
+
+        if (sinkType == "sync")
+            sink = make_shared<SyncTerminalSinkHelper>(terminal);
+        else
+        {
+            ringSink = make_shared<ndnapp::helpers::RingSink>([&terminal](const char* data, size_t size)
+            {
+                terminal.write("\r", 1);
+                terminal.write(data, size);
+                terminal.write("_ > ", 4);
+            }, 8192, (sinkType == "ring/drop" ? ndnapp::helpers::RingSink::Overflow::Drop :
+                ndnapp::helpers::RingSink::Overflow::Block));
+            sink = ringSink;
+        }
+
+        auto logger = make_shared<spdlog::logger>("bench-logging-" + sinkType, sink);
+        logger->set_level(spdlog::level::info);
+
+        // logging thread alone: cost of a record to the thread that logs it
+        vector<double> callsUs;
+        callsUs.reserve(nRecords);
+        auto started = Clock::now();
+        for (int i = 0; i < nRecords; ++i)
+        {
+            auto called = Clock::now();
+            logger->info("published object /bench/logging/{} ({} bytes)", i, 8000);
+            callsUs.push_back(chrono::duration<double, micro>(Clock::now() - called).count());
+        }
+        auto elapsed = chrono::duration<double>(Clock::now() - started).count();
+        logger->flush();
+
+        cout << setw(10) << sinkType << ": " << fixed << setprecision(0) << nRecords / elapsed
+            << " records/s, log call p50 " << setprecision(2) << percentileHelper(callsUs, 0.5)
+            << "us, p99 " << percentileHelper(callsUs, 0.99) << "us, max "
+            << percentileHelper(callsUs, 1) << "us";
+        if (ringSink)
+        {
+            auto stats = ringSink->getStats();
+            cout << ", written " << stats.written_ << " dropped " << stats.dropped_ << " blocked "
+                << stats.blocked_ << " in " << stats.batches_ << " batches";
+        }
+        cout << endl;
+
+        // App logs at info per event: latency of posted commands
+        KeyChain keyChain("pib-memory:", "tpm-memory:");
+        keyChain.createIdentityV2(Name("/bench/signer"));
+        Face face(ptr_lib::make_shared<ndntools::MicroForwarderTransport>(),
+            ptr_lib::make_shared<ndntools::MicroForwarderTransport::ConnectionInfo>(
+                ndntools::MicroForwarder::get()));
+
+        ndnapp::App app("bench", "bench-logging-app", logger, &face, &keyChain);
+        NdnSd::AdvertiseParameters params;
+        params.prefix_ = "/bench/logging/app";
+        params.subtype_ = kNdnDnsServiceSubtypeMFD;
+        app.configure({ Proto::UDP }, params, "/bench/signer");
+
+        int nRan = 0;
+        vector<double> latenciesMs;
+        thread producer([&]() {
+            for (int i = 0; i < nEvents; ++i)
+            {
+                auto posted = Clock::now();
+                app.post([&, posted, i]() {
+                    logger->info("event {}", i);
+                    latenciesMs.push_back(chrono::duration<double, milli>(Clock::now() - posted).count());
+                    nRan++;
+                });
+                this_thread::sleep_for(chrono::microseconds(20));
+            }
+        });
+
+        auto deadline = Clock::now() + chrono::seconds(60);
+        while (nRan < nEvents && Clock::now() < deadline)
+            app.run(chrono::milliseconds(100));
+        producer.join();
+
+        REQUIRE(nRan == nEvents);
+        cout << setw(10) << sinkType << ": " << nEvents << " events, post to run p50 " << fixed
+            << setprecision(2) << percentileHelper(latenciesMs, 0.5) << "ms, p99 "
+            << percentileHelper(latenciesMs, 0.99) << "ms" << endl;
+
+        logger->flush();
+    }
+
+    REQUIRE(NdnSd::setBackend(DiscoveryBackend::DnsSd));
+}
+#endif
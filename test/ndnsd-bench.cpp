@@ -0,0 +1,323 @@
+#include <catch2/catch_test_macros.hpp>
+#include <catch2/benchmark/catch_benchmark.hpp>
+#include <catch2/generators/catch_generators.hpp>
+#include <ndn-sd/ndn-sd.hpp>
+#include <deque>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "dns_sd.h"
+#include "request-slab.hpp"
+
+#ifndef _WIN32
+#include <arpa/inet.h>
+#include <sys/resource.h>
+#include <sys/select.h>
+#include <unistd.h>
+#endif
+#ifdef __linux__
+#include <sys/epoll.h>
+#endif
+
+using namespace std;
+using namespace ndnsd;
+
+// NOTE: benchmarks require a running mDNS daemon, like the unit tests do.
+// Run with: bench-ndnsd "[!benchmark]"
+
+void browseReplyNoop(DNSServiceRef, DNSServiceFlags, uint32_t, DNSServiceErrorType,
+    const char*, const char*, const char*, void*) {}
+
+vector<DNSServiceRef> browseRefsHelper(size_t n)
+{
+    vector<DNSServiceRef> refs;
+
+    for (size_t i = 0; i < n; ++i)
+    {
+        DNSServiceRef ref;
+        auto err = DNSServiceBrowse(&ref, 0, kDNSServiceInterfaceIndexLocalOnly,
+            "_ndn._udp", nullptr, &browseReplyNoop, nullptr);
+
+        if (err != kDNSServiceErr_NoError)
+            break;
+        refs.push_back(ref);
+    }
+
+    return refs;
+}
+
+void registerReplyNoop(DNSServiceRef, DNSServiceFlags, DNSServiceErrorType,
+    const char*, const char*, const char*, void*) {}
+
+vector<DNSServiceRef> registerServicesHelper(size_t n)
+{
+    vector<DNSServiceRef> refs;
+    string prefix = "/bench/prefix";
+    uint8_t txtBuf[256];
+    TXTRecordRef txtRecRef;
+    TXTRecordCreate(&txtRecRef, sizeof(txtBuf), txtBuf);
+    TXTRecordSetValue(&txtRecRef, "p", prefix.size(), prefix.data());
+
+    for (size_t i = 0; i < n; ++i)
+    {
+        DNSServiceRef ref;
+        string uuid = "bench-uuid-" + to_string(i);
+        auto err = DNSServiceRegister(&ref, 0, kDNSServiceInterfaceIndexLocalOnly,
+            uuid.c_str(), "_ndn._udp", nullptr, nullptr, htons(40000 + i % 1000),
+            TXTRecordGetLength(&txtRecRef), TXTRecordGetBytesPtr(&txtRecRef),
+            &registerReplyNoop, nullptr);
+
+        if (err != kDNSServiceErr_NoError)
+            break;
+
+        DNSServiceProcessResult(ref);
+        refs.push_back(ref);
+    }
+
+    return refs;
+}
+
+void raiseFdLimitHelper(size_t n)
+{
+#ifndef _WIN32
+    struct rlimit rl;
+    if (getrlimit(RLIMIT_NOFILE, &rl) == 0 && rl.rlim_cur < n)
+    {
+        rl.rlim_cur = min((rlim_t)n, rl.rlim_max);
+        setrlimit(RLIMIT_NOFILE, &rl);
+    }
+#endif
+}
+
+#ifdef __linux__
+TEST_CASE("run loop: select vs epoll", "[!benchmark][runloop]") {
+    raiseFdLimitHelper(4096);
+
+    auto nRefs = GENERATE(10, 100, 1000);
+    auto refs = browseRefsHelper(nRefs);
+    REQUIRE(refs.size() == (size_t)nRefs);
+
+    vector<int> fds;
+    map<int, DNSServiceRef> fdRefs;
+    for (auto r : refs)
+    {
+        fds.push_back(DNSServiceRefSockFD(r));
+        fdRefs[fds.back()] = r;
+    }
+
+    int epollFd = epoll_create1(EPOLL_CLOEXEC);
+    REQUIRE(epollFd >= 0);
+    for (auto fd : fds)
+    {
+        struct epoll_event ev = {};
+        ev.events = EPOLLIN;
+        ev.data.fd = fd;
+        epoll_ctl(epollFd, EPOLL_CTL_ADD, fd, &ev);
+    }
+
+    // drain initial replies, so that every descriptor is idle. only the
+    // ref which descriptor is ready is processed: the read blocks otherwise
+    struct epoll_event ev;
+    while (epoll_wait(epollFd, &ev, 1, 10) > 0)
+        DNSServiceProcessResult(fdRefs[ev.data.fd]);
+
+    // this mirrors one wakeup of the select-based NdnSd::run:
+    // fd_set is rebuilt from scratch and select() scans all descriptors
+    BENCHMARK("select, " + to_string(nRefs) + " refs") {
+        int maxFd = 0;
+        fd_set readfds;
+        FD_ZERO(&readfds);
+        for (auto fd : fds)
+        {
+            maxFd = max(maxFd, fd);
+            FD_SET(fd, &readfds);
+        }
+
+        struct timeval tv = { 0, 0 };
+        return select(maxFd + 1, &readfds, nullptr, nullptr, &tv);
+    };
+
+    // descriptors registered once, only ready ones are returned
+    BENCHMARK("epoll, " + to_string(nRefs) + " refs") {
+        struct epoll_event events[64];
+        return epoll_wait(epollFd, events, 64, 0);
+    };
+
+    close(epollFd);
+    for (auto r : refs)
+        DNSServiceRefDeallocate(r);
+}
+#endif
+
+TEST_CASE("resolve throughput: shared vs per-request connection", "[!benchmark][resolve]") {
+    raiseFdLimitHelper(4096);
+
+    const size_t nServices = 500;
+    auto srvRefs = registerServicesHelper(nServices);
+    REQUIRE(srvRefs.size() == nServices);
+
+    auto errorCb = [](int, int errCode, string msg, bool, void*) {
+        FAIL("error occurred: " << errCode << " " << msg);
+    };
+
+    auto shareConnection = GENERATE(false, true);
+    NdnSd::setShareConnection(shareConnection);
+
+    {
+        NdnSd browser("bench-browser-uuid");
+        vector<shared_ptr<const NdnSd>> discovered;
+
+        browser.browse({ Proto::UDP, kDNSServiceInterfaceIndexLocalOnly },
+            [&](int, Announcement a, shared_ptr<const NdnSd> sd, void*)
+        {
+            if (a == Announcement::Added)
+                discovered.push_back(sd);
+        }, errorCb);
+
+        for (int i = 0; i < 100 && discovered.size() < nServices; ++i)
+            NdnSd::runAll(100);
+        REQUIRE(discovered.size() == nServices);
+
+        // every iteration must go to the daemon, not to resolve cache
+        NdnSd::setResolveCacheTtl(0);
+        BENCHMARK(string(shareConnection ? "shared connection" : "connection per request") +
+            ", resolve " + to_string(nServices) + " services")
+        {
+            size_t nResolved = 0;
+
+            for (auto& sd : discovered)
+                browser.resolve(sd, [&](int, Announcement, shared_ptr<const NdnSd>, void*)
+                {
+                    nResolved++;
+                }, errorCb);
+
+            for (int i = 0; i < 1000 && nResolved < nServices; ++i)
+                NdnSd::runAll(10);
+
+            return nResolved;
+        };
+        NdnSd::setResolveCacheTtl(120);
+    }
+
+    NdnSd::setShareConnection(true);
+    for (auto r : srvRefs)
+        DNSServiceRefDeallocate(r);
+}
+
+TEST_CASE("resolve throughput: cached vs uncached", "[!benchmark][resolve][cache]") {
+    raiseFdLimitHelper(4096);
+
+    const size_t nServices = 500;
+    auto srvRefs = registerServicesHelper(nServices);
+    REQUIRE(srvRefs.size() == nServices);
+
+    auto errorCb = [](int, int errCode, string msg, bool, void*) {
+        FAIL("error occurred: " << errCode << " " << msg);
+    };
+
+    auto cacheTtl = GENERATE(0u, 120u);
+    NdnSd::setResolveCacheTtl(cacheTtl);
+
+    {
+        NdnSd browser("bench-cache-browser-uuid");
+        vector<shared_ptr<const NdnSd>> discovered;
+
+        browser.browse({ Proto::UDP, kDNSServiceInterfaceIndexLocalOnly },
+            [&](int, Announcement a, shared_ptr<const NdnSd> sd, void*)
+        {
+            if (a == Announcement::Added)
+                discovered.push_back(sd);
+        }, errorCb);
+
+        for (int i = 0; i < 100 && discovered.size() < nServices; ++i)
+            NdnSd::runAll(100);
+        REQUIRE(discovered.size() == nServices);
+
+        auto resolveAll = [&]() {
+            size_t nResolved = 0;
+
+            for (auto& sd : discovered)
+                browser.resolve(sd, [&](int, Announcement, shared_ptr<const NdnSd>, void*)
+                {
+                    nResolved++;
+                }, errorCb);
+
+            for (int i = 0; i < 1000 && nResolved < nServices; ++i)
+                NdnSd::runAll(10);
+
+            return nResolved;
+        };
+        // warm up the cache, so that benchmark measures hits only
+        REQUIRE(resolveAll() == nServices);
+
+        BENCHMARK(string(cacheTtl ? "cached" : "uncached") +
+            ", resolve " + to_string(nServices) + " services")
+        {
+            return resolveAll();
+        };
+    }
+
+    NdnSd::setResolveCacheTtl(120);
+    for (auto r : srvRefs)
+        DNSServiceRefDeallocate(r);
+}
+
+TEST_CASE("request ids: map vs slab", "[!benchmark][requests]") {
+    // resembles a resolve request: a few handles, callbacks and a timestamp
+    struct Request {
+        RequestId id_ = -1;
+        DNSServiceRef serviceRef_ = nullptr;
+        shared_ptr<NdnSd> sd_;
+        OnResolvedService onResolved_;
+        OnError onError_;
+        chrono::steady_clock::time_point requestedAt_;
+    };
+
+    const size_t nCycles = 100000;
+    // requests alive at a time, finished in FIFO order (as with in-flight cap)
+    const size_t nLive = 64;
+
+    // this mirrors allocation in NdnSd::resolve before request slabs
+    BENCHMARK("map, rbegin()+1 ids, " + to_string(nCycles) + " start/finish cycles") {
+        map<int, shared_ptr<Request>> requests;
+        deque<int> live;
+
+        for (size_t i = 0; i < nCycles; ++i)
+        {
+            int id = (requests.size() ? requests.rbegin()->first + 1 : 1);
+            auto r = make_shared<Request>();
+            r->id_ = id;
+            requests[id] = r;
+            live.push_back(id);
+
+            if (live.size() > nLive)
+            {
+                requests.erase(live.front());
+                live.pop_front();
+            }
+        }
+
+        return requests.size();
+    };
+
+    BENCHMARK("slab, generational handles, " + to_string(nCycles) + " start/finish cycles") {
+        helpers::RequestSlab<Request> requests;
+        deque<RequestId> live;
+
+        for (size_t i = 0; i < nCycles; ++i)
+        {
+            auto slot = requests.acquire();
+            slot.second->id_ = slot.first;
+            live.push_back(slot.first);
+
+            if (live.size() > nLive)
+            {
+                requests.release(live.front());
+                live.pop_front();
+            }
+        }
+
+        return requests.size();
+    };
+}
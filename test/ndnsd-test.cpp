@@ -1,11 +1,21 @@
 #include <catch2/catch_test_macros.hpp>
 #include <ndn-sd/ndn-sd.hpp>
+#include <chrono>
 #include <map>
 
 #include "dns_sd.h"
+#include "instance-id.hpp"
+#include "loopback-backend.hpp"
+#include "request-slab.hpp"
+#include "resolve-cache.hpp"
+#include "run-loop.hpp"
+#include "txt-record.hpp"
 #if __APPLE__
 #include <net/if.h>
 #endif
+#ifndef _WIN32
+#include <unistd.h>
+#endif
 
 using namespace std;
 using namespace ndnsd;
@@ -41,6 +51,464 @@ TEST_CASE( "NDN-SD construction", "[ctor]" ) {
     }
 }
 
+TEST_CASE("NDN-SD request handles", "[requests]") {
+    struct Request { int value_ = 0; };
+    helpers::RequestSlab<Request> slab;
+
+    GIVEN("a request is released") {
+        auto slot = slab.acquire();
+        slot.second->value_ = 1;
+        RequestId stale = slot.first;
+        void* staleContext = helpers::RequestSlab<Request>::toContext(stale);
+        slot.second.reset();
+        REQUIRE(slab.release(stale));
+
+        THEN("its handle and context are rejected") {
+            REQUIRE(slab.size() == 0);
+            REQUIRE_FALSE(slab.get(stale));
+            REQUIRE_FALSE(slab.release(stale));
+            REQUIRE_FALSE(slab.get(helpers::RequestSlab<Request>::fromContext(staleContext)));
+        }
+
+        WHEN("its slot is reused") {
+            auto reused = slab.acquire();
+
+            THEN("request is reset and gets a new handle") {
+                REQUIRE(reused.first != stale);
+                REQUIRE(reused.first > 0);
+                REQUIRE(reused.second->value_ == 0);
+                REQUIRE_FALSE(slab.get(stale));
+                REQUIRE(slab.get(helpers::RequestSlab<Request>::fromContext(
+                    helpers::RequestSlab<Request>::toContext(reused.first))) == reused.second);
+            }
+        }
+    }
+}
+
+TEST_CASE("NDN-SD compact instance ids", "[ids]") {
+    GIVEN("canonical UUID") {
+        string uuid = "0f1e2d3c-4b5a-4978-8a9b-abcdefabcdef";
+        helpers::InstanceId id(uuid);
+
+        THEN("it is kept in binary and prints back the same") {
+            REQUIRE(id.isBinary());
+            REQUIRE(id.str() == uuid);
+            REQUIRE(id == uuid.c_str());
+            REQUIRE(id == helpers::InstanceId(uuid));
+            REQUIRE(id != "0f1e2d3c-4b5a-4978-8a9b-abcdefabcdee");
+        }
+    }
+    GIVEN("other instance names") {
+        // uppercase would not print back the same
+        for (string name : { "test-uuid1", "0F1E2D3C-4B5A-4978-8A9B-ABCDEFABCDEF", "" })
+        {
+            helpers::InstanceId id(name);
+            REQUIRE_FALSE(id.isBinary());
+            REQUIRE(id.str() == name);
+            REQUIRE(id == name.c_str());
+        }
+    }
+    GIVEN("interned strings") {
+        size_t poolSize = helpers::InternedString::getPoolSize();
+        {
+            helpers::InternedString a(string("interned.local.")), b(string("interned.local."));
+            REQUIRE(a == b);
+            REQUIRE(a.str() == "interned.local.");
+            REQUIRE(helpers::InternedString::getPoolSize() == poolSize + 1);
+        }
+        THEN("they are freed with the last reference") {
+            REQUIRE(helpers::InternedString::getPoolSize() == poolSize);
+        }
+    }
+}
+
+#ifndef _WIN32
+TEST_CASE("NDN-SD watched descriptors", "[watch]") {
+    int fds[2];
+    REQUIRE(pipe(fds) == 0);
+
+    int nReadable = 0;
+    REQUIRE(NdnSd::watchDescriptor(fds[0], [&]()
+    {
+        char c;
+        REQUIRE(read(fds[0], &c, 1) == 1);
+        nReadable++;
+    }));
+
+    GIVEN("nothing to read") {
+        THEN("run times out") {
+            auto start = chrono::steady_clock::now();
+            NdnSd::runAll(50);
+            REQUIRE(nReadable == 0);
+            REQUIRE(chrono::steady_clock::now() - start >= chrono::milliseconds(50));
+        }
+    }
+    GIVEN("descriptor is readable") {
+        REQUIRE(write(fds[1], "x", 1) == 1);
+
+        THEN("run returns once callback is called") {
+            auto start = chrono::steady_clock::now();
+            NdnSd::runAll(RUNLOOP_TIMEOUT);
+            REQUIRE(nReadable == 1);
+            REQUIRE(chrono::steady_clock::now() - start < chrono::milliseconds(RUNLOOP_TIMEOUT));
+        }
+    }
+    GIVEN("descriptor is unwatched") {
+        NdnSd::unwatchDescriptor(fds[0]);
+        REQUIRE(write(fds[1], "x", 1) == 1);
+        NdnSd::runAll(50);
+
+        THEN("callback is not called") {
+            REQUIRE(nReadable == 0);
+        }
+    }
+
+    NdnSd::unwatchDescriptor(fds[0]);
+    close(fds[0]);
+    close(fds[1]);
+}
+#endif
+
+TEST_CASE("NDN-SD TXT record", "[txt]") {
+    uint8_t txtBuf[512];
+    TXTRecordRef txtRecRef;
+    TXTRecordCreate(&txtRecRef, sizeof(txtBuf), txtBuf);
+
+    GIVEN("a record with ports of protocols this version doesn't know") {
+        string ports;
+        for (uint8_t protocol : { (uint8_t)Proto::TCP, (uint8_t)0x80, (uint8_t)0 })
+        {
+            uint16_t port = htons(6363);
+            ports += (char)protocol;
+            ports.append((const char*)&port, sizeof(port));
+        }
+        TXTRecordSetValue(&txtRecRef, "v", 1, "\x01");
+        TXTRecordSetValue(&txtRecRef, "p", 10, "/test/txt/");
+        TXTRecordSetValue(&txtRecRef, "m", (uint8_t)ports.size(), ports.data());
+
+        THEN("only the known ones are decoded") {
+            NdnSd::AdvertiseParameters params;
+            REQUIRE(helpers::decodeTxtRecord(TXTRecordGetLength(&txtRecRef),
+                (const unsigned char*)TXTRecordGetBytesPtr(&txtRecRef), params));
+            REQUIRE(params.ports_ == map<Proto, uint16_t>({ { Proto::TCP, 6363 } }));
+        }
+    }
+
+    GIVEN("a version 0 record with certificate") {
+        TXTRecordSetValue(&txtRecRef, "p", 10, "/test/txt/");
+        TXTRecordSetValue(&txtRecRef, "c", 12, "Bv0CEgdDCAN0");
+
+        THEN("certificate is not taken for a name") {
+            NdnSd::AdvertiseParameters params;
+            params.cert_ = "/stale/cert";
+            REQUIRE(helpers::decodeTxtRecord(TXTRecordGetLength(&txtRecRef),
+                (const unsigned char*)TXTRecordGetBytesPtr(&txtRecRef), params));
+            REQUIRE(params.prefix_ == "/test/txt/");
+            REQUIRE(params.cert_.empty());
+            REQUIRE(params.certDigest_.empty());
+        }
+    }
+
+    TXTRecordDeallocate(&txtRecRef);
+}
+
+TEST_CASE("NDN-SD loopback backend", "[loopback]") {
+    // no daemon involved: announcements are delivered within the process
+    REQUIRE(NdnSd::setBackend(DiscoveryBackend::Loopback));
+    {
+        const int nServices = 100;
+        vector<shared_ptr<NdnSd>> services;
+        int nRegistered = 0;
+
+        for (int i = 0; i < nServices; ++i)
+        {
+            auto sd = make_shared<NdnSd>("loopback-" + to_string(i));
+            NdnSd::AdvertiseParameters params;
+            params.protocol_ = Proto::UDP;
+            params.port_ = 43000 + i;
+            params.prefix_ = "/test/loopback/" + to_string(i);
+            params.subtype_ = "mfd";
+
+            REQUIRE(sd->announce(params, [&](void*) { nRegistered++; },
+                [](int, int, string msg, bool, void*) { FAIL(msg); }) == 0);
+            services.push_back(sd);
+        }
+
+        for (int i = 0; i < 10 && nRegistered < nServices; ++i)
+            NdnSd::runAll(RUNLOOP_TIMEOUT);
+        REQUIRE(nRegistered == nServices);
+
+        GIVEN("services are browsed and resolved") {
+            NdnSd browser("loopback-browser");
+            int nAdded = 0, nResolved = 0, nRemoved = 0;
+            shared_ptr<const NdnSd> updated;
+
+            browser.browse({ Proto::UDP, 0, "mfd" },
+                [&](int, Announcement a, shared_ptr<const NdnSd> sd, void*)
+            {
+                if (a == Announcement::Removed)
+                {
+                    nRemoved++;
+                    return;
+                }
+                if (a == Announcement::Resolved)
+                {
+                    updated = sd;
+                    return;
+                }
+
+                nAdded++;
+                browser.resolve(sd, [&](int, Announcement a, shared_ptr<const NdnSd> sd, void*)
+                {
+                    REQUIRE(a == Announcement::Resolved);
+                    REQUIRE(sd->getPrefix() == "/test/loopback/" + sd->getUuid().substr(9));
+                    REQUIRE(sd->getAddresses() == vector<string>({ "127.0.0.1" }));
+                    nResolved++;
+                }, [](int, int, string msg, bool, void*) { FAIL(msg); });
+            }, [](int, int, string msg, bool, void*) { FAIL(msg); });
+
+            for (int i = 0; i < 100 && nResolved < nServices; ++i)
+                NdnSd::runAll(RUNLOOP_TIMEOUT);
+
+            THEN("all of them are discovered") {
+                REQUIRE(nAdded == nServices);
+                REQUIRE(nResolved == nServices);
+                REQUIRE(browser.getDiscoveredServices().size() == nServices);
+            }
+
+            WHEN("half of services are gone") {
+                services.resize(nServices / 2);
+                for (int i = 0; i < 10 && nRemoved < nServices / 2; ++i)
+                    NdnSd::runAll(RUNLOOP_TIMEOUT);
+
+                THEN("their removal is announced") {
+                    REQUIRE(nRemoved == nServices / 2);
+                    REQUIRE(browser.getDiscoveredServices().size() == nServices / 2);
+                }
+            }
+
+            WHEN("a resolved service updates its TXT record") {
+                NdnSd::AdvertiseParameters params;
+                params.protocol_ = Proto::UDP;
+                params.port_ = 43000;
+                params.prefix_ = "/test/loopback/0";
+                params.prefixes_ = { "/test/loopback/0/more" };
+                params.subtype_ = "mfd";
+                REQUIRE(services[0]->update(params, [](int, int, string msg, bool, void*) { FAIL(msg); }) == 0);
+
+                for (int i = 0; i < 10 && !updated; ++i)
+                    NdnSd::runAll(RUNLOOP_TIMEOUT);
+
+                THEN("browser announces it resolved with the new record") {
+                    REQUIRE(updated);
+                    REQUIRE(updated->getUuid() == "loopback-0");
+                    REQUIRE(updated->getPrefixes() == vector<string>({ "/test/loopback/0",
+                        "/test/loopback/0/more" }));
+                    REQUIRE(browser.getSnapshot()->generation_ > 0);
+                }
+            }
+
+            WHEN("services are gone while their resolves are queued") {
+                NdnSd::setResolveCacheTtl(0);
+                browser.setResolveOptions({ 1, 5000, 0, 100 });
+                for (auto& sd : browser.getDiscoveredServices())
+                    browser.resolve(sd, [](int, Announcement, shared_ptr<const NdnSd>, void*) {},
+                        [](int, int, string msg, bool, void*) { FAIL(msg); });
+                REQUIRE(browser.getResolveStats().queued_ == nServices - 1);
+
+                services.clear();
+                for (int i = 0; i < 10 && nRemoved < nServices; ++i)
+                    NdnSd::runAll(RUNLOOP_TIMEOUT);
+
+                THEN("the resolves are cancelled") {
+                    REQUIRE(nRemoved == nServices);
+                    auto stats = browser.getResolveStats();
+                    REQUIRE(stats.queued_ == 0);
+                    REQUIRE(stats.inFlight_ == 0);
+                }
+
+                NdnSd::setResolveCacheTtl(120);
+            }
+
+            WHEN("backend is switched while requests are alive") {
+                THEN("it fails") {
+                    REQUIRE_FALSE(NdnSd::setBackend(DiscoveryBackend::DnsSd));
+                }
+            }
+        }
+    }
+    REQUIRE(NdnSd::setBackend(DiscoveryBackend::DnsSd));
+}
+
+TEST_CASE("NDN-SD shared connection loss", "[loopback]") {
+    REQUIRE(NdnSd::setBackend(DiscoveryBackend::Loopback));
+    {
+        NdnSd::AdvertiseParameters params;
+        params.protocol_ = Proto::UDP;
+        params.port_ = 43500;
+        params.prefix_ = "/test/connection-loss";
+
+        int nRegistered = 0, nRegisterErrors = 0;
+        auto onRegisterError = [&](int, int errCode, string msg, bool, void*) {
+            REQUIRE(errCode == kDNSServiceErr_ServiceNotRunning);
+            nRegisterErrors++;
+        };
+        auto service = make_shared<NdnSd>("connection-loss-service");
+        REQUIRE(service->announce(params, [&](void*) { nRegistered++; }, onRegisterError) == 0);
+
+        NdnSd browser("connection-loss-browser");
+        int nAdded = 0, nBrowseErrors = 0;
+        browser.browse({ Proto::UDP },
+            [&](int, Announcement a, shared_ptr<const NdnSd>, void*)
+        {
+            if (a == Announcement::Added)
+                nAdded++;
+        }, [&](int, int errCode, string, bool isDnsSdError, void*)
+        {
+            REQUIRE(errCode == kDNSServiceErr_ServiceNotRunning);
+            REQUIRE(isDnsSdError);
+            nBrowseErrors++;
+        });
+
+        for (int i = 0; i < 10 && !(nRegistered && nAdded); ++i)
+            NdnSd::runAll(RUNLOOP_TIMEOUT);
+        REQUIRE(nRegistered == 1);
+        REQUIRE(nAdded == 1);
+
+        GIVEN("the daemon closes the shared connection") {
+            auto connection = helpers::RunLoop::getSharedInstance().getSharedConnection();
+            REQUIRE(connection);
+            static_cast<helpers::LoopbackBackend&>(helpers::getLoopbackBackend()).dropConnection(connection);
+
+            for (int i = 0; i < 3 && !(nRegisterErrors && nBrowseErrors); ++i)
+                NdnSd::runAll(RUNLOOP_TIMEOUT);
+
+            THEN("requests made over it are reported once") {
+                REQUIRE(nRegisterErrors == 1);
+                REQUIRE(nBrowseErrors == 1);
+            }
+
+            WHEN("service is announced again") {
+                REQUIRE(service->announce(params, [&](void*) { nRegistered++; }, onRegisterError) == 0);
+                for (int i = 0; i < 10 && nRegistered < 2; ++i)
+                    NdnSd::runAll(RUNLOOP_TIMEOUT);
+
+                THEN("it is registered over a new connection") {
+                    REQUIRE(nRegistered == 2);
+                }
+            }
+        }
+    }
+    REQUIRE(NdnSd::setBackend(DiscoveryBackend::DnsSd));
+}
+
+TEST_CASE("NDN-SD connection loss without sharing", "[loopback]") {
+    REQUIRE(NdnSd::setBackend(DiscoveryBackend::Loopback));
+    NdnSd::setShareConnection(false);
+    {
+        NdnSd::AdvertiseParameters params;
+        params.protocol_ = Proto::UDP;
+        params.port_ = 43501;
+        params.prefix_ = "/test/connection-loss";
+
+        int nRegistered = 0, nRegisterErrors = 0;
+        auto service = make_shared<NdnSd>("own-connection-loss-service");
+        REQUIRE(service->announce(params, [&](void*) { nRegistered++; },
+            [&](int, int errCode, string, bool, void*)
+        {
+            REQUIRE(errCode == kDNSServiceErr_ServiceNotRunning);
+            nRegisterErrors++;
+        }) == 0);
+
+        NdnSd browser("own-connection-loss-browser");
+        int nAdded = 0, nBrowseErrors = 0;
+        browser.browse({ Proto::UDP },
+            [&](int, Announcement a, shared_ptr<const NdnSd>, void*)
+        {
+            if (a == Announcement::Added)
+                nAdded++;
+        }, [&](int, int errCode, string, bool isDnsSdError, void*)
+        {
+            REQUIRE(errCode == kDNSServiceErr_ServiceNotRunning);
+            REQUIRE(isDnsSdError);
+            nBrowseErrors++;
+        });
+
+        for (int i = 0; i < 10 && !(nRegistered && nAdded); ++i)
+            NdnSd::runAll(RUNLOOP_TIMEOUT);
+        REQUIRE(nRegistered == 1);
+        REQUIRE(nAdded == 1);
+        REQUIRE(helpers::RunLoop::getSharedInstance().size() == 2);
+
+        GIVEN("the daemon restarts") {
+            static_cast<helpers::LoopbackBackend&>(helpers::getLoopbackBackend()).dropConnections();
+
+            for (int i = 0; i < 3 && !(nRegisterErrors && nBrowseErrors); ++i)
+                NdnSd::runAll(RUNLOOP_TIMEOUT);
+
+            THEN("requests of every connection are reported once and released") {
+                REQUIRE(nRegisterErrors == 1);
+                REQUIRE(nBrowseErrors == 1);
+                REQUIRE(helpers::RunLoop::getSharedInstance().size() == 0);
+                REQUIRE(helpers::getLoopbackBackend().size() == 0);
+            }
+        }
+    }
+    NdnSd::setShareConnection(true);
+    REQUIRE(NdnSd::setBackend(DiscoveryBackend::DnsSd));
+}
+
+TEST_CASE("NDN-SD resolve cache addresses", "[loopback][cache]") {
+    REQUIRE(NdnSd::setBackend(DiscoveryBackend::Loopback));
+    {
+        auto& cache = helpers::ResolveCache::getSharedInstance();
+        const string fullname = "cache-test._ndn._udp.local.";
+
+        GIVEN("a host resolved on interface 2") {
+            cache.store(fullname, 2, "cache-test.local.", 43600, "", 
+                { "192.168.1.2", "fe80::1%2" }, nullptr);
+
+            THEN("all its addresses are used on that interface") {
+                auto e = cache.lookup(fullname, 2);
+                REQUIRE(e);
+                REQUIRE(e->getAddresses(2) == vector<string>({ "192.168.1.2", "fe80::1%2" }));
+            }
+
+            THEN("addresses scoped to it are not used on another one") {
+                auto e = cache.lookup(fullname, 3);
+                REQUIRE(e);
+                REQUIRE(e->getAddresses(3) == vector<string>({ "192.168.1.2" }));
+            }
+
+            WHEN("it is resolved on interface 3 too") {
+                cache.store(fullname, 3, "cache-test.local.", 43600, "", 
+                    { "192.168.1.2", "fe80::1%3" }, nullptr);
+
+                THEN("each interface has its own scope") {
+                    REQUIRE(cache.lookup(fullname, 3)->getAddresses(3) == 
+                        vector<string>({ "192.168.1.2", "fe80::1%3" }));
+                    REQUIRE(cache.lookup(fullname, 2)->getAddresses(2) == 
+                        vector<string>({ "192.168.1.2", "fe80::1%2" }));
+                }
+            }
+
+            cache.invalidate(fullname);
+        }
+
+        GIVEN("a host with link-local addresses only") {
+            cache.store(fullname, 2, "cache-test.local.", 43600, "", { "fe80::1%2" }, nullptr);
+
+            THEN("lookup on another interface misses") {
+                REQUIRE(cache.lookup(fullname, 2));
+                REQUIRE_FALSE(cache.lookup(fullname, 3));
+            }
+
+            cache.invalidate(fullname);
+        }
+    }
+    REQUIRE(NdnSd::setBackend(DiscoveryBackend::DnsSd));
+}
+
 TEST_CASE("NDN-SD service browse", "[browse discover]") {
 
     auto ndnSdErrorCb = [](int reqId, int errCode, string msg, bool, void*) {
@@ -492,6 +960,64 @@ TEST_CASE("NDN-SD service browse", "[browse discover]") {
     }
 }
 
+TEST_CASE("NDN-SD batched service browse", "[browse discover batch]") {
+
+    auto ndnSdErrorCb = [](int reqId, int errCode, string msg, bool, void*) {
+        FAIL("error occurred: " << errCode << " " << msg);
+    };
+
+    GIVEN("three advertised NDN services over UDP") {
+
+        auto srvRef1 = dnsRegisterHelper("_udp", "", "test-batch-uuid1", 45312, "/test/prefix/1");
+        auto srvRef2 = dnsRegisterHelper("_udp", "", "test-batch-uuid2", 45313, "/test/prefix/2");
+        auto srvRef3 = dnsRegisterHelper("_udp", "", "test-batch-uuid3", 45314, "/test/prefix/3");
+
+        WHEN("NdnSd instance browse with batch callback") {
+
+            int nBatches = 0;
+            vector<ServiceAnnouncement> announcements;
+
+            NdnSd sd("test-uuid1");
+            sd.browse({ ndnsd::Proto::UDP, kDNSServiceInterfaceIndexLocalOnly },
+                [&](int, const vector<ServiceAnnouncement>& batch, void*)
+            {
+                nBatches += 1;
+                REQUIRE(batch.size() > 0);
+                announcements.insert(announcements.end(), batch.begin(), batch.end());
+            }, ndnSdErrorCb);
+
+            THEN("all services are delivered in batches") {
+                sd.run(RUNLOOP_TIMEOUT);
+                REQUIRE(announcements.size() == 3);
+                REQUIRE(nBatches <= 3);
+
+                for (auto& a : announcements)
+                {
+                    REQUIRE(a.announcement_ == Announcement::Added);
+                    REQUIRE(a.sd_->getUuid().find("test-batch-uuid") == 0);
+                }
+            }
+
+            THEN("snapshot is published only when services change") {
+                REQUIRE(sd.getSnapshot()->services_.empty());
+                
+                sd.run(RUNLOOP_TIMEOUT);
+                auto snapshot = sd.getSnapshot();
+                REQUIRE(snapshot->services_.size() == 3);
+                REQUIRE(snapshot->generation_ == sd.getSnapshotGeneration());
+                REQUIRE(snapshot->generation_ <= (uint64_t)nBatches);
+
+                sd.run(RUNLOOP_TIMEOUT);
+                REQUIRE(sd.getSnapshot() == snapshot);
+            }
+        }
+
+        dnsServiceCleanupHelper(srvRef1);
+        dnsServiceCleanupHelper(srvRef2);
+        dnsServiceCleanupHelper(srvRef3);
+    }
+}
+
 TEST_CASE("NDN-SD service announcement", "[announce register]") {
     auto ndnSdErrorCb = [](int reqId, int errCode, string msg, bool, void*) {
         FAIL("error occurred: " << errCode << " " << msg);
@@ -885,6 +1411,150 @@ TEST_CASE("NDN-SD service announcement", "[announce register]") {
     }
 }
 
+TEST_CASE("NDN-SD service update", "[announce update]") {
+    auto ndnSdErrorCb = [](int reqId, int errCode, string msg, bool, void*) {
+        FAIL("error occurred: " << errCode << " " << msg);
+    };
+
+    GIVEN("an NDN-SD service is registered") {
+        NdnSd sd("update-uuid");
+        NdnSd::AdvertiseParameters params = 
+            { Proto::UDP, kDNSServiceInterfaceIndexLocalOnly, "", "", nullptr, 41433, "/test/update/1" };
+
+        bool registered = false;
+        sd.announce(params, [&](void*) { registered = true; }, ndnSdErrorCb);
+        sd.run(RUNLOOP_TIMEOUT);
+        REQUIRE(registered);
+
+        WHEN("its prefix is updated") {
+            params.prefix_ = "/test/update/2";
+            REQUIRE(sd.update(params, ndnSdErrorCb) == 0);
+            REQUIRE(sd.getPrefix() == "/test/update/2");
+
+            THEN("peers resolve new prefix without seeing it removed") {
+                NdnSd browser("update-browser");
+                shared_ptr<const NdnSd> resolved;
+                browser.browse({ Proto::UDP, kDNSServiceInterfaceIndexLocalOnly },
+                    [&](int, Announcement a, shared_ptr<const NdnSd> s, void*)
+                {
+                    REQUIRE(a == Announcement::Added);
+                    if (s->getUuid() == "update-uuid")
+                        browser.resolve(s, [&](int, Announcement, shared_ptr<const NdnSd> s, void*) {
+                            resolved = s;
+                        }, ndnSdErrorCb);
+                }, ndnSdErrorCb);
+
+                for (int i = 0; i < 3 && !resolved; ++i)
+                    browser.run(RUNLOOP_TIMEOUT);
+
+                REQUIRE(resolved);
+                REQUIRE(resolved->getPrefix() == "/test/update/2");
+            }
+        }
+
+        WHEN("certificate name and digest are updated") {
+            params.cert_ = "/test/update/KEY/%01/self/%FD%01";
+            params.certDigest_ = string(32, '\xab');
+            REQUIRE(sd.update(params, ndnSdErrorCb) == 0);
+
+            THEN("peers resolve them") {
+                NdnSd browser("update-cert-browser");
+                shared_ptr<const NdnSd> resolved;
+                browser.browse({ Proto::UDP, kDNSServiceInterfaceIndexLocalOnly },
+                    [&](int, Announcement a, shared_ptr<const NdnSd> s, void*)
+                {
+                    if (s->getUuid() == "update-uuid")
+                        browser.resolve(s, [&](int, Announcement, shared_ptr<const NdnSd> s, void*) {
+                            resolved = s;
+                        }, ndnSdErrorCb);
+                }, ndnSdErrorCb);
+
+                for (int i = 0; i < 3 && !resolved; ++i)
+                    browser.run(RUNLOOP_TIMEOUT);
+
+                REQUIRE(resolved);
+                REQUIRE(resolved->getCertificate() == params.cert_);
+                REQUIRE(resolved->getCertificateDigest() == params.certDigest_);
+            }
+        }
+
+        WHEN("more prefixes, ports and capabilities are advertised") {
+            params.prefixes_ = { "/test/update/1/a", "/test/update/1/b", "/test/other" };
+            params.ports_ = { { Proto::TCP, 41435 } };
+            params.capabilities_ = (uint8_t)Capability::Forwarder;
+            REQUIRE(sd.update(params, ndnSdErrorCb) == 0);
+
+            THEN("peers get all of them from a single resolve") {
+                NdnSd browser("update-prefixes-browser");
+                shared_ptr<const NdnSd> resolved;
+                browser.browse({ Proto::UDP, kDNSServiceInterfaceIndexLocalOnly },
+                    [&](int, Announcement a, shared_ptr<const NdnSd> s, void*)
+                {
+                    if (s->getUuid() == "update-uuid")
+                        browser.resolve(s, [&](int, Announcement, shared_ptr<const NdnSd> s, void*) {
+                            resolved = s;
+                        }, ndnSdErrorCb);
+                }, ndnSdErrorCb);
+
+                for (int i = 0; i < 3 && !resolved; ++i)
+                    browser.run(RUNLOOP_TIMEOUT);
+
+                REQUIRE(resolved);
+                REQUIRE(resolved->getPrefix() == "/test/update/1");
+                REQUIRE(resolved->getPrefixes() == vector<string>({ "/test/update/1",
+                    "/test/update/1/a", "/test/update/1/b", "/test/other" }));
+                REQUIRE(resolved->getPorts() == map<Proto, uint16_t>({
+                    { Proto::UDP, 41433 }, { Proto::TCP, 41435 } }));
+                REQUIRE(resolved->getCapabilities() == (uint8_t)Capability::Forwarder);
+            }
+        }
+
+        WHEN("certificate is larger than TXT record value") {
+            params.cert_ = string(300, 'c');
+            bool failed = false;
+
+            THEN("update fails") {
+                REQUIRE(sd.update(params, [&](int, int, string, bool, void*) { failed = true; }) == -1);
+                REQUIRE(failed);
+            }
+
+            THEN("advertised record is left intact") {
+                params.prefix_ = "/test/update/3";
+                REQUIRE(sd.update(params, [&](int, int, string, bool, void*) { failed = true; }) == -1);
+
+                NdnSd browser("update-intact-browser");
+                shared_ptr<const NdnSd> resolved;
+                browser.browse({ Proto::UDP, kDNSServiceInterfaceIndexLocalOnly },
+                    [&](int, Announcement a, shared_ptr<const NdnSd> s, void*)
+                {
+                    if (a == Announcement::Added && s->getUuid() == "update-uuid")
+                        browser.resolve(s, [&](int, Announcement, shared_ptr<const NdnSd> s, void*) {
+                            resolved = s;
+                        }, ndnSdErrorCb);
+                }, ndnSdErrorCb);
+
+                for (int i = 0; i < 3 && !resolved; ++i)
+                    browser.run(RUNLOOP_TIMEOUT);
+
+                REQUIRE(resolved);
+                REQUIRE(resolved->getPrefix() == "/test/update/1");
+                REQUIRE(resolved->getCertificate().empty());
+            }
+        }
+
+        WHEN("its port is updated") {
+            params.port_ = 41434;
+            bool failed = false;
+
+            THEN("update fails") {
+                REQUIRE(sd.update(params, [&](int, int, string, bool, void*) { failed = true; }) == -1);
+                REQUIRE(failed);
+                REQUIRE(sd.getPort() == 41433);
+            }
+        }
+    }
+}
+
 TEST_CASE("NDN-SD service resolution", "[resolve]") {
     auto ndnSdErrorCb = [](int reqId, int errCode, string msg, bool, void*) {
         FAIL("error occurred: " << errCode << " " << msg);
@@ -925,16 +1595,133 @@ TEST_CASE("NDN-SD service resolution", "[resolve]") {
             },
                 ndnSdErrorCb);
             
-            browser.run(RUNLOOP_TIMEOUT);
+            // service, then its host's addresses
+            for (int i = 0; i < 3 && !resolved; ++i)
+                browser.run(RUNLOOP_TIMEOUT);
 
             THEN("it is successful") {
                 REQUIRE(resolved);
                 REQUIRE(resolved == discovered);
+                // numeric, IPv4 first
+                REQUIRE(resolved->getAddresses().size() > 0);
+                REQUIRE(resolved->getAddresses().front() != resolved->getHostname());
+                // version 0 TXT record: single prefix, no capabilities
+                REQUIRE(resolved->getPrefixes() == vector<string>({ "/test/prefix/1" }));
+                REQUIRE(resolved->getCapabilities() == 0);
+
+                auto stats = browser.getResolveStats();
+                REQUIRE(stats.succeeded_ == 1);
+                REQUIRE(stats.inFlight_ == 0);
+                REQUIRE(stats.queued_ == 0);
+            }
+        }
+
+        WHEN("resolves are limited to one in flight") {
+            NdnSd::setResolveCacheTtl(0);
+            browser.setResolveOptions({ 1, 5000, 0, 100 });
+
+            int nResolved = 0;
+            auto onResolved = [&](int, Announcement an, shared_ptr<const NdnSd> sd, void*)
+            {
+                REQUIRE(an == Announcement::Resolved);
+                nResolved++;
+            };
+            browser.resolve(discovered, onResolved, ndnSdErrorCb);
+            browser.resolve(discovered, onResolved, ndnSdErrorCb);
+
+            auto stats = browser.getResolveStats();
+            REQUIRE(stats.inFlight_ == 1);
+            REQUIRE(stats.queued_ == 1);
+
+            THEN("queued request starts once the first one completes") {
+                for (int i = 0; i < 6 && nResolved < 2; ++i)
+                    browser.run(RUNLOOP_TIMEOUT);
+
+                REQUIRE(nResolved == 2);
+                REQUIRE(browser.getResolveStats().queued_ == 0);
+            }
+
+            NdnSd::setResolveCacheTtl(120);
+        }
+
+        WHEN("service is resolved again") {
+            auto onResolved = [&](int, Announcement an, shared_ptr<const NdnSd> sd, void*)
+            {
+                REQUIRE(an == Announcement::Resolved);
+                REQUIRE(sd->getPrefix() == "/test/prefix/1");
+            };
+            browser.resolve(discovered, onResolved, ndnSdErrorCb);
+            for (int i = 0; i < 3 && discovered->getPort() != 43211; ++i)
+                browser.run(RUNLOOP_TIMEOUT);
+            REQUIRE(discovered->getPort() == 43211);
+
+            auto hits = NdnSd::getResolveCacheStats().hits_;
+            bool resolved = false;
+            browser.resolve(discovered,
+                [&](int, Announcement an, shared_ptr<const NdnSd> sd, void*)
+            {
+                resolved = true;
+            }, ndnSdErrorCb);
+
+            THEN("it completes synchronously from cache") {
+                REQUIRE(resolved);
+                REQUIRE(NdnSd::getResolveCacheStats().hits_ == hits + 1);
+                REQUIRE(browser.getResolveStats().inFlight_ == 0);
             }
         }
 
         dnsServiceCleanupHelper(ref);
     }
+
+    GIVEN("a service without prefix in its TXT record is discovered") {
+        DNSServiceRef ref;
+        REQUIRE(DNSServiceRegister(&ref, 0, kDNSServiceInterfaceIndexLocalOnly, "no-prefix-uuid",
+            "_ndn._udp", nullptr, nullptr, htons(43212), 0, nullptr,
+            &dnsRegisterReplyHelper, nullptr) == kDNSServiceErr_NoError);
+        DNSServiceProcessResult(ref);
+
+        NdnSd browser("no-prefix-browser");
+        shared_ptr<const NdnSd> discovered;
+        browser.browse({ Proto::UDP, kDNSServiceInterfaceIndexLocalOnly },
+            [&](int, Announcement a, shared_ptr<const NdnSd> sd, void*)
+        {
+            if (a == Announcement::Added && sd->getUuid() == "no-prefix-uuid")
+                discovered = sd;
+        }, ndnSdErrorCb);
+
+        for (int i = 0; i < 3 && !discovered; ++i)
+            browser.run(RUNLOOP_TIMEOUT);
+        REQUIRE(discovered);
+
+        WHEN("it is resolved") {
+            NdnSd::setResolveCacheTtl(0);
+            browser.setResolveOptions({ 1, 500, 2, 100 });
+
+            int nFailed = 0;
+            browser.resolve(discovered, [](int, Announcement, shared_ptr<const NdnSd>, void*) {
+                FAIL("malformed service is resolved");
+            }, [&](int, int, string, bool isDnsSdError, void*) {
+                REQUIRE_FALSE(isDnsSdError);
+                nFailed++;
+            });
+
+            for (int i = 0; i < 4; ++i)
+                browser.run(RUNLOOP_TIMEOUT);
+
+            THEN("failure is reported once and the slot is freed") {
+                REQUIRE(nFailed == 1);
+                auto stats = browser.getResolveStats();
+                REQUIRE(stats.failed_ == 1);
+                REQUIRE(stats.retried_ == 0);
+                REQUIRE(stats.inFlight_ == 0);
+                REQUIRE(stats.queued_ == 0);
+            }
+
+            NdnSd::setResolveCacheTtl(120);
+        }
+
+        DNSServiceRefDeallocate(ref);
+    }
 }
 
 DNSServiceRef* dnsRegisterHelper(string protocol, string subtype, string uuid,
@@ -0,0 +1,125 @@
+
+#include <catch2/catch_test_macros.hpp>
+#include <filesystem>
+
+#include "peer-table.hpp"
+
+using namespace std;
+using namespace ndnsd;
+using namespace ndnapp::helpers;
+
+static PeerTable::Peer makePeer(string uuid, Proto p, uint16_t port)
+{
+    return { uuid, p, "host-" + uuid + ".local.", port, { "/test/" + uuid, "/test/alt/" + uuid },
+        PeerTable::digest("cert-" + uuid), chrono::system_clock::now() };
+}
+
+TEST_CASE("PeerTable persistence", "[peer-table]")
+{
+    string path = (filesystem::temp_directory_path() / "ndnapp-peer-table-test").string();
+    filesystem::remove(path);
+
+    GIVEN("peer table with two peers")
+    {
+        {
+            PeerTable pt;
+            REQUIRE(pt.open(path));
+            REQUIRE(pt.size() == 0);
+            REQUIRE(pt.update(makePeer("uuid1", Proto::UDP, 4000)));
+            REQUIRE(pt.update(makePeer("uuid1", Proto::TCP, 4001)));
+            REQUIRE(pt.update(makePeer("uuid2", Proto::UDP, 4002)));
+            pt.remove("uuid2", Proto::UDP);
+            REQUIRE(pt.size() == 2);
+        }
+
+        WHEN("it is reopened")
+        {
+            PeerTable pt;
+            REQUIRE(pt.open(path));
+
+            THEN("peers are loaded back")
+            {
+                auto peers = pt.load();
+                REQUIRE(peers.size() == 2);
+                for (auto& p : peers)
+                {
+                    REQUIRE(p.uuid_ == "uuid1");
+                    REQUIRE(p.hostname_ == "host-uuid1.local.");
+                    REQUIRE(p.port_ == (p.protocol_ == Proto::UDP ? 4000 : 4001));
+                    REQUIRE(p.prefixes_ == vector<string>({ "/test/uuid1", "/test/alt/uuid1" }));
+                    REQUIRE(p.certDigest_ == PeerTable::digest("cert-uuid1"));
+                }
+            }
+        }
+
+        WHEN("it is opened twice")
+        {
+            PeerTable pt, other;
+            REQUIRE(pt.open(path));
+
+            THEN("second open fails until the first one is closed")
+            {
+                REQUIRE_FALSE(other.open(path));
+                pt.close();
+                REQUIRE(other.open(path));
+                REQUIRE(other.size() == 2);
+            }
+        }
+
+        WHEN("peer does not fit into the record")
+        {
+            PeerTable pt;
+            REQUIRE(pt.open(path));
+            auto p = makePeer("uuid3", Proto::UDP, 4003);
+            p.prefixes_.assign(100, "/test/too-many-prefixes");
+
+            THEN("it is not stored")
+            {
+                REQUIRE_FALSE(pt.update(p));
+                REQUIRE(pt.size() == 2);
+            }
+        }
+
+        WHEN("record has unknown protocol")
+        {
+            PeerTable pt;
+            REQUIRE(pt.open(path));
+            REQUIRE_FALSE(pt.update(makePeer("uuid3", (Proto)3, 4003)));
+            pt.close();
+
+            // protocol byte of the first record (header, then 64 records) is
+            // overwritten
+            FILE* f = fopen(path.c_str(), "r+b");
+            REQUIRE(f);
+            uint8_t bad = 0x7f;
+            size_t recordSize = (filesystem::file_size(path) - 16) / 64;
+            REQUIRE(fseek(f, 16 + recordSize - 6, SEEK_SET) == 0);
+            REQUIRE(fwrite(&bad, 1, 1, f) == 1);
+            fclose(f);
+
+            REQUIRE(pt.open(path));
+
+            THEN("it is not loaded")
+            {
+                auto peers = pt.load();
+                REQUIRE(peers.size() == 1);
+                REQUIRE(peers[0].protocol_ != (Proto)bad);
+            }
+        }
+
+        WHEN("more peers than initial capacity are added")
+        {
+            PeerTable pt;
+            REQUIRE(pt.open(path));
+            for (int i = 0; i < 200; ++i)
+                REQUIRE(pt.update(makePeer("peer" + to_string(i), Proto::UDP, 5000 + i)));
+
+            THEN("table grows")
+            {
+                REQUIRE(pt.size() == 202);
+            }
+        }
+    }
+
+    filesystem::remove(path);
+}
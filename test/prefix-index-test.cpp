@@ -0,0 +1,62 @@
+
+#include <catch2/catch_test_macros.hpp>
+
+#include "prefix-index.hpp"
+
+using namespace std;
+using namespace ndn;
+using namespace ndnapp::helpers;
+
+TEST_CASE("PrefixIndex lookups", "[prefix-index]")
+{
+    PrefixIndex<string> index;
+    index.insert("a", { Name("/x"), Name("/x/y/z") });
+    index.insert("b", { Name("/x/y") });
+    index.insert("c", { Name("/q") });
+
+    GIVEN("indexed prefixes")
+    {
+        THEN("longest advertised prefix of a name wins")
+        {
+            REQUIRE(index.longestPrefixMatch(Name("/x/y/z/w")) == vector<string>{ "a" });
+            REQUIRE(index.longestPrefixMatch(Name("/x/y/k")) == vector<string>{ "b" });
+            REQUIRE(index.longestPrefixMatch(Name("/x/k")) == vector<string>{ "a" });
+            REQUIRE(index.longestPrefixMatch(Name("/r")).empty());
+        }
+        THEN("subtree lists every value once")
+        {
+            REQUIRE(index.findUnder(Name("/x")) == vector<string>{ "a", "b" });
+            REQUIRE(index.findUnder(Name("/")) == vector<string>{ "a", "b", "c" });
+            REQUIRE(index.findUnder(Name("/x/y/z/w")).empty());
+        }
+    }
+
+    WHEN("value advertises other prefixes")
+    {
+        index.insert("a", { Name("/q") });
+
+        THEN("its old prefixes are dropped")
+        {
+            REQUIRE(index.longestPrefixMatch(Name("/x/y/z/w")) == vector<string>{ "b" });
+            REQUIRE(index.findUnder(Name("/q")) == vector<string>{ "a", "c" });
+            REQUIRE(index.size() == 3);
+        }
+    }
+
+    WHEN("values are removed")
+    {
+        REQUIRE(index.remove("b"));
+        REQUIRE_FALSE(index.remove("b"));
+
+        THEN("they are not found anymore")
+        {
+            REQUIRE(index.longestPrefixMatch(Name("/x/y/k")) == vector<string>{ "a" });
+            REQUIRE(index.findUnder(Name("/x")) == vector<string>{ "a" });
+        }
+
+        index.remove("a");
+        index.remove("c");
+        REQUIRE(index.size() == 0);
+        REQUIRE(index.findUnder(Name("/")).empty());
+    }
+}
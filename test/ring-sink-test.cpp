@@ -0,0 +1,158 @@
+
+#include <catch2/catch_test_macros.hpp>
+
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <sstream>
+#include <thread>
+#include <vector>
+
+#include <spdlog/spdlog.h>
+
+#include "ring-sink.hpp"
+
+using namespace std;
+using namespace ndnapp::helpers;
+
+// records written, one per line
+static vector<string> splitLinesHelper(const string& s)
+{
+    vector<string> lines;
+    istringstream ss(s);
+    for (string line; getline(ss, line); )
+        lines.push_back(line);
+    return lines;
+}
+
+TEST_CASE("RingSink writes records", "[ring-sink]")
+{
+    mutex m;
+    string output;
+    auto sink = make_shared<RingSink>([&](const char* data, size_t size)
+    {
+        lock_guard<mutex> lock(m);
+        output.append(data, size);
+    }, 16, RingSink::Overflow::Block);
+    sink->set_pattern("%v");
+    spdlog::logger logger("ring-sink-test", sink);
+
+    GIVEN("more records than the ring holds")
+    {
+        for (int i = 0; i < 1000; ++i)
+            logger.info("{}", i);
+        logger.flush();
+
+        THEN("they are written in order, in batches")
+        {
+            auto stats = sink->getStats();
+            auto lines = splitLinesHelper(output);
+
+            REQUIRE(stats.written_ == 1000);
+            REQUIRE(lines.size() == 1000);
+            for (size_t i = 0; i < lines.size(); ++i)
+                REQUIRE(lines[i] == to_string(i));
+            REQUIRE(stats.batches_ <= stats.written_);
+        }
+    }
+}
+
+TEST_CASE("RingSink overflow", "[ring-sink]")
+{
+    atomic<bool> stalled(true);
+    mutex m;
+    string output;
+    auto writer = [&](const char* data, size_t size)
+    {
+        // slow terminal
+        while (stalled)
+            this_thread::sleep_for(chrono::milliseconds(1));
+
+        lock_guard<mutex> lock(m);
+        output.append(data, size);
+    };
+
+    WHEN("records are dropped")
+    {
+        auto sink = make_shared<RingSink>(writer, 16, RingSink::Overflow::Drop);
+        sink->set_pattern("%v");
+        spdlog::logger logger("ring-sink-test", sink);
+
+        for (int i = 0; i < 100; ++i)
+            logger.info("{}", i);
+        stalled = false;
+        logger.flush();
+
+        THEN("logging thread doesn't wait, drops are counted and reported")
+        {
+            auto stats = sink->getStats();
+            REQUIRE(stats.dropped_ > 0);
+            REQUIRE(stats.written_ + stats.dropped_ == 100);
+            REQUIRE(stats.blocked_ == 0);
+            REQUIRE(output.find(" log records dropped") != string::npos);
+        }
+    }
+
+    WHEN("logging thread is blocked")
+    {
+        auto sink = make_shared<RingSink>(writer, 16, RingSink::Overflow::Block);
+        sink->set_pattern("%v");
+        spdlog::logger logger("ring-sink-test", sink);
+
+        thread release([&]() {
+            this_thread::sleep_for(chrono::milliseconds(50));
+            stalled = false;
+        });
+        for (int i = 0; i < 100; ++i)
+            logger.info("{}", i);
+        logger.flush();
+        release.join();
+
+        THEN("all records are written")
+        {
+            auto stats = sink->getStats();
+            REQUIRE(stats.written_ == 100);
+            REQUIRE(stats.dropped_ == 0);
+            REQUIRE(stats.blocked_ > 0);
+            REQUIRE(splitLinesHelper(output).size() == 100);
+        }
+    }
+}
+
+TEST_CASE("RingSink producers", "[ring-sink]")
+{
+    const int nProducers = 4, nRecords = 10000;
+    vector<int> last(nProducers, -1);
+    bool ordered = true;
+    size_t nLines = 0;
+
+    {
+        auto sink = make_shared<RingSink>([&](const char* data, size_t size)
+        {
+            for (auto& line : splitLinesHelper(string(data, size)))
+            {
+                int p = line[0] - '0', i = stoi(line.substr(2));
+                ordered = ordered && (last[p] == i - 1);
+                last[p] = i;
+                nLines++;
+            }
+        }, 256, RingSink::Overflow::Block);
+        sink->set_pattern("%v");
+        spdlog::logger logger("ring-sink-test", sink);
+
+        vector<thread> producers;
+        for (int p = 0; p < nProducers; ++p)
+            producers.emplace_back([&, p]()
+            {
+                for (int i = 0; i < nRecords; ++i)
+                    logger.info("{} {}", p, i);
+            });
+
+        for (auto& t : producers)
+            t.join();
+        // the rest is written on destruction
+    }
+
+    REQUIRE(nLines == nProducers * nRecords);
+    REQUIRE(ordered);
+}